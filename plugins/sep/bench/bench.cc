@@ -0,0 +1,579 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/algorithm/string/split.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/make_shared.hpp>
+#include <fmt/format.h>
+#include <scroom/tiledbitmapinterface.hh>
+
+#include "../colorconfig/CustomColorConfig.hh"
+#include "../colorconfig/CustomColorOperations.hh"
+#include "../generator/datasetgenerator.hh"
+#include "../sepsource.hh"
+#include "../sli/sliparser.hh"
+#include "../sli/slisource.hh"
+#include "../stripreader.hh"
+#include "../varnish/varnishoperations.hh"
+
+namespace fs = boost::filesystem;
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocation counting
+
+namespace {
+std::atomic<uint64_t> allocationCount{0};
+std::atomic<uint64_t> allocatedBytes{0};
+} // namespace
+
+// Only allocations through operator new are counted. Buffers that are
+// allocated with malloc(), such as the cairo surfaces, are not.
+void *operator new(size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+  if (void *p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+///////////////////////////////////////////////////////////////////////////////
+// Options
+
+struct Options {
+  int width = 4096;
+  int height = 4096;
+  int channels = 4;
+  int layers = 4;
+  /** Horizontal and vertical offset between consecutive SLI layers */
+  int offset = 0;
+  std::string compression = "lzw";
+  int iterations = 5;
+  /** Where to write the JSON report, or empty for no report */
+  std::string json;
+  /** The stages to run, or empty to run all of them */
+  std::set<std::string> stages;
+};
+
+void usage(const char *name) {
+  printf("Usage: %s [options]\n"
+         "  --width=N        width of the synthetic images (4096)\n"
+         "  --height=N       height of the synthetic images (4096)\n"
+         "  --channels=N     number of channels of the SEP file, up to 16 (4)\n"
+         "  --layers=N       number of SLI layers (4)\n"
+         "  --offset=N       offset between consecutive SLI layers (0)\n"
+         "  --compression=C  none, lzw, deflate or packbits (lzw)\n"
+         "  --iterations=N   timed runs of every stage (5)\n"
+         "  --stages=A,B     only run the given stages\n"
+         "  --json=FILE      write the results to FILE\n",
+         name);
+}
+
+bool parseOptions(int argc, char *argv[], Options &options) {
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const size_t equals = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || equals == std::string::npos) {
+      return false;
+    }
+    const std::string key = arg.substr(2, equals - 2);
+    const std::string value = arg.substr(equals + 1);
+
+    if (key == "width") {
+      options.width = std::atoi(value.c_str());
+    } else if (key == "height") {
+      options.height = std::atoi(value.c_str());
+    } else if (key == "channels") {
+      options.channels = std::atoi(value.c_str());
+    } else if (key == "layers") {
+      options.layers = std::atoi(value.c_str());
+    } else if (key == "offset") {
+      options.offset = std::atoi(value.c_str());
+    } else if (key == "compression") {
+      options.compression = value;
+    } else if (key == "iterations") {
+      options.iterations = std::atoi(value.c_str());
+    } else if (key == "json") {
+      options.json = value;
+    } else if (key == "stages") {
+      std::vector<std::string> stages;
+      boost::split(stages, value, [](char c) { return c == ','; });
+      options.stages.insert(stages.begin(), stages.end());
+    } else {
+      return false;
+    }
+  }
+  return options.width > 0 && options.height > 0 && options.channels > 0 &&
+         options.channels <= DatasetGenerator::MAX_CHANNELS &&
+         options.layers > 0 && options.offset >= 0 && options.iterations > 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Synthetic inputs
+
+/** Interleaved samples of @param spp channels */
+std::vector<uint8_t> syntheticImage(int width, int height, int spp) {
+  std::vector<uint8_t> image(static_cast<size_t>(width) * height * spp);
+  uint8_t *p = image.data();
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      for (int c = 0; c < spp; c++) {
+        *p++ = DatasetGenerator::sample(x, y, c);
+      }
+    }
+  }
+  return image;
+}
+
+/** The colors of the channels of the synthetic SEP file */
+std::vector<CustomColor::Ptr> syntheticColors(int count) {
+  std::vector<CustomColor::Ptr> colors;
+  for (int c = 0; c < count; c++) {
+    colors.push_back(
+        boost::make_shared<CustomColor>(DatasetGenerator::channelColor(c)));
+  }
+  return colors;
+}
+
+boost::shared_ptr<uint8_t> toTileData(const std::vector<uint8_t> &image) {
+  boost::shared_ptr<uint8_t> data(new uint8_t[image.size()],
+                                  [](uint8_t *p) { delete[] p; });
+  memcpy(data.get(), image.data(), image.size());
+  return data;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Timing
+
+struct Stage {
+  std::string name;
+  /** Pixels and bytes processed in a single run */
+  uint64_t pixels = 0;
+  uint64_t bytes = 0;
+  /** The duration of every timed run */
+  std::vector<double> seconds;
+  /** Allocations of the last run */
+  uint64_t allocations = 0;
+  uint64_t allocatedBytes = 0;
+
+  double median() const {
+    std::vector<double> sorted = seconds;
+    std::sort(sorted.begin(), sorted.end());
+    const size_t n = sorted.size();
+    return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+  }
+
+  double best() const {
+    return *std::min_element(seconds.begin(), seconds.end());
+  }
+};
+
+class Bench {
+public:
+  Options options;
+  std::vector<Stage> stages;
+
+  explicit Bench(Options options_) : options(std::move(options_)) {}
+
+  bool enabled(const std::string &name) const {
+    return options.stages.empty() || options.stages.count(name);
+  }
+
+  /**
+   * Runs @param body once to warm up, and then `options.iterations` times
+   * while timing it. @param setup runs before every run, and is not timed.
+   */
+  void run(const std::string &name, uint64_t pixels, uint64_t bytes,
+           const std::function<void()> &setup,
+           const std::function<void()> &body) {
+    if (!enabled(name)) {
+      return;
+    }
+
+    Stage stage;
+    stage.name = name;
+    stage.pixels = pixels;
+    stage.bytes = bytes;
+    for (int i = 0; i <= options.iterations; i++) {
+      setup();
+      const uint64_t count = allocationCount.load();
+      const uint64_t size = allocatedBytes.load();
+      const auto start = std::chrono::steady_clock::now();
+      body();
+      const std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      stage.allocations = allocationCount.load() - count;
+      stage.allocatedBytes = allocatedBytes.load() - size;
+      if (i > 0) {
+        stage.seconds.push_back(elapsed.count());
+      }
+    }
+
+    const double median = stage.median();
+    printf("%-22s %9.3f ms %9.1f MPix/s %9.1f MB/s %9lu allocs\n", name.c_str(),
+           median * 1e3, pixels / median / 1e6, bytes / median / 1e6,
+           static_cast<unsigned long>(stage.allocations));
+    stages.push_back(std::move(stage));
+  }
+
+  bool writeJson(const std::string &path) const {
+    std::string json = "{\n  \"config\": {\n";
+    json += fmt::format("    \"width\": {},\n    \"height\": {},\n"
+                        "    \"channels\": {},\n    \"layers\": {},\n"
+                        "    \"offset\": {},\n    \"compression\": \"{}\",\n"
+                        "    \"iterations\": {}\n  }},\n  \"stages\": [\n",
+                        options.width, options.height, options.channels,
+                        options.layers, options.offset, options.compression,
+                        options.iterations);
+    for (size_t i = 0; i < stages.size(); i++) {
+      const Stage &stage = stages[i];
+      const double median = stage.median();
+      json += fmt::format(
+          "    {{\"name\": \"{}\", \"seconds\": {:.6f}, "
+          "\"best_seconds\": {:.6f}, \"mpix_per_s\": {:.3f}, "
+          "\"mb_per_s\": {:.3f}, \"allocations\": {}, "
+          "\"allocated_bytes\": {}}}{}\n",
+          stage.name, median, stage.best(), stage.pixels / median / 1e6,
+          stage.bytes / median / 1e6, stage.allocations, stage.allocatedBytes,
+          i + 1 < stages.size() ? "," : "");
+    }
+    json += "  ]\n}\n";
+
+    std::ofstream out(path);
+    out << json;
+    return static_cast<bool>(out);
+  }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Stages
+
+/** Decodes all tiles of a SEP file with synthetic channel TIFFs */
+bool benchSepSource(Bench &bench, const fs::path &directory) {
+  const Options &options = bench.options;
+  if (!bench.enabled("sep_fill_tiles")) {
+    return true;
+  }
+
+  DatasetOptions dataset;
+  dataset.width = options.width;
+  dataset.height = options.height;
+  dataset.channels = options.channels;
+  if (!DatasetGenerator::parseCompression(options.compression,
+                                          dataset.compression)) {
+    printf("ERROR: Unknown compression %s\n", options.compression.c_str());
+    return false;
+  }
+  if (!DatasetGenerator::generate(directory.string(), "bench", dataset)) {
+    return false;
+  }
+
+  // Spot colors are only known from the colours.json of the dataset
+  ColorConfig::getInstance().loadFile((directory / "colours.json").string());
+  const std::string path = (directory / "bench.sep").string();
+  SepSource::Ptr source = SepSource::create();
+  source->setData(SepSource::parseSep(path));
+  source->setName(path);
+  source->openFiles();
+
+  // One row of tiles, as the tiled bitmap requests them
+  const int bpp = options.channels;
+  const int tileCount = (options.width + TILESIZE - 1) / TILESIZE;
+  std::vector<Tile::Ptr> tiles;
+  for (int t = 0; t < tileCount; t++) {
+    boost::shared_ptr<uint8_t> data(
+        new uint8_t[static_cast<size_t>(TILESIZE) * TILESIZE * bpp],
+        [](uint8_t *p) { delete[] p; });
+    tiles.push_back(Tile::Ptr(new Tile(TILESIZE, TILESIZE, 8 * bpp, data)));
+  }
+
+  const uint64_t pixels = static_cast<uint64_t>(options.width) * options.height;
+  bench.run(
+      "sep_fill_tiles", pixels, pixels * bpp, [] {},
+      [&] {
+        for (int top = 0; top < options.height; top += TILESIZE) {
+          source->fillTiles(top, std::min(TILESIZE, options.height - top),
+                            TILESIZE, 0, tiles);
+        }
+        source->done();
+      });
+  return true;
+}
+
+/** Drops @param path from the page cache, so it is read from disk again */
+void evictFromPageCache(const std::string &path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  // Dirty pages can't be dropped
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+/**
+ * Reads all tiles of an uncompressed SEP file from a cold page cache, with
+ * every StripReader backend. The files are evicted before every run.
+ */
+bool benchChannelReads(Bench &bench, const fs::path &directory) {
+  const Options &options = bench.options;
+  const std::vector<StripReader::Backend> backends = {
+      StripReader::SCANLINE, StripReader::PREAD, StripReader::IO_URING};
+  bool enabled = false;
+  for (auto backend : backends) {
+    enabled |= bench.enabled("sep_read_" + StripReader::getName(backend));
+  }
+  if (!enabled) {
+    return true;
+  }
+
+  DatasetOptions dataset;
+  dataset.width = options.width;
+  dataset.height = options.height;
+  dataset.channels = options.channels;
+  dataset.compression = COMPRESSION_NONE;
+  if (!DatasetGenerator::generate(directory.string(), "reads", dataset)) {
+    return false;
+  }
+
+  const std::string path = (directory / "reads.sep").string();
+  SepSource::Ptr source = SepSource::create();
+  source->setData(SepSource::parseSep(path));
+  source->setName(path);
+  source->openFiles();
+  // Only measure the reads themselves, not how well they overlap
+  source->readAheadBytes = 0;
+
+  const int bpp = options.channels;
+  const int tileCount = (options.width + TILESIZE - 1) / TILESIZE;
+  std::vector<Tile::Ptr> tiles;
+  for (int t = 0; t < tileCount; t++) {
+    boost::shared_ptr<uint8_t> data(
+        new uint8_t[static_cast<size_t>(TILESIZE) * TILESIZE * bpp],
+        [](uint8_t *p) { delete[] p; });
+    tiles.push_back(Tile::Ptr(new Tile(TILESIZE, TILESIZE, 8 * bpp, data)));
+  }
+
+  const StripReader::Backend original = StripReader::getBackend();
+  const uint64_t pixels = static_cast<uint64_t>(options.width) * options.height;
+  for (auto backend : backends) {
+    if (backend == StripReader::IO_URING && !StripReader::ioUringAvailable()) {
+      printf("sep_read_io_uring      skipped, io_uring is not available\n");
+      continue;
+    }
+    StripReader::setBackend(backend);
+    bench.run(
+        "sep_read_" + StripReader::getName(backend), pixels, pixels * bpp,
+        [&] {
+          for (const auto &file : source->sep_file.files) {
+            evictFromPageCache(file.second.string());
+          }
+        },
+        [&] {
+          for (int top = 0; top < options.height; top += TILESIZE) {
+            source->fillTiles(top, std::min(TILESIZE, options.height - top),
+                              TILESIZE, 0, tiles);
+          }
+          source->done();
+        });
+  }
+  StripReader::setBackend(original);
+  return true;
+}
+
+/** Converts and reduces single tiles, and runs the SEP pipette on them */
+void benchTileOperations(Bench &bench) {
+  const Options &options = bench.options;
+  // Reducing works on blocks of 8 x 8 pixels
+  const int width = std::max(8, std::min(TILESIZE, options.width) / 8 * 8);
+  const int height = std::max(8, std::min(TILESIZE, options.height) / 8 * 8);
+  const uint64_t pixels = static_cast<uint64_t>(width) * height;
+  const int spp = options.channels;
+  auto noSetup = [] {};
+
+  OperationsCustomColors colorOperations(spp, Stats::Set::create());
+  colorOperations.setColors(syntheticColors(spp));
+  ConstTile::Ptr colorTile(new ConstTile(
+      width, height, 8 * spp, toTileData(syntheticImage(width, height, spp))));
+  Tile::Ptr colorTarget(
+      new Tile(width, height, 8 * spp,
+               toTileData(std::vector<uint8_t>(pixels * spp))));
+
+  bench.run("colors_cache", pixels, pixels * spp, noSetup,
+            [&] { colorOperations.cache(colorTile); });
+  // A complete target tile is reduced from 8 x 8 source tiles
+  bench.run("colors_reduce", 64 * pixels, 64 * pixels * spp, noSetup, [&] {
+    for (int y = 0; y < 8; y++) {
+      for (int x = 0; x < 8; x++) {
+        colorOperations.reduce(colorTarget, colorTile, x, y);
+      }
+    }
+  });
+  bench.run("sep_pipette", pixels, pixels * spp, noSetup, [&] {
+    colorOperations.sumPixelValues({0, 0, width, height}, colorTile);
+  });
+
+  VarnishOperations::Ptr varnishOperations =
+      VarnishOperations::create(Stats::Set::create());
+  ConstTile::Ptr varnishTile(new ConstTile(
+      width, height, 8, toTileData(syntheticImage(width, height, 1))));
+  Tile::Ptr varnishTarget(new Tile(width, height, 8,
+                                   toTileData(std::vector<uint8_t>(pixels))));
+
+  bench.run("varnish_cache", pixels, pixels, noSetup,
+            [&] { varnishOperations->cache(varnishTile); });
+  bench.run("varnish_reduce", 64 * pixels, 64 * pixels, noSetup, [&] {
+    for (int y = 0; y < 8; y++) {
+      for (int x = 0; x < 8; x++) {
+        varnishOperations->reduce(varnishTarget, varnishTile, x, y);
+      }
+    }
+  });
+}
+
+/** Composes, reduces and samples an SLI file of synthetic CMYK layers */
+void benchSliSource(Bench &bench) {
+  const Options &options = bench.options;
+  if (!bench.enabled("sli_compute_rgb") && !bench.enabled("sli_reduce_rgb") &&
+      !bench.enabled("sli_pipette")) {
+    return;
+  }
+
+  boost::function<void()> redraw = [] {};
+  SliSource::Ptr source = SliSource::create(redraw);
+  const std::vector<CustomColor::Ptr> colors = syntheticColors(4);
+  const std::vector<uint8_t> image =
+      syntheticImage(options.width, options.height, 4);
+
+  uint64_t layerBytes = 0;
+  for (int l = 0; l < options.layers; l++) {
+    SliLayer::Ptr layer =
+        SliLayer::create("", fmt::format("layer{}.tif", l), l * options.offset,
+                         l * options.offset);
+    layer->width = options.width;
+    layer->height = options.height;
+    layer->spp = 4;
+    layer->bps = 8;
+    layer->channels = colors;
+    layer->colorTable = CustomColorTable(colors);
+    layer->bitmap.reset(new uint8_t[image.size()]);
+    memcpy(layer->bitmap.get(), image.data(), image.size());
+    layerBytes += image.size();
+    source->layers.push_back(layer);
+  }
+  source->visible = boost::dynamic_bitset<>(options.layers).set();
+  source->toggled = boost::dynamic_bitset<>(options.layers).set();
+  source->computeHeightWidth();
+  source->checkXoffsets();
+  source->bitmapsImported = true;
+
+  const uint64_t pixels =
+      static_cast<uint64_t>(source->total_width) * source->total_height;
+
+  bench.run(
+      "sli_compute_rgb", pixels, layerBytes,
+      [&] { source->clearBottomSurface(); }, [&] { source->computeRgb(); });
+  if (!source->rgbCache.count(0)) {
+    source->computeRgb();
+  }
+  // Every level reads the level above it, which is a third of the base level
+  bench.run(
+      "sli_reduce_rgb", pixels * 4 / 3, pixels * 4 / 3 * 4, [] {},
+      [&] {
+        for (int zoom = -1; zoom >= -30; zoom--) {
+          source->reduceRgb(zoom, true);
+        }
+      });
+  bench.run(
+      "sli_pipette", pixels, layerBytes, [] {},
+      [&] {
+        source->averageVisibleChannels(
+            {0, 0, source->total_width, source->total_height});
+      });
+}
+
+/**
+ * Parses an SLI file of 10000 layers that refer to a few files, as a print
+ * job of many small pages would. Every layer counts as a pixel.
+ */
+void benchSliParser(Bench &bench, const fs::path &directory) {
+  const size_t layerCount = 10000;
+  const std::vector<std::string> files = {"page-a.tif", "page-b.tif",
+                                          "page-c.tif"};
+  for (const auto &file : files) {
+    std::ofstream((directory / file).string()).put('\0');
+  }
+  std::string contents = "Xresolution: 100\nYresolution: 200\n";
+  for (size_t i = 0; i < layerCount; i++) {
+    contents += fmt::format("{} : {} {}\n", files[i % files.size()], i % 977,
+                            i / 977);
+  }
+
+  bench.run(
+      "sli_parse", layerCount, contents.size(), [] {},
+      [&] { SliParser::parse(contents, directory.string()); });
+}
+
+} // namespace
+
+/**
+ * Benchmarks the hot paths of the plugin on synthetic inputs, and optionally
+ * writes the results as JSON. Compare two reports with bench/compare.py.
+ */
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  // The disk cache would add writing the reduced images to the SEP stage
+  unsetenv("SCROOM_SEP_CACHE_DIR");
+
+  const fs::path directory =
+      fs::temp_directory_path() / fs::unique_path("spsep-bench-%%%%-%%%%");
+  fs::create_directories(directory);
+
+  Bench bench(options);
+  printf("%dx%d pixels, %d channels, %d layers, %s compression\n",
+         options.width, options.height, options.channels, options.layers,
+         options.compression.c_str());
+
+  const bool ok = benchSepSource(bench, directory) &&
+                  benchChannelReads(bench, directory);
+  benchTileOperations(bench);
+  benchSliSource(bench);
+  benchSliParser(bench, directory);
+
+  boost::system::error_code ec;
+  fs::remove_all(directory, ec);
+
+  if (!ok) {
+    return 1;
+  }
+  if (!options.json.empty() && !bench.writeJson(options.json)) {
+    printf("ERROR: Could not write %s\n", options.json.c_str());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+"""Compares two JSON reports of spsep_bench.
+
+Prints the change of the median time and of the allocations of every stage,
+and exits with status 1 if any stage became slower than the threshold.
+
+Usage: compare.py <baseline.json> <candidate.json> [--threshold=PERCENT]
+"""
+
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        report = json.load(f)
+    return report["config"], {s["name"]: s for s in report["stages"]}
+
+
+def change(old, new):
+    return 100.0 * (new - old) / old if old else 0.0
+
+
+def main(argv):
+    threshold = 10.0
+    paths = []
+    for arg in argv[1:]:
+        if arg.startswith("--threshold="):
+            threshold = float(arg.split("=", 1)[1])
+        else:
+            paths.append(arg)
+    if len(paths) != 2:
+        print(__doc__)
+        return 2
+
+    old_config, old = load(paths[0])
+    new_config, new = load(paths[1])
+    if old_config != new_config:
+        print("WARNING: The reports were made with different configurations")
+
+    print("{:<22} {:>11} {:>11} {:>8} {:>10} {:>10}".format(
+        "stage", "base ms", "new ms", "time", "base alloc", "new alloc"))
+    regressions = []
+    for name in [n for n in old if n in new]:
+        a, b = old[name], new[name]
+        time = change(a["seconds"], b["seconds"])
+        print("{:<22} {:>11.3f} {:>11.3f} {:>+7.1f}% {:>10} {:>10}".format(
+            name, a["seconds"] * 1e3, b["seconds"] * 1e3, time,
+            a["allocations"], b["allocations"]))
+        if time > threshold:
+            regressions.append(name)
+
+    for name in sorted(set(old) ^ set(new)):
+        print("{:<22} only in {}".format(
+            name, paths[0] if name in old else paths[1]))
+
+    if regressions:
+        print("Slower by more than {}%: {}".format(threshold,
+                                                   ", ".join(regressions)))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -4,117 +4,162 @@
 #include "CustomColorConfig.hh"
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <boost/make_shared.hpp>
+#include <fstream>
 #include <iostream>
 #include <list>
+#include <sstream>
 #include <unordered_set>
 
 namespace pt = boost::property_tree;
 
-ColorConfig::ColorConfig() {}
+ColorConfig::ColorConfig() : snapshot(boost::make_shared<Snapshot>()) {}
+
+ColorConfig::Snapshot::ConstPtr ColorConfig::getSnapshot() const {
+  return boost::atomic_load(&snapshot);
+}
 
 void ColorConfig::loadFile(std::string file) {
-  colors.clear();
-  pt::ptree root;
   boost::filesystem::path full_path(boost::filesystem::current_path());
   if (file == "colours.json") {
     full_path.append(file);
   } else {
     full_path = file;
   }
-  if (!boost::filesystem::exists(
-          full_path)) { // File does not exist on file system
-    std::cout << "WARNING: Colours file does not exist at path: " +
-                     full_path.string() + "\n";
-    std::cout << "Loading default CMYK \n";
-    addNonExistentDefaultColors();
-    return;
+
+  // Only one thread loads at a time. Others wait for it, and then find the
+  // file unchanged.
+  boost::mutex::scoped_lock lock(loadMutex);
+
+  LoadedFile current;
+  current.path = full_path.string();
+  boost::system::error_code ec;
+  current.exists = boost::filesystem::exists(full_path, ec);
+  if (current.exists) {
+    current.mtime = boost::filesystem::last_write_time(full_path, ec);
+    current.size = boost::filesystem::file_size(full_path, ec);
   }
 
-  try {
-    pt::read_json(full_path.string(), root);
-  } catch (const std::exception &e) {
-    // Loading didnt work
-    std::cout << "WARNING: Loading colours file failed. file at: " +
-                     full_path.string() + " is most likely ill formed.\n";
-    std::cout << "Loading default CMYK \n";
-    addNonExistentDefaultColors();
+  if (hasLoaded && current.path == loaded.path &&
+      current.exists == loaded.exists && current.mtime == loaded.mtime &&
+      current.size == loaded.size) {
     return;
   }
 
-  std::unordered_set<std::string> seenNamesAndAliases = {};
-  seenNamesAndAliases.insert("V"); // Insert placeholder for varnish
+  boost::shared_ptr<Snapshot> colors = boost::make_shared<Snapshot>();
+  if (!current.exists) { // File does not exist on file system
+    std::cout << "WARNING: Colours file does not exist at path: " +
+                     full_path.string() + "\n";
+    std::cout << "Loading default CMYK \n";
+    addDefaultColors(*colors);
+  } else {
+    std::ifstream stream(current.path, std::ios::binary);
+    const std::string contents((std::istreambuf_iterator<char>(stream)),
+                               std::istreambuf_iterator<char>());
+    current.contentHash = boost::hash<std::string>()(contents);
+    if (hasLoaded && current.path == loaded.path && loaded.exists &&
+        current.contentHash == loaded.contentHash) {
+      // Only touched, the colors are still the same
+      loaded = current;
+      return;
+    }
 
-  std::cout << "Loading colour config file. NOTE: v is reserved for varnish, "
-               "so should not be defined as name or alias!!\n";
-  for (pt::ptree::value_type &v : root.get_child("colours")) {
-    parseColor(v, seenNamesAndAliases);
+    pt::ptree root;
+    try {
+      std::istringstream json(contents);
+      pt::read_json(json, root);
+    } catch (const std::exception &e) {
+      // Loading didnt work
+      std::cout << "WARNING: Loading colours file failed. file at: " +
+                       full_path.string() + " is most likely ill formed.\n";
+      std::cout << "Loading default CMYK \n";
+      root.clear();
+    }
+
+    if (!root.empty()) {
+      std::unordered_set<std::string> seenNamesAndAliases = {};
+      seenNamesAndAliases.insert("V"); // Insert placeholder for varnish
+
+      std::cout
+          << "Loading colour config file. NOTE: v is reserved for varnish, "
+             "so should not be defined as name or alias!!\n";
+      for (pt::ptree::value_type &v : root.get_child("colours")) {
+        parseColor(v, seenNamesAndAliases, *colors);
+      }
+    }
+    addDefaultColors(*colors);
   }
-  addNonExistentDefaultColors();
+
+  boost::atomic_store(&snapshot, Snapshot::ConstPtr(colors));
+  loaded = current;
+  hasLoaded = true;
 }
 
 void ColorConfig::addNonExistentDefaultColors() {
+  boost::mutex::scoped_lock lock(loadMutex);
+  boost::shared_ptr<Snapshot> colors =
+      boost::make_shared<Snapshot>(*getSnapshot());
+  addDefaultColors(*colors);
+  boost::atomic_store(&snapshot, Snapshot::ConstPtr(colors));
+  // The colors no longer match the loaded file
+  hasLoaded = false;
+}
 
-  // If no cyan configuration exists, add the default configuration
-  if (!getColorByNameOrAlias("c")) {
-    CustomColor::Ptr newColour =
-        boost::make_shared<CustomColor>("C", 1, 0, 0, 0);
+void ColorConfig::addDefaultColors(Snapshot &colors) {
 
-    colors.push_back(newColour);
+  // If no cyan configuration exists, add the default configuration
+  if (!colors.get("c")) {
+    colors.addColor(boost::make_shared<CustomColor>("C", 1, 0, 0, 0));
   }
 
   // If no magenta configuration exists, add the default configuration
-  if (!getColorByNameOrAlias("m")) {
-    CustomColor::Ptr newColour =
-        boost::make_shared<CustomColor>("M", 0, 1, 0, 0);
-
-    colors.push_back(newColour);
+  if (!colors.get("m")) {
+    colors.addColor(boost::make_shared<CustomColor>("M", 0, 1, 0, 0));
   }
 
   // If no yellow configuration exists, add the default configuration
-  if (!getColorByNameOrAlias("y")) {
-    CustomColor::Ptr newColour =
-        boost::make_shared<CustomColor>("Y", 0, 0, 1, 0);
-
-    colors.push_back(newColour);
+  if (!colors.get("y")) {
+    colors.addColor(boost::make_shared<CustomColor>("Y", 0, 0, 1, 0));
   }
 
   // If no key configuration exists, add the default configuration
-  if (!getColorByNameOrAlias("k")) {
-    CustomColor::Ptr newColour =
-        boost::make_shared<CustomColor>("K", 0, 0, 0, 1);
-
-    colors.push_back(newColour);
+  if (!colors.get("k")) {
+    colors.addColor(boost::make_shared<CustomColor>("K", 0, 0, 0, 1));
   }
 }
 
-CustomColor::Ptr ColorConfig::getColorByNameOrAlias(std::string name) {
-  boost::algorithm::to_upper(name);
-  auto definedColors = getDefinedColors();
-  std::string lowerName;
-  std::string lowerAlias;
-  for (auto &color : definedColors) {
-    lowerName = boost::algorithm::to_upper_copy(color->name);
-    if (lowerName == name) {
-      return color;
-    }
+CustomColor::Ptr ColorConfig::getColorByNameOrAlias(const std::string &name) {
+  return getSnapshot()->get(name);
+}
 
-    for (auto const &alias : color->aliases) {
-      lowerAlias = boost::algorithm::to_upper_copy(alias);
-      if (lowerAlias == name) {
-        return color;
-      }
-    }
+std::vector<CustomColor::Ptr> ColorConfig::getDefinedColors() {
+  return getSnapshot()->colors;
+}
+
+CustomColor::Ptr ColorConfig::Snapshot::get(const std::string &name) const {
+  // Channel names are usually upper case already, so try without a copy first
+  auto found = index.find(name);
+  if (found == index.end()) {
+    found = index.find(boost::algorithm::to_upper_copy(name));
   }
-  return nullptr;
+  return found == index.end() ? nullptr : found->second;
 }
 
-std::vector<CustomColor::Ptr> ColorConfig::getDefinedColors() { return colors; }
+void ColorConfig::Snapshot::addColor(const CustomColor::Ptr &color) {
+  colors.push_back(color);
+  // emplace() keeps the first color of a name or alias
+  index.emplace(boost::algorithm::to_upper_copy(color->name), color);
+  for (const auto &alias : color->aliases) {
+    index.emplace(boost::algorithm::to_upper_copy(alias), color);
+  }
+}
 
 void ColorConfig::parseColor(
     pt::ptree::value_type &v,
-    std::unordered_set<std::string> &seenNamesAndAliases) {
+    std::unordered_set<std::string> &seenNamesAndAliases, Snapshot &colors) {
   auto name = v.second.get<std::string>("name");
   boost::algorithm::to_upper(name); // Convert the name to uppercase
 
@@ -172,5 +217,18 @@ void ColorConfig::parseColor(
     std::cout << "No aliasses found.\n";
   }
 
-  colors.push_back(newColour);
-}
\ No newline at end of file
+  colors.addColor(newColour);
+}
+
+size_t ColorConfig::getHash() {
+  size_t seed = 0;
+  for (const auto &color : getSnapshot()->colors) {
+    boost::hash_combine(seed, color->name);
+    boost::hash_range(seed, color->aliases.begin(), color->aliases.end());
+    boost::hash_combine(seed, color->cMultiplier);
+    boost::hash_combine(seed, color->mMultiplier);
+    boost::hash_combine(seed, color->yMultiplier);
+    boost::hash_combine(seed, color->kMultiplier);
+  }
+  return seed;
+}
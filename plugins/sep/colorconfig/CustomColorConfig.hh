@@ -6,11 +6,14 @@
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <ctime>
 #include <iostream>
 
 #include "CustomColor.hh"
 #include <scroom/plugininformationinterface.hh>
 #include <scroom/utilities.hh>
+#include <unordered_map>
 #include <unordered_set>
 
 namespace pt = boost::property_tree;
@@ -19,8 +22,51 @@ class ColorConfig {
 public: // For testing
   ColorConfig();
 
-private:
-  std::vector<CustomColor::Ptr> colors;
+  /**
+   * An immutable set of defined colors. Loading creates a new snapshot and
+   * swaps it in, so lookups never see a half loaded configuration, and colors
+   * looked up before remain valid.
+   */
+  struct Snapshot {
+    typedef boost::shared_ptr<const Snapshot> ConstPtr;
+
+    std::vector<CustomColor::Ptr> colors;
+
+    /**
+     * The colors by their upper case names and aliases. A name or alias that
+     * is used more than once refers to the color that was defined first.
+     */
+    std::unordered_map<std::string, CustomColor::Ptr> index;
+
+    /** Adds @param color to the colors and to the index */
+    void addColor(const CustomColor::Ptr &color);
+
+    /** Looks up a color by its name or one of its aliases, ignoring case */
+    CustomColor::Ptr get(const std::string &name) const;
+  };
+
+  /** The file that was loaded last, to detect changes */
+  struct LoadedFile {
+    std::string path;
+    bool exists = false;
+    std::time_t mtime = 0;
+    uintmax_t size = 0;
+    size_t contentHash = 0;
+  };
+
+  /** The current snapshot. Only accessed with boost::atomic_load/store. */
+  Snapshot::ConstPtr snapshot;
+
+  /** Serializes loading, and protects `loaded` */
+  boost::mutex loadMutex;
+
+  /** Whether `loaded` describes the current snapshot */
+  bool hasLoaded = false;
+
+  LoadedFile loaded;
+
+  /** Returns the current snapshot */
+  Snapshot::ConstPtr getSnapshot() const;
 
 public:
   static ColorConfig &getInstance() {
@@ -28,13 +74,32 @@ public:
     return INSTANCE;
   }
 
+  /** Returns a copy of the currently defined colors */
   std::vector<CustomColor::Ptr> getDefinedColors();
-  CustomColor::Ptr getColorByNameOrAlias(std::string name);
+
+  /** Looks up a color by its name or one of its aliases, ignoring case */
+  CustomColor::Ptr getColorByNameOrAlias(const std::string &name);
+
+  /**
+   * Loads the colors from @param file, unless it is the file that was loaded
+   * last and it has not changed since. Safe to call from multiple threads.
+   */
   void loadFile(std::string file = "colours.json");
 
   void addNonExistentDefaultColors();
 
+  /**
+   * Returns a hash of the defined colors, which changes whenever the way the
+   * colors are drawn changes.
+   */
+  size_t getHash();
+
 private:
-  void parseColor(pt::ptree::value_type &v,
-                  std::unordered_set<std::string> &seenNamesAndAliases);
+  static void
+  parseColor(pt::ptree::value_type &v,
+             std::unordered_set<std::string> &seenNamesAndAliases,
+             Snapshot &colors);
+
+  /** Adds C, M, Y and K to @param colors if they are not defined */
+  static void addDefaultColors(Snapshot &colors);
 };
@@ -17,3 +17,14 @@ void CustomColorHelpers::calculateCMYK(CustomColor::Ptr &color, int16_t &C,
   Y += (color->yMultiplier * value);
   K += (color->kMultiplier * value);
 }
+
+uint32_t CustomColorHelpers::cmykToARGB(uint8_t C, uint8_t M, uint8_t Y,
+                                        uint8_t K) {
+  double black = (1 - K / 255.0);
+  uint8_t A = 255;
+  uint8_t R = 255 * (1 - C / 255.0) * black;
+  uint8_t G = 255 * (1 - M / 255.0) * black;
+  uint8_t B = 255 * (1 - Y / 255.0) * black;
+
+  return (A << 24) | (R << 16) | (G << 8) | B;
+}
@@ -6,6 +6,7 @@
 
 #include "CustomColor.hh"
 #include <cstdint>
+#include <vector>
 
 class CustomColorHelpers {
 public:
@@ -31,4 +32,11 @@ public:
    */
   static void calculateCMYK(CustomColor::Ptr &color, int16_t &C, int16_t &M,
                             int16_t &Y, int16_t &K, uint8_t value);
+
+  /**
+   * Convert a single CMYK pixel to opaque RGB, the way SliSource does when
+   * drawing.
+   * @return the pixel as 0xAARRGGBB
+   */
+  static uint32_t cmykToARGB(uint8_t C, uint8_t M, uint8_t Y, uint8_t K);
 };
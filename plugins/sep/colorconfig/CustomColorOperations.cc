@@ -4,6 +4,9 @@
 
 #include "CustomColorOperations.hh"
 #include "CustomColorHelpers.hh"
+#include "../probes.hh"
+#include "../stats.hh"
+#include <algorithm>
 #include <iostream>
 #include <scroom/bitmap-helpers.hh>
 #include <utility>
@@ -37,38 +40,38 @@ PipetteCommonOperationsCustomColor::sumPixelValues(
     si += stride;
   }
 
-  // Copy map to vector of pairs
+  return toPipetteColor(std::vector<double>(sums.begin(), sums.end()));
+}
+
+PipetteLayerOperations::PipetteColor
+PipetteCommonOperationsCustomColor::toPipetteColor(
+    const std::vector<double> &sums) {
   PipetteColor result = {};
-  // Map different aliasses of the same color to the same pipette color
-  std::unordered_map<std::string, int> colorIndex = {};
+  for (const auto &name : colorNames) {
+    result.push_back(std::pair<std::string, double>(name, 0));
+  }
   for (int i = 0; i < spp; i++) {
-    // if the color is already in the pipette colors, add the sum to that color
-    if (colorIndex.find(colors[i]->name) != colorIndex.end()) {
-      result[colorIndex[colors[i]->name]].second += sums[i];
-    }
-    // This is a pipette color that we have not seen before
-    else {
-      // The pipette color that is about to be added will have the index of the
-      // current size, as vectors are 0 indexed
-      colorIndex.insert({colors[i]->name, result.size()});
-      result.push_back(
-          std::pair<std::string, double>(colors[i]->name, sums[i]));
-    }
+    result[colorIndex[i]].second += sums[i];
   }
 
   return result;
 }
 
-OperationsCustomColors::OperationsCustomColors(int spp_)
-    : PipetteCommonOperationsCustomColor(8, spp_) {}
+OperationsCustomColors::OperationsCustomColors(int spp_,
+                                               Stats::Set::Ptr stats_)
+    : PipetteCommonOperationsCustomColor(8, spp_), stats(std::move(stats_)) {}
 
 PipetteCommonOperationsCustomColor::Ptr
-OperationsCustomColors::create(int spp) {
+OperationsCustomColors::create(int spp, const Stats::Set::Ptr &stats) {
   return PipetteCommonOperationsCustomColor::Ptr(
-      new OperationsCustomColors(spp));
+      new OperationsCustomColors(spp, stats));
 }
 
 Scroom::Utils::Stuff OperationsCustomColors::cache(const ConstTile::Ptr &tile) {
+  Stats::ScopedTimer timer(stats->cache);
+  timer.addPixels(static_cast<uint64_t>(tile->width) * tile->height);
+  // width, height, samples per pixel
+  SPSEP_PROBE3(cache__entry, tile->width, tile->height, spp);
   // Allocate the space for the cache - stride is the height of one row
   const int stride =
       cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, tile->width);
@@ -82,29 +85,13 @@ Scroom::Utils::Stuff OperationsCustomColors::cache(const ConstTile::Ptr &tile) {
   for (int i = 0; i < spp * tile->height * tile->width; i += spp) {
     // Convert custom colors to CMYK and then to ARGB, because cairo doesn't
     // know how to render CMYK.
-    int16_t C = 0;
-    int16_t M = 0;
-    int16_t Y = 0;
-    int16_t K = 0;
-    for (uint16_t j = 0; j < spp; j++) {
-      auto &color = colors[j];
-      CustomColorHelpers::calculateCMYK(color, C, M, Y, K, cur[i + j]);
-    }
-
-    uint8_t C_i = 255 - CustomColorHelpers::toUint8(C);
-    uint8_t M_i = 255 - CustomColorHelpers::toUint8(M);
-    uint8_t Y_i = 255 - CustomColorHelpers::toUint8(Y);
-    uint8_t K_i = 255 - CustomColorHelpers::toUint8(K);
-
-    uint8_t R = (C_i * K_i) / 255;
-    uint8_t G = (M_i * K_i) / 255;
-    uint8_t B = (Y_i * K_i) / 255;
-
-    // Write 255 as alpha (fully opaque)
     uint32_t target = i * 4 / spp; // Scale the target to the 4 channel target
                                    // row, from the n channel source row
-    row[target / 4] = 255u << 24 | R << 16 | G << 8 | B;
+    row[target / 4] = colorTable.toARGB(cur + i);
   }
+  // width, height, bytes of the converted tile
+  SPSEP_PROBE3(cache__return, tile->width, tile->height,
+               static_cast<size_t>(stride) * tile->height);
   return Scroom::Bitmap::BitmapSurface::create(
       tile->width, tile->height, CAIRO_FORMAT_ARGB32, stride, data);
 }
@@ -112,6 +99,11 @@ Scroom::Utils::Stuff OperationsCustomColors::cache(const ConstTile::Ptr &tile) {
 void OperationsCustomColors::reduce(Tile::Ptr target,
                                     const ConstTile::Ptr source, int top_left_x,
                                     int top_left_y) {
+  Stats::ScopedTimer timer(stats->reduce);
+  timer.addPixels(static_cast<uint64_t>(source->width) * source->height);
+  // source width, source height, position in the target
+  SPSEP_PROBE4(reduce__entry, source->width, source->height, top_left_x,
+               top_left_y);
   // Reducing by a factor 8
   int sourceStride = getBpp() * source->width / 8; // stride in bytes
   const byte *sourceBase = source->data.get();
@@ -156,6 +148,8 @@ void OperationsCustomColors::reduce(Tile::Ptr target,
     targetBase += targetStride;
     sourceBase += sourceStride * 8;
   }
+  SPSEP_PROBE4(reduce__return, source->width, source->height, top_left_x,
+               top_left_y);
 }
 
 int OperationsCustomColors::getBpp() { return spp * bps; }
@@ -163,4 +157,17 @@ int OperationsCustomColors::getBpp() { return spp * bps; }
 void PipetteCommonOperationsCustomColor::setColors(
     std::vector<CustomColor::Ptr> colors_) {
   colors = std::move(colors_);
+  colorTable = CustomColorTable(colors);
+
+  // Map different aliasses of the same color to the same pipette color, once,
+  // instead of on every pipette call
+  colorIndex.clear();
+  colorNames.clear();
+  for (const auto &color : colors) {
+    auto name = std::find(colorNames.begin(), colorNames.end(), color->name);
+    colorIndex.push_back(name - colorNames.begin());
+    if (name == colorNames.end()) {
+      colorNames.push_back(color->name);
+    }
+  }
 }
@@ -4,7 +4,9 @@
 
 #pragma once
 
+#include "../stats.hh"
 #include "CustomColor.hh"
+#include "CustomColorTable.hh"
 #include <boost/shared_ptr.hpp>
 #include <scroom/layeroperations.hh>
 #include <scroom/pipettelayeroperations.hh>
@@ -16,6 +18,21 @@ protected:
   uint16_t spp;
   std::vector<CustomColor::Ptr> colors;
 
+  /**
+   * The multipliers of `colors`, captured in setColors(). The tiles are
+   * converted on worker threads, which only read this table.
+   */
+  CustomColorTable colorTable;
+
+  /**
+   * For every channel, the index of its color in the pipette result. Aliases
+   * of the same color map to the same index. Computed in setColors().
+   */
+  std::vector<size_t> colorIndex;
+
+  /** The names of the pipette colors, in order of their index */
+  std::vector<std::string> colorNames;
+
 public:
   using Ptr = boost::shared_ptr<PipetteCommonOperationsCustomColor>;
 
@@ -25,15 +42,27 @@ public:
   };
 
   void setColors(std::vector<CustomColor::Ptr> colors_);
+
+  /**
+   * Converts the sums of the individual channels into a pipette color,
+   * merging the sums of channels that map to the same color.
+   */
+  PipetteLayerOperations::PipetteColor
+  toPipetteColor(const std::vector<double> &sums);
+
   PipetteLayerOperations::PipetteColor
   sumPixelValues(Scroom::Utils::Rectangle<int> area,
                  const ConstTile::Ptr &tile) override;
 };
 
 class OperationsCustomColors : public PipetteCommonOperationsCustomColor {
+private:
+  /** The statistics cache() and reduce() record into */
+  Stats::Set::Ptr stats;
+
 public:
-  static Ptr create(int spp);
-  OperationsCustomColors(int spp_);
+  static Ptr create(int spp, const Stats::Set::Ptr &stats);
+  OperationsCustomColors(int spp_, Stats::Set::Ptr stats_);
 
   int getBpp() override;
   Scroom::Utils::Stuff cache(const ConstTile::Ptr &tile) override;
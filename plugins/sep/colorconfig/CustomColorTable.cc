@@ -0,0 +1,15 @@
+#include "CustomColorTable.hh"
+
+CustomColorTable::CustomColorTable(
+    const std::vector<CustomColor::Ptr> &colors) {
+  entries.reserve(colors.size());
+  for (const auto &color : colors) {
+    // A channel without a color does not add ink
+    if (color) {
+      entries.push_back({color->cMultiplier, color->mMultiplier,
+                         color->yMultiplier, color->kMultiplier});
+    } else {
+      entries.push_back({0, 0, 0, 0});
+    }
+  }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "CustomColor.hh"
+#include "CustomColorHelpers.hh"
+#include <cstdint>
+#include <vector>
+
+/**
+ * The multipliers of a list of colors, packed into one array so converting a
+ * pixel reads a few cache lines instead of following a shared pointer per
+ * sample.
+ *
+ * A table is captured when a presentation opens and never changes afterwards,
+ * so worker threads can read it without locks, and without touching the
+ * reference counts of the CustomColor objects. Reloading the color
+ * configuration does not affect existing tables.
+ */
+class CustomColorTable {
+public:
+  /** The multipliers of a single color, 16 bytes so 4 fit in a cache line */
+  struct alignas(16) Entry {
+    float c;
+    float m;
+    float y;
+    float k;
+  };
+
+private:
+  std::vector<Entry> entries;
+
+public:
+  CustomColorTable() = default;
+
+  /** Captures the multipliers of @param colors, in the same order */
+  explicit CustomColorTable(const std::vector<CustomColor::Ptr> &colors);
+
+  size_t size() const { return entries.size(); }
+
+  const Entry &operator[](size_t i) const { return entries[i]; }
+
+  /**
+   * Same as CustomColorHelpers::calculateCMYK(), for the color at
+   * @param index.
+   */
+  void calculateCMYK(size_t index, int16_t &C, int16_t &M, int16_t &Y,
+                     int16_t &K, uint8_t value) const {
+    const Entry &entry = entries[index];
+    C += (entry.c * value);
+    M += (entry.m * value);
+    Y += (entry.y * value);
+    K += (entry.k * value);
+  }
+
+  /**
+   * Converts the samples of a single pixel of a SEP file to opaque RGB, the
+   * way OperationsCustomColors does when drawing.
+   * @param samples one value per color in the table
+   * @return the pixel as 0xAARRGGBB
+   */
+  uint32_t toARGB(const uint8_t *samples) const {
+    int16_t C = 0;
+    int16_t M = 0;
+    int16_t Y = 0;
+    int16_t K = 0;
+    for (size_t j = 0; j < entries.size(); j++) {
+      calculateCMYK(j, C, M, Y, K, samples[j]);
+    }
+
+    uint8_t C_i = 255 - CustomColorHelpers::toUint8(C);
+    uint8_t M_i = 255 - CustomColorHelpers::toUint8(M);
+    uint8_t Y_i = 255 - CustomColorHelpers::toUint8(Y);
+    uint8_t K_i = 255 - CustomColorHelpers::toUint8(K);
+
+    uint8_t R = (C_i * K_i) / 255;
+    uint8_t G = (M_i * K_i) / 255;
+    uint8_t B = (Y_i * K_i) / 255;
+
+    // Write 255 as alpha (fully opaque)
+    return 255u << 24 | R << 16 | G << 8 | B;
+  }
+};
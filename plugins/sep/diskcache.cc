@@ -0,0 +1,265 @@
+#include "diskcache.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+
+#include <boost/functional/hash.hpp>
+#include <fmt/format.h>
+
+namespace bi = boost::interprocess;
+namespace fs = boost::filesystem;
+
+namespace DiskCache {
+
+/** "SEPCACHE", followed by the version of the format */
+const uint64_t MAGIC = 0x5345504341434845ull + 1;
+
+uint8_t *Entry::data() {
+  return static_cast<uint8_t *>(region.get_address()) + DATA_OFFSET;
+}
+
+Writer::~Writer() {
+  if (!committed) {
+    boost::system::error_code ec;
+    fs::remove(temporary, ec);
+  }
+}
+
+uint8_t *Writer::data() {
+  return static_cast<uint8_t *>(region.get_address()) + DATA_OFFSET;
+}
+
+bool Writer::commit() {
+  region.flush();
+  boost::system::error_code ec;
+  fs::rename(temporary, path, ec);
+  committed = !ec;
+  if (committed) {
+    trim(key);
+  }
+  return committed;
+}
+
+fs::path getDirectory() {
+  const char *directory = std::getenv("SCROOM_SEP_CACHE_DIR");
+  if (directory == nullptr || directory[0] == '\0') {
+    return {};
+  }
+  return directory;
+}
+
+uintmax_t getMaxSize() {
+  const char *megabytes = std::getenv("SCROOM_SEP_CACHE_SIZE");
+  if (megabytes != nullptr && std::atoll(megabytes) > 0) {
+    return static_cast<uintmax_t>(std::atoll(megabytes)) << 20;
+  }
+  return static_cast<uintmax_t>(8) << 30;
+}
+
+void touch(const std::string &key) {
+  if (key.empty()) {
+    return;
+  }
+  boost::system::error_code ec;
+  fs::last_write_time(getDirectory() / key, std::time(nullptr), ec);
+}
+
+void trim(const std::string &keep) {
+  const fs::path directory = getDirectory();
+  if (directory.empty()) {
+    return;
+  }
+
+  struct Subdirectory {
+    std::time_t used;
+    uintmax_t size;
+    fs::path path;
+  };
+  std::vector<Subdirectory> subdirectories;
+  uintmax_t total = 0;
+  boost::system::error_code ec;
+  for (fs::directory_iterator i(directory, ec), end; !ec && i != end;
+       i.increment(ec)) {
+    boost::system::error_code fileEc;
+    if (!fs::is_directory(i->path(), fileEc)) {
+      continue;
+    }
+    Subdirectory subdirectory = {fs::last_write_time(i->path(), fileEc), 0,
+                                 i->path()};
+    for (fs::directory_iterator entry(i->path(), fileEc);
+         !fileEc && entry != end; entry.increment(fileEc)) {
+      boost::system::error_code sizeEc;
+      const uintmax_t size = fs::file_size(entry->path(), sizeEc);
+      if (!sizeEc) {
+        subdirectory.size += size;
+      }
+    }
+    total += subdirectory.size;
+    subdirectories.push_back(subdirectory);
+  }
+
+  std::sort(subdirectories.begin(), subdirectories.end(),
+            [](const Subdirectory &a, const Subdirectory &b) {
+              return a.used < b.used;
+            });
+  const uintmax_t maxSize = getMaxSize();
+  for (const auto &subdirectory : subdirectories) {
+    if (total <= maxSize) {
+      break;
+    }
+    // Entries that are mapped by another process stay readable to it
+    if (subdirectory.path.filename() != keep) {
+      fs::remove_all(subdirectory.path, ec);
+      total -= subdirectory.size;
+    }
+  }
+}
+
+std::string computeKey(const std::vector<std::string> &files,
+                       const std::string &salt) {
+  if (getDirectory().empty()) {
+    return "";
+  }
+
+  size_t seed = MAGIC;
+  for (const auto &file : files) {
+    boost::system::error_code ec;
+    const fs::path path = fs::absolute(file);
+    const auto size = fs::file_size(path, ec);
+    if (ec) {
+      return "";
+    }
+    const auto mtime = fs::last_write_time(path, ec);
+    if (ec) {
+      return "";
+    }
+
+    boost::hash_combine(seed, path.string());
+    boost::hash_combine(seed, size);
+    boost::hash_combine(seed, mtime);
+  }
+  boost::hash_combine(seed, salt);
+
+  return fmt::format("{:016x}", seed);
+}
+
+fs::path getPath(const std::string &key, const std::string &name) {
+  if (key.empty()) {
+    return {};
+  }
+  return getDirectory() / key / name;
+}
+
+fs::path createTemporary(const std::string &key, const std::string &name) {
+  if (key.empty()) {
+    return {};
+  }
+  boost::system::error_code ec;
+  fs::create_directories(getDirectory() / key, ec);
+  if (ec) {
+    return {};
+  }
+  return getDirectory() / key / fs::unique_path(name + ".%%%%%%%%.tmp");
+}
+
+bool commitTemporary(const fs::path &temporary, const std::string &key,
+                     const std::string &name) {
+  boost::system::error_code ec;
+  fs::rename(temporary, getPath(key, name), ec);
+  if (ec) {
+    fs::remove(temporary, ec);
+    return false;
+  }
+  trim(key);
+  return true;
+}
+
+Entry::Ptr open(const std::string &key, const std::string &name) {
+  if (key.empty()) {
+    return nullptr;
+  }
+
+  const fs::path path = getPath(key, name);
+  boost::system::error_code ec;
+  if (!fs::exists(path, ec)) {
+    return nullptr;
+  }
+
+  try {
+    Entry::Ptr entry(new Entry());
+    entry->file = bi::file_mapping(path.c_str(), bi::read_only);
+    entry->region = bi::mapped_region(entry->file, bi::copy_on_write);
+    if (entry->region.get_size() < DATA_OFFSET) {
+      return nullptr;
+    }
+
+    memcpy(&entry->header, entry->region.get_address(), sizeof(Header));
+    const size_t size = static_cast<size_t>(entry->header.height) *
+                        static_cast<size_t>(entry->header.stride);
+    if (entry->header.magic != MAGIC ||
+        entry->region.get_size() < DATA_OFFSET + size) {
+      return nullptr;
+    }
+    touch(key);
+    return entry;
+  } catch (const bi::interprocess_exception &ex) {
+    printf("WARNING: Failed to open cache entry %s: %s\n",
+           path.string().c_str(), ex.what());
+    return nullptr;
+  }
+}
+
+Writer::Ptr create(const std::string &key, const std::string &name, int width,
+                   int height, int stride) {
+  if (key.empty()) {
+    return nullptr;
+  }
+
+  Writer::Ptr writer(new Writer());
+  writer->key = key;
+  writer->path = getPath(key, name);
+  writer->temporary = createTemporary(key, name);
+  if (writer->temporary.empty()) {
+    return nullptr;
+  }
+
+  try {
+    const size_t size =
+        DATA_OFFSET + static_cast<size_t>(height) * static_cast<size_t>(stride);
+    {
+      // Create a (sparse) file of the right size
+      std::ofstream file(writer->temporary.string(), std::ios::binary);
+      Header header = {MAGIC, width, height, stride, 0};
+      file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      file.seekp(size - 1);
+      file.put('\0');
+      if (!file) {
+        return nullptr;
+      }
+    }
+
+    writer->file = bi::file_mapping(writer->temporary.c_str(), bi::read_write);
+    writer->region = bi::mapped_region(writer->file, bi::read_write);
+    return writer;
+  } catch (const std::exception &ex) {
+    printf("WARNING: Failed to create cache entry %s: %s\n",
+           writer->path.string().c_str(), ex.what());
+    return nullptr;
+  }
+}
+
+bool store(const std::string &key, const std::string &name, int width,
+           int height, int stride, const uint8_t *data) {
+  Writer::Ptr writer = create(key, name, width, height, stride);
+  if (!writer) {
+    return false;
+  }
+  memcpy(writer->data(), data,
+         static_cast<size_t>(height) * static_cast<size_t>(stride));
+  return writer->commit();
+}
+
+} // namespace DiskCache
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/shared_ptr.hpp>
+
+/**
+ * Persistent cache of decoded and reduced bitmaps, so reopening the same file
+ * does not need to decode and reduce everything again.
+ *
+ * The cache is only used when the environment variable SCROOM_SEP_CACHE_DIR
+ * points to a directory. Every set of input files gets its own subdirectory,
+ * named after a key that covers the paths, sizes and modification times of
+ * the files, and any setting the data depends on. Entries are stored as raw
+ * data behind a small header, so they can be memory mapped, or as files in
+ * a format of their own.
+ *
+ * The subdirectories are removed least recently used first, once the cache
+ * grows beyond SCROOM_SEP_CACHE_SIZE megabytes (8 GiB by default). This is
+ * checked whenever an entry is committed, and never removes the
+ * subdirectory of that entry, so the files that are being opened keep their
+ * entries even if those don't fit by themselves. A subdirectory is used when
+ * one of its entries is committed or opened, see touch(). Anything else is
+ * left to the user, who may remove the directory at any time it is not in
+ * use.
+ */
+namespace DiskCache {
+
+/** Fixed size header in front of the data of every entry */
+struct Header {
+  /** Identifies the format of the entry */
+  uint64_t magic;
+  int32_t width;
+  int32_t height;
+  /** Length of a row of the data (in bytes) */
+  int32_t stride;
+  int32_t reserved;
+};
+
+/** The data starts at this offset, so it is page aligned */
+const size_t DATA_OFFSET = 4096;
+
+/** A read-only, memory mapped entry */
+class Entry {
+public:
+  typedef boost::shared_ptr<Entry> Ptr;
+
+  Header header;
+
+  boost::interprocess::file_mapping file;
+  boost::interprocess::mapped_region region;
+
+  /**
+   * The data of the entry. The mapping is private, so the data may be
+   * modified without changing the file.
+   */
+  uint8_t *data();
+};
+
+/**
+ * An entry that is being written. It is only renamed to its final name by
+ * commit(), so an entry that is not complete is never read.
+ */
+class Writer {
+public:
+  typedef boost::shared_ptr<Writer> Ptr;
+
+  boost::filesystem::path path;
+  boost::filesystem::path temporary;
+
+  boost::interprocess::file_mapping file;
+  boost::interprocess::mapped_region region;
+
+  /** The key of the entry, which trim() keeps */
+  std::string key;
+
+  bool committed = false;
+
+  /** Removes the file if it has not been committed */
+  ~Writer();
+
+  /** The data of the entry, to be filled in */
+  uint8_t *data();
+
+  /** Makes the entry available to open(), and trims the cache */
+  bool commit();
+};
+
+/** Returns the cache directory, or an empty path if caching is disabled */
+boost::filesystem::path getDirectory();
+
+/** Returns the maximum size of the cache (in bytes) */
+uintmax_t getMaxSize();
+
+/**
+ * Marks the entries of @param key as used now, so trim() removes them after
+ * the ones that have been used less recently
+ */
+void touch(const std::string &key);
+
+/**
+ * Removes the subdirectories of the cache, least recently used first, until
+ * the cache fits in getMaxSize() again. The subdirectory of @param keep is
+ * never removed.
+ */
+void trim(const std::string &keep);
+
+/**
+ * Computes the key of a set of input files, or an empty string if caching is
+ * disabled or one of the files does not exist. @param salt covers any other
+ * setting that changes the cached data, such as the color configuration for
+ * data that has been converted to RGB.
+ */
+std::string computeKey(const std::vector<std::string> &files,
+                       const std::string &salt = "");
+
+/**
+ * Returns the path of entry @param name of @param key, whether it exists or
+ * not, or an empty path if @param key is empty.
+ */
+boost::filesystem::path getPath(const std::string &key,
+                                const std::string &name);
+
+/**
+ * Returns a new path next to entry @param name of @param key, to write the
+ * entry to before it is committed with commitTemporary().
+ * @return the path, or an empty path if the directory could not be created
+ */
+boost::filesystem::path createTemporary(const std::string &key,
+                                        const std::string &name);
+
+/**
+ * Renames @param temporary to entry @param name of @param key, or removes it
+ * if that fails. Then trims the cache.
+ */
+bool commitTemporary(const boost::filesystem::path &temporary,
+                     const std::string &key, const std::string &name);
+
+/**
+ * Opens entry @param name of @param key.
+ * @return the entry, or nullptr if it does not exist or has another format
+ */
+Entry::Ptr open(const std::string &key, const std::string &name);
+
+/**
+ * Creates entry @param name of @param key with room for @param height rows
+ * of @param stride bytes.
+ * @return the writer, or nullptr if the entry could not be created
+ */
+Writer::Ptr create(const std::string &key, const std::string &name, int width,
+                   int height, int stride);
+
+/** Creates an entry with the given data at once */
+bool store(const std::string &key, const std::string &name, int width,
+           int height, int stride, const uint8_t *data);
+
+} // namespace DiskCache
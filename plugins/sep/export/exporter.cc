@@ -0,0 +1,90 @@
+#include "exporter.hh"
+
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <scroom/threadpool.hh>
+
+#include "exportsource.hh"
+#include "pyramidtiffwriter.hh"
+
+bool exportPyramidTiff(const std::string &input, const std::string &output,
+                       int tileSize, int threads) {
+  if (threads <= 0) {
+    threads = std::max(1u, boost::thread::hardware_concurrency());
+  }
+
+  // The bands lease their own handles, so they can share the source
+  ExportSource::Ptr source = ExportSource::open(input);
+  if (!source) {
+    return false;
+  }
+
+  const int width = source->getWidth();
+  const int height = source->getHeight();
+  PyramidTiffWriter::Ptr writer =
+      PyramidTiffWriter::create(output, width, height, tileSize);
+  if (!writer) {
+    return false;
+  }
+
+  // A band is a row of tiles
+  const int bandHeight = tileSize;
+  const size_t rowLength = static_cast<size_t>(width) * 3;
+  std::vector<std::vector<uint8_t>> bands(
+      threads, std::vector<uint8_t>(rowLength * bandHeight));
+
+  boost::mutex mtx;
+  boost::condition_variable bandsRead;
+  bool readFailed = false;
+  for (int first = 0; first < height; first += threads * bandHeight) {
+    int bandsLeft = 0;
+    for (int t = 0; t < threads; t++) {
+      const int top = first + t * bandHeight;
+      const int bottom = std::min(top + bandHeight, height);
+      if (top >= height) {
+        break;
+      }
+
+      // The jobs are waited for below, so they can refer to the locals
+      bandsLeft++;
+      CpuBound()->schedule([&, t, top, bottom] {
+        const bool read =
+            source->readRgbRows(top, bottom - top, bands[t].data());
+        boost::mutex::scoped_lock lock(mtx);
+        readFailed |= !read;
+        if (--bandsLeft == 0) {
+          bandsRead.notify_all();
+        }
+      });
+    }
+    {
+      boost::mutex::scoped_lock lock(mtx);
+      while (bandsLeft > 0) {
+        bandsRead.wait(lock);
+      }
+    }
+    if (readFailed) {
+      printf("Error: Failed to read %s\n", input.c_str());
+      return false;
+    }
+
+    for (int t = 0; t < threads; t++) {
+      const int top = first + t * bandHeight;
+      if (top >= height) {
+        break;
+      }
+      const int count = std::min(bandHeight, height - top);
+      if (!writer->writeRows(bands[t].data(), count)) {
+        printf("Error: Failed to write %s\n", output.c_str());
+        return false;
+      }
+    }
+  }
+
+  if (!writer->finish()) {
+    printf("Error: Failed to write %s\n", output.c_str());
+    return false;
+  }
+  return true;
+}
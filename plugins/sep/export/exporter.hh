@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+
+/**
+ * Exports a SEP or SLI file as a tiled, multi-resolution RGB TIFF file.
+ *
+ * The image is processed in bands of rows, which are read by jobs on
+ * CpuBound(), @param threads bands at a time. Every band of such a group
+ * leases its own file handles from TiffPool, and the bands are written in
+ * order as soon as the whole group has been read. So memory use and the
+ * number of open files only depend on the width of the image, the tile size
+ * and the number of threads.
+ *
+ * @param input path to the SEP or SLI file
+ * @param output path of the TIFF file to create
+ * @param tileSize width and height of the tiles (a multiple of 16)
+ * @param threads number of bands to read at a time, or 0 for one per core
+ * @return true if the export succeeded, false if a file could not be read
+ *         or written
+ */
+bool exportPyramidTiff(const std::string &input, const std::string &output,
+                       int tileSize = 256, int threads = 0);
@@ -0,0 +1,229 @@
+#include "exportsource.hh"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include "../colorconfig/CustomColorConfig.hh"
+#include "../colorconfig/CustomColorHelpers.hh"
+#include "../sli/sliparser.hh"
+#include "../tiffpool.hh"
+
+ExportSource::Ptr ExportSource::open(const std::string &path) {
+  auto extension = boost::filesystem::path(path).extension().string();
+  boost::to_lower(extension);
+
+  if (extension == ".sep") {
+    return SepExportSource::open(path);
+  }
+  if (extension == ".sli") {
+    return SliExportSource::open(path);
+  }
+
+  printf("Error: File extension of %s is not supported\n", path.c_str());
+  return nullptr;
+}
+
+namespace {
+/** Leases the channel files of @param file, for reading a band */
+SepSource::Ptr openBand(const SepFile &file) {
+  SepSource::Ptr source = SepSource::create();
+  source->setData(file);
+  source->openFiles();
+  return source;
+}
+
+/** Writes @param argb into @param out as 3 bytes (R, G and B) */
+void writeRgb(uint32_t argb, uint8_t *out) {
+  out[0] = (argb >> 16) & 0xFF;
+  out[1] = (argb >> 8) & 0xFF;
+  out[2] = argb & 0xFF;
+}
+} // namespace
+
+////////////////////////////////////////////////////////////////////////
+// SepExportSource
+
+ExportSource::Ptr SepExportSource::open(const std::string &path) {
+  SepFile file = SepSource::parseSep(path);
+  if (file.width == 0 || file.height == 0) {
+    printf("Error: %s does not define its width and height\n", path.c_str());
+    return nullptr;
+  }
+  // The varnish is an overlay, not part of the composite
+  file.varnish_file = "";
+
+  boost::shared_ptr<SepExportSource> result(new SepExportSource());
+  result->file = file;
+  SepSource::Ptr source = SepSource::create();
+  source->setData(file);
+  for (const auto &channel : source->getChannels()) {
+    result->colors.push_back(
+        ColorConfig::getInstance().getColorByNameOrAlias(channel));
+  }
+  result->colorTable = CustomColorTable(result->colors);
+
+  return result;
+}
+
+int SepExportSource::getWidth() { return static_cast<int>(file.width); }
+
+int SepExportSource::getHeight() { return static_cast<int>(file.height); }
+
+bool SepExportSource::readRgbRows(int top, int count, uint8_t *out) {
+  SepSource::Ptr source = openBand(file);
+  const size_t spp = colors.size();
+  const int width = getWidth();
+  std::vector<byte> samples(file.width * spp);
+
+  bool result = true;
+  for (int y = top; y < top + count && result; y++) {
+    result = source->readCombinedScanline(samples, y);
+    for (int x = 0; x < width; x++) {
+      writeRgb(colorTable.toARGB(samples.data() + x * spp), out);
+      out += 3;
+    }
+  }
+  source->done();
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////
+// SliExportSource
+
+bool SliExportSource::addLayer(const std::string &imagePath,
+                               const std::string &filename, int xOffset,
+                               int yOffset) {
+  auto extension = boost::filesystem::path(filename).extension().string();
+  boost::to_lower(extension);
+
+  Layer layer;
+  layer.layer = SliLayer::create(imagePath, filename, xOffset, yOffset);
+
+  if (extension == ".sep") {
+    SepSource::Ptr source = SepSource::create();
+    source->fillSliLayerMeta(layer.layer);
+    source->done();
+    layer.sep = source->sep_file;
+    layer.isSep = true;
+  } else if (extension == ".tif" || extension == ".tiff") {
+    if (!layer.layer->fillMetaFromTiff(8, 4)) {
+      return false;
+    }
+  } else {
+    printf("Error: File extension of %s is not supported\n",
+           filename.c_str());
+    return false;
+  }
+
+  width = std::max(width, xOffset + layer.layer->width);
+  height = std::max(height, yOffset + layer.layer->height);
+  layers.push_back(std::move(layer));
+  return true;
+}
+
+ExportSource::Ptr SliExportSource::open(const std::string &path) {
+  boost::shared_ptr<SliExportSource> result(new SliExportSource());
+
+  // The resolution and the varnish don't change the composite
+  SliFile sli = SliParser::parseFile(path);
+  if (!sli.errors.empty()) {
+    for (const auto &error : sli.errors) {
+      printf("Error: %s\n", error.c_str());
+    }
+    return nullptr;
+  }
+
+  for (const auto &layer : sli.layers) {
+    if (!result->addLayer(layer.filepath, layer.name, layer.xoffset,
+                          layer.yoffset)) {
+      return nullptr;
+    }
+  }
+
+  if (result->layers.empty()) {
+    printf("Error: %s does not contain any layers\n", path.c_str());
+    return nullptr;
+  }
+
+  return result;
+}
+
+int SliExportSource::getWidth() { return width; }
+
+int SliExportSource::getHeight() { return height; }
+
+bool SliExportSource::readRgbRows(int top, int count, uint8_t *out) {
+  // The handles of the layers that overlap the band
+  std::vector<SepSource::Ptr> seps(layers.size());
+  std::vector<TiffPool::Handle> files(layers.size());
+  std::vector<std::vector<byte>> rows(layers.size());
+  bool result = true;
+  for (size_t i = 0; i < layers.size() && result; i++) {
+    SliLayer::Ptr &meta = layers[i].layer;
+    if (top + count <= meta->yoffset || top >= meta->yoffset + meta->height) {
+      continue;
+    }
+    if (layers[i].isSep) {
+      seps[i] = openBand(layers[i].sep);
+    } else {
+      files[i] = TiffPool::getInstance().acquire(meta->filepath);
+      result = files[i] != nullptr;
+    }
+    rows[i].resize(static_cast<size_t>(meta->width) * meta->spp);
+  }
+
+  std::vector<uint8_t> cmyk(4 * static_cast<size_t>(width));
+  for (int y = top; y < top + count && result; y++) {
+    std::fill(cmyk.begin(), cmyk.end(), 0);
+
+    for (size_t i = 0; i < layers.size() && result; i++) {
+      SliLayer::Ptr &meta = layers[i].layer;
+      const int layerY = y - meta->yoffset;
+      if (layerY < 0 || layerY >= meta->height) {
+        continue;
+      }
+
+      if (seps[i]) {
+        result = seps[i]->readCombinedScanline(rows[i], layerY);
+      } else {
+        result = TIFFReadScanline(files[i].get(), rows[i].data(), layerY) == 1;
+      }
+
+      // Add the layer on top of the composite, clipping after every layer,
+      // as SliSource::drawCmyk() does
+      uint8_t *surfacePointer = cmyk.data() + 4 * meta->xoffset;
+      const byte *bitmap = rows[i].data();
+      for (int x = 0; x < meta->width; x++) {
+        int16_t C = surfacePointer[0];
+        int16_t M = surfacePointer[1];
+        int16_t Y = surfacePointer[2];
+        int16_t K = surfacePointer[3];
+        for (unsigned int j = 0; j < meta->spp; j++) {
+          meta->colorTable.calculateCMYK(j, C, M, Y, K, bitmap[j]);
+        }
+        surfacePointer[0] = CustomColorHelpers::toUint8(C);
+        surfacePointer[1] = CustomColorHelpers::toUint8(M);
+        surfacePointer[2] = CustomColorHelpers::toUint8(Y);
+        surfacePointer[3] = CustomColorHelpers::toUint8(K);
+
+        surfacePointer += 4;
+        bitmap += meta->spp;
+      }
+    }
+
+    for (int x = 0; x < width; x++) {
+      writeRgb(CustomColorHelpers::cmykToARGB(cmyk[4 * x], cmyk[4 * x + 1],
+                                              cmyk[4 * x + 2],
+                                              cmyk[4 * x + 3]),
+               out);
+      out += 3;
+    }
+  }
+
+  for (auto &sep : seps) {
+    if (sep) {
+      sep->done();
+    }
+  }
+  return result;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <tiffio.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include "../colorconfig/CustomColor.hh"
+#include "../colorconfig/CustomColorTable.hh"
+#include "../sepsource.hh"
+#include "../sli/slilayer.hh"
+
+/**
+ * Produces the composite of a SEP or SLI file as RGB rows, without any GTK
+ * or cairo presentation. The colors are computed the same way the
+ * presentations draw them.
+ *
+ * An ExportSource only holds the layout of the file. Every call of
+ * readRgbRows() leases the handles it reads through from TiffPool, so one
+ * source can read different bands on different threads at the same time,
+ * and the handles of a finished band are reused by the next one.
+ */
+class ExportSource {
+public:
+  typedef boost::shared_ptr<ExportSource> Ptr;
+
+  virtual ~ExportSource() = default;
+
+  /** Width of the composite (in pixels) */
+  virtual int getWidth() = 0;
+
+  /** Height of the composite (in pixels) */
+  virtual int getHeight() = 0;
+
+  /**
+   * Writes the @param count rows of the composite starting at row @param top
+   * into @param out, as 3 bytes (R, G and B) per pixel.
+   * @return false if one of the files could not be read
+   */
+  virtual bool readRgbRows(int top, int count, uint8_t *out) = 0;
+
+  /** Same as readRgbRows(), for the single row @param y */
+  bool readRgbRow(int y, uint8_t *out) { return readRgbRows(y, 1, out); }
+
+  /**
+   * Opens a SEP or SLI file, depending on its extension.
+   * @return the source, or nullptr if the file could not be opened
+   */
+  static Ptr open(const std::string &path);
+};
+
+/** Composite of a SEP file, as drawn by SepPresentation */
+class SepExportSource : public ExportSource {
+public: // For testing
+  /** The SEP file, without its varnish */
+  SepFile file;
+
+  /** The color of every channel */
+  std::vector<CustomColor::Ptr> colors;
+
+  /** The multipliers of `colors` */
+  CustomColorTable colorTable;
+
+public:
+  static Ptr open(const std::string &path);
+
+  int getWidth() override;
+  int getHeight() override;
+  bool readRgbRows(int top, int count, uint8_t *out) override;
+};
+
+/** Composite of all layers of an SLI file, as drawn by SliPresentation */
+class SliExportSource : public ExportSource {
+public: // For testing
+  /** A layer, together with what its rows are read from */
+  struct Layer {
+    SliLayer::Ptr layer;
+
+    /** The channel files of SEP layers */
+    SepFile sep;
+
+    /** Whether the layer is a SEP file, rather than a TIFF file */
+    bool isSep = false;
+  };
+
+  std::vector<Layer> layers;
+
+  int width = 0;
+  int height = 0;
+
+  /** Adds the layer in @param imagePath at the given offsets */
+  bool addLayer(const std::string &imagePath, const std::string &filename,
+                int xOffset, int yOffset);
+
+public:
+  static Ptr open(const std::string &path);
+
+  int getWidth() override;
+  int getHeight() override;
+  bool readRgbRows(int top, int count, uint8_t *out) override;
+};
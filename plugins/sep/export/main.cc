@@ -0,0 +1,27 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "../colorconfig/CustomColorConfig.hh"
+#include "exporter.hh"
+
+/**
+ * Headless export of SEP and SLI files to tiled, multi-resolution RGB TIFF
+ * files, for pre-rendering jobs on machines without a display.
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 3 || argc > 5) {
+    printf("Usage: %s <input.sep|input.sli> <output.tif> [tile size] "
+           "[threads]\n",
+           argv[0]);
+    return 2;
+  }
+
+  const int tileSize = argc > 3 ? std::atoi(argv[3]) : 256;
+  const int threads = argc > 4 ? std::atoi(argv[4]) : 0;
+
+  // Uses colours.json from the working directory, like Scroom does
+  ColorConfig::getInstance().loadFile();
+
+  return exportPyramidTiff(argv[1], argv[2], tileSize, threads) ? 0 : 1;
+}
@@ -0,0 +1,227 @@
+#include "pyramidtiffwriter.hh"
+
+#include <algorithm>
+#include <cstring>
+
+PyramidTiffWriter::Level::Level(TIFF *tif_, int width_, int height_,
+                                int tileSize_, int spp_, FILE *next_)
+    : tif(tif_), width(width_), height(height_), tileSize(tileSize_),
+      spp(spp_), next(next_), previous(static_cast<size_t>(width_) * spp_),
+      reducedRow(static_cast<size_t>((width_ + 1) / 2) * spp_) {
+  if (tif != nullptr) {
+    tileRows.resize(static_cast<size_t>(tileSize) * width * spp);
+    tile.resize(static_cast<size_t>(tileSize) * tileSize * spp);
+  }
+}
+
+bool PyramidTiffWriter::Level::addRow(const uint8_t *row) {
+  const size_t rowLength = static_cast<size_t>(width) * spp;
+  if (tif != nullptr) {
+    memcpy(tileRows.data() + (rows % tileSize) * rowLength, row, rowLength);
+  }
+
+  if (next != nullptr) {
+    if (rows % 2 == 1) {
+      if (!reduce(previous.data(), row)) {
+        return false;
+      }
+    } else if (rows == height - 1) {
+      // An odd number of rows: the last row is averaged with itself
+      if (!reduce(row, row)) {
+        return false;
+      }
+    } else {
+      memcpy(previous.data(), row, rowLength);
+    }
+  }
+
+  rows++;
+  if (tif != nullptr && (rows % tileSize == 0 || rows == height)) {
+    return writeTileRow();
+  }
+  return true;
+}
+
+bool PyramidTiffWriter::Level::writeTileRow() {
+  const int top = (rows - 1) / tileSize * tileSize;
+  const int rowCount = rows - top;
+  const size_t rowLength = static_cast<size_t>(width) * spp;
+  const size_t tileRowLength = static_cast<size_t>(tileSize) * spp;
+
+  for (int left = 0; left < width; left += tileSize) {
+    // Tiles on the edges are padded with white
+    std::fill(tile.begin(), tile.end(), 255);
+    const size_t length = std::min(tileSize, width - left) * spp;
+    for (int y = 0; y < rowCount; y++) {
+      memcpy(tile.data() + y * tileRowLength,
+             tileRows.data() + y * rowLength + left * spp, length);
+    }
+
+    if (TIFFWriteTile(tif, tile.data(), left, top, 0, 0) < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PyramidTiffWriter::Level::reduce(const uint8_t *first,
+                                      const uint8_t *second) {
+  const int reducedWidth = (width + 1) / 2;
+
+  for (int x = 0; x < reducedWidth; x++) {
+    // An odd number of columns: the last column is averaged with itself
+    const int left = 2 * x * spp;
+    const int right = std::min(2 * x + 1, width - 1) * spp;
+    for (int c = 0; c < spp; c++) {
+      reducedRow[x * spp + c] = (first[left + c] + first[right + c] +
+                                 second[left + c] + second[right + c] + 2) /
+                                4;
+    }
+  }
+
+  return fwrite(reducedRow.data(), 1, reducedRow.size(), next) ==
+         reducedRow.size();
+}
+
+PyramidTiffWriter::PyramidTiffWriter(TIFF *tif_, int width_, int height_,
+                                     int tileSize_, int spp_,
+                                     uint16_t photometric_,
+                                     bool fullResolution_)
+    : tif(tif_), width(width_), height(height_), tileSize(tileSize_),
+      spp(spp_), photometric(photometric_), fullResolution(fullResolution_) {
+  if (needsReduction(width, height)) {
+    reduced = tmpfile();
+    if (reduced == nullptr) {
+      printf("WARNING: No temporary file available, so the reduced levels "
+             "will not be written\n");
+    }
+  }
+  if (fullResolution) {
+    setupDirectory(width, height, false);
+  }
+  level.reset(new Level(fullResolution ? tif : nullptr, width, height,
+                        tileSize, spp, reduced));
+}
+
+PyramidTiffWriter::~PyramidTiffWriter() {
+  if (reduced != nullptr) {
+    fclose(reduced);
+  }
+  if (tif != nullptr) {
+    TIFFClose(tif);
+  }
+}
+
+PyramidTiffWriter::Ptr
+PyramidTiffWriter::create(const std::string &path, int width, int height,
+                          int tileSize, int spp, uint16_t photometric,
+                          bool fullResolution) {
+  if (width <= 0 || height <= 0 || tileSize <= 0 || tileSize % 16 != 0 ||
+      spp <= 0) {
+    printf("Error: Invalid dimensions for %s\n", path.c_str());
+    return nullptr;
+  }
+  if (!fullResolution && width <= tileSize && height <= tileSize) {
+    // There are no reduced levels
+    return nullptr;
+  }
+
+  // Classic TIFF files are limited to 4GB, so switch to BigTIFF well before
+  // the (uncompressed) pyramid could reach that. The reduced levels together
+  // are a third of the full resolution image.
+  const double levels = fullResolution ? 4.0 / 3 : 1.0 / 3;
+  const double estimatedSize = levels * width * height * spp;
+  const char *mode = estimatedSize > 2e9 ? "w8" : "w";
+  TIFF *tif = TIFFOpen(path.c_str(), mode);
+  if (tif == nullptr) {
+    printf("Error: Failed to create file %s\n", path.c_str());
+    return nullptr;
+  }
+
+  return Ptr(new PyramidTiffWriter(tif, width, height, tileSize, spp,
+                                   photometric, fullResolution));
+}
+
+bool PyramidTiffWriter::needsReduction(int levelWidth, int levelHeight) {
+  return levelWidth > tileSize || levelHeight > tileSize;
+}
+
+void PyramidTiffWriter::setupDirectory(int levelWidth, int levelHeight,
+                                       bool isReduced) {
+  TIFFSetField(tif, TIFFTAG_SUBFILETYPE, isReduced ? FILETYPE_REDUCEDIMAGE : 0);
+  TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, levelWidth);
+  TIFFSetField(tif, TIFFTAG_IMAGELENGTH, levelHeight);
+  TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
+  TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, spp);
+  TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, photometric);
+  const int colorSamples = photometric == PHOTOMETRIC_RGB ? 3 : 1;
+  if (spp > colorSamples) {
+    std::vector<uint16_t> extraSamples(spp - colorSamples,
+                                       EXTRASAMPLE_UNSPECIFIED);
+    TIFFSetField(tif, TIFFTAG_EXTRASAMPLES,
+                 static_cast<uint16_t>(extraSamples.size()),
+                 extraSamples.data());
+  }
+  TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
+  TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
+  TIFFSetField(tif, TIFFTAG_TILEWIDTH, tileSize);
+  TIFFSetField(tif, TIFFTAG_TILELENGTH, tileSize);
+}
+
+bool PyramidTiffWriter::writeRows(const uint8_t *rows, int count) {
+  const size_t rowLength = static_cast<size_t>(width) * spp;
+  for (int y = 0; y < count; y++) {
+    if (!level->addRow(rows + y * rowLength)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PyramidTiffWriter::finish() {
+  if (level->rows != height ||
+      (fullResolution && !TIFFWriteDirectory(tif))) {
+    return false;
+  }
+
+  int levelWidth = width;
+  int levelHeight = height;
+  FILE *source = reduced;
+  reduced = nullptr;
+  if (!fullResolution && source == nullptr) {
+    // Nothing has been written at all
+    return false;
+  }
+
+  while (source != nullptr) {
+    levelWidth = (levelWidth + 1) / 2;
+    levelHeight = (levelHeight + 1) / 2;
+    FILE *next = needsReduction(levelWidth, levelHeight) ? tmpfile() : nullptr;
+
+    setupDirectory(levelWidth, levelHeight, true);
+    Level reducedLevel(tif, levelWidth, levelHeight, tileSize, spp, next);
+
+    // Stream the level from its temporary file
+    rewind(source);
+    std::vector<uint8_t> row(static_cast<size_t>(levelWidth) * spp);
+    bool success = true;
+    for (int y = 0; y < levelHeight && success; y++) {
+      success = fread(row.data(), 1, row.size(), source) == row.size() &&
+                reducedLevel.addRow(row.data());
+    }
+    fclose(source);
+    source = next;
+
+    if (!success || !TIFFWriteDirectory(tif)) {
+      if (source != nullptr) {
+        fclose(source);
+      }
+      return false;
+    }
+  }
+
+  TIFFClose(tif);
+  tif = nullptr;
+  return true;
+}
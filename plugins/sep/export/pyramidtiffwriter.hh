@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <tiffio.h>
+
+#include <boost/shared_ptr.hpp>
+
+/**
+ * Writes an image, row by row, into a tiled TIFF file with a pyramid of
+ * reduced resolution images. Every level is half the size of the previous
+ * one, until a level fits in a single tile. The image is RGB by default, but
+ * any number of 8 bit samples per pixel can be written.
+ *
+ * Only a single row of tiles per level is kept in memory. The reduced levels
+ * are stored in temporary files while the full resolution image is written,
+ * as a TIFF file can only be written one directory at a time.
+ */
+class PyramidTiffWriter {
+public:
+  typedef boost::shared_ptr<PyramidTiffWriter> Ptr;
+
+public: // For testing
+  /** Writes the tiles of a single level and produces the next level */
+  class Level {
+  public:
+    /** The file to write the tiles to, or nullptr to only reduce the level */
+    TIFF *tif;
+    int width;
+    int height;
+    int tileSize;
+
+    /** Number of samples per pixel */
+    int spp;
+
+    /** Number of rows received so far */
+    int rows = 0;
+
+    /** The rows of the current row of tiles, spp bytes per pixel */
+    std::vector<uint8_t> tileRows;
+
+    /** Buffer for a single tile */
+    std::vector<uint8_t> tile;
+
+    /** Receives the rows of the next level, or nullptr for the last level */
+    FILE *next;
+
+    /** The previous row, to be averaged with the current one */
+    std::vector<uint8_t> previous;
+
+    /** Buffer for a row of the next level */
+    std::vector<uint8_t> reducedRow;
+
+    Level(TIFF *tif, int width, int height, int tileSize, int spp,
+          FILE *next);
+
+    /** Adds the next row of the level */
+    bool addRow(const uint8_t *row);
+
+    /** Writes the buffered rows as a row of tiles */
+    bool writeTileRow();
+
+    /** Writes the average of two rows to the next level */
+    bool reduce(const uint8_t *first, const uint8_t *second);
+  };
+
+  TIFF *tif;
+  int width;
+  int height;
+  int tileSize;
+  int spp;
+  uint16_t photometric;
+
+  /** Whether the full resolution image is written, or only the reduced ones */
+  bool fullResolution;
+
+  /** The full resolution level */
+  std::unique_ptr<Level> level;
+
+  /** Receives the rows of the first reduced level */
+  FILE *reduced = nullptr;
+
+  /** Constructor */
+  PyramidTiffWriter(TIFF *tif, int width, int height, int tileSize, int spp,
+                    uint16_t photometric, bool fullResolution);
+
+  /** Sets the tags of a new directory */
+  void setupDirectory(int levelWidth, int levelHeight, bool isReduced);
+
+  /** Returns whether a level of the given size needs a reduced level */
+  bool needsReduction(int levelWidth, int levelHeight);
+
+public:
+  /** Destructor */
+  ~PyramidTiffWriter();
+
+  /**
+   * Creates @param path, for an image of @param width by @param height
+   * pixels, with tiles of @param tileSize pixels (a multiple of 16).
+   * Every pixel has @param spp samples. Any samples after the ones that
+   * @param photometric defines are stored as unspecified extra samples. If
+   * @param fullResolution is false, the file only holds the reduced images.
+   * @return the writer, or nullptr if the file could not be created or
+   * would not hold any image
+   */
+  static Ptr create(const std::string &path, int width, int height,
+                    int tileSize = 256, int spp = 3,
+                    uint16_t photometric = PHOTOMETRIC_RGB,
+                    bool fullResolution = true);
+
+  /** Writes @param count rows of spp * width bytes each */
+  bool writeRows(const uint8_t *rows, int count);
+
+  /**
+   * Writes the reduced levels and closes the file. Must be called after all
+   * rows have been written.
+   */
+  bool finish();
+};
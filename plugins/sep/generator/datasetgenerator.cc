@@ -0,0 +1,259 @@
+#include "datasetgenerator.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <fmt/format.h>
+
+namespace fs = boost::filesystem;
+
+namespace {
+/**
+ * Fills @param row with the samples of line @param y of an image reduced by
+ * @param factor, which takes every factor-th sample of the full image.
+ */
+void fillRow(uint8_t *row, size_t width, size_t y, int spp, int firstChannel,
+             size_t factor) {
+  for (size_t x = 0; x < width; x++) {
+    for (int c = 0; c < spp; c++) {
+      *row++ =
+          DatasetGenerator::sample(x * factor, y * factor, firstChannel + c);
+    }
+  }
+}
+
+bool writeStrips(TIFF *tif, size_t width, size_t height, int spp,
+                 int firstChannel, size_t factor) {
+  std::vector<uint8_t> row(width * spp);
+  for (size_t y = 0; y < height; y++) {
+    fillRow(row.data(), width, y, spp, firstChannel, factor);
+    if (TIFFWriteScanline(tif, row.data(), static_cast<uint32_t>(y)) < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool writeTiles(TIFF *tif, size_t width, size_t height, int spp,
+                int firstChannel, size_t tileSize, size_t factor) {
+  const size_t rowLength = width * spp;
+  const size_t tileRowLength = tileSize * spp;
+  std::vector<uint8_t> rows(tileSize * rowLength);
+  std::vector<uint8_t> tile(tileSize * tileRowLength);
+
+  for (size_t top = 0; top < height; top += tileSize) {
+    const size_t rowCount = std::min(tileSize, height - top);
+    for (size_t y = 0; y < rowCount; y++) {
+      fillRow(rows.data() + y * rowLength, width, top + y, spp, firstChannel,
+              factor);
+    }
+
+    for (size_t left = 0; left < width; left += tileSize) {
+      // Tiles on the edges are padded with zeroes
+      const size_t copied = std::min(tileSize, width - left) * spp;
+      std::fill(tile.begin(), tile.end(), 0);
+      for (size_t y = 0; y < rowCount; y++) {
+        memcpy(tile.data() + y * tileRowLength,
+               rows.data() + y * rowLength + left * spp, copied);
+      }
+      if (TIFFWriteTile(tif, tile.data(), static_cast<uint32_t>(left),
+                        static_cast<uint32_t>(top), 0, 0) < 0) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+} // namespace
+
+CustomColor DatasetGenerator::channelColor(int channel) {
+  float multipliers[4] = {0, 0, 0, 0};
+  if (channel < 4) {
+    multipliers[channel] = 1;
+    return CustomColor(std::string(1, "cmyk"[channel]), multipliers[0],
+                       multipliers[1], multipliers[2], multipliers[3]);
+  }
+
+  multipliers[channel % 4] = 0.5f;
+  multipliers[(channel + 1) % 4] = 0.25f * (channel % 3);
+  return CustomColor(fmt::format("s{}", channel + 1), multipliers[0],
+                     multipliers[1], multipliers[2], multipliers[3]);
+}
+
+bool DatasetGenerator::parseCompression(const std::string &name,
+                                        uint16_t &compression) {
+  if (name == "none") {
+    compression = COMPRESSION_NONE;
+  } else if (name == "lzw") {
+    compression = COMPRESSION_LZW;
+  } else if (name == "deflate") {
+    compression = COMPRESSION_ADOBE_DEFLATE;
+  } else if (name == "packbits") {
+    compression = COMPRESSION_PACKBITS;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool DatasetGenerator::writeTiff(const std::string &path, size_t width,
+                                 size_t height, int spp, int firstChannel,
+                                 const DatasetOptions &options) {
+  if (width == 0 || height == 0 ||
+      width > std::numeric_limits<uint32_t>::max() ||
+      height > std::numeric_limits<uint32_t>::max() ||
+      (options.tiled && (options.tileSize == 0 || options.tileSize % 16)) ||
+      options.overviews < 0 || options.overviews > 16) {
+    printf("Error: Invalid dimensions for %s\n", path.c_str());
+    return false;
+  }
+
+  // Classic TIFF files are limited to 4GB, so switch to BigTIFF well before
+  // the uncompressed image could reach that
+  const double estimatedSize = static_cast<double>(width) * height * spp;
+  TIFF *tif = TIFFOpen(path.c_str(), estimatedSize > 2e9 ? "w8" : "w");
+  if (tif == nullptr) {
+    printf("Error: Failed to create file %s\n", path.c_str());
+    return false;
+  }
+
+  // The overviews are pages after the image, each half the size of the
+  // previous one
+  bool ok = true;
+  for (int level = 0; ok && level <= options.overviews; level++) {
+    const size_t factor = size_t(1) << level;
+    const size_t levelWidth = (width + factor - 1) / factor;
+    const size_t levelHeight = (height + factor - 1) / factor;
+    if (level > 0) {
+      if (!TIFFWriteDirectory(tif)) {
+        ok = false;
+        break;
+      }
+      TIFFSetField(tif, TIFFTAG_SUBFILETYPE, FILETYPE_REDUCEDIMAGE);
+    }
+
+    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, static_cast<uint32_t>(levelWidth));
+    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, static_cast<uint32_t>(levelHeight));
+    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
+    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, spp);
+    if (spp == 4) {
+      TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_SEPARATED);
+      TIFFSetField(tif, TIFFTAG_INKSET, INKSET_CMYK);
+    } else {
+      TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+    }
+    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, options.compression);
+    TIFFSetField(tif, TIFFTAG_XRESOLUTION, 300.0f / factor);
+    TIFFSetField(tif, TIFFTAG_YRESOLUTION, 300.0f / factor);
+    TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, RESUNIT_INCH);
+
+    if (options.tiled) {
+      TIFFSetField(tif, TIFFTAG_TILEWIDTH, options.tileSize);
+      TIFFSetField(tif, TIFFTAG_TILELENGTH, options.tileSize);
+      ok = writeTiles(tif, levelWidth, levelHeight, spp, firstChannel,
+                      options.tileSize, factor);
+    } else {
+      TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP,
+                   std::max(1u, options.rowsPerStrip));
+      ok = writeStrips(tif, levelWidth, levelHeight, spp, firstChannel, factor);
+    }
+  }
+  TIFFClose(tif);
+
+  if (!ok) {
+    printf("Error: Failed to write %s\n", path.c_str());
+  }
+  return ok;
+}
+
+bool DatasetGenerator::generate(const std::string &directory,
+                                const std::string &name,
+                                const DatasetOptions &options) {
+  if (options.channels < 1 || options.channels > MAX_CHANNELS ||
+      options.layers < 0) {
+    printf("Error: Invalid number of channels or layers\n");
+    return false;
+  }
+
+  boost::system::error_code ec;
+  fs::create_directories(directory, ec);
+  const fs::path dir(directory);
+
+  // The colors, so the SEP file does not depend on the user's colours.json
+  std::ofstream colours((dir / "colours.json").string());
+  colours << "{\n  \"colours\": [\n";
+  for (int c = 0; c < options.channels; c++) {
+    const CustomColor color = channelColor(c);
+    colours << fmt::format(
+        "    {{\"name\": \"{}\", \"cMultiplier\": {}, \"mMultiplier\": {}, "
+        "\"yMultiplier\": {}, \"kMultiplier\": {}}}{}\n",
+        color.name, color.cMultiplier, color.mMultiplier, color.yMultiplier,
+        color.kMultiplier, c + 1 < options.channels ? "," : "");
+  }
+  colours << "  ]\n}\n";
+  colours.close();
+
+  std::ofstream sep((dir / (name + ".sep")).string());
+  sep << options.width << "\n" << options.height << "\n";
+  for (int c = 0; c < options.channels; c++) {
+    const std::string channel = channelColor(c).name;
+    const std::string file = fmt::format("{}_{}.tif", name, channel);
+    if (!writeTiff((dir / file).string(), options.width, options.height, 1, c,
+                   options)) {
+      return false;
+    }
+    sep << channel << " : " << file << "\n";
+  }
+
+  const std::string varnish = name + "_v.tif";
+  if (options.varnish) {
+    if (!writeTiff((dir / varnish).string(), options.width, options.height, 1,
+                   MAX_CHANNELS, options)) {
+      return false;
+    }
+    sep << "V : " << varnish << "\n";
+  }
+  sep.close();
+  if (!colours || !sep) {
+    printf("Error: Failed to write the SEP file in %s\n", directory.c_str());
+    return false;
+  }
+
+  if (options.layers == 0) {
+    return true;
+  }
+
+  const std::string cmyk = name + "_cmyk.tif";
+  if (options.mixedLayers &&
+      !writeTiff((dir / cmyk).string(), options.width, options.height, 4, 0,
+                 options)) {
+    return false;
+  }
+
+  std::ofstream sli((dir / (name + ".sli")).string());
+  sli << "Xresolution: 300\nYresolution: 300\n";
+  if (options.varnish) {
+    sli << "varnish_file: " << varnish << "\n";
+  }
+  for (int i = 0; i < options.layers; i++) {
+    const int column =
+        options.layersPerRow > 0 ? i % options.layersPerRow : i;
+    const int row = options.layersPerRow > 0 ? i / options.layersPerRow : i;
+    const bool isCmyk = options.mixedLayers && i % 2 == 1;
+    sli << (isCmyk ? cmyk : name + ".sep") << " : "
+        << static_cast<int64_t>(column) * options.xOffset << " "
+        << static_cast<int64_t>(row) * options.yOffset << "\n";
+  }
+  sli.close();
+  if (!sli) {
+    printf("Error: Failed to write the SLI file in %s\n", directory.c_str());
+    return false;
+  }
+  return true;
+}
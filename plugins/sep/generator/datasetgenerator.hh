@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <tiffio.h>
+
+#include "../colorconfig/CustomColor.hh"
+
+/** Parameters of a synthetic dataset, see DatasetGenerator */
+struct DatasetOptions {
+  /** Dimensions of the SEP file, in pixels */
+  size_t width = 1024;
+  size_t height = 1024;
+
+  /** Number of channels of the SEP file, from 1 to 16 */
+  int channels = 4;
+
+  /** Whether the TIFF files are tiled, instead of divided into strips */
+  bool tiled = false;
+  uint32_t rowsPerStrip = 64;
+  /** Width and height of the tiles, a multiple of 16 */
+  uint32_t tileSize = 256;
+
+  /** One of the COMPRESSION_* constants of libtiff */
+  uint16_t compression = COMPRESSION_LZW;
+
+  /**
+   * Number of reduced-resolution pages after the image in every TIFF file,
+   * each half the size of the previous one, up to 16. See TiffOverviews.
+   */
+  int overviews = 0;
+
+  /** Whether the SEP and SLI files have a varnish file */
+  bool varnish = false;
+
+  /** Number of layers of the SLI file, or 0 to not write an SLI file */
+  int layers = 0;
+
+  /**
+   * Whether every other SLI layer is a CMYK TIFF file instead of the SEP file
+   */
+  bool mixedLayers = false;
+
+  /** Offsets between consecutive SLI layers */
+  int xOffset = 0;
+  int yOffset = 0;
+
+  /**
+   * Number of layers on a row of the SLI file. Layers continue on the next
+   * row after this many, so `xOffset` and `yOffset` lay them out in a grid.
+   * With 0, every layer is offset from the previous one in both directions.
+   */
+  int layersPerRow = 0;
+};
+
+/**
+ * Writes synthetic SEP and SLI files for scale testing, of any size. The
+ * files are written a row (or a row of tiles) at a time, so generating
+ * gigapixel images only needs memory for a single row.
+ *
+ * For a dataset called `name`, the directory will contain
+ * - `name.sep` and its channel files `name_<channel>.tif`
+ * - `name_v.tif` if there is varnish
+ * - `name.sli` and `name_cmyk.tif` if there are layers
+ * - `colours.json`, which defines the colors of all channels
+ *
+ * The samples are a deterministic function of their position, see sample(),
+ * so readers can be checked without keeping a copy of the image.
+ */
+class DatasetGenerator {
+public:
+  /** Maximum number of channels of a SEP file */
+  static const int MAX_CHANNELS = 16;
+
+  /** The sample of @param channel at (@param x, @param y) */
+  static uint8_t sample(size_t x, size_t y, int channel) {
+    const uint64_t hash = (x * 73856093u) ^ (y * 19349663u) ^
+                          (static_cast<uint64_t>(channel) * 83492791u);
+    // Smooth gradients with a bit of noise, so compression is realistic
+    return static_cast<uint8_t>((x >> 4) * (channel + 1) * 13 + (y >> 4) * 7 +
+                                ((hash >> 13) & 7));
+  }
+
+  /**
+   * The color of @param channel: c, m, y and k, followed by spot colors that
+   * are mixtures of them.
+   */
+  static CustomColor channelColor(int channel);
+
+  /**
+   * Converts a compression name (none, lzw, deflate or packbits) to the
+   * libtiff constant.
+   * @return false if the name is unknown
+   */
+  static bool parseCompression(const std::string &name, uint16_t &compression);
+
+  /**
+   * Writes an 8 bit TIFF file with @param spp samples per pixel, which are
+   * channels @param firstChannel and up.
+   * @return true on success
+   */
+  static bool writeTiff(const std::string &path, size_t width, size_t height,
+                        int spp, int firstChannel,
+                        const DatasetOptions &options);
+
+  /**
+   * Writes the dataset called @param name into @param directory, which is
+   * created if needed.
+   * @return true on success
+   */
+  static bool generate(const std::string &directory, const std::string &name,
+                       const DatasetOptions &options);
+};
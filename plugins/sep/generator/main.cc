@@ -0,0 +1,95 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "datasetgenerator.hh"
+
+namespace {
+void usage(const char *name) {
+  printf("Usage: %s [options] <directory> <name>\n"
+         "  --width=N           width of the SEP file (1024)\n"
+         "  --height=N          height of the SEP file (1024)\n"
+         "  --channels=N        number of channels, 1 to 16 (4)\n"
+         "  --layout=L          strips or tiles (strips)\n"
+         "  --rows-per-strip=N  rows in a strip (64)\n"
+         "  --tile-size=N       width and height of the tiles (256)\n"
+         "  --compression=C     none, lzw, deflate or packbits (lzw)\n"
+         "  --overviews=N       reduced-resolution pages per TIFF file (0)\n"
+         "  --varnish           add a varnish file\n"
+         "  --layers=N          write an SLI file with N layers (0)\n"
+         "  --mixed             alternate SEP and CMYK TIFF layers\n"
+         "  --x-offset=N        horizontal offset between layers (0)\n"
+         "  --y-offset=N        vertical offset between layers (0)\n"
+         "  --layers-per-row=N  lay the layers out in a grid (0)\n",
+         name);
+}
+
+bool parseOptions(int argc, char *argv[], DatasetOptions &options,
+                  std::string &directory, std::string &name) {
+  int positional = 0;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg.compare(0, 2, "--") != 0) {
+      (positional++ == 0 ? directory : name) = arg;
+      continue;
+    }
+
+    const size_t equals = arg.find('=');
+    const std::string key = arg.substr(2, equals - 2);
+    const std::string value =
+        equals == std::string::npos ? "" : arg.substr(equals + 1);
+    const long long number = std::atoll(value.c_str());
+
+    if (key == "width") {
+      options.width = number;
+    } else if (key == "height") {
+      options.height = number;
+    } else if (key == "channels") {
+      options.channels = number;
+    } else if (key == "layout" && (value == "strips" || value == "tiles")) {
+      options.tiled = value == "tiles";
+    } else if (key == "rows-per-strip") {
+      options.rowsPerStrip = number;
+    } else if (key == "tile-size") {
+      options.tileSize = number;
+    } else if (key == "compression") {
+      if (!DatasetGenerator::parseCompression(value, options.compression)) {
+        return false;
+      }
+    } else if (key == "overviews") {
+      options.overviews = number;
+    } else if (key == "varnish") {
+      options.varnish = true;
+    } else if (key == "layers") {
+      options.layers = number;
+    } else if (key == "mixed") {
+      options.mixedLayers = true;
+    } else if (key == "x-offset") {
+      options.xOffset = number;
+    } else if (key == "y-offset") {
+      options.yOffset = number;
+    } else if (key == "layers-per-row") {
+      options.layersPerRow = number;
+    } else {
+      return false;
+    }
+  }
+  return positional == 2 && options.width > 0 && options.height > 0;
+}
+} // namespace
+
+/**
+ * Writes synthetic SEP and SLI files of any size, for scale testing and
+ * benchmarking. See DatasetGenerator for the files that are written.
+ */
+int main(int argc, char *argv[]) {
+  DatasetOptions options;
+  std::string directory;
+  std::string name;
+  if (!parseOptions(argc, argv, options, directory, name)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  return DatasetGenerator::generate(directory, name, options) ? 0 : 1;
+}
@@ -0,0 +1,193 @@
+#include "inkcoverage.hh"
+
+#include <algorithm>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/thread.hpp>
+#include <fmt/format.h>
+
+#include "trace.hh"
+
+InkCoverage::InkCoverage(const SepFile &file) : sep_file(file) {
+  // The varnish is not ink
+  sep_file.varnish_file = "";
+
+  for (const auto &channel : sep_file.files) {
+    channels.push_back(channel.first);
+  }
+  histograms.resize(channels.size(), Histogram{});
+
+  // A couple of bands per core balances the load, while keeping the
+  // overhead of opening the files per band small
+  const int nBands = std::max(1u, 4 * boost::thread::hardware_concurrency());
+  bandHeight = std::max<int>(
+      1, (static_cast<int>(sep_file.height) + nBands - 1) / nBands);
+
+  // Bands that start halfway a strip would decode that strip twice, and a
+  // compressed strip can only be decoded from its start
+  const int stripHeight = getStripHeight();
+  bandHeight = (bandHeight + stripHeight - 1) / stripHeight * stripHeight;
+  bandsLeft = getBandCount();
+
+  threadQueue = ThreadPool::Queue::create();
+}
+
+InkCoverage::Ptr InkCoverage::create(const SepFile &file) {
+  return Ptr(new InkCoverage(file));
+}
+
+int InkCoverage::getStripHeight() {
+  SepSource::Ptr source = SepSource::create();
+  source->setData(sep_file);
+  source->openFiles();
+
+  // The channels are usually written alike, otherwise align to the largest
+  size_t result = 1;
+  for (const auto &channel : channels) {
+    tiff *file = source->channel_files[channel].get();
+    uint32_t rowsPerStrip = 0;
+    if (file != nullptr && !TIFFIsTiled(file) &&
+        TIFFGetFieldDefaulted(file, TIFFTAG_ROWSPERSTRIP, &rowsPerStrip) == 1) {
+      result =
+          std::max(result, std::min<size_t>(rowsPerStrip, sep_file.height));
+    }
+  }
+  source->done();
+  return static_cast<int>(result);
+}
+
+const char *const InkCoverage::STATUS_PROPERTY = "Ink coverage status";
+
+bool InkCoverage::isProperty(const std::string &name) {
+  // The status also starts with "Ink coverage "
+  return boost::starts_with(name, "Ink coverage ") ||
+         boost::starts_with(name, "Total area coverage ");
+}
+
+int InkCoverage::getBandCount() {
+  return (static_cast<int>(sep_file.height) + bandHeight - 1) / bandHeight;
+}
+
+void InkCoverage::start() {
+  WeakPtr weakThis = shared_from_this<InkCoverage>();
+  for (int band = 0; band < getBandCount(); band++) {
+    // Don't keep the job alive, so closing the presentation cancels it
+    CpuBound()->schedule(
+        [weakThis, band] {
+          InkCoverage::Ptr self = weakThis.lock();
+          if (self) {
+            self->processBand(band);
+          }
+        },
+        PRIO_LOW, threadQueue);
+  }
+}
+
+void InkCoverage::processBand(int band) {
+  Trace::Span job("job", "InkCoverage::processBand");
+  SepSource::Ptr source = SepSource::create();
+  source->setData(sep_file);
+  source->openFiles();
+
+  const size_t width = sep_file.width;
+  const size_t nChannels = channels.size();
+  const int top = band * bandHeight;
+  const int bottom =
+      std::min(top + bandHeight, static_cast<int>(sep_file.height));
+
+  std::vector<Histogram> bandHistograms(nChannels, Histogram{});
+  std::vector<std::vector<uint8_t>> lines(nChannels,
+                                          std::vector<uint8_t>(width));
+  std::vector<uint16_t> totals(width);
+  int bandMax = 0;
+
+  for (int y = top; y < bottom; y++) {
+    std::fill(totals.begin(), totals.end(), 0);
+
+    for (size_t c = 0; c < nChannels; c++) {
+      uint8_t *line = lines[c].data();
+      // Some channels may not have a file, which reads as no ink at all
+      if (SepSource::TIFFReadScanline_(
+              source->channel_files[channels[c]].get(), line, y) != 1) {
+        std::fill(lines[c].begin(), lines[c].end(), 0);
+      }
+
+      Histogram &histogram = bandHistograms[c];
+      for (size_t x = 0; x < width; x++) {
+        histogram[line[x]]++;
+        totals[x] += line[x];
+      }
+    }
+
+    bandMax = std::max<int>(bandMax,
+                            *std::max_element(totals.begin(), totals.end()));
+  }
+
+  source->done();
+
+  {
+    boost::mutex::scoped_lock lock(mtx);
+    for (size_t c = 0; c < nChannels; c++) {
+      for (size_t value = 0; value < 256; value++) {
+        histograms[c][value] += bandHistograms[c][value];
+      }
+    }
+    maxTotalCoverage = std::max(maxTotalCoverage, bandMax);
+  }
+
+  if (--bandsLeft == 0 && done) {
+    done();
+  }
+}
+
+bool InkCoverage::isDone() { return bandsLeft == 0; }
+
+std::string InkCoverage::getStatus() {
+  const int left = bandsLeft;
+  if (left == 0) {
+    return "done";
+  }
+  return fmt::format("{} of {} bands", getBandCount() - left, getBandCount());
+}
+
+InkCoverage::Histogram InkCoverage::getHistogram(const std::string &channel) {
+  boost::mutex::scoped_lock lock(mtx);
+  auto position = std::find(channels.begin(), channels.end(), channel);
+  if (position == channels.end()) {
+    return {};
+  }
+  return histograms[position - channels.begin()];
+}
+
+std::map<std::string, std::string> InkCoverage::getProperties() {
+  boost::mutex::scoped_lock lock(mtx);
+  std::map<std::string, std::string> result;
+
+  double totalMean = 0;
+  for (size_t c = 0; c < channels.size(); c++) {
+    uint64_t sum = 0;
+    uint64_t count = 0;
+    for (size_t value = 0; value < 256; value++) {
+      sum += value * histograms[c][value];
+      count += histograms[c][value];
+    }
+    const double mean = count == 0 ? 0 : static_cast<double>(sum) / count;
+    result["Ink coverage " + channels[c]] =
+        fmt::format("{:.2f}%", mean * 100 / 255);
+    std::string histogram;
+    for (size_t value = 0; value < 256; value++) {
+      if (value > 0) {
+        histogram += ' ';
+      }
+      histogram += std::to_string(histograms[c][value]);
+    }
+    result["Ink coverage histogram " + channels[c]] = histogram;
+    totalMean += mean;
+  }
+  result["Total area coverage mean"] =
+      fmt::format("{:.2f}%", totalMean * 100 / 255);
+  result["Total area coverage max"] =
+      fmt::format("{:.2f}%", maxTotalCoverage * 100.0 / 255);
+
+  return result;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <scroom/threadpool.hh>
+#include <scroom/utilities.hh>
+
+#include "sepsource.hh"
+
+/**
+ * Computes ink coverage statistics of a complete SEP file in the background:
+ * a histogram and the mean coverage of every channel, and the maximum total
+ * area coverage (the sum of all channels in a single pixel).
+ *
+ * The image is divided into bands of rows, which are processed in parallel.
+ * The bands consist of complete strips of the TIFF files. Every band opens
+ * its own handles to the TIFF files, as libtiff handles cannot be shared
+ * between threads.
+ */
+class InkCoverage : public virtual Scroom::Utils::Base {
+public:
+  typedef boost::shared_ptr<InkCoverage> Ptr;
+  typedef boost::weak_ptr<InkCoverage> WeakPtr;
+
+  /** Number of occurrences of every sample value */
+  typedef std::array<uint64_t, 256> Histogram;
+
+public: // For testing
+  /** The SEP file to compute the statistics of */
+  SepFile sep_file;
+
+  /** Names of the channels, in the order of the files of the SEP file */
+  std::vector<std::string> channels;
+
+  /** Number of rows in a band */
+  int bandHeight;
+
+  /** Number of bands that have not been processed yet */
+  std::atomic<int> bandsLeft;
+
+  /** Must be acquired before accessing the results below */
+  boost::mutex mtx;
+
+  /** Histogram of every channel */
+  std::vector<Histogram> histograms;
+
+  /** Maximum total area coverage found so far (0-255 per channel) */
+  int maxTotalCoverage = 0;
+
+  /** The thread queue into which the bands are enqueued */
+  ThreadPool::Queue::Ptr threadQueue;
+
+  /** Constructor */
+  InkCoverage(const SepFile &file);
+
+  /**
+   * Returns the number of rows in a strip of the channel files, or the
+   * largest one if they differ
+   */
+  int getStripHeight();
+
+  /** Computes the statistics of band @param band and merges them */
+  void processBand(int band);
+
+public:
+  /** Called from a worker thread when all bands have been processed */
+  boost::function<void()> done;
+
+  /**
+   * Creates a job for the given SEP file. The varnish is not part of the
+   * statistics.
+   */
+  static Ptr create(const SepFile &file);
+
+  /**
+   * The property that tells how far the statistics are, see getStatus().
+   * Asking a presentation for it starts computing them.
+   */
+  static const char *const STATUS_PROPERTY;
+
+  /**
+   * Returns whether @param name is one of the properties computed here, or
+   * STATUS_PROPERTY
+   */
+  static bool isProperty(const std::string &name);
+
+  /** Returns the number of bands the image is divided into */
+  int getBandCount();
+
+  /** Enqueues all bands on the CPU-bound thread pool */
+  void start();
+
+  /** Returns whether all bands have been processed */
+  bool isDone();
+
+  /**
+   * Returns "done" once all bands have been processed, and the number of
+   * bands processed so far otherwise, e.g. "3 of 16 bands"
+   */
+  std::string getStatus();
+
+  /** Returns the histogram of channel @param channel */
+  Histogram getHistogram(const std::string &channel);
+
+  /**
+   * Returns the statistics as presentation properties: the mean coverage of
+   * every channel and the mean and maximum total area coverage, in percent,
+   * and the histogram of every channel as `Ink coverage histogram <channel>`,
+   * which holds the number of pixels of each of the 256 values, separated by
+   * spaces.
+   */
+  std::map<std::string, std::string> getProperties();
+};
@@ -0,0 +1,174 @@
+#include "memorybudget.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+
+#include <fmt/format.h>
+#include <unistd.h>
+
+MemoryBudget::Account::Account(MemoryBudget &budget_, std::string subsystem_,
+                               boost::function<void()> shed_)
+    : subsystem(std::move(subsystem_)), budget(budget_),
+      shed(std::move(shed_)) {
+  touch();
+}
+
+void MemoryBudget::Account::set(size_t n) {
+  const size_t previous = bytes.exchange(n);
+  shedRequested = false;
+  if (n > previous) {
+    budget.enforce();
+  }
+}
+
+void MemoryBudget::Account::shedFailed() { shedRequested = false; }
+
+void MemoryBudget::Account::touch() { lastUsed = ++budget.clock; }
+
+void MemoryBudget::Account::setOwner(const std::string &owner_) {
+  boost::mutex::scoped_lock lock(budget.mutex);
+  owner = owner_;
+}
+
+MemoryBudget::MemoryBudget() {
+  const char *megabytes = getenv("SCROOM_SEP_MEMORY_BUDGET");
+  if (megabytes != nullptr && atoll(megabytes) > 0) {
+    budgetBytes = static_cast<size_t>(atoll(megabytes)) << 20;
+  } else {
+    budgetBytes = static_cast<size_t>(sysconf(_SC_PHYS_PAGES)) *
+                  static_cast<size_t>(sysconf(_SC_PAGESIZE)) / 2;
+  }
+}
+
+MemoryBudget &MemoryBudget::getInstance() {
+  static MemoryBudget INSTANCE;
+  return INSTANCE;
+}
+
+MemoryBudget::Account::Ptr
+MemoryBudget::createAccount(const std::string &subsystem,
+                            boost::function<void()> shed) {
+  Account::Ptr account(new Account(*this, subsystem, std::move(shed)));
+  boost::mutex::scoped_lock lock(mutex);
+  accounts.push_back(account);
+  return account;
+}
+
+void MemoryBudget::setBudget(size_t bytes) {
+  budgetBytes = bytes;
+  enforce();
+}
+
+std::vector<MemoryBudget::Account::Ptr> MemoryBudget::getAccounts() {
+  boost::mutex::scoped_lock lock(mutex);
+  std::vector<Account::Ptr> result;
+  std::vector<Account::WeakPtr> live;
+  for (const auto &weak : accounts) {
+    Account::Ptr account = weak.lock();
+    if (account) {
+      result.push_back(account);
+      live.push_back(weak);
+    }
+  }
+  accounts.swap(live);
+  return result;
+}
+
+size_t MemoryBudget::getTotal() {
+  size_t total = 0;
+  for (const auto &account : getAccounts()) {
+    total += account->bytes;
+  }
+  return total;
+}
+
+void MemoryBudget::enforce() {
+  std::vector<Account::Ptr> all = getAccounts();
+  size_t total = 0;
+  for (const auto &account : all) {
+    total += account->bytes;
+  }
+  if (total <= budgetBytes) {
+    return;
+  }
+
+  // Take a snapshot, as the accounts keep changing while sorting
+  struct Candidate {
+    Account::Ptr account;
+    uint64_t lastUsed;
+    size_t bytes;
+  };
+  std::vector<Candidate> candidates;
+  uint64_t newest = 0;
+  for (const auto &account : all) {
+    const size_t bytes = account->bytes;
+    if (account->shedRequested) {
+      // Memory that is already being shed no longer counts
+      total -= std::min(total, bytes);
+    } else if (account->shed && bytes > 0) {
+      candidates.push_back({account, account->lastUsed, bytes});
+      newest = std::max(newest, candidates.back().lastUsed);
+    }
+  }
+
+  // Least recently used first, and the largest first among those
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Candidate &a, const Candidate &b) {
+              if (a.lastUsed != b.lastUsed) {
+                return a.lastUsed < b.lastUsed;
+              }
+              return a.bytes > b.bytes;
+            });
+
+  // The most recently used cache is the one being viewed. Shedding it would
+  // only make it compute everything again, so it is kept even when it
+  // exceeds the budget by itself. The callbacks are called without holding
+  // the mutex, as they may report their new size right away.
+  for (const auto &candidate : candidates) {
+    if (total <= budgetBytes || candidate.lastUsed == newest) {
+      break;
+    }
+    if (!candidate.account->shedRequested.exchange(true)) {
+      total -= std::min(total, candidate.bytes);
+      candidate.account->shed();
+    }
+  }
+}
+
+std::string MemoryBudget::summary() {
+  std::vector<std::pair<size_t, std::string>> lines;
+  size_t total = 0;
+  for (const auto &account : getAccounts()) {
+    const size_t bytes = account->bytes;
+    total += bytes;
+    if (bytes > 0) {
+      boost::mutex::scoped_lock lock(mutex);
+      lines.emplace_back(bytes, fmt::format("{} {}: {:.1f} MiB\n",
+                                            account->owner, account->subsystem,
+                                            bytes / 1048576.0));
+    }
+  }
+  // Largest first
+  std::sort(lines.rbegin(), lines.rend());
+
+  std::string result = fmt::format("Total: {:.1f} of {:.1f} MiB\n",
+                                   total / 1048576.0, getBudget() / 1048576.0);
+  for (const auto &line : lines) {
+    result += line.second;
+  }
+  return result;
+}
+
+bool MemoryBudget::getProperty(const std::string &name, std::string &value) {
+  if (name == "memory") {
+    value = summary();
+  } else if (name == "memory.total") {
+    value = std::to_string(getTotal());
+  } else if (name == "memory.budget") {
+    value = std::to_string(getBudget());
+  } else {
+    return false;
+  }
+  return true;
+}
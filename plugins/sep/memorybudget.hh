@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/weak_ptr.hpp>
+
+/**
+ * Keeps track of the memory held by all open presentations of the plugin,
+ * and makes caches shed memory when the total exceeds a global budget, so
+ * opening one more large file degrades gracefully instead of running out of
+ * memory.
+ *
+ * Every subsystem that holds memory, such as the layers or the composited
+ * surfaces of an SLI file, reports its size through an Account. Accounts
+ * with a shed function can give up their memory on request. When the total
+ * exceeds the budget, the least recently viewed of them are asked to shed,
+ * the largest first among those viewed equally long ago.
+ *
+ * Not every account can shed. The decoded layers of an SLI file
+ * ("sli.layers") are usually the largest, but every composite is computed
+ * from them, so they are only counted. They make the caches of the other
+ * presentations shed sooner instead.
+ *
+ * The budget is SCROOM_SEP_MEMORY_BUDGET MiB, or half of the physical
+ * memory. The tiles that Scroom caches for SEP files and varnish are not
+ * accounted for, as Scroom manages those itself.
+ */
+class MemoryBudget {
+public:
+  /** The memory held by a single subsystem of a presentation */
+  class Account {
+  public:
+    typedef boost::shared_ptr<Account> Ptr;
+    typedef boost::weak_ptr<Account> WeakPtr;
+
+    /** The subsystem holding the memory, e.g. "sli.rgbCache" */
+    const std::string subsystem;
+
+  private:
+    MemoryBudget &budget;
+
+    /** The file of the presentation, only used for reporting */
+    std::string owner;
+
+    /** Releases memory, and reports the new size with set() */
+    boost::function<void()> shed;
+
+    std::atomic<size_t> bytes{0};
+    std::atomic<uint64_t> lastUsed{0};
+
+    /**
+     * Whether shed() has been called since the last call to set() or
+     * shedFailed()
+     */
+    std::atomic<bool> shedRequested{false};
+
+    Account(MemoryBudget &budget_, std::string subsystem_,
+            boost::function<void()> shed_);
+
+    friend class MemoryBudget;
+
+  public:
+    /**
+     * Reports that the subsystem now holds @param n bytes. Growing beyond
+     * the budget makes other accounts, or this one, shed memory.
+     */
+    void set(size_t n);
+
+    size_t getBytes() const { return bytes; }
+
+    /**
+     * Reports that the last shed() released nothing, e.g. because the memory
+     * was in use. The memory counts towards the total again, and may be
+     * asked for again.
+     */
+    void shedFailed();
+
+    /** Marks the memory as in use, e.g. because it is being drawn */
+    void touch();
+
+    void setOwner(const std::string &owner_);
+  };
+
+private:
+  boost::mutex mutex;
+  std::vector<Account::WeakPtr> accounts;
+  std::atomic<size_t> budgetBytes;
+  std::atomic<uint64_t> clock{0};
+
+  MemoryBudget();
+
+public: // For testing
+  /** Asks accounts to shed memory until the total is within the budget */
+  void enforce();
+
+  /** The live accounts, pruning the destroyed ones */
+  std::vector<Account::Ptr> getAccounts();
+
+public:
+  static MemoryBudget &getInstance();
+
+  /**
+   * Creates an account for @param subsystem. Without @param shed, its memory
+   * is counted, but never released on request.
+   */
+  Account::Ptr createAccount(const std::string &subsystem,
+                             boost::function<void()> shed = {});
+
+  size_t getBudget() const { return budgetBytes; }
+  void setBudget(size_t bytes);
+
+  /** The memory held by all accounts together */
+  size_t getTotal();
+
+  /** Returns the total and the size of every account as text */
+  std::string summary();
+
+  /**
+   * Looks up the property @param name, which is `memory`, `memory.total` or
+   * `memory.budget` (in bytes).
+   * @return false if it is not a memory property
+   */
+  bool getProperty(const std::string &name, std::string &value);
+};
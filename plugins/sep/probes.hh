@@ -0,0 +1,30 @@
+#pragma once
+
+/**
+ * USDT probes in the hot paths, for profiling a production build with perf
+ * or bpftrace without rebuilding it. They are compiled in when the plugin is
+ * configured with ENABLE_USDT_PROBES, which needs sys/sdt.h (systemtap-sdt).
+ *
+ * A probe that is not attached is a single nop. The probes are named
+ * `<function>__entry` and `<function>__return` in the provider `spsep`, and
+ * their arguments are listed where they fire. See bench/probes.bt for an
+ * example.
+ */
+
+#ifdef SPSEP_USDT_PROBES
+#include <sys/sdt.h>
+
+#define SPSEP_PROBE(name) DTRACE_PROBE(spsep, name)
+#define SPSEP_PROBE1(name, a) DTRACE_PROBE1(spsep, name, a)
+#define SPSEP_PROBE2(name, a, b) DTRACE_PROBE2(spsep, name, a, b)
+#define SPSEP_PROBE3(name, a, b, c) DTRACE_PROBE3(spsep, name, a, b, c)
+#define SPSEP_PROBE4(name, a, b, c, d) DTRACE_PROBE4(spsep, name, a, b, c, d)
+#else
+#define SPSEP_PROBE(name)                                                      \
+  do {                                                                         \
+  } while (0)
+#define SPSEP_PROBE1(name, a) SPSEP_PROBE(name)
+#define SPSEP_PROBE2(name, a, b) SPSEP_PROBE(name)
+#define SPSEP_PROBE3(name, a, b, c) SPSEP_PROBE(name)
+#define SPSEP_PROBE4(name, a, b, c, d) SPSEP_PROBE(name)
+#endif
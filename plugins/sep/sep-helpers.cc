@@ -1,8 +1,24 @@
 #include "sep-helpers.hh"
 
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+namespace {
+/** The collector of the current thread, if any */
+thread_local CollectShownMessages *collector = nullptr;
+} // namespace
+
+CollectShownMessages::CollectShownMessages() { collector = this; }
+
+CollectShownMessages::~CollectShownMessages() { collector = nullptr; }
+
 int Show(std::string message, GtkMessageType type_gtk) {
 
   if (!Scroom::GtkHelpers::on_ui_thread()) {
+    if (collector) {
+      collector->messages.emplace_back(message, type_gtk);
+    }
     // Probably testing...
     return 0;
   }
@@ -21,6 +37,15 @@ int ShowWarning(std::string message) {
   return Show(message, GTK_MESSAGE_WARNING);
 }
 
+size_t checkedSize(size_t count, size_t size) {
+  size_t result;
+  if (__builtin_mul_overflow(count, size, &result)) {
+    throw std::length_error(
+        fmt::format("An image of {} x {} bytes is too large", count, size));
+  }
+  return result;
+}
+
 /**
  * Add two pipette color vectors values of the same key.
  */
@@ -42,7 +67,7 @@ sumPipetteColors(const PipetteLayerOperations::PipetteColor &lhs,
  */
 PipetteLayerOperations::PipetteColor
 dividePipetteColors(PipetteLayerOperations::PipetteColor elements,
-                    const int divisor) {
+                    const int64_t divisor) {
   for (auto &elem : elements) {
     elem.second /= divisor;
   }
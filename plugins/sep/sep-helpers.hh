@@ -1,14 +1,43 @@
 #pragma once
 
 #include <gtk/gtk.h>
+#include <cstddef>
+#include <cstdint>
 #include <scroom/layeroperations.hh>
 #include <string>
+#include <utility>
+#include <vector>
 
 int Show(std::string message, GtkMessageType type_gtk);
 int ShowWarning(std::string message);
+
+/**
+ * Show() can only show dialogs on the UI thread, and drops messages on other
+ * threads. While an instance of this class exists, messages passed to Show()
+ * on the thread that created it are collected instead, so they can be shown
+ * once the work is back on the UI thread.
+ */
+class CollectShownMessages {
+public:
+  std::vector<std::pair<std::string, GtkMessageType>> messages;
+
+  CollectShownMessages();
+  ~CollectShownMessages();
+
+  CollectShownMessages(const CollectShownMessages &) = delete;
+  CollectShownMessages &operator=(const CollectShownMessages &) = delete;
+};
+
+/**
+ * Returns @param count * @param size, the size of an allocation of @param
+ * count elements.
+ * @throw std::length_error if the product does not fit in a size_t
+ */
+size_t checkedSize(size_t count, size_t size);
+
 PipetteLayerOperations::PipetteColor
 sumPipetteColors(const PipetteLayerOperations::PipetteColor &lhs,
                  const PipetteLayerOperations::PipetteColor &rhs);
 PipetteLayerOperations::PipetteColor
 dividePipetteColors(PipetteLayerOperations::PipetteColor elements,
-                    const int divisor);
+                    const int64_t divisor);
@@ -3,20 +3,66 @@
 #include <scroom/cairo-helpers.hh>
 #include <scroom/layeroperations.hh>
 #include <scroom/tiledbitmaplayer.hh>
+#include <limits>
 #include <string>
 
 #include "colorconfig/CustomColorConfig.hh"
 #include "colorconfig/CustomColorOperations.hh"
+#include "memorybudget.hh"
 #include "sep-helpers.hh"
+#include "stats.hh"
+#include "trace.hh"
+
+namespace {
+/**
+ * Converts the combined channels of an overview of @param width by
+ * @param height pixels to RGB, the way OperationsCustomColors does.
+ * @return the surface, or nullptr if it can't be allocated
+ */
+SurfaceWrapper::Ptr toSurface(const std::vector<byte> &samples, uint32_t width,
+                              uint32_t height, const CustomColorTable &colors) {
+  const size_t spp = colors.size();
+  if (samples.size() != static_cast<size_t>(width) * height * spp) {
+    return nullptr;
+  }
+
+  SurfaceWrapper::Ptr surface;
+  try {
+    surface = SurfaceWrapper::create(static_cast<int>(width),
+                                     static_cast<int>(height),
+                                     CAIRO_FORMAT_ARGB32);
+  } catch (const std::exception &) {
+    return nullptr;
+  }
+
+  surface->flush();
+  const byte *pixel = samples.data();
+  for (uint32_t y = 0; y < height; y++) {
+    auto *row = reinterpret_cast<uint32_t *>(surface->getBitmap() +
+                                             y * surface->getStride());
+    for (uint32_t x = 0; x < width; x++, pixel += spp) {
+      row[x] = colors.toARGB(pixel);
+    }
+  }
+  surface->markDirty();
+  return surface;
+}
+} // namespace
 
 /////////////////////////////////////////////////////////
 ///// SepPresentation ///////////////////////////////////
 
-SepPresentation::SepPresentation() : sep_source(SepSource::create()) {
+SepPresentation::SepPresentation()
+    : sep_source(SepSource::create()),
+      overviewMemory(
+          MemoryBudget::getInstance().createAccount("sep.overviews")) {
   properties[PIPETTE_PROPERTY_NAME] = ""; // add support for pipette
 }
 
-SepPresentation::~SepPresentation() {}
+SepPresentation::~SepPresentation() {
+  Stats::dumpIfEnabled();
+  Trace::writeIfEnabled();
+}
 
 SepPresentation::Ptr SepPresentation::create() {
   return Ptr(new SepPresentation());
@@ -37,12 +83,27 @@ bool SepPresentation::load(const std::string &fileName) {
 
   sep_source->setData(file_content);
   sep_source->setName(fileName);
+  overviewMemory->setOwner(fileName);
+
+  // The varnish is loaded in the background. Show it once it is available.
+  boost::weak_ptr<SepPresentation> weakThis =
+      shared_from_this<SepPresentation>();
+  sep_source->varnishLoaded = [weakThis] {
+    Scroom::GtkHelpers::async_on_ui_thread([weakThis] {
+      SepPresentation::Ptr self = weakThis.lock();
+      if (self) {
+        self->attachVarnish();
+      }
+    });
+  };
+
   sep_source->openFiles();
   sep_source->checkFiles();
 
   transform = sep_source->getTransform();
 
-  layer_operations = OperationsCustomColors::create(sep_source->getSpp());
+  layer_operations =
+      OperationsCustomColors::create(sep_source->getSpp(), sep_source->stats);
 
   // Set the colors relevant to this tiledbitmap
   std::vector<CustomColor::Ptr> bitmapColors = {};
@@ -51,16 +112,187 @@ bool SepPresentation::load(const std::string &fileName) {
         ColorConfig::getInstance().getColorByNameOrAlias(color));
   }
   layer_operations->setColors(bitmapColors);
+  colorTable = CustomColorTable(bitmapColors);
   tbi = createTiledBitmap(width, height, {layer_operations});
-  tbi->setSource(sep_source);
+
+  // Zoomed-out views are drawn from the overviews embedded in the files, so
+  // opening a large file at a low zoom level does not decode all of it
+  sep_source->findOverviews();
+  const uint32_t anyFactor = std::numeric_limits<uint32_t>::max();
+  if (sep_source->getOverviewFactor(anyFactor) == 0) {
+    loadFullResolution();
+  }
 
   return true;
 }
 
 TransformationData::Ptr SepPresentation::getTransform() { return transform; }
 
+void SepPresentation::startCoverage() {
+  // Nothing has been loaded if there is no tiled bitmap
+  if (coverage != nullptr || tbi == nullptr) {
+    return;
+  }
+
+  // Show the statistics as properties once they are done
+  boost::weak_ptr<SepPresentation> weakThis =
+      shared_from_this<SepPresentation>();
+  coverage = InkCoverage::create(sep_source->sep_file);
+  coverage->done = [weakThis] {
+    Scroom::GtkHelpers::async_on_ui_thread([weakThis] {
+      SepPresentation::Ptr self = weakThis.lock();
+      if (self) {
+        for (const auto &property : self->coverage->getProperties()) {
+          self->properties[property.first] = property.second;
+        }
+      }
+    });
+  };
+  coverage->start();
+}
+
+void SepPresentation::attachVarnish() {
+  Varnish::Ptr varnish = sep_source->getVarnish();
+  if (varnishAttached || varnish == nullptr || views.empty()) {
+    return;
+  }
+
+  varnish->setView(*views.begin());
+  varnish->triggerRedraw = boost::bind(&SepPresentation::triggerRedraw,
+                                       shared_from_this<SepPresentation>());
+  for (const ViewInterface::WeakPtr &view : views) {
+    varnish->open(view);
+  }
+  varnishAttached = true;
+
+  triggerRedraw();
+}
+
+void SepPresentation::loadFullResolution() {
+  // Only the first of the redraw and the pipette hands the source over
+  bool expected = false;
+  if (fullResolution.compare_exchange_strong(expected, true)) {
+    tbi->setSource(sep_source);
+  }
+}
+
+bool SepPresentation::drawOverview(
+    cairo_t *cr, Scroom::Utils::Rectangle<double> presentationArea,
+    int zoom) {
+  if (zoom >= 0 || overviewFailed) {
+    return false;
+  }
+
+  // Every pixel on the screen covers 2^-zoom pixels of the image, so any
+  // overview with a smaller factor has enough detail
+  const uint32_t factor =
+      sep_source->getOverviewFactor(1u << std::min(-zoom, 31));
+  if (factor == 0) {
+    return false;
+  }
+  if (!overviewSurfaces.count(factor)) {
+    loadOverview(factor);
+  }
+
+  // While it is being read, the finest overview that is available is drawn
+  uint32_t drawnFactor = factor;
+  SurfaceWrapper::Ptr surface = overviewSurfaces[factor];
+  for (auto other = overviewSurfaces.begin();
+       surface == nullptr && other != overviewSurfaces.end(); ++other) {
+    drawnFactor = other->first;
+    surface = other->second;
+  }
+  if (surface) {
+    drawReduced(cr, surface, drawnFactor, presentationArea,
+                pixelSizeFromZoom(zoom));
+  }
+  return true;
+}
+
+void SepPresentation::loadOverview(uint32_t factor) {
+  overviewSurfaces[factor] = nullptr;
+
+  boost::weak_ptr<SepPresentation> weakThis =
+      shared_from_this<SepPresentation>();
+  boost::weak_ptr<SepSource> weakSource = sep_source;
+  const CustomColorTable colors = colorTable;
+  CpuBound()->schedule(
+      [weakThis, weakSource, colors, factor] {
+        Trace::Span job("job", "SepPresentation::loadOverview");
+        SepSource::Ptr source = weakSource.lock();
+        if (!source) {
+          return;
+        }
+        uint32_t width = 0;
+        uint32_t height = 0;
+        const std::vector<byte> samples =
+            source->readOverview(factor, width, height);
+        SurfaceWrapper::Ptr surface = toSurface(samples, width, height, colors);
+        Scroom::GtkHelpers::async_on_ui_thread([weakThis, factor, surface] {
+          SepPresentation::Ptr self = weakThis.lock();
+          if (self) {
+            self->overviewLoaded(factor, surface);
+          }
+        });
+      },
+      PRIO_HIGHER, sep_source->threadQueue);
+}
+
+void SepPresentation::overviewLoaded(uint32_t factor,
+                                     SurfaceWrapper::Ptr surface) {
+  if (surface) {
+    overviewSurfaces[factor] = surface;
+    size_t bytes = 0;
+    for (const auto &overview : overviewSurfaces) {
+      if (overview.second) {
+        bytes += overview.second->getStride() * overview.second->getHeight();
+      }
+    }
+    overviewMemory->set(bytes);
+  } else {
+    // The full resolution is drawn from now on
+    printf("WARNING: The overviews of %s could not be read\n",
+           file_name.c_str());
+    overviewFailed = true;
+  }
+
+  for (const ViewInterface::WeakPtr &view : views) {
+    ViewInterface::Ptr v = view.lock();
+    if (v) {
+      v->invalidate();
+    }
+  }
+}
+
+static void exact_pipette_toggled(GtkToggleButton *button,
+                                  gpointer presentationP) {
+  static_cast<SepPresentation *>(presentationP)->exactPipette =
+      gtk_toggle_button_get_active(button);
+}
+
+void SepPresentation::registerPipetteUI(const ViewInterface::WeakPtr &view) {
+  require(Scroom::GtkHelpers::on_ui_thread());
+
+  pipetteBox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+  GtkWidget *exact = gtk_check_button_new_with_label("Exact averages");
+  gtk_widget_set_tooltip_text(
+      exact, "Estimate the edges of large selections instead of decoding "
+             "their tiles when unchecked");
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(exact), exactPipette);
+  g_signal_connect(static_cast<gpointer>(exact), "toggled",
+                   G_CALLBACK(exact_pipette_toggled), this);
+  gtk_box_pack_start(GTK_BOX(pipetteBox), exact, true, false, 0);
+  gtk_widget_show_all(pipetteBox);
+
+  pipetteView = view;
+  ViewInterface::Ptr v(view);
+  v->addSideWidget("Pipette", pipetteBox);
+}
+
 void SepPresentation::triggerRedraw() {
+  Trace::Span wait("ui-wait", "SepPresentation::triggerRedraw");
   Scroom::GtkHelpers::sync_on_ui_thread([&] {
+    Trace::Span span("ui", "SepPresentation::triggerRedraw");
     for (const ViewInterface::WeakPtr &view : views) {
       view.lock()->invalidate();
     }
@@ -77,18 +309,34 @@ Scroom::Utils::Rectangle<double> SepPresentation::getRect() {
 void SepPresentation::redraw(ViewInterface::Ptr const &vi, cairo_t *cr,
                              Scroom::Utils::Rectangle<double> presentationArea,
                              int zoom) {
+  Trace::Span span("ui", "SepPresentation::redraw");
+  sep_source->tileSumsMemory->touch();
   drawOutOfBoundsWithoutBackground(cr, presentationArea, getRect(),
                                    pixelSizeFromZoom(zoom));
-  if (tbi)
+  if (tbi && !drawOverview(cr, presentationArea, zoom)) {
+    loadFullResolution();
     tbi->redraw(vi, cr, presentationArea, zoom);
+  }
 
-  // Draw varnish if it exists
-  if (sep_source->varnish != nullptr) {
-    sep_source->varnish->drawOverlay(vi, cr, presentationArea, zoom);
+  // Draw varnish if it has been loaded
+  if (varnishAttached) {
+    sep_source->getVarnish()->drawOverlay(vi, cr, presentationArea, zoom);
   }
 }
 
 bool SepPresentation::getProperty(const std::string &name, std::string &value) {
+  if (sep_source->stats->getProperty(name, value) ||
+      MemoryBudget::getInstance().getProperty(name, value)) {
+    return true;
+  }
+  if (InkCoverage::isProperty(name)) {
+    startCoverage();
+  }
+  if (name == InkCoverage::STATUS_PROPERTY && coverage != nullptr) {
+    value = coverage->getStatus();
+    return true;
+  }
+
   std::map<std::string, std::string>::iterator p = properties.find(name);
   bool found = false;
   if (p == properties.end()) {
@@ -103,7 +351,14 @@ bool SepPresentation::getProperty(const std::string &name, std::string &value) {
 }
 
 bool SepPresentation::isPropertyDefined(const std::string &name) {
-  return properties.end() != properties.find(name);
+  if (InkCoverage::isProperty(name)) {
+    startCoverage();
+  }
+  std::string value;
+  return (name == InkCoverage::STATUS_PROPERTY && coverage != nullptr) ||
+         properties.end() != properties.find(name) ||
+         sep_source->stats->getProperty(name, value) ||
+         MemoryBudget::getInstance().getProperty(name, value);
 }
 
 std::string SepPresentation::getTitle() { return file_name; }
@@ -118,15 +373,17 @@ void SepPresentation::viewAdded(ViewInterface::WeakPtr interface) {
     return;
   }
 
-  if (views.empty() && sep_source->varnish != nullptr) {
-    sep_source->varnish->setView(interface);
-    sep_source->varnish->triggerRedraw = boost::bind(
-        &SepPresentation::triggerRedraw, shared_from_this<SepPresentation>());
-  }
-
   views.insert(interface);
+  if (pipetteBox == nullptr) {
+    registerPipetteUI(interface);
+  }
 
   tbi->open(interface);
+  if (varnishAttached) {
+    sep_source->getVarnish()->open(interface);
+  } else {
+    attachVarnish();
+  }
 }
 
 void SepPresentation::viewRemoved(ViewInterface::WeakPtr interface) {
@@ -138,12 +395,24 @@ void SepPresentation::viewRemoved(ViewInterface::WeakPtr interface) {
     return;
   }
 
-  if (!views.empty() && sep_source->varnish &&
-      interface.lock() == sep_source->varnish->viewWeak.lock()) {
-    sep_source->varnish->resetView(*views.begin());
+  Varnish::Ptr varnish = varnishAttached ? sep_source->getVarnish() : nullptr;
+  if (!views.empty() && varnish &&
+      interface.lock() == varnish->viewWeak.lock()) {
+    varnish->resetView(*views.begin());
+  }
+
+  // The settings disappear together with the sidebar of their view
+  if (pipetteBox != nullptr && interface.lock() == pipetteView.lock()) {
+    pipetteBox = nullptr;
+    if (!views.empty()) {
+      registerPipetteUI(*views.begin());
+    }
   }
 
   tbi->close(interface);
+  if (varnish != nullptr) {
+    varnish->close(interface);
+  }
 }
 
 std::set<ViewInterface::WeakPtr> SepPresentation::getViews() { return views; }
@@ -151,16 +420,73 @@ std::set<ViewInterface::WeakPtr> SepPresentation::getViews() { return views; }
 ////////////////////////////////////////////////////////////////////////
 // PipetteViewInterface
 
+PipetteLayerOperations::PipetteColor
+SepPresentation::sumTile(const Layer::Ptr &bottomLayer, int x, int y,
+                         const TileSums::Ptr &sums,
+                         Scroom::Utils::Rectangle<int> area) {
+  Scroom::Utils::Rectangle<int> tile_rectangle(0, 0, sums->width,
+                                               sums->height);
+  Scroom::Utils::Rectangle<int> inter_rect = tile_rectangle.intersection(area);
+
+  if (!exactPipette) {
+    return layer_operations->toPipetteColor(
+        sums->approximateSum(inter_rect));
+  }
+
+  // The cells that are completely covered come from the summed-area table
+  Scroom::Utils::Rectangle<int> inner = sums->alignInward(inter_rect);
+  PipetteLayerOperations::PipetteColor result =
+      layer_operations->toPipetteColor(sums->sum(inner));
+
+  // The strips around them need the pixels of the tile
+  std::vector<Scroom::Utils::Rectangle<int>> strips;
+  if (inner.getWidth() == 0) {
+    strips.push_back(inter_rect);
+  } else {
+    strips = {
+        {inter_rect.getLeft(), inter_rect.getTop(), inter_rect.getWidth(),
+         inner.getTop() - inter_rect.getTop()},
+        {inter_rect.getLeft(), inner.getBottom(), inter_rect.getWidth(),
+         inter_rect.getBottom() - inner.getBottom()},
+        {inter_rect.getLeft(), inner.getTop(),
+         inner.getLeft() - inter_rect.getLeft(), inner.getHeight()},
+        {inner.getRight(), inner.getTop(),
+         inter_rect.getRight() - inner.getRight(), inner.getHeight()}};
+  }
+
+  ConstTile::Ptr tile;
+  for (const auto &strip : strips) {
+    if (strip.getWidth() <= 0 || strip.getHeight() <= 0) {
+      continue;
+    }
+    if (!tile) {
+      tile = bottomLayer->getTile(x, y)->getConstTileSync();
+    }
+    result =
+        sumPipetteColors(result, layer_operations->sumPixelValues(strip, tile));
+  }
+
+  return result;
+}
+
 PipetteLayerOperations::PipetteColor SepPresentation::getPixelAverages(
     Scroom::Utils::Rectangle<double> requestedArea) {
   Scroom::Utils::Rectangle<double> presentationArea = getRect();
   auto area =
       roundOutward(requestedArea.intersection(presentationArea)).to<int>();
 
+  // The tiles that are loaded from now on are summed right away, so later
+  // selections don't need to decode them again
+  sep_source->buildTileSums = true;
+
+  // The pipette needs the tiles, even if only overviews have been drawn
+  loadFullResolution();
   Layer::Ptr bottomLayer = tbi->getBottomLayer();
   PipetteLayerOperations::PipetteColor pipetteColors;
 
-  int totalPixels = area.getWidth() * area.getHeight();
+  // Selections of gigapixel images easily hold more pixels than an int
+  const int64_t totalPixels =
+      static_cast<int64_t>(area.getWidth()) * area.getHeight();
   if (totalPixels == 0) {
     return {};
   }
@@ -175,16 +501,22 @@ PipetteLayerOperations::PipetteColor SepPresentation::getPixelAverages(
 
   for (int x = tile_pos_x_start; x <= tile_pos_x_end; x++) {
     for (int y = tile_pos_y_start; y <= tile_pos_y_end; y++) {
-      ConstTile::Ptr tile = bottomLayer->getTile(x, y)->getConstTileSync();
-      Scroom::Utils::Rectangle<int> tile_rectangle(0, 0, tile->width,
-                                                   tile->height);
       Scroom::Utils::Point<int> base(x * TILESIZE, y * TILESIZE);
 
-      Scroom::Utils::Rectangle<int> inter_rect =
-          tile_rectangle.intersection(area - base);
-
+      TileSums::Ptr sums = sep_source->getTileSums(x, y);
+      if (!sums) {
+        // Tiles that were loaded before the pipette was first used are
+        // summed once here
+        ConstTile::Ptr tile = bottomLayer->getTile(x, y)->getConstTileSync();
+        const int spp = static_cast<int>(sep_source->getSpp());
+        sums = TileSums::create(
+            tile->data.get(), tile->width * spp,
+            std::min(tile->width, static_cast<int>(width) - base.x),
+            std::min(tile->height, static_cast<int>(height) - base.y), spp);
+        sep_source->storeTileSums(x, y, sums);
+      }
       pipetteColors = sumPipetteColors(
-          pipetteColors, layer_operations->sumPixelValues(inter_rect, tile));
+          pipetteColors, sumTile(bottomLayer, x, y, sums, area - base));
     }
   }
 
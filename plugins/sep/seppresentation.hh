@@ -1,13 +1,18 @@
 #pragma once
 
+#include <atomic>
 #include <map>
 #include <string>
 
 #include <scroom/layeroperations.hh>
 #include <scroom/presentationinterface.hh>
+#include <scroom/tiledbitmaplayer.hh>
 
 #include "colorconfig/CustomColorOperations.hh"
+#include "colorconfig/CustomColorTable.hh"
+#include "inkcoverage.hh"
 #include "sepsource.hh"
+#include "sli/sli-helpers.hh"
 
 ////////////////////////////////////////////////////////////////
 ////////////// SepPresentation
@@ -35,6 +40,64 @@ public: // For testing
 
   PipetteCommonOperationsCustomColor::Ptr layer_operations;
 
+  /**
+   * Background job computing the ink coverage statistics. It decodes the
+   * whole file, so it is only started once one of its properties is asked
+   * for.
+   */
+  InkCoverage::Ptr coverage;
+
+  /**
+   * Whether sep_source has been handed to tbi, which then loads all tiles.
+   * Files with overviews are drawn from those while zoomed out, so their full
+   * resolution is only loaded once it is needed. Set on the UI thread by
+   * redraw(), and on a worker thread by the pipette.
+   */
+  std::atomic<bool> fullResolution{false};
+
+  /** The colors of the channels, for converting the overviews to RGB */
+  CustomColorTable colorTable;
+
+  /**
+   * The overviews read so far, by reduction factor. They are nullptr while
+   * they are being read. Only accessed on the UI thread.
+   */
+  std::map<uint32_t, SurfaceWrapper::Ptr> overviewSurfaces;
+
+  /** Whether an overview could not be read, so they are not used anymore */
+  bool overviewFailed = false;
+
+  /** The memory held by `overviewSurfaces` */
+  MemoryBudget::Account::Ptr overviewMemory;
+
+  /**
+   * Whether the varnish has been loaded and hooked up to the views. Only
+   * accessed on the UI thread.
+   */
+  bool varnishAttached = false;
+
+  /**
+   * Whether the pipette sums the exact pixel values. If not, the parts of the
+   * selection that do not cover complete cells of the summed-area tables are
+   * estimated, so no tiles need to be decoded at all. Set with the "Exact
+   * averages" button in the sidebar.
+   */
+  std::atomic<bool> exactPipette{true};
+
+  /** The sidebar widget with the pipette settings, see registerPipetteUI() */
+  GtkWidget *pipetteBox = nullptr;
+
+  /** The view whose sidebar holds `pipetteBox` */
+  ViewInterface::WeakPtr pipetteView;
+
+  /**
+   * Sums the pixel values of the part of `area` (relative to the tile) that
+   * lies within the bottom layer tile at (x, y), using its summed-area table.
+   */
+  PipetteLayerOperations::PipetteColor
+  sumTile(const Layer::Ptr &bottomLayer, int x, int y,
+          const TileSums::Ptr &sums, Scroom::Utils::Rectangle<int> area);
+
 private:
   /**
    * Constructor for a standalone SepPresentation to be passed to
@@ -61,9 +124,57 @@ public:
    */
   TransformationData::Ptr getTransform();
 
+  /**
+   * Starts computing the ink coverage statistics, which are added to the
+   * properties once they are done. Does nothing if that has been done
+   * already.
+   */
+  void startCoverage();
+
+  /**
+   * Hooks the varnish up to the views once it has been loaded in the
+   * background. Does nothing if there is no varnish (yet), or no views.
+   */
+  void attachVarnish();
+
+  /**
+   * Adds the pipette settings to the sidebar of @param view, as the sidebar
+   * of a single view is enough to change them.
+   */
+  void registerPipetteUI(const ViewInterface::WeakPtr &view);
+
   /** Causes the SepPresentation to redraw the current presentation */
   void triggerRedraw();
 
+  /**
+   * Hands sep_source to tbi, so the tiles are loaded. Does nothing if that
+   * has been done already. Can be called from any thread.
+   */
+  void loadFullResolution();
+
+  /**
+   * Draws @param presentationArea from the overview that best fits
+   * @param zoom, and starts reading it if that has not been done yet. Draws
+   * another overview while it is being read.
+   * @return false if there is no suitable overview, so the full resolution
+   * has to be drawn instead
+   */
+  bool drawOverview(cairo_t *cr,
+                    Scroom::Utils::Rectangle<double> presentationArea,
+                    int zoom);
+
+  /**
+   * Reads the overview with reduction @param factor and converts it to RGB
+   * in the background, and redraws once it is available.
+   */
+  void loadOverview(uint32_t factor);
+
+  /**
+   * Stores the overview with reduction @param factor once it has been read,
+   * or gives up on the overviews if @param surface is nullptr, and redraws.
+   */
+  void overviewLoaded(uint32_t factor, SurfaceWrapper::Ptr surface);
+
   ////////////////////////////////////////////////////////////////////////
   // PresentationInterface
   ////////////////////////////////////////////////////////////////////////
@@ -10,14 +10,60 @@
 #include <iostream>
 
 #include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <climits>
+#include <fcntl.h>
 #include <iterator>
+#include <limits>
 
+#include "diskcache.hh"
+#include "probes.hh"
 #include "sep-helpers.hh"
+#include "stats.hh"
+#include "trace.hh"
 
-SepSource::SepSource() {}
-SepSource::~SepSource() {}
+#include <scroom/gtk-helpers.hh>
 
-SepSource::Ptr SepSource::create() { return Ptr(new SepSource()); }
+namespace {
+/** The name of the reduced images in the disk cache */
+const std::string PYRAMID_ENTRY = "pyramid.tif";
+
+/** The tiles of the reduced images, small ones as only a row is buffered */
+const int PYRAMID_TILE_SIZE = 256;
+} // namespace
+
+SepSource::SepSource() { threadQueue = ThreadPool::Queue::create(); }
+SepSource::~SepSource() {
+  boost::mutex::scoped_lock lock(diskCacheMutex);
+  abandonPyramid();
+}
+
+SepSource::Ptr SepSource::create() {
+  Ptr result(new SepSource());
+  boost::weak_ptr<SepSource> weakResult = result;
+  result->tileSumsMemory =
+      MemoryBudget::getInstance().createAccount("sep.tileSums", [weakResult] {
+        Ptr self = weakResult.lock();
+        if (self) {
+          boost::mutex::scoped_lock lock(self->tileSumsMutex);
+          self->tileSums.clear();
+          self->tileSumsBytes = 0;
+          self->tileSumsMemory->set(0);
+        }
+      });
+  result->readAheadMemory =
+      MemoryBudget::getInstance().createAccount("sep.readAhead", [weakResult] {
+        Ptr self = weakResult.lock();
+        if (self) {
+          {
+            boost::mutex::scoped_lock lock(self->readAheadMutex);
+            self->readAheadBands.clear();
+          }
+          self->readAheadMemory->set(0);
+        }
+      });
+  return result;
+}
 
 boost::filesystem::path SepSource::findParentDir(const std::string &file_path) {
   return boost::filesystem::path(file_path).parent_path();
@@ -141,7 +187,7 @@ bool SepSource::getResolution(uint16_t &unit, float &x_resolution,
   // Use the values for the first channel as baseline, if there is a first
   // channel
   if (channels.size() > 0) {
-    getForOneChannel(channel_files[channels[0]], unit, x_resolution,
+    getForOneChannel(channel_files[channels[0]].get(), unit, x_resolution,
                      y_resolution);
   } else { // Otherwise use nullptr
     getForOneChannel(nullptr, unit, x_resolution, y_resolution);
@@ -149,7 +195,7 @@ bool SepSource::getResolution(uint16_t &unit, float &x_resolution,
 
   bool first = true;
   for (const auto &channelName : channels) {
-    auto channel = channel_files[channelName];
+    auto channel = channel_files[channelName].get();
     if (channel == nullptr) {
       continue;
     }
@@ -183,7 +229,9 @@ void SepSource::fillSliLayerMeta(SliLayer::Ptr sli) {
     return;
   }
 
-  const SepFile values = parseSep(sli->filepath);
+  SepFile values = parseSep(sli->filepath);
+  // SLI files have a varnish of their own, the one of a layer is not drawn
+  values.varnish_file = "";
 
   sli->height = values.height;
   sli->width = values.width;
@@ -200,19 +248,32 @@ void SepSource::fillSliLayerMeta(SliLayer::Ptr sli) {
     sli->channels.push_back(
         ColorConfig::getInstance().getColorByNameOrAlias(colorName));
   }
+  sli->colorTable = CustomColorTable(sli->channels);
 }
 
 void SepSource::fillSliLayerBitmap(SliLayer::Ptr sli) {
+  acquireFiles();
   uint16_t unit;
   getResolution(unit, sli->xAspect, sli->yAspect);
 
-  const int row_width =
-      sli->width *
-      nr_channels; // nr_channels bytes per pixel (8 bits per channel)
-  sli->bitmap.reset(new uint8_t[sli->height * row_width]);
+  // nr_channels bytes per pixel (8 bits per channel)
+  const size_t row_width = checkedSize(sli->width, nr_channels);
+  sli->bitmap.reset(new uint8_t[checkedSize(sli->height, row_width)]);
+
+  // Uncompressed channels are read directly, a band of lines at a time
+  const int band_lines = 256;
+  int y = 0;
+  {
+    boost::mutex::scoped_lock lock(channelFilesMutex);
+    while (y < sli->height &&
+           readStrips(&sli->bitmap[y * row_width], y,
+                      std::min(band_lines, sli->height - y))) {
+      y += band_lines;
+    }
+  }
 
   auto temp = std::vector<byte>(row_width);
-  for (int y = 0; y < sli->height; y++) {
+  for (; y < sli->height; y++) {
     readCombinedScanline(temp, y);
     memcpy(&sli->bitmap[y * row_width], temp.data(), row_width);
   }
@@ -229,6 +290,8 @@ void SepSource::setData(SepFile file) {
 
 void SepSource::setName(const std::string &file_name_) {
   file_name = file_name_;
+  tileSumsMemory->setOwner(file_name);
+  readAheadMemory->setOwner(file_name);
 }
 
 void SepSource::openFiles() {
@@ -245,24 +308,25 @@ void SepSource::openFiles() {
 
   // open color channels
   for (const auto &c : channels) {
-    channel_files[c] = TIFFOpen(sep_file.files[c].string().c_str(), "r");
+    channel_files[c] =
+        TiffPool::getInstance().acquire(sep_file.files[c].string());
 
     // Don't show a warning when the file path is empty. This means
     // that the file was not specified, and the customer requested
     // there not to be a warning in that case.
     show_warning |= !sep_file.files[c].empty() && channel_files[c] == nullptr;
+    if (channel_files[c]) {
+      posix_fadvise(TIFFFileno(channel_files[c].get()), 0, 0,
+                    POSIX_FADV_SEQUENTIAL);
+    }
   }
 
-  // open varnish channel
+  // open varnish channel in the background, so the image itself can be shown
+  // while the varnish is still loading
   if (sep_file.varnish_file.string() != "") {
-    SliLayer::Ptr varnishLayer =
-        SliLayer::create(sep_file.varnish_file.string(), "Varnish", 0, 0);
-    if (varnishLayer->fillMetaFromTiff(8, 1)) {
-      varnishLayer->fillBitmapFromTiff();
-      varnish = Varnish::create(varnishLayer);
-    } else {
-      show_warning = true;
-    }
+    CpuBound()->schedule(
+        boost::bind(&SepSource::loadVarnish, shared_from_this<SepSource>()),
+        PRIO_HIGHER, threadQueue);
   }
 
   if (show_warning) {
@@ -273,6 +337,35 @@ void SepSource::openFiles() {
   }
 }
 
+void SepSource::loadVarnish() {
+  Trace::Span job("job", "SepSource::loadVarnish");
+  SliLayer::Ptr varnishLayer =
+      SliLayer::create(sep_file.varnish_file.string(), "Varnish", 0, 0);
+  if (!varnishLayer->fillMetaFromTiff(8, 1)) {
+    printf("PANIC: The varnish file is not valid, or could not be opened!\n");
+    Scroom::GtkHelpers::async_on_ui_thread([] {
+      ShowWarning("PANIC: The varnish file is not valid, or could not be "
+                  "opened!");
+    });
+    return;
+  }
+
+  Varnish::Ptr loaded = Varnish::create(varnishLayer, stats);
+  {
+    boost::mutex::scoped_lock lock(varnishMutex);
+    varnish = loaded;
+  }
+
+  if (varnishLoaded) {
+    varnishLoaded();
+  }
+}
+
+Varnish::Ptr SepSource::getVarnish() {
+  boost::mutex::scoped_lock lock(varnishMutex);
+  return varnish;
+}
+
 void SepSource::checkFiles() {
   uint16_t spp, bps;
   std::string warning = "";
@@ -280,12 +373,14 @@ void SepSource::checkFiles() {
   // check CMYK
   for (const auto &c : channels) {
     if (channel_files[c] != nullptr &&
-        TIFFGetField(channel_files[c], TIFFTAG_SAMPLESPERPIXEL, &spp) == 1 &&
+        TIFFGetField(channel_files[c].get(), TIFFTAG_SAMPLESPERPIXEL, &spp) ==
+            1 &&
         spp != 1) {
       warning += "ERROR: Samples per pixel is not 1!\n";
     }
     if (channel_files[c] != nullptr &&
-        TIFFGetField(channel_files[c], TIFFTAG_BITSPERSAMPLE, &bps) == 1 &&
+        TIFFGetField(channel_files[c].get(), TIFFTAG_BITSPERSAMPLE, &bps) ==
+            1 &&
         bps != 8) {
       warning += "ERROR: Bits per sample is not 8!\n";
     }
@@ -301,16 +396,24 @@ int SepSource::TIFFReadScanline_(tiff *file, void *buf, uint32_t row,
   return file == nullptr ? -1 : TIFFReadScanline(file, buf, row, sample);
 }
 
-void SepSource::readCombinedScanline(std::vector<byte> &out, size_t line_nr) {
+bool SepSource::readCombinedScanline(std::vector<byte> &out, size_t line_nr) {
+  // line, bytes
+  SPSEP_PROBE2(readCombinedScanline__entry, line_nr, out.size());
   // There are n (=spp) channels in out, so the number of bytes an individual
   // channel has is one nth of the output vector's size.
   size_t size = out.size() / nr_channels;
 
   // Create buffers for the scanlines of the individual channels.
   std::vector<uint8_t> lines[nr_channels];
+  bool result = true;
   for (size_t i = 0; i < nr_channels; i++) {
     lines[i] = std::vector<uint8_t>(size);
-    TIFFReadScanline_(channel_files[channels[i]], lines[i].data(), line_nr);
+    // A channel without a file has no ink
+    tiff *file = channel_files[channels[i]].get();
+    if (file != nullptr &&
+        TIFFReadScanline_(file, lines[i].data(), line_nr) != 1) {
+      result = false;
+    }
   }
 
   for (size_t i = 0; i < size; i++) {
@@ -318,15 +421,21 @@ void SepSource::readCombinedScanline(std::vector<byte> &out, size_t line_nr) {
       out[nr_channels * i + j] = lines[j][i];
     }
   }
+  SPSEP_PROBE2(readCombinedScanline__return, line_nr, out.size());
+  return result;
 }
 
 void SepSource::fillTiles(int startLine, int line_count, int tileWidth,
                           int firstTile, std::vector<Tile::Ptr> &tiles) {
+  Stats::ScopedTimer timer(stats->fillTiles);
+  timer.addPixels(static_cast<uint64_t>(line_count) * tileWidth * tiles.size());
   const size_t bpp = channels.size(); // number of bytes per pixel
   const size_t start_line = static_cast<size_t>(startLine);
   const size_t first_tile = static_cast<size_t>(firstTile);
   const size_t tile_stride = static_cast<size_t>(tileWidth) * bpp;
   const size_t tile_count = tiles.size();
+  // first line, lines, first tile, tiles
+  SPSEP_PROBE4(fillTiles__entry, startLine, line_count, firstTile, tile_count);
 
   // Buffer for the scanline to be written into
   auto row = std::vector<byte>(bpp * sep_file.width);
@@ -345,12 +454,47 @@ void SepSource::fillTiles(int startLine, int line_count, int tileWidth,
   // The number of remaining bytes
   const size_t remaining_width = bpp * sep_file.width - accounted_width;
 
-  // This points to the beginning of the row (taking the starting tile
-  // into account).
-  const byte *horizontal_offset = row.data() + first_tile * tile_stride;
+  acquireFiles();
+  const size_t row_length = bpp * sep_file.width;
+
+  // Use the band if it has been decoded ahead, and decode it here otherwise.
+  // The files are locked meanwhile, as the read-ahead job uses them as well.
+  std::vector<byte> band = takeReadAhead(startLine, line_count);
+  boost::unique_lock<boost::mutex> files_lock(channelFilesMutex,
+                                              boost::defer_lock);
+  if (band.empty()) {
+    files_lock.lock();
+    if (canReadStrips()) {
+      band.resize(static_cast<size_t>(line_count) * row_length);
+      if (!readStrips(band.data(), startLine, line_count)) {
+        band.clear();
+      }
+    }
+  }
+  // The next bands are decoded while this one is being converted. The job
+  // waits for the files, so it never reads them out of order.
+  startReadAhead();
+
+  // The reduced images are stored for the next open, as long as the lines
+  // pass by in order. Other tiles of the same lines may be asked for later.
+  PyramidTiffWriter::Ptr pyramid =
+      firstTile == 0 ? getPyramidWriter(startLine) : nullptr;
+  bool pyramidWritten = true;
 
   for (size_t i = 0; i < static_cast<size_t>(line_count); i++) {
-    readCombinedScanline(row, i + start_line);
+    const byte *line = row.data();
+    if (!band.empty()) {
+      line = band.data() + i * row_length;
+    } else {
+      readCombinedScanline(row, i + start_line);
+    }
+    if (pyramid && pyramidWritten) {
+      pyramidWritten = pyramid->writeRows(line, 1);
+    }
+
+    // This points to the beginning of the row (taking the starting tile
+    // into account).
+    const byte *horizontal_offset = line + first_tile * tile_stride;
 
     // The general case for completely filled tiles. The last tile
     // is the only tile that might not be completely filled, so that
@@ -364,10 +508,406 @@ void SepSource::fillTiles(int startLine, int line_count, int tileWidth,
     // Copy the data into the last tile. This tile might not be
     // completely filled, so that's why this case is not included
     // in the for loop.
-    memcpy(tile_data[tile_count - 1], row.data() + accounted_width,
-           remaining_width);
+    memcpy(tile_data[tile_count - 1], line + accounted_width, remaining_width);
     tile_data[tile_count - 1] += tile_stride;
   }
+  if (files_lock.owns_lock()) {
+    files_lock.unlock();
+  }
+
+  if (pyramid) {
+    pyramidLinesWritten(pyramid, line_count, pyramidWritten);
+  }
+
+  if (buildTileSums) {
+    // The tiles have just been read, so summing them is cheap compared to
+    // decoding them again for every pipette selection
+    const int tile_y = startLine / TILESIZE;
+    for (size_t tile = 0; tile < tile_count; tile++) {
+      const size_t width =
+          tile < tile_count - 1 ? tile_stride : remaining_width;
+      storeTileSums(firstTile + static_cast<int>(tile), tile_y,
+                    TileSums::create(tiles[tile]->data.get(), tile_stride,
+                                     width / bpp, line_count, bpp));
+    }
+  }
+  // first line, lines, bytes read from the files
+  SPSEP_PROBE3(fillTiles__return, startLine, line_count,
+               static_cast<size_t>(line_count) * row_length);
+}
+
+std::vector<byte> SepSource::takeReadAhead(int startLine, int lineCount) {
+  std::vector<byte> band;
+  size_t bytes = 0;
+  {
+    boost::mutex::scoped_lock lock(readAheadMutex);
+    sequential = startLine == nextLine;
+    nextLine = startLine + lineCount;
+    bandLines = lineCount;
+
+    while (readAheadLine == startLine) {
+      readAheadChanged.wait(lock);
+    }
+
+    auto found = readAheadBands.find(startLine);
+    if (found != readAheadBands.end() &&
+        found->second.size() ==
+            static_cast<size_t>(lineCount) * nr_channels * sep_file.width) {
+      band.swap(found->second);
+    }
+
+    // Only the bands after this one can still be asked for
+    if (sequential) {
+      readAheadBands.erase(readAheadBands.begin(),
+                           readAheadBands.lower_bound(nextLine));
+    } else {
+      readAheadBands.clear();
+    }
+    for (const auto &b : readAheadBands) {
+      bytes += b.second.size();
+    }
+  }
+  readAheadMemory->set(bytes);
+  return band;
+}
+
+int SepSource::readAheadLimit() const {
+  if (readAheadBytes == 0 || bandLines <= 0) {
+    return 0;
+  }
+  const size_t bandBytes =
+      static_cast<size_t>(bandLines) * nr_channels * sep_file.width;
+  const size_t bands = readAheadBytes / std::max<size_t>(bandBytes, 1);
+  // Decoding ahead is pointless beyond the end of the image
+  const size_t maxBands = sep_file.height / bandLines + 1;
+  return static_cast<int>(std::max<size_t>(1, std::min(bands, maxBands)));
+}
+
+void SepSource::startReadAhead() {
+  boost::mutex::scoped_lock lock(readAheadMutex);
+  if (!sequential || readAheadRunning || readAheadLimit() <= 0 ||
+      nextLine >= static_cast<int>(sep_file.height)) {
+    return;
+  }
+  readAheadRunning = true;
+
+  // Don't keep the job alive, so closing the presentation cancels it
+  boost::weak_ptr<SepSource> weakThis = shared_from_this<SepSource>();
+  CpuBound()->schedule(
+      [weakThis] {
+        Ptr self = weakThis.lock();
+        if (self) {
+          self->readAhead();
+        }
+      },
+      PRIO_HIGHER, threadQueue);
+}
+
+void SepSource::readAhead() {
+  Trace::Span job("job", "SepSource::readAhead");
+  const size_t row_length = nr_channels * sep_file.width;
+  const int height = static_cast<int>(sep_file.height);
+
+  boost::mutex::scoped_lock lock(readAheadMutex);
+  while (sequential) {
+    // The first band after the requested one that is not decoded yet
+    int line = nextLine;
+    while (readAheadBands.count(line) > 0) {
+      line += bandLines;
+    }
+    if (line >= height || line >= nextLine + readAheadLimit() * bandLines) {
+      break;
+    }
+    const int count = std::min(bandLines, height - line);
+    readAheadLine = line;
+    lock.unlock();
+
+    std::vector<byte> band(static_cast<size_t>(count) * row_length);
+    const bool read = readBand(band, line, count);
+
+    lock.lock();
+    readAheadLine = -1;
+    // fillTiles() may have moved on while the band was being decoded
+    if (read && line >= nextLine) {
+      readAheadBands[line].swap(band);
+    }
+    readAheadChanged.notify_all();
+    if (!read) {
+      break;
+    }
+
+    size_t bytes = 0;
+    for (const auto &b : readAheadBands) {
+      bytes += b.second.size();
+    }
+    lock.unlock();
+    readAheadMemory->set(bytes);
+    lock.lock();
+  }
+  readAheadRunning = false;
+  readAheadChanged.notify_all();
+}
+
+bool SepSource::readBand(std::vector<byte> &band, int line, int count) {
+  Stats::ScopedTimer timer(stats->readAhead);
+  timer.addPixels(static_cast<uint64_t>(count) * sep_file.width);
+  boost::mutex::scoped_lock lock(channelFilesMutex);
+  if (filesReleased) {
+    return false;
+  }
+  if (readStrips(band.data(), line, count)) {
+    return true;
+  }
+
+  // Let the kernel read all channels at once, instead of one channel at a
+  // time as they are decoded
+  for (const auto &c : channels) {
+    adviseWillNeed(channel_files[c].get(), static_cast<uint32_t>(line),
+                   static_cast<uint32_t>(count));
+  }
+  const size_t row_length = nr_channels * sep_file.width;
+  std::vector<byte> row(row_length);
+  for (int i = 0; i < count; i++) {
+    readCombinedScanline(row, static_cast<size_t>(line + i));
+    memcpy(band.data() + static_cast<size_t>(i) * row_length, row.data(),
+           row_length);
+  }
+  return true;
+}
+
+bool SepSource::canReadStrips() {
+  if (StripReader::getBackend() == StripReader::SCANLINE ||
+      channels.empty() || filesReleased) {
+    return false;
+  }
+  for (const auto &c : channels) {
+    tiff *file = channel_files[c].get();
+    if (!StripReader::canReadDirectly(file) ||
+        static_cast<size_t>(TIFFScanlineSize64(file)) != sep_file.width) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SepSource::readStrips(byte *out, int line, int count) {
+  if (count <= 0 || !canReadStrips()) {
+    return false;
+  }
+
+  // Collect the reads of all channels first, so they are performed together
+  const size_t size = static_cast<size_t>(count) * sep_file.width;
+  std::vector<std::vector<uint8_t>> strips(nr_channels);
+  std::vector<StripReader::Request> requests;
+  for (size_t i = 0; i < nr_channels; i++) {
+    strips[i].resize(size);
+    if (!StripReader::addRows(channel_files[channels[i]].get(),
+                              static_cast<uint32_t>(line),
+                              static_cast<uint32_t>(count), strips[i].data(),
+                              requests)) {
+      return false;
+    }
+  }
+  if (!StripReader::read(requests)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < size; i++) {
+    for (size_t j = 0; j < nr_channels; j++) {
+      out[nr_channels * i + j] = strips[j][i];
+    }
+  }
+  return true;
+}
+
+void SepSource::adviseWillNeed(tiff *file, uint32_t row, uint32_t count) {
+  uint64_t *offsets = nullptr;
+  uint64_t *byte_counts = nullptr;
+  if (file == nullptr || count == 0 || TIFFIsTiled(file) ||
+      TIFFGetField(file, TIFFTAG_STRIPOFFSETS, &offsets) != 1 ||
+      TIFFGetField(file, TIFFTAG_STRIPBYTECOUNTS, &byte_counts) != 1) {
+    return;
+  }
+
+  const uint32_t strips = TIFFNumberOfStrips(file);
+  const uint32_t first = TIFFComputeStrip(file, row, 0);
+  const uint32_t last = TIFFComputeStrip(file, row + count - 1, 0);
+  uint64_t begin = UINT64_MAX;
+  uint64_t end = 0;
+  for (uint32_t strip = first; strip <= last && strip < strips; strip++) {
+    begin = std::min(begin, offsets[strip]);
+    end = std::max(end, offsets[strip] + byte_counts[strip]);
+  }
+  if (begin < end && end <= static_cast<uint64_t>(LLONG_MAX)) {
+    posix_fadvise(TIFFFileno(file), static_cast<off_t>(begin),
+                  static_cast<off_t>(end - begin), POSIX_FADV_WILLNEED);
+  }
+}
+
+void SepSource::findOverviews() {
+  overviews.clear();
+  overviewPaths.clear();
+  for (const auto &channel : channels) {
+    overviewPaths.push_back(sep_file.files.at(channel).string());
+    overviews.push_back(TiffOverviews::find(overviewPaths.back()));
+  }
+  const uint32_t anyFactor = std::numeric_limits<uint32_t>::max();
+  if (getOverviewFactor(anyFactor) != 0) {
+    return;
+  }
+
+  // All channels are in a single file there
+  const std::string key = computeDiskCacheKey();
+  const boost::filesystem::path cached = DiskCache::getPath(key, PYRAMID_ENTRY);
+  boost::system::error_code ec;
+  if (cached.empty() || !boost::filesystem::exists(cached, ec)) {
+    return;
+  }
+  DiskCache::touch(key);
+  auto reductions = TiffOverviews::findReductions(
+      cached.string(), static_cast<uint32_t>(sep_file.width),
+      static_cast<uint32_t>(sep_file.height),
+      static_cast<uint16_t>(nr_channels));
+  if (!reductions.empty()) {
+    overviews = {reductions};
+    overviewPaths = {cached.string()};
+  }
+}
+
+uint32_t SepSource::getOverviewFactor(uint32_t factor) {
+  return TiffOverviews::commonFactor(overviews, factor);
+}
+
+std::vector<byte> SepSource::readOverview(uint32_t factor, uint32_t &width,
+                                          uint32_t &height) {
+  Stats::ScopedTimer timer(stats->overviews);
+  std::vector<byte> result = TiffOverviews::readInterleaved(
+      overviewPaths, overviews, factor, width, height);
+  if (!result.empty()) {
+    timer.addPixels(static_cast<uint64_t>(width) * height);
+  }
+  return result;
+}
+
+std::string SepSource::computeDiskCacheKey() {
+  std::vector<std::string> files = {file_name};
+  for (const auto &channel : channels) {
+    files.push_back(sep_file.files[channel].string());
+  }
+  return DiskCache::computeKey(files);
+}
+
+void SepSource::startPyramid() {
+  pyramidStarted = true;
+  const uint32_t anyFactor = std::numeric_limits<uint32_t>::max();
+  if (getOverviewFactor(anyFactor) != 0) {
+    return;
+  }
+
+  const std::string key = computeDiskCacheKey();
+  boost::system::error_code ec;
+  if (key.empty() ||
+      boost::filesystem::exists(DiskCache::getPath(key, PYRAMID_ENTRY), ec)) {
+    return;
+  }
+
+  pyramidTemporary = DiskCache::createTemporary(key, PYRAMID_ENTRY);
+  if (pyramidTemporary.empty()) {
+    return;
+  }
+  // The channels are not colors, so they are stored as extra samples
+  pyramidWriter = PyramidTiffWriter::create(
+      pyramidTemporary.string(), static_cast<int>(sep_file.width),
+      static_cast<int>(sep_file.height), PYRAMID_TILE_SIZE,
+      static_cast<int>(nr_channels), PHOTOMETRIC_MINISBLACK, false);
+  if (!pyramidWriter) {
+    abandonPyramid();
+    return;
+  }
+  pyramidKey = key;
+  pyramidLines = 0;
+}
+
+void SepSource::abandonPyramid() {
+  pyramidWriter.reset();
+  if (!pyramidTemporary.empty()) {
+    boost::system::error_code ec;
+    boost::filesystem::remove(pyramidTemporary, ec);
+    pyramidTemporary.clear();
+  }
+}
+
+PyramidTiffWriter::Ptr SepSource::getPyramidWriter(int startLine) {
+  boost::mutex::scoped_lock lock(diskCacheMutex);
+  if (!pyramidStarted && startLine == 0) {
+    startPyramid();
+  }
+  if (pyramidWriter && startLine != pyramidLines) {
+    abandonPyramid();
+  }
+  return pyramidWriter;
+}
+
+void SepSource::pyramidLinesWritten(const PyramidTiffWriter::Ptr &writer,
+                                    int lineCount, bool success) {
+  boost::mutex::scoped_lock lock(diskCacheMutex);
+  if (writer != pyramidWriter) {
+    return;
+  }
+  if (!success) {
+    abandonPyramid();
+    return;
+  }
+  pyramidLines += lineCount;
+  if (pyramidLines < static_cast<int>(sep_file.height)) {
+    return;
+  }
+
+  // Writing the reduced images takes a while, so don't hold up the last band
+  // of the tiled bitmap. The entry is completed even if the file is closed.
+  const std::string key = pyramidKey;
+  const boost::filesystem::path temporary = pyramidTemporary;
+  pyramidWriter.reset();
+  pyramidTemporary.clear();
+  boost::weak_ptr<SepSource> weakThis = shared_from_this<SepSource>();
+  CpuBound()->schedule(
+      [writer, key, temporary, weakThis] {
+        Trace::Span job("job", "SepSource::storePyramid");
+        if (!writer->finish()) {
+          boost::system::error_code ec;
+          boost::filesystem::remove(temporary, ec);
+          return;
+        }
+        if (!DiskCache::commitTemporary(temporary, key, PYRAMID_ENTRY)) {
+          return;
+        }
+        Ptr self = weakThis.lock();
+        if (self && self->pyramidCached) {
+          self->pyramidCached();
+        }
+      },
+      PRIO_LOW);
+}
+
+TileSums::Ptr SepSource::getTileSums(int x, int y) {
+  boost::mutex::scoped_lock lock(tileSumsMutex);
+  auto sums = tileSums.find({x, y});
+  return sums == tileSums.end() ? nullptr : sums->second;
+}
+
+void SepSource::storeTileSums(int x, int y, const TileSums::Ptr &sums) {
+  size_t bytes;
+  {
+    boost::mutex::scoped_lock lock(tileSumsMutex);
+    TileSums::Ptr &entry = tileSums[{x, y}];
+    if (entry) {
+      tileSumsBytes -= entry->table.size() * sizeof(uint32_t);
+    }
+    entry = sums;
+    tileSumsBytes += sums->table.size() * sizeof(uint32_t);
+    bytes = tileSumsBytes;
+  }
+  tileSumsMemory->set(bytes);
 }
 
 void SepSource::closeIfNeeded(struct tiff *&file) {
@@ -378,10 +918,41 @@ void SepSource::closeIfNeeded(struct tiff *&file) {
   file = nullptr;
 }
 
+void SepSource::acquireFiles() {
+  boost::mutex::scoped_lock lock(channelFilesMutex);
+  if (!filesReleased) {
+    return;
+  }
+  filesReleased = false;
+
+  for (const auto &c : channels) {
+    channel_files[c] =
+        TiffPool::getInstance().acquire(sep_file.files[c].string());
+    if (channel_files[c]) {
+      posix_fadvise(TIFFFileno(channel_files[c].get()), 0, 0,
+                    POSIX_FADV_SEQUENTIAL);
+    }
+  }
+}
+
 void SepSource::done() {
-  // Close all tiff files and reset pointers
+  // Drop the bands decoded ahead. A read-ahead job that is still running
+  // stops once the files below have been released.
+  {
+    boost::mutex::scoped_lock lock(readAheadMutex);
+    readAheadBands.clear();
+    nextLine = -1;
+    sequential = false;
+  }
+  readAheadMemory->set(0);
+
+  // Return all tiff files to the pool and reset pointers
+  boost::mutex::scoped_lock lock(channelFilesMutex);
   for (auto &x : channel_files) {
-    SepSource::closeIfNeeded(x.second);
+    if (x.second) {
+      x.second.reset();
+      filesReleased = true;
+    }
   }
 }
 
@@ -3,11 +3,23 @@
 
 #include <tiffio.h>
 
+#include <atomic>
+
 #include <boost/filesystem.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <scroom/threadpool.hh>
 #include <scroom/tiledbitmapinterface.hh>
 #include <scroom/transformpresentation.hh>
 
+#include "export/pyramidtiffwriter.hh"
+#include "memorybudget.hh"
 #include "sli/slilayer.hh"
+#include "stats.hh"
+#include "stripreader.hh"
+#include "tiffoverviews.hh"
+#include "tiffpool.hh"
+#include "tilesums.hh"
 #include "varnish/varnish.hh"
 
 struct SepFile {
@@ -23,7 +35,8 @@ struct SepFile {
  * directly in SepPresentation is to avoid a memory leak through cyclic
  * dependencies.
  */
-class SepSource : public SourcePresentation {
+class SepSource : public SourcePresentation,
+                  public virtual Scroom::Utils::Base {
 public:
   typedef boost::shared_ptr<SepSource> Ptr;
 
@@ -33,8 +46,17 @@ public: // For testing
 
   std::vector<std::string> channels = {};
 
-  /** Stores pointers to color files. */
-  std::map<std::string, tiff *> channel_files = {};
+  /**
+   * The color files, leased from TiffPool between openFiles() and done().
+   * After done(), acquireFiles() leases them again.
+   */
+  std::map<std::string, TiffPool::Handle> channel_files = {};
+
+  /** Whether done() has returned channel_files to the pool */
+  bool filesReleased = false;
+
+  /** Must be acquired before accessing `channel_files` */
+  boost::mutex channelFilesMutex;
 
   /** Number of channels (=spp). Set after loading*/
   size_t nr_channels = 0;
@@ -49,9 +71,265 @@ public:
   /** Destructor */
   ~SepSource();
 
-  /** Pointer to varnish layer. */
+  /**
+   * Pointer to varnish layer. It is loaded in the background, so it remains
+   * nullptr until loading is done. Use getVarnish() to read it.
+   */
   Varnish::Ptr varnish;
 
+  /** Must be acquired before accessing `varnish` */
+  boost::mutex varnishMutex;
+
+  /** The thread queue into which the varnish loading job is enqueued */
+  ThreadPool::Queue::Ptr threadQueue;
+
+  /**
+   * Callback that is called from a worker thread once the varnish layer has
+   * been loaded successfully.
+   */
+  boost::function<void()> varnishLoaded;
+
+  /**
+   * Callback that is called from a worker thread once the reduced images
+   * have been stored in the disk cache.
+   */
+  boost::function<void()> pyramidCached;
+
+  /**
+   * The statistics this source, and the varnish it loads, record into. The
+   * presentation that owns the source replaces them with its own.
+   */
+  Stats::Set::Ptr stats = Stats::Set::create();
+
+  /**
+   * Whether fillTiles() computes a summed-area table for every tile it
+   * fills, so the pipette does not need to decode tiles that are completely
+   * covered by the selection. The tables are only worth their time and
+   * memory once the pipette is used, so SepPresentation switches this on
+   * then.
+   */
+  std::atomic<bool> buildTileSums{false};
+
+  /** The summed-area tables of the tiles loaded so far, by tile position */
+  std::map<std::pair<int, int>, TileSums::Ptr> tileSums;
+
+  /** Must be acquired before accessing `tileSums` and `tileSumsBytes` */
+  boost::mutex tileSumsMutex;
+
+  /** The size of all tables in `tileSums` (in bytes) */
+  size_t tileSumsBytes = 0;
+
+  /**
+   * The memory held by `tileSums`, which is dropped to stay within the memory
+   * budget. The pipette decodes the tiles again in that case.
+   */
+  MemoryBudget::Account::Ptr tileSumsMemory;
+
+  /**
+   * Returns the summed-area table of the bottom layer tile at (x, y), or
+   * nullptr if the tile has not been loaded yet.
+   */
+  TileSums::Ptr getTileSums(int x, int y);
+
+  /** Stores @param sums as the summed-area table of the tile at (x, y) */
+  void storeTileSums(int x, int y, const TileSums::Ptr &sums);
+
+  /** Must be acquired before accessing the disk cache members below */
+  boost::mutex diskCacheMutex;
+
+  /** Whether startPyramid() has been called */
+  bool pyramidStarted = false;
+
+  /**
+   * Receives the lines of fillTiles() if the reduced images are to be stored
+   * in the disk cache, or nullptr. Only the reduced images are stored, as
+   * they are what a new open of the same files draws first.
+   */
+  PyramidTiffWriter::Ptr pyramidWriter;
+
+  /** Key of the channel files in the disk cache, while pyramidWriter is set */
+  std::string pyramidKey;
+
+  /** The file pyramidWriter writes to, renamed to the entry once complete */
+  boost::filesystem::path pyramidTemporary;
+
+  /** The number of lines written to pyramidWriter */
+  int pyramidLines = 0;
+
+  /**
+   * Computes the key of the channel files in the disk cache (see DiskCache),
+   * or an empty string if caching is disabled. The key does not depend on
+   * the colors, as the channels are cached as they are.
+   */
+  std::string computeDiskCacheKey();
+
+  /**
+   * Prepares to store the reduced images in the disk cache, unless caching
+   * is disabled, they are there already, or the files have overviews of
+   * their own.
+   * @pre `diskCacheMutex` is held
+   */
+  void startPyramid();
+
+  /**
+   * Gives up on storing the reduced images, and removes what has been
+   * written so far.
+   * @pre `diskCacheMutex` is held
+   */
+  void abandonPyramid();
+
+  /**
+   * Returns pyramidWriter if the lines starting at @param startLine are the
+   * next ones it needs. Gives up on it if they are not, as the lines must be
+   * written in order.
+   */
+  PyramidTiffWriter::Ptr getPyramidWriter(int startLine);
+
+  /**
+   * Records that @param lineCount lines have been written to @param writer,
+   * or gives up on it if that failed according to @param success. Once all
+   * lines have been written, the reduced images are written and committed
+   * to the disk cache in the background.
+   */
+  void pyramidLinesWritten(const PyramidTiffWriter::Ptr &writer,
+                           int lineCount, bool success);
+
+  /**
+   * The number of bytes that are decoded ahead in the background once
+   * fillTiles() is asked for consecutive bands, or 0 to disable read-ahead.
+   * At least one band is decoded ahead, however large the bands are.
+   */
+  size_t readAheadBytes = static_cast<size_t>(256) << 20;
+
+  /**
+   * Must be acquired before accessing the read-ahead members below. It may be
+   * acquired while holding `channelFilesMutex`, but not the other way around.
+   */
+  boost::mutex readAheadMutex;
+
+  /** Notified whenever the read-ahead job finishes a band, or stops */
+  boost::condition_variable readAheadChanged;
+
+  /** The combined channels of the bands decoded ahead, by their first line */
+  std::map<int, std::vector<byte>> readAheadBands;
+
+  /** The line after the band fillTiles() was asked for last, or -1 */
+  int nextLine = -1;
+
+  /** The number of lines of the band fillTiles() was asked for last */
+  int bandLines = 0;
+
+  /** Whether the last two bands fillTiles() was asked for were adjacent */
+  bool sequential = false;
+
+  /** Whether the read-ahead job has been scheduled and not finished yet */
+  bool readAheadRunning = false;
+
+  /** The first line of the band the read-ahead job is decoding, or -1 */
+  int readAheadLine = -1;
+
+  /**
+   * The memory held by `readAheadBands`, which is dropped to stay within the
+   * memory budget. fillTiles() decodes the bands itself in that case.
+   */
+  MemoryBudget::Account::Ptr readAheadMemory;
+
+  /**
+   * Takes the band of @param lineCount lines at @param startLine out of
+   * `readAheadBands`, waiting for it if it is being decoded, and drops the
+   * bands that will not be asked for anymore.
+   * @return the combined channels, or an empty vector if the band has not
+   * been decoded ahead
+   */
+  std::vector<byte> takeReadAhead(int startLine, int lineCount);
+
+  /**
+   * Returns the number of bands of `bandLines` lines that fit in
+   * `readAheadBytes`, but at least 1, or 0 if read-ahead is disabled. Must be
+   * called with `readAheadMutex` held.
+   */
+  int readAheadLimit() const;
+
+  /** Schedules readAhead() if consecutive bands have been asked for */
+  void startReadAhead();
+
+  /**
+   * Decodes the readAheadLimit() bands after the one fillTiles() was asked
+   * for last into `readAheadBands`. Runs on a worker thread.
+   */
+  void readAhead();
+
+  /**
+   * Decodes @param count lines starting at @param line into @param band.
+   * @return false if done() has released the files
+   */
+  bool readBand(std::vector<byte> &band, int line, int count);
+
+  /**
+   * Whether all channels can be read with StripReader.
+   * @pre `channelFilesMutex` is held
+   */
+  bool canReadStrips();
+
+  /**
+   * Reads @param count lines starting at @param line of all channels with
+   * StripReader, and combines them into @param out.
+   * @pre `channelFilesMutex` is held
+   * @return false if the channels can't be read directly, e.g. because they
+   * are compressed, in which case they must be read with readCombinedScanline
+   */
+  bool readStrips(byte *out, int line, int count);
+
+  /**
+   * Tells the kernel the strips of @param file that hold @param count rows
+   * starting at @param row will be read soon, so they are read from disk
+   * while other channels are being decoded.
+   */
+  static void adviseWillNeed(tiff *file, uint32_t row, uint32_t count);
+
+  /**
+   * The overviews of every file in `overviewPaths`. Set by findOverviews(),
+   * and not changed afterwards.
+   */
+  std::vector<std::vector<TiffOverviews::Overview>> overviews;
+
+  /**
+   * The files the overviews are read from: the file of every channel, in
+   * the order of `channels`, or the reduced images in the disk cache.
+   */
+  std::vector<std::string> overviewPaths;
+
+  /**
+   * Looks up the overviews embedded in the files of all channels, see
+   * TiffOverviews. If there are none, uses the reduced images that a
+   * previous open stored in the disk cache instead.
+   */
+  void findOverviews();
+
+  /**
+   * Returns the largest reduction factor up to @param factor that all
+   * channels have an overview of, or 0 if there is none.
+   */
+  uint32_t getOverviewFactor(uint32_t factor);
+
+  /**
+   * Reads the overviews of all channels with reduction @param factor, and
+   * combines them like readCombinedScanline() does. Does not use the files
+   * leased from TiffPool, so it can run next to fillTiles().
+   * @return the combined channels, or an empty vector if they can't be read
+   */
+  std::vector<byte> readOverview(uint32_t factor, uint32_t &width,
+                                 uint32_t &height);
+
+  /** Returns the varnish layer, or nullptr if it is not (yet) loaded. */
+  Varnish::Ptr getVarnish();
+
+  /**
+   * Loads the varnish layer. Is potentially expensive, hence run outside of
+   * the UI thread.
+   */
+  void loadVarnish();
+
   /**
    * Create a pointer to SepSource using constructor and return it.
    */
@@ -71,7 +349,8 @@ public:
    * This function is only needed when the SepPresentation is used by
    * the SliPresentation to parse a layer of an SLI file.
    * Upon being called, it fills all relevant
-   * attributes of the SliLayer, except for the bitmap.
+   * attributes of the SliLayer, except for the bitmap. The varnish of the
+   * SEP file is not loaded.
    * @param sli - pointer to SliLayer
    */
   void fillSliLayerMeta(SliLayer::Ptr sli);
@@ -113,10 +392,17 @@ public:
 
   /**
    * Opens the required TIFF files for the individual channels.
-   * Sets value of channel_files, white_ink and varnish.
+   * Sets value of channel_files and white_ink, and enqueues the loading of
+   * the varnish.
    */
   void openFiles();
 
+  /**
+   * Leases the color files from TiffPool again, if done() has released them.
+   * Files that are still idle in the pool are not opened again.
+   */
+  void acquireFiles();
+
   /**
    * Checks the opened files and shows a warning popup if there
    * are any problems.
@@ -135,11 +421,13 @@ public:
                                uint16_t sample = 0);
 
   /**
-   * Retrieves a scanline from all components combined.
+   * Retrieves a scanline from all components combined. Channels without a
+   * file read as no ink.
    *
    * @pre `openFiles()` has been called.
+   * @return false if one of the channel files could not be read
    */
-  void readCombinedScanline(std::vector<byte> &out, size_t line_nr);
+  bool readCombinedScanline(std::vector<byte> &out, size_t line_nr);
 
   /**
    * Retrieves the transformation data for the loaded sep file, with
@@ -163,7 +451,8 @@ public:
                  std::vector<Tile::Ptr> &tiles) override;
 
   /**
-   * Closes the TIFF files opened by `openFiles()`.
+   * Returns the TIFF files opened by `openFiles()` to TiffPool, which closes
+   * them once too many files are open.
    */
   void done() override;
 
@@ -1,6 +1,11 @@
 #include "sli-helpers.hh"
 #include "../sep-helpers.hh"
 
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <new>
+
 SurfaceWrapper::Ptr SurfaceWrapper::create() {
   SurfaceWrapper::Ptr result(new SurfaceWrapper());
 
@@ -14,34 +19,93 @@ SurfaceWrapper::Ptr SurfaceWrapper::create(int width, int height,
   return result;
 }
 
+SurfaceWrapper::Ptr SurfaceWrapper::create(uint8_t *data, int width,
+                                           int height, size_t stride,
+                                           boost::shared_ptr<void> owner) {
+  SurfaceWrapper::Ptr result(new SurfaceWrapper());
+  result->bitmap = data;
+  result->width = width;
+  result->height = height;
+  result->stride = stride;
+  result->createCairoSurface(CAIRO_FORMAT_ARGB32);
+  result->dataOwner = owner;
+  result->empty = false;
+  result->clear = false;
+
+  return result;
+}
+
 SurfaceWrapper::SurfaceWrapper() {
   clear = true;
   empty = true;
 }
 
-SurfaceWrapper::SurfaceWrapper(int width, int height, cairo_format_t format) {
-  int stride = cairo_format_stride_for_width(format, width);
-  uint8_t *bitmap = static_cast<uint8_t *>(calloc(height * stride, 1));
-  surface = cairo_image_surface_create_for_data(bitmap, CAIRO_FORMAT_ARGB32,
-                                                width, height, stride);
+SurfaceWrapper::SurfaceWrapper(int width_, int height_, cairo_format_t format)
+    : width(std::max(0, width_)), height(std::max(0, height_)),
+      stride(strideForWidth(width, format)),
+      bytesPerPixel(format == CAIRO_FORMAT_A8 ? 1 : 4) {
+  // calloc() does not check the multiplication on all platforms
+  bitmap = static_cast<uint8_t *>(calloc(checkedSize(height, stride), 1));
+  if (bitmap == nullptr && height > 0 && stride > 0) {
+    throw std::bad_alloc();
+  }
+  createCairoSurface(format);
   empty = false;
   clear = true;
 }
 
-int SurfaceWrapper::getHeight() {
-  return cairo_image_surface_get_height(surface);
+size_t SurfaceWrapper::strideForWidth(int width, cairo_format_t format) {
+  if (width <= MAX_CAIRO_SIZE) {
+    return cairo_format_stride_for_width(format, width);
+  }
+  // Cairo refuses these widths, but rows are aligned the same way
+  const size_t bytes = checkedSize(width, format == CAIRO_FORMAT_A8 ? 1 : 4);
+  return (bytes + 3) / 4 * 4;
+}
+
+void SurfaceWrapper::createCairoSurface(cairo_format_t format) {
+  if (width <= MAX_CAIRO_SIZE && height <= MAX_CAIRO_SIZE &&
+      stride <= static_cast<size_t>(INT_MAX)) {
+    surface = cairo_image_surface_create_for_data(
+        bitmap, format, width, height, static_cast<int>(stride));
+  }
 }
 
-int SurfaceWrapper::getWidth() {
-  return cairo_image_surface_get_width(surface);
+int SurfaceWrapper::getHeight() { return height; }
+
+int SurfaceWrapper::getWidth() { return width; }
+
+size_t SurfaceWrapper::getStride() { return stride; }
+
+uint8_t *SurfaceWrapper::getBitmap() { return bitmap; }
+
+void SurfaceWrapper::flush() {
+  if (surface) {
+    cairo_surface_flush(surface);
+  }
 }
 
-int SurfaceWrapper::getStride() {
-  return cairo_image_surface_get_stride(surface);
+void SurfaceWrapper::markDirty() {
+  if (surface) {
+    cairo_surface_mark_dirty(surface);
+  }
 }
 
-uint8_t *SurfaceWrapper::getBitmap() {
-  return cairo_image_surface_get_data(surface);
+cairo_surface_t *
+SurfaceWrapper::createSubSurface(Scroom::Utils::Rectangle<int> area) {
+  area = area.intersection(toRectangle());
+  if (area.isEmpty() || stride > static_cast<size_t>(INT_MAX)) {
+    return nullptr;
+  }
+
+  flush();
+  uint8_t *data = bitmap + static_cast<size_t>(area.getTop()) * stride +
+                  static_cast<size_t>(area.getLeft()) * bytesPerPixel;
+  return cairo_image_surface_create_for_data(
+      data, bytesPerPixel == 1 ? CAIRO_FORMAT_A8 : CAIRO_FORMAT_ARGB32,
+      std::min(area.getWidth(), static_cast<int>(MAX_CAIRO_SIZE)),
+      std::min(area.getHeight(), static_cast<int>(MAX_CAIRO_SIZE)),
+      static_cast<int>(stride));
 }
 
 Scroom::Utils::Rectangle<int> SurfaceWrapper::toRectangle() {
@@ -51,20 +115,26 @@ Scroom::Utils::Rectangle<int> SurfaceWrapper::toRectangle() {
 }
 
 void SurfaceWrapper::clearSurface() {
-  cairo_t *cr = cairo_create(surface);
-  cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
-  cairo_paint(cr);
-  cairo_destroy(cr);
+  if (bitmap) {
+    flush();
+    memset(bitmap, 0, static_cast<size_t>(height) * stride);
+    markDirty();
+  }
   clear = true;
 }
 
 void SurfaceWrapper::clearSurface(Scroom::Utils::Rectangle<int> rect) {
-  cairo_t *cr = cairo_create(surface);
-  cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
-  cairo_rectangle(cr, rect.getTopLeft().x, rect.getTopLeft().y, rect.getWidth(),
-                  rect.getHeight());
-  cairo_fill(cr);
-  cairo_destroy(cr);
+  rect = rect.intersection(toRectangle());
+  if (bitmap && !rect.isEmpty()) {
+    flush();
+    const size_t length = static_cast<size_t>(rect.getWidth()) * bytesPerPixel;
+    for (int y = rect.getTop(); y < rect.getBottom(); y++) {
+      memset(bitmap + static_cast<size_t>(y) * stride +
+                 static_cast<size_t>(rect.getLeft()) * bytesPerPixel,
+             0, length);
+    }
+    markDirty();
+  }
   clear = true;
 }
 
@@ -77,18 +147,19 @@ toBytesRectangle(Scroom::Utils::Rectangle<int> rect, int bpp) {
   return bytesRect;
 }
 
-int getArea(Scroom::Utils::Rectangle<int> rect) {
-  return rect.getHeight() * rect.getWidth();
+int64_t getArea(Scroom::Utils::Rectangle<int> rect) {
+  return static_cast<int64_t>(rect.getHeight()) * rect.getWidth();
 }
 
-int pointToOffset(Scroom::Utils::Point<int> p, int stride) {
+int64_t pointToOffset(Scroom::Utils::Point<int> p, int64_t stride) {
   return p.y * stride + p.x;
 }
 
-int pointToOffset(Scroom::Utils::Rectangle<int> rect,
-                  Scroom::Utils::Point<int> p) {
-  return std::max(0, (p.y - rect.getTop()) * rect.getWidth() +
-                         (p.x - rect.getLeft()));
+int64_t pointToOffset(Scroom::Utils::Rectangle<int> rect,
+                      Scroom::Utils::Point<int> p) {
+  return std::max<int64_t>(
+      0, static_cast<int64_t>(p.y - rect.getTop()) * rect.getWidth() +
+             (p.x - rect.getLeft()));
 }
 
 Scroom::Utils::Rectangle<int>
@@ -154,9 +225,45 @@ halfSegBitmask(boost::dynamic_bitset<> toggledSegments) {
   return bitmask;
 }
 
+void drawReduced(cairo_t *cr, const SurfaceWrapper::Ptr &surface,
+                 uint32_t factor,
+                 Scroom::Utils::Rectangle<double> presentationArea,
+                 double pixelSize) {
+  const int left = static_cast<int>(floor(presentationArea.getLeft() / factor));
+  const int top = static_cast<int>(floor(presentationArea.getTop() / factor));
+  const int right =
+      static_cast<int>(ceil(presentationArea.getRight() / factor));
+  const int bottom =
+      static_cast<int>(ceil(presentationArea.getBottom() / factor));
+  Scroom::Utils::Rectangle<int> area =
+      Scroom::Utils::Rectangle<int>{left, top, right - left, bottom - top}
+          .intersection(surface->toRectangle());
+  cairo_surface_t *visible = surface->createSubSurface(area);
+  if (visible == nullptr) {
+    return;
+  }
+
+  const double scale = factor * pixelSize;
+  cairo_save(cr);
+  cairo_translate(cr, -presentationArea.getLeft() * pixelSize,
+                  -presentationArea.getTop() * pixelSize);
+  cairo_scale(cr, scale, scale);
+  cairo_set_source_surface(cr, visible, area.getLeft(), area.getTop());
+  if (scale > 1) {
+    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+  }
+  cairo_paint(cr);
+  cairo_restore(cr);
+  cairo_surface_destroy(visible);
+}
+
 SurfaceWrapper::~SurfaceWrapper() {
   if (!empty) {
-    free(cairo_image_surface_get_data(surface));
-    cairo_surface_destroy(surface);
+    if (surface) {
+      cairo_surface_destroy(surface);
+    }
+    if (!dataOwner) {
+      free(bitmap);
+    }
   }
 }
\ No newline at end of file
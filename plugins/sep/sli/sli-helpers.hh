@@ -12,25 +12,64 @@ class SurfaceWrapper : public virtual Scroom::Utils::Base {
 public:
   typedef boost::shared_ptr<SurfaceWrapper> Ptr;
 
-  /** The cairo surface wrapped by this class */
-  cairo_surface_t *surface;
+  /** Cairo image surfaces can not be larger than this in either direction */
+  static const int MAX_CAIRO_SIZE = 32767;
+
+  /**
+   * The cairo surface wrapped by this class, or nullptr if the surface is
+   * larger than MAX_CAIRO_SIZE. Use createSubSurface() to draw those.
+   */
+  cairo_surface_t *surface = nullptr;
 
   /** Whether the surface contents have been cleared
    * Mostly used for the bottom layer surface
    */
   bool clear;
 
+  /**
+   * Keeps the memory of the surface alive if it was not allocated by this
+   * class. Otherwise nullptr.
+   */
+  boost::shared_ptr<void> dataOwner;
+
 private:
   /** Used to destroy SurfaceWrapper pointers with no surface */
   bool empty;
+
+  /** The pixels of the surface, in the format of cairo */
+  uint8_t *bitmap = nullptr;
+  int width = 0;
+  int height = 0;
+  size_t stride = 0;
+  int bytesPerPixel = 4;
+
   SurfaceWrapper();
   SurfaceWrapper(int width, int height, cairo_format_t format);
 
+  /** Creates `surface` if the size allows it */
+  void createCairoSurface(cairo_format_t format);
+
 public:
   /** Constructors */
   static Ptr create();
+
+  /**
+   * Allocates a cleared surface.
+   * @throw std::length_error or std::bad_alloc if it is too large
+   */
   static Ptr create(int width, int height, cairo_format_t format);
 
+  /**
+   * Wraps existing ARGB32 data, which is kept alive by @param owner for as
+   * long as the surface exists.
+   */
+  static Ptr create(uint8_t *data, int width, int height, size_t stride,
+                    boost::shared_ptr<void> owner);
+
+  /** The stride of a surface of @param width pixels */
+  static size_t strideForWidth(int width,
+                               cairo_format_t format = CAIRO_FORMAT_ARGB32);
+
   /** Get the height of the wrapped surface */
   virtual int getHeight();
 
@@ -38,15 +77,31 @@ public:
   virtual int getWidth();
 
   /** Get the stride of the wrapped surface */
-  virtual int getStride();
+  virtual size_t getStride();
 
   /** Get the bitmap of the wrapped surface */
   virtual uint8_t *getBitmap();
 
+  /** Finishes pending cairo drawing, before accessing the bitmap directly */
+  virtual void flush();
+
+  /** Tells cairo the bitmap has been modified directly */
+  virtual void markDirty();
+
+  /**
+   * Creates a cairo surface for @param area (in pixels) of this surface,
+   * sharing its memory, so areas of surfaces that are too large for cairo can
+   * be drawn. The area is clipped to the surface and to MAX_CAIRO_SIZE.
+   * @return the surface, which the caller must destroy, or nullptr if the
+   * clipped area is empty
+   */
+  virtual cairo_surface_t *
+  createSubSurface(Scroom::Utils::Rectangle<int> area);
+
   /** Fill the entire surface with 0s */
   virtual void clearSurface();
 
-  /** Fill a rectangle of the surface with 0s */
+  /** Fill a rectangle (in pixels) of the surface with 0s */
   virtual void clearSurface(Scroom::Utils::Rectangle<int> rect);
 
   /** Return the Rectangle representation of the surface (in pixels) */
@@ -57,23 +112,26 @@ public:
 };
 
 /** Compute area in pixels of the given rectangle */
-int getArea(Scroom::Utils::Rectangle<int> rect);
+int64_t getArea(Scroom::Utils::Rectangle<int> rect);
 
 /** Stretch the rectangle @param bpp (Bytes Per Pixel, 4 for this plugin) times
  * horizontally */
 Scroom::Utils::Rectangle<int>
 toBytesRectangle(Scroom::Utils::Rectangle<int> rect, int bpp = 4);
 
-/** Compute the offset from coordinate (0,0) of the canvas to the given point */
-int pointToOffset(Scroom::Utils::Point<int> p, int stride);
+/**
+ * Compute the offset from coordinate (0,0) of the canvas to the given point.
+ * Offsets are 64 bit, as surfaces and layers can be larger than 2 GiB.
+ */
+int64_t pointToOffset(Scroom::Utils::Point<int> p, int64_t stride);
 
 /**
  * Compute the offset of the point from the top-left point of the rectangle.
  * Keep in ming this is still computed with the origin (0,0)  as the absolute
  * point of reference, for both the rectangle and the point!
  */
-int pointToOffset(Scroom::Utils::Rectangle<int> rect,
-                  Scroom::Utils::Point<int> p);
+int64_t pointToOffset(Scroom::Utils::Rectangle<int> rect,
+                      Scroom::Utils::Point<int> p);
 
 /**
  * Compute the Rectangle (in pixels) spanned by the union of all toggled layers
@@ -94,4 +152,16 @@ int findBestSegFit(unsigned int nSegments, unsigned int height);
 /**
  * Returns a bitmask that divides the @param toggledSegments bitamp in half.
  */
-boost::dynamic_bitset<> halfSegBitmask(boost::dynamic_bitset<> toggledSegments);
\ No newline at end of file
+boost::dynamic_bitset<> halfSegBitmask(boost::dynamic_bitset<> toggledSegments);
+
+/**
+ * Draws the part of @param surface within @param presentationArea onto
+ * @param cr, at @param pixelSize pixels per presentation pixel. Every pixel of
+ * the surface covers @param factor x @param factor pixels of the
+ * presentation, as for the overviews of TIFF files. Only the visible part is
+ * drawn, so the surface may exceed MAX_CAIRO_SIZE.
+ */
+void drawReduced(cairo_t *cr, const SurfaceWrapper::Ptr &surface,
+                 uint32_t factor,
+                 Scroom::Utils::Rectangle<double> presentationArea,
+                 double pixelSize);
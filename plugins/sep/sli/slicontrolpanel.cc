@@ -4,6 +4,7 @@
 
 #include "slicontrolpanel.hh"
 #include "slilayer.hh"
+#include "../trace.hh"
 
 using Scroom::GtkHelpers::sync_on_ui_thread;
 
@@ -329,7 +330,9 @@ SliControlPanel::SliControlPanel(
 }
 
 void SliControlPanel::disableInteractions() {
+  Trace::Span wait("ui-wait", "SliControlPanel::disableInteractions");
   sync_on_ui_thread([&] {
+    Trace::Span span("ui", "SliControlPanel::disableInteractions");
     for (auto widget : widgets) {
       gtk_widget_set_sensitive(widget.second, false);
     }
@@ -337,7 +340,9 @@ void SliControlPanel::disableInteractions() {
 }
 
 void SliControlPanel::enableInteractions() {
+  Trace::Span wait("ui-wait", "SliControlPanel::enableInteractions");
   sync_on_ui_thread([&] {
+    Trace::Span span("ui", "SliControlPanel::enableInteractions");
     for (auto widget : widgets) {
       gtk_widget_set_sensitive(widget.second, true);
     }
@@ -87,6 +87,7 @@ bool SliLayer::fillMetaFromTiff(unsigned int allowedBps,
                 ColorConfig::getInstance().getColorByNameOrAlias("m"),
                 ColorConfig::getInstance().getColorByNameOrAlias("y"),
                 ColorConfig::getInstance().getColorByNameOrAlias("k")};
+    colorTable = CustomColorTable(channels);
     return true;
 
   } catch (const std::exception &ex) {
@@ -108,11 +109,20 @@ void SliLayer::fillBitmapFromTiff() {
     }
 
     // create sli bitmap ------------------------------------
-    // Could just use the width here but we don't want to make overflows too
-    // easy, right ;)
-    int byteWidth = TIFFScanlineSize(tif);
-    bitmap.reset(new uint8_t[byteWidth * height]);
-    int stride = width * spp;
+    // Layers can be larger than 2 GiB, so the sizes are 64 bit, and the
+    // allocation fails instead of overflowing
+    const size_t stride = checkedSize(width, spp);
+    if (static_cast<size_t>(TIFFScanlineSize64(tif)) != stride) {
+      TIFFClose(tif);
+      throw std::invalid_argument(
+          fmt::format("Unexpected scanline size in {}", filepath));
+    }
+    try {
+      bitmap.reset(new uint8_t[checkedSize(stride, height)]);
+    } catch (...) {
+      TIFFClose(tif);
+      throw;
+    }
 
     // Iterate over the rows and copy the bitmap data to newly allocated memory
     // pointed to by currentBitmap
@@ -3,6 +3,7 @@
 #include <memory>
 
 #include "../colorconfig/CustomColor.hh"
+#include "../colorconfig/CustomColorTable.hh"
 #include <scroom/scroominterface.hh>
 
 class SliLayer : public virtual Scroom::Utils::Base {
@@ -22,6 +23,9 @@ public:
    */
   std::vector<CustomColor::Ptr> channels = {};
 
+  /** The multipliers of `channels`, for the drawing loops */
+  CustomColorTable colorTable;
+
   /** Samples per pixel */
   unsigned int spp = 0;
 
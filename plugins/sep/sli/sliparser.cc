@@ -0,0 +1,173 @@
+#include "sliparser.hh"
+
+#include <charconv>
+#include <cstdlib>
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <fmt/format.h>
+
+namespace fs = boost::filesystem;
+namespace bi = boost::interprocess;
+
+namespace {
+bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+bool parseInt(std::string_view token, int &value) {
+  if (!token.empty() && token.front() == '+') {
+    token.remove_prefix(1);
+  }
+  const char *end = token.data() + token.size();
+  auto [ptr, ec] = std::from_chars(token.data(), end, value);
+  return ec == std::errc() && ptr == end;
+}
+
+bool parseFloat(std::string_view token, float &value) {
+  // std::from_chars for floating point is not available everywhere yet. The
+  // resolutions are only parsed twice per file, so the copy does not matter.
+  const std::string copy(token);
+  char *end = nullptr;
+  value = std::strtof(copy.c_str(), &end);
+  return !copy.empty() && end == copy.c_str() + copy.size();
+}
+} // namespace
+
+SliParser::SliParser(const std::string &directory_) : directory(directory_) {}
+
+std::vector<std::string_view> SliParser::tokenize(std::string_view line) {
+  std::vector<std::string_view> tokens;
+  size_t pos = 0;
+  while (pos < line.size()) {
+    while (pos < line.size() && isSpace(line[pos])) {
+      pos++;
+    }
+    const size_t start = pos;
+    while (pos < line.size() && !isSpace(line[pos])) {
+      pos++;
+    }
+    if (pos > start) {
+      tokens.push_back(line.substr(start, pos - start));
+    }
+  }
+  return tokens;
+}
+
+bool SliParser::fileExists(const std::string &path) {
+  auto known = exists.find(path);
+  if (known != exists.end()) {
+    return known->second;
+  }
+  boost::system::error_code ec;
+  const bool result = fs::is_regular_file(path, ec);
+  exists.emplace(path, result);
+  return result;
+}
+
+void SliParser::parseLine(std::string_view line, size_t lineNumber) {
+  const std::vector<std::string_view> tokens = tokenize(line);
+  if (tokens.empty()) {
+    return;
+  }
+
+  auto error = [&](const std::string &message) {
+    result.errors.push_back(fmt::format("Line {}: {}", lineNumber, message));
+  };
+
+  const std::string_view first = tokens[0];
+  if (first == "Xresolution:" || first == "Yresolution:") {
+    float &resolution =
+        first == "Xresolution:" ? result.Xresolution : result.Yresolution;
+    if (tokens.size() < 2 || !parseFloat(tokens[1], resolution)) {
+      error(fmt::format("{} is not followed by a number", first));
+    }
+    return;
+  }
+
+  if (first == "varnish_file:") {
+    if (tokens.size() < 2) {
+      error("varnish_file: is not followed by a file name");
+      return;
+    }
+    const std::string name(tokens[1]);
+    const std::string path = (fs::path(directory) / name).string();
+    if (!fileExists(path)) {
+      error(fmt::format("Varnish file not found: {}", path));
+      return;
+    }
+    result.varnishName = name;
+    result.varnishPath = path;
+    return;
+  }
+
+  // Any other line contains the name of an existing file, optionally followed
+  // by a colon and the offsets
+  SliFileLayer layer;
+  layer.name = std::string(first);
+  layer.filepath = (fs::path(directory) / layer.name).string();
+  if (!fileExists(layer.filepath)) {
+    error(fmt::format("Token '{}' in SLI file is not an existing file", first));
+    return;
+  }
+
+  size_t next = 1;
+  if (next < tokens.size() && tokens[next] == ":") {
+    next++;
+  }
+  if (next < tokens.size() && !parseInt(tokens[next++], layer.xoffset)) {
+    error(fmt::format("Invalid x offset '{}'", tokens[next - 1]));
+    return;
+  }
+  if (next < tokens.size() && !parseInt(tokens[next++], layer.yoffset)) {
+    error(fmt::format("Invalid y offset '{}'", tokens[next - 1]));
+    return;
+  }
+  result.layers.push_back(std::move(layer));
+}
+
+SliFile SliParser::parse(std::string_view contents,
+                         const std::string &directory) {
+  SliParser parser(directory);
+
+  size_t lineNumber = 1;
+  while (!contents.empty()) {
+    const size_t end = contents.find('\n');
+    parser.parseLine(contents.substr(0, end), lineNumber++);
+    if (end == std::string_view::npos) {
+      break;
+    }
+    contents.remove_prefix(end + 1);
+  }
+
+  return parser.result;
+}
+
+SliFile SliParser::parseFile(const std::string &path) {
+  const std::string directory = fs::path(path).parent_path().string();
+
+  boost::system::error_code ec;
+  if (!fs::is_regular_file(path, ec)) {
+    SliFile result;
+    result.errors.push_back(fmt::format("Can not read SLI file {}", path));
+    return result;
+  }
+  if (fs::file_size(path, ec) == 0) {
+    // An empty file can not be mapped
+    return parse({}, directory);
+  }
+
+  try {
+    bi::file_mapping file(path.c_str(), bi::read_only);
+    bi::mapped_region region(file, bi::read_only);
+    return parse({static_cast<const char *>(region.get_address()),
+                  region.get_size()},
+                 directory);
+  } catch (const bi::interprocess_exception &ex) {
+    SliFile result;
+    result.errors.push_back(
+        fmt::format("Can not read SLI file {}: {}", path, ex.what()));
+    return result;
+  }
+}
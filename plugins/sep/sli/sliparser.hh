@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/** A layer as listed in an SLI file */
+struct SliFileLayer {
+  /** Absolute path to the TIFF or SEP file of the layer */
+  std::string filepath;
+
+  /** The file name as written in the SLI file */
+  std::string name;
+
+  int xoffset = 0;
+  int yoffset = 0;
+};
+
+/** The contents of an SLI file */
+struct SliFile {
+  /** The resolutions, or -1 if the SLI file does not define them */
+  float Xresolution = -1;
+  float Yresolution = -1;
+
+  /** Absolute path to the varnish file, or empty if there is none */
+  std::string varnishPath;
+
+  /** The varnish file name as written in the SLI file */
+  std::string varnishName;
+
+  std::vector<SliFileLayer> layers;
+
+  /** All problems found in the SLI file, one message per problem */
+  std::vector<std::string> errors;
+};
+
+/**
+ * Parses SLI files. The file is memory mapped and split into lines and tokens
+ * without copying, and every referenced file is checked for existence only
+ * once, so SLI files with many layers parse quickly. Parsing does not stop at
+ * the first problem: all of them are collected in SliFile::errors.
+ */
+class SliParser {
+public: // For testing
+  /** Directory the file names in the SLI file are relative to */
+  std::string directory;
+
+  /** Whether the files referenced so far exist, by absolute path */
+  std::unordered_map<std::string, bool> exists;
+
+  /** The result so far */
+  SliFile result;
+
+  SliParser(const std::string &directory);
+
+  /** Parses line number @param lineNumber, without the newline */
+  void parseLine(std::string_view line, size_t lineNumber);
+
+  /** Returns whether @param path exists, and remembers the answer */
+  bool fileExists(const std::string &path);
+
+  /** Splits @param line into whitespace separated tokens */
+  static std::vector<std::string_view> tokenize(std::string_view line);
+
+public:
+  /**
+   * Parses the SLI file at @param path. A file that can not be read results
+   * in an error.
+   */
+  static SliFile parseFile(const std::string &path);
+
+  /**
+   * Parses the @param contents of an SLI file, resolving file names relative
+   * to @param directory.
+   */
+  static SliFile parse(std::string_view contents,
+                       const std::string &directory);
+};
@@ -1,13 +1,18 @@
 #include "slipresentation.hh"
+#include "../memorybudget.hh"
 #include "../sep-helpers.hh"
+#include "../stats.hh"
+#include "../trace.hh"
+#include "sliparser.hh"
 #include "slisource.hh"
 
 #include "../colorconfig/CustomColorConfig.hh"
 #include "../varnish/varnish.hh"
 
+#include <boost/algorithm/string/join.hpp>
 #include <boost/filesystem.hpp>
+#include <cmath>
 #include <fmt/format.h>
-#include <regex>
 
 #include <scroom/cairo-helpers.hh>
 #include <scroom/unused.hh>
@@ -31,11 +36,16 @@ SliPresentation::create(ScroomInterface::Ptr scroomInterface_) {
   return result;
 }
 
-SliPresentation::~SliPresentation() {}
+SliPresentation::~SliPresentation() {
+  Stats::dumpIfEnabled();
+  Trace::writeIfEnabled();
+}
 
 bool SliPresentation::load(const std::string &fileName) {
   ColorConfig::getInstance().loadFile();
   filepath = fileName;
+  source->layersMemory->setOwner(fileName);
+  source->cacheMemory->setOwner(fileName);
   if (!parseSli(fileName)) {
     return false;
   }
@@ -68,75 +78,43 @@ bool SliPresentation::load(const std::string &fileName) {
 }
 
 bool SliPresentation::parseSli(const std::string &sliFileName) {
-  std::ifstream file(sliFileName);
-  std::string line;
-  std::regex e("\\s+"); // split on whitespaces
-  std::sregex_token_iterator j;
-  namespace fs = boost::filesystem;
-  std::string dirPath = fs::path(sliFileName).parent_path().string();
-
-  // Iterate over the lines
-  while (std::getline(file, line)) {
-    std::sregex_token_iterator i(line.begin(), line.end(), e, -1);
-    // Iterate over the whitespace-separated tokens of the line
-    std::string firstToken = *i++;
-    if (firstToken == "Xresolution:" && i != j) {
-      Xresolution = std::stof(*i++);
-      printf("xresolution: %f\n", Xresolution);
-    } else if (firstToken == "Yresolution:" && i != j) {
-      Yresolution = std::stof(*i++);
-      printf("yresolution: %f\n", Yresolution);
-    } else if (firstToken == "varnish_file:") {
-      std::string varnishFile = std::string(*i++);
-      printf("varnish_file: %s\n", varnishFile.c_str());
-      fs::path imagePath = fs::path(dirPath) /= varnishFile;
-      if (fs::exists(imagePath)) {
-        printf("varnish file exists.\n");
-        SliLayer::Ptr varnishLayer =
-            SliLayer::create(imagePath.string(), varnishFile, 0, 0);
-        if (varnishLayer->fillMetaFromTiff(8, 1)) {
-          varnishLayer->fillBitmapFromTiff();
-          varnish = Varnish::create(varnishLayer);
-          varnish->triggerRedraw = triggerRedrawFunc;
-        } else {
-          std::string error =
-              "Error: Varnish file could not be loaded successfully";
-          printf("%s\n", error.c_str());
-          Show(error, GTK_MESSAGE_ERROR);
-          return false;
-        }
-      } else {
-        auto error = fmt::format("Error: Varnish file not found: {}",
-                                 imagePath.string());
-        printf("%s\n", error.c_str());
-        Show(error, GTK_MESSAGE_ERROR);
-        return false;
-      }
-    } else if (fs::exists(fs::path(dirPath) /= firstToken)) {
-      // Line contains name of an existing file
-      if (i != j && *i == ":") {
-        i++; // discard the colon
-      }
-      int xOffset = 0;
-      int yOffset = 0;
-      if (i != j) {
-        xOffset = std::stoi(*i++);
-      }
-      if (i != j) {
-        yOffset = std::stoi(*i++);
-      }
-      fs::path imagePath = fs::path(dirPath) /= firstToken;
-      if (!source->addLayer(imagePath.string(), firstToken, xOffset, yOffset)) {
-        return false;
-      }
+  SliFile sli = SliParser::parseFile(sliFileName);
+  if (!sli.errors.empty()) {
+    // Report all problems at once, so they can all be fixed at once
+    for (const auto &error : sli.errors) {
+      printf("Error: %s\n", error.c_str());
+    }
+    Show(fmt::format("Error: The SLI file contains errors:\n{}",
+                     boost::algorithm::join(sli.errors, "\n")),
+         GTK_MESSAGE_ERROR);
+    return false;
+  }
+
+  Xresolution = sli.Xresolution;
+  Yresolution = sli.Yresolution;
+  printf("xresolution: %f\n", Xresolution);
+  printf("yresolution: %f\n", Yresolution);
+
+  if (!sli.varnishPath.empty()) {
+    printf("varnish_file: %s\n", sli.varnishName.c_str());
+    SliLayer::Ptr varnishLayer =
+        SliLayer::create(sli.varnishPath, sli.varnishName, 0, 0);
+    if (varnishLayer->fillMetaFromTiff(8, 1)) {
+      varnish = Varnish::create(varnishLayer, source->stats);
+      varnish->triggerRedraw = triggerRedrawFunc;
     } else {
-      auto error = fmt::format(
-          "Error: Token '{}' in SLI file is not an existing file", firstToken);
+      std::string error =
+          "Error: Varnish file could not be loaded successfully";
       printf("%s\n", error.c_str());
       Show(error, GTK_MESSAGE_ERROR);
       return false;
     }
   }
+
+  if (!source->addLayers(sli.layers)) {
+    return false;
+  }
+
   if (Xresolution > 0 && Yresolution > 0 && source->layers.size() > 0) {
     source->queryImportBitmaps();
     return true;
@@ -153,7 +131,9 @@ bool SliPresentation::parseSli(const std::string &sliFileName) {
 void SliPresentation::wipeCacheAndRedraw() { source->wipeCacheAndRedraw(); }
 
 void SliPresentation::triggerRedraw() {
+  Trace::Span wait("ui-wait", "SliPresentation::triggerRedraw");
   Scroom::GtkHelpers::sync_on_ui_thread([&] {
+    Trace::Span span("ui", "SliPresentation::triggerRedraw");
     for (const ViewInterface::WeakPtr &view : views) {
       view.lock()->invalidate();
     }
@@ -161,7 +141,7 @@ void SliPresentation::triggerRedraw() {
 }
 
 boost::dynamic_bitset<> SliPresentation::getVisible() {
-  return source->visible;
+  return source->getVisible();
 }
 
 void SliPresentation::setToggled(boost::dynamic_bitset<> bitmap) {
@@ -181,6 +161,8 @@ void SliPresentation::redraw(ViewInterface::Ptr const &vi, cairo_t *cr,
                              Scroom::Utils::Rectangle<double> presentationArea,
                              int zoom) {
   UNUSED(vi);
+  Trace::Span span("ui", "SliPresentation::redraw");
+  source->cacheMemory->touch();
   Scroom::Utils::Rectangle<double> actualPresentationArea = getRect();
   double pixelSize = pixelSizeFromZoom(zoom);
 
@@ -189,29 +171,49 @@ void SliPresentation::redraw(ViewInterface::Ptr const &vi, cairo_t *cr,
 
   SurfaceWrapper::Ptr surfaceWrap = source->getSurface(zoom);
 
-  // Check if it's not computed yet and we need to draw the waiting rectangle
+  // Check if it's not computed yet and we need to draw the preview, or the
+  // waiting rectangle if there is none. Don't wait for what failed.
   if (surfaceWrap == nullptr) {
-    drawRectangle(cr, Color(0.5, 1, 0.5),
-                  pixelSize *
-                      (actualPresentationArea - presentationArea.getTopLeft()));
+    uint32_t factor = 0;
+    SurfaceWrapper::Ptr preview = source->getPreview(factor);
+    if (preview) {
+      drawReduced(cr, preview, factor, presentationArea, pixelSize);
+    } else if (!source->cacheFailed) {
+      drawRectangle(
+          cr, Color(0.5, 1, 0.5),
+          pixelSize * (actualPresentationArea - presentationArea.getTopLeft()));
+    }
     return;
   }
 
-  // The level that we need is in the cache, so draw it!
-  cairo_save(cr);
-  cairo_translate(cr, -presentationArea.getLeft() * pixelSize,
-                  -presentationArea.getTop() * pixelSize);
-  if (zoom >= 0) {
-    // We're using the bottom bitmap, hence we have to scale
-    cairo_scale(cr, pixelSize, pixelSize);
-    cairo_set_source_surface(cr, surfaceWrap->surface, 0, 0);
-    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
-  } else {
-    // Cached and reduced bitmap is already to scale
-    cairo_set_source_surface(cr, surfaceWrap->surface, 0, 0);
+  // The level that we need is in the cache, so draw it! Cairo can't handle
+  // surfaces larger than 32767 pixels, so only the visible part is drawn.
+  // The bottom bitmap is scaled, the reduced bitmaps are already to scale.
+  const double scale = zoom >= 0 ? 1 : pixelSize;
+  const int left = static_cast<int>(floor(presentationArea.getLeft() * scale));
+  const int top = static_cast<int>(floor(presentationArea.getTop() * scale));
+  const int right = static_cast<int>(ceil(presentationArea.getRight() * scale));
+  const int bottom =
+      static_cast<int>(ceil(presentationArea.getBottom() * scale));
+  Scroom::Utils::Rectangle<int> area =
+      Scroom::Utils::Rectangle<int>{left, top, right - left, bottom - top}
+          .intersection(surfaceWrap->toRectangle());
+  cairo_surface_t *visible = surfaceWrap->createSubSurface(area);
+  if (visible != nullptr) {
+    cairo_save(cr);
+    cairo_translate(cr, -presentationArea.getLeft() * pixelSize,
+                    -presentationArea.getTop() * pixelSize);
+    if (zoom >= 0) {
+      cairo_scale(cr, pixelSize, pixelSize);
+    }
+    cairo_set_source_surface(cr, visible, area.getLeft(), area.getTop());
+    if (zoom >= 0) {
+      cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+    }
+    cairo_paint(cr);
+    cairo_restore(cr);
+    cairo_surface_destroy(visible);
   }
-  cairo_paint(cr);
-  cairo_restore(cr);
 
   /* --> Draw The varnish overlay if it exists */
   if (varnish) {
@@ -220,6 +222,11 @@ void SliPresentation::redraw(ViewInterface::Ptr const &vi, cairo_t *cr,
 }
 
 bool SliPresentation::getProperty(const std::string &name, std::string &value) {
+  if (source->stats->getProperty(name, value) ||
+      MemoryBudget::getInstance().getProperty(name, value)) {
+    return true;
+  }
+
   std::map<std::string, std::string>::iterator p = properties.find(name);
   bool found = false;
   if (p == properties.end()) {
@@ -234,7 +241,10 @@ bool SliPresentation::getProperty(const std::string &name, std::string &value) {
 }
 
 bool SliPresentation::isPropertyDefined(const std::string &name) {
-  return properties.end() != properties.find(name);
+  std::string value;
+  return properties.end() != properties.find(name) ||
+         source->stats->getProperty(name, value) ||
+         MemoryBudget::getInstance().getProperty(name, value);
 }
 
 std::string SliPresentation::getTitle() { return filepath; }
@@ -261,11 +271,18 @@ void SliPresentation::viewAdded(ViewInterface::WeakPtr vi) {
     }
   }
 
+  if (varnish) {
+    varnish->open(vi);
+  }
+
   views.insert(vi);
 }
 
 void SliPresentation::viewRemoved(ViewInterface::WeakPtr vi) {
   views.erase(vi);
+  if (varnish) {
+    varnish->close(vi);
+  }
   // If the view contains the control panel, attach the control panel to another
   // view
   if (!views.empty() && vi.lock() == controlPanel->viewWeak.lock()) {
@@ -288,50 +305,7 @@ PipetteLayerOperations::PipetteColor SliPresentation::getPixelAverages(
   if (area.isEmpty())
     return {};
 
-  auto surfaceWrapper = source->getSurface(0);
-  int stride = surfaceWrapper->getStride();
-  uint8_t *surfaceBegin = cairo_image_surface_get_data(surfaceWrapper->surface);
-  Scroom::Utils::Rectangle<int> intersectionPixels =
-      area.intersection(surfaceWrapper->toRectangle());
-  Scroom::Utils::Rectangle<int> intersectionBytes =
-      toBytesRectangle(intersectionPixels);
-  int offset = pointToOffset(intersectionBytes.getTopLeft(), stride);
-  int offsetEnd =
-      pointToOffset(intersectionBytes.getBottomRight(), stride) - stride;
-
-  uint8_t A;
-  double R, G, B, c, m, y, k;
-  double C = 0, Y = 0, M = 0, K = 0;
-
-  for (; offset < offsetEnd; offset += 4) // SPP = 4
-  {
-    if (offset % stride == intersectionBytes.getRight() % stride)
-      offset += stride - intersectionBytes.getWidth();
-
-    B = surfaceBegin[offset + 0];
-    G = surfaceBegin[offset + 1];
-    R = surfaceBegin[offset + 2];
-    A = surfaceBegin[offset + 3];
-
-    c = (255.0 - R);
-    m = (255.0 - G);
-    y = (255.0 - B);
-    k = std::min({c, m, y});
-
-    // transparent -> only the white background of Scroom remains visible
-    if (A != 0) {
-      C += c - k;
-      M += m - k;
-      Y += y - k;
-      K += k;
-    }
-  }
-
-  PipetteLayerOperations::PipetteColor result = {
-      {"C", C / getArea(intersectionPixels)},
-      {"M", M / getArea(intersectionPixels)},
-      {"Y", Y / getArea(intersectionPixels)},
-      {"K", K / getArea(intersectionPixels)}};
-
-  return result;
+  // Integrate the native channel data of the layers, rather than
+  // reconstructing CMYK from the (lossy) RGB cache
+  return source->averageVisibleChannels(area);
 }
\ No newline at end of file
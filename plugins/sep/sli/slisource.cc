@@ -1,10 +1,20 @@
 #include "slisource.hh"
+#include "../colorconfig/CustomColorConfig.hh"
 #include "../colorconfig/CustomColorHelpers.hh"
+#include "../diskcache.hh"
+#include "../probes.hh"
 #include "../sep-helpers.hh"
 #include "../sepsource.hh"
+#include "../stats.hh"
+#include "../trace.hh"
 
 #include <scroom/bitmap-helpers.hh>
+#include <scroom/gtk-helpers.hh>
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <boost/thread.hpp>
 #include <fmt/format.h>
 
 SliSource::SliSource(boost::function<void()> &triggerRedrawFunc)
@@ -15,7 +25,122 @@ SliSource::SliSource(boost::function<void()> &triggerRedrawFunc)
 SliSource::~SliSource() {}
 
 SliSource::Ptr SliSource::create(boost::function<void()> &triggerRedrawFunc) {
-  return Ptr(new SliSource(triggerRedrawFunc));
+  Ptr result(new SliSource(triggerRedrawFunc));
+  WeakPtr weakResult = result;
+  MemoryBudget &budget = MemoryBudget::getInstance();
+  // The layers can't be shed, as every composite is computed from them
+  result->layersMemory = budget.createAccount("sli.layers");
+  result->previewMemory = budget.createAccount("sli.preview");
+  result->cacheMemory = budget.createAccount("sli.rgbCache", [weakResult] {
+    Ptr self = weakResult.lock();
+    if (self) {
+      self->shedCache();
+    }
+  });
+  return result;
+}
+
+PipetteLayerOperations::PipetteColor
+SliSource::averageVisibleChannels(Scroom::Utils::Rectangle<int> area) {
+  if (!importBitmaps())
+    return {};
+
+  area = area.intersection({0, 0, total_width, total_height});
+  if (area.isEmpty())
+    return {};
+
+  // The layers that are visible now, even if they are still being drawn
+  const boost::dynamic_bitset<> visibleLayers = getVisible();
+
+  // Give every channel name a slot, in order of appearance
+  std::vector<std::string> names;
+  std::vector<std::vector<size_t>> slots(layers.size());
+  for (size_t j = 0; j < layers.size(); j++) {
+    for (auto &channel : layers[j]->channels) {
+      auto name = std::find(names.begin(), names.end(), channel->name);
+      slots[j].push_back(name - names.begin());
+      if (name == names.end())
+        names.push_back(channel->name);
+    }
+  }
+
+  // Divide the rows into jobs, but don't bother with jobs for small areas
+  const int minRowsPerJob = 64;
+  const int nJobs = std::max(
+      1, std::min(static_cast<int>(boost::thread::hardware_concurrency()),
+                  area.getHeight() / minRowsPerJob));
+  const int rowsPerJob = (area.getHeight() + nJobs - 1) / nJobs;
+
+  std::vector<std::vector<uint64_t>> sums(
+      nJobs, std::vector<uint64_t>(names.size(), 0));
+  // The threads are joined below, so they can refer to the locals
+  boost::thread_group threads;
+  for (int t = 1; t < nJobs; t++) {
+    const int top = area.getTop() + t * rowsPerJob;
+    const int bottom = std::min(top + rowsPerJob, area.getBottom());
+    threads.create_thread([&, top, bottom, t] {
+      sumVisibleRows(area, top, bottom, visibleLayers, slots, sums[t]);
+    });
+  }
+  sumVisibleRows(area, area.getTop(),
+                 std::min(area.getTop() + rowsPerJob, area.getBottom()),
+                 visibleLayers, slots, sums[0]);
+  threads.join_all();
+
+  PipetteLayerOperations::PipetteColor result;
+  const double pixels = getArea(area);
+  for (size_t i = 0; i < names.size(); i++) {
+    uint64_t total = 0;
+    for (auto &jobSums : sums)
+      total += jobSums[i];
+    result.push_back({names[i], total / pixels});
+  }
+  return result;
+}
+
+boost::dynamic_bitset<> SliSource::getVisible() {
+  boost::mutex::scoped_lock lock(visibleMutex);
+  return visible;
+}
+
+void SliSource::sumVisibleRows(Scroom::Utils::Rectangle<int> area, int top,
+                               int bottom,
+                               const boost::dynamic_bitset<> &visibleLayers,
+                               const std::vector<std::vector<size_t>> &slots,
+                               std::vector<uint64_t> &sums) {
+  for (size_t j = 0; j < layers.size(); j++) { // For every layer
+    if (!visibleLayers[j])
+      continue;
+
+    auto &layer = layers[j];
+    Scroom::Utils::Rectangle<int> rows{area.getLeft(), top, area.getWidth(),
+                                       bottom - top};
+    Scroom::Utils::Rectangle<int> intersectRect =
+        rows.intersection(layer->toRectangle());
+    if (intersectRect.isEmpty() || !layer->bitmap)
+      continue;
+
+    const int spp = layer->spp;
+    const size_t rowLength = static_cast<size_t>(layer->width) * spp;
+    // Sum per channel of this layer first, to keep the inner loop simple
+    std::vector<uint64_t> layerSums(spp, 0);
+
+    for (int y = intersectRect.getTop(); y < intersectRect.getBottom(); y++) {
+      const uint8_t *cur =
+          layer->bitmap.get() + (y - layer->yoffset) * rowLength +
+          static_cast<size_t>(intersectRect.getLeft() - layer->xoffset) * spp;
+      const uint8_t *end =
+          cur + static_cast<size_t>(intersectRect.getWidth()) * spp;
+
+      for (; cur < end; cur += spp) {
+        for (int i = 0; i < spp; i++)
+          layerSums[i] += cur[i];
+      }
+    }
+
+    for (int i = 0; i < spp; i++)
+      sums[slots[j][i]] += layerSums[i];
+  }
 }
 
 void SliSource::computeHeightWidth() {
@@ -32,50 +157,304 @@ void SliSource::checkXoffsets() {
   }
 }
 
-bool SliSource::addLayer(std::string imagePath, std::string filename,
-                         int xOffset, int yOffset) {
-
+SliLayer::Ptr SliSource::createLayer(const std::string &imagePath,
+                                     const std::string &filename, int xOffset,
+                                     int yOffset, SepSource::Ptr &sep) {
   auto extension = filename.substr(filename.find_last_of("."));
   boost::to_lower(extension);
 
   SliLayer::Ptr layer = SliLayer::create(imagePath, filename, xOffset, yOffset);
 
   if (extension == ".sep") {
-    sepSources[layer] = SepSource::create();
-    sepSources[layer]->fillSliLayerMeta(layer);
+    sep = SepSource::create();
+    sep->stats = stats;
+    sep->fillSliLayerMeta(layer);
+    // Don't keep the files of every layer open until the bitmaps are read
+    sep->done();
   } else if (extension == ".tif" || extension == ".tiff") {
     if (!layer->fillMetaFromTiff(8, 4)) {
-      return false;
+      return nullptr;
     }
   } else {
     auto error =
         fmt::format("Error: File extension of {} is not supported", filename);
     printf("%s\n", error.c_str());
     Show(error, GTK_MESSAGE_ERROR);
+    return nullptr;
+  }
+  return layer;
+}
+
+bool SliSource::addLayer(std::string imagePath, std::string filename,
+                         int xOffset, int yOffset) {
+  SepSource::Ptr sep;
+  SliLayer::Ptr layer = createLayer(imagePath, filename, xOffset, yOffset, sep);
+  if (!layer) {
     return false;
   }
+  if (sep) {
+    sepSources[layer] = sep;
+  }
   layers.push_back(layer);
   return true;
 }
 
-void SliSource::importBitmaps() {
+bool SliSource::addLayers(const std::vector<SliFileLayer> &files) {
+  struct Probe {
+    SliLayer::Ptr layer;
+    SepSource::Ptr sep;
+    std::vector<std::pair<std::string, GtkMessageType>> messages;
+  };
+  std::vector<Probe> probes(files.size());
+  std::atomic<size_t> next{0};
+
+  auto probeFiles = [&files, &probes, &next] {
+    CollectShownMessages collect;
+    for (size_t i = next++; i < files.size(); i = next++) {
+      const SliFileLayer &file = files[i];
+      try {
+        probes[i].layer = createLayer(file.filepath, file.name, file.xoffset,
+                                      file.yoffset, probes[i].sep);
+      } catch (const std::exception &ex) {
+        auto error = fmt::format("Error: {}", ex.what());
+        printf("%s\n", error.c_str());
+        Show(error, GTK_MESSAGE_ERROR);
+      }
+      probes[i].messages.swap(collect.messages);
+    }
+  };
+
+  const int nThreads =
+      std::min(MAX_PROBE_THREADS, static_cast<int>(files.size()));
+  boost::thread_group threads;
+  for (int t = 0; t < nThreads; t++) {
+    threads.create_thread(probeFiles);
+  }
+  threads.join_all();
+
+  // Merge in the order of the SLI file, and show the messages the threads
+  // could not show
+  for (Probe &probe : probes) {
+    for (const auto &message : probe.messages) {
+      Show(message.first, message.second);
+    }
+    if (!probe.layer) {
+      return false;
+    }
+    if (probe.sep) {
+      sepSources[probe.layer] = probe.sep;
+    }
+    layers.push_back(probe.layer);
+  }
+  return true;
+}
+
+std::string SliSource::computeDiskCacheKey() {
+  // The key covers all files, and the offsets the layers are drawn at
+  std::vector<std::string> files;
+  std::string offsets;
   for (SliLayer::Ptr layer : layers) {
-    auto extension = layer->name.substr(layer->name.find_last_of("."));
-    boost::to_lower(extension);
+    files.push_back(layer->filepath);
+    auto sep = sepSources.find(layer);
+    if (sep != sepSources.end()) {
+      for (const auto &channel : sep->second->sep_file.files) {
+        files.push_back(channel.second.string());
+      }
+    }
+    offsets += fmt::format("{},{};", layer->xoffset, layer->yoffset);
+  }
+  // The cache holds the composite in RGB, which depends on the colors
+  return DiskCache::computeKey(
+      files,
+      fmt::format("{}{}", offsets, ColorConfig::getInstance().getHash()));
+}
 
-    if (extension == ".sep") {
-      sepSources[layer]->fillSliLayerBitmap(layer);
-    } else {
-      layer->fillBitmapFromTiff();
+bool SliSource::importBitmaps() {
+  boost::mutex::scoped_lock lock(importMutex);
+  if (bitmapsImported || cacheFailed) {
+    return bitmapsImported;
+  }
+  Stats::ScopedTimer timer(stats->importBitmaps);
+
+  try {
+    for (SliLayer::Ptr layer : layers) {
+      auto extension = layer->name.substr(layer->name.find_last_of("."));
+      boost::to_lower(extension);
+
+      if (extension == ".sep") {
+        sepSources[layer]->fillSliLayerBitmap(layer);
+        sepSources[layer]->done();
+      } else {
+        layer->fillBitmapFromTiff();
+      }
+      timer.addPixels(static_cast<uint64_t>(layer->width) * layer->height);
+    }
+  } catch (const std::exception &ex) {
+    // Most likely a layer that does not fit in memory
+    auto error = fmt::format("Error: Can not import the layers: {}", ex.what());
+    printf("%s\n", error.c_str());
+    Scroom::GtkHelpers::async_on_ui_thread([error] { ShowWarning(error); });
+    for (SliLayer::Ptr layer : layers) {
+      layer->bitmap.reset();
+      if (sepSources.count(layer)) {
+        sepSources[layer]->done();
+      }
     }
+    cacheFailed = true;
+    triggerRedraw();
+    return false;
+  }
+
+  size_t bytes = 0;
+  for (SliLayer::Ptr layer : layers) {
+    bytes += static_cast<size_t>(layer->width) * layer->height * layer->spp;
   }
+  layersMemory->set(bytes);
   bitmapsImported = true;
+  return true;
+}
+
+std::vector<std::string> SliSource::layerFiles(const SliLayer::Ptr &layer) {
+  auto sep = sepSources.find(layer);
+  if (sep == sepSources.end()) {
+    return {layer->filepath};
+  }
+  std::vector<std::string> files;
+  for (const auto &channel : sep->second->channels) {
+    files.push_back(sep->second->sep_file.files.at(channel).string());
+  }
+  return files;
+}
+
+SurfaceWrapper::Ptr SliSource::compositeOverviews(uint32_t &factor) {
+  const uint32_t limit = std::max(total_width, total_height) / previewSize;
+  if (limit < 2 || layers.empty()) {
+    return nullptr;
+  }
+  Stats::ScopedTimer timer(stats->overviews);
+
+  // The layers are composited at a single factor, which all files must have
+  std::vector<std::vector<std::string>> files;
+  std::vector<std::vector<TiffOverviews::Overview>> overviews;
+  for (const SliLayer::Ptr &layer : layers) {
+    files.push_back(layerFiles(layer));
+    for (const auto &file : files.back()) {
+      overviews.push_back(TiffOverviews::find(file));
+    }
+  }
+  factor = TiffOverviews::commonFactor(overviews, limit);
+  if (factor == 0) {
+    return nullptr;
+  }
+
+  const int width = static_cast<int>((total_width + factor - 1) / factor);
+  const int height = static_cast<int>((total_height + factor - 1) / factor);
+  std::vector<uint8_t> cmyk(static_cast<size_t>(width) * height * 4, 0);
+  auto first = overviews.begin();
+  for (size_t j = 0; j < layers.size(); j++) {
+    const SliLayer::Ptr &layer = layers[j];
+    const std::vector<std::vector<TiffOverviews::Overview>> layerOverviews(
+        first, first + files[j].size());
+    first += files[j].size();
+
+    uint32_t layerWidth = 0;
+    uint32_t layerHeight = 0;
+    const std::vector<uint8_t> samples = TiffOverviews::readInterleaved(
+        files[j], layerOverviews, factor, layerWidth, layerHeight);
+    const size_t spp = layer->spp;
+    if (samples.size() != static_cast<size_t>(layerWidth) * layerHeight * spp) {
+      return nullptr;
+    }
+
+    // Same as drawCmyk(), at the reduced offsets
+    const CustomColorTable &colorTable = layer->colorTable;
+    const int left = layer->xoffset / static_cast<int>(factor);
+    const int top = layer->yoffset / static_cast<int>(factor);
+    for (int y = 0; y < static_cast<int>(layerHeight); y++) {
+      if (top + y < 0 || top + y >= height) {
+        continue;
+      }
+      for (int x = 0; x < static_cast<int>(layerWidth); x++) {
+        if (left + x < 0 || left + x >= width) {
+          continue;
+        }
+        uint8_t *target =
+            &cmyk[(static_cast<size_t>(top + y) * width + left + x) * 4];
+        const uint8_t *pixel =
+            &samples[(static_cast<size_t>(y) * layerWidth + x) * spp];
+        int16_t C = target[0];
+        int16_t M = target[1];
+        int16_t Y = target[2];
+        int16_t K = target[3];
+        for (size_t s = 0; s < spp; s++) {
+          colorTable.calculateCMYK(s, C, M, Y, K, pixel[s]);
+        }
+        target[0] = CustomColorHelpers::toUint8(C);
+        target[1] = CustomColorHelpers::toUint8(M);
+        target[2] = CustomColorHelpers::toUint8(Y);
+        target[3] = CustomColorHelpers::toUint8(K);
+      }
+    }
+    timer.addPixels(static_cast<uint64_t>(layerWidth) * layerHeight);
+  }
+
+  SurfaceWrapper::Ptr surface;
+  try {
+    surface = SurfaceWrapper::create(width, height, CAIRO_FORMAT_ARGB32);
+  } catch (const std::exception &) {
+    return nullptr;
+  }
+  surface->flush();
+  for (int y = 0; y < height; y++) {
+    auto *row = reinterpret_cast<uint32_t *>(surface->getBitmap() +
+                                             y * surface->getStride());
+    const uint8_t *pixel = &cmyk[static_cast<size_t>(y) * width * 4];
+    for (int x = 0; x < width; x++, pixel += 4) {
+      row[x] = CustomColorHelpers::cmykToARGB(pixel[0], pixel[1], pixel[2],
+                                              pixel[3]);
+    }
+  }
+  surface->markDirty();
+  return surface;
+}
+
+void SliSource::computePreview() {
+  Trace::Span job("job", "SliSource::computePreview");
+  uint32_t factor = 0;
+  SurfaceWrapper::Ptr surface = compositeOverviews(factor);
+  if (!surface) {
+    return;
+  }
+
+  WeakPtr weakThis = shared_from_this<SliSource>();
+  Scroom::GtkHelpers::async_on_ui_thread([weakThis, surface, factor] {
+    Ptr self = weakThis.lock();
+    if (self) {
+      self->preview = surface;
+      self->previewFactor = factor;
+      self->previewMemory->set(surface->getStride() * surface->getHeight());
+    }
+  });
+  // Invalidates the views after the preview has been stored
   triggerRedraw();
 }
 
+SurfaceWrapper::Ptr SliSource::getPreview(uint32_t &factor) {
+  // Once layers have been toggled, the preview no longer matches
+  if (!preview || !(visible ^ toggled).all()) {
+    return nullptr;
+  }
+  factor = previewFactor;
+  return preview;
+}
+
 void SliSource::queryImportBitmaps() {
   CpuBound()->schedule(
-      boost::bind(&SliSource::importBitmaps, shared_from_this<SliSource>()),
+      boost::bind(&SliSource::computePreview, shared_from_this<SliSource>()),
+      PRIO_HIGHEST, threadQueue);
+  fillCacheQueued = true;
+  CpuBound()->schedule(
+      boost::bind(&SliSource::fillCache, shared_from_this<SliSource>()),
       PRIO_HIGHER, threadQueue);
 }
 
@@ -85,12 +464,15 @@ void SliSource::wipeCacheAndRedraw() {
 }
 
 SurfaceWrapper::Ptr SliSource::getSurface(int zoom) {
-  if (!bitmapsImported) {
+  if (cacheFailed) {
     return nullptr;
   } else if (!rgbCache.count(std::min(0, zoom)) || rgbCache.at(0)->clear) {
-    CpuBound()->schedule(
-        boost::bind(&SliSource::fillCache, shared_from_this<SliSource>()),
-        PRIO_HIGHER, threadQueue);
+    // Every redraw asks for the surface, but one job fills all levels
+    if (!fillCacheQueued.exchange(true)) {
+      CpuBound()->schedule(
+          boost::bind(&SliSource::fillCache, shared_from_this<SliSource>()),
+          PRIO_HIGHER, threadQueue);
+    }
     if (rgbCache.count(std::min(0, zoom))) {
       return rgbCache.at(std::min(0, zoom));
     }
@@ -100,36 +482,169 @@ SurfaceWrapper::Ptr SliSource::getSurface(int zoom) {
   }
 }
 void SliSource::fillCache() {
+  Trace::Span job("job", "SliSource::fillCache");
+  // width, height, layers to toggle
+  SPSEP_PROBE3(fillCache__entry, total_width, total_height, toggled.count());
+  Trace::Span wait("lock", "SliSource::mtx wait");
   mtx.lock();
+  wait.end();
+  // Changes from here on schedule another job
+  fillCacheQueued = false;
+  Trace::Span held("lock", "SliSource::mtx held");
   disableInteractions();
-  visible ^= toggled;
+  {
+    boost::mutex::scoped_lock lock(visibleMutex);
+    visible ^= toggled;
+  }
+  if (!rgbCache.count(0)) {
+    // Either the first time, or the cache was shed: draw everything
+    toggled.set();
+  }
 
   if (!rgbCache.count(0) || rgbCache.at(0)->clear) {
-    computeRgb();
+    if (!diskCacheKeyComputed) {
+      diskCacheKey = computeDiskCacheKey();
+      diskCacheKeyComputed = true;
+    }
+    // The disk cache can only provide the initial state, with all layers
+    // visible. The layers are only imported once they have to be composited.
+    const bool allVisible = visible.all() && toggled.all();
+    if (!allVisible || rgbCache.count(0) || !loadDiskCache()) {
+      bool drawn = importBitmaps();
+      try {
+        if (drawn) {
+          computeRgb();
+
+          for (int i = -1; i >= -30; i--) {
+            // true -> uses multithreading
+            reduceRgb(i, true);
+          }
+        }
+      } catch (const std::exception &ex) {
+        auto error = fmt::format("Error: Can not draw {} x {} pixels: {}",
+                                 total_width, total_height, ex.what());
+        printf("%s\n", error.c_str());
+        Scroom::GtkHelpers::async_on_ui_thread(
+            [error] { ShowWarning(error); });
+        drawn = false;
+      }
+
+      if (!drawn) {
+        rgbCache.clear();
+        cacheMemory->set(0);
+        cacheFailed = true;
+        toggled.reset();
+        enableInteractions();
+        held.end();
+        mtx.unlock();
+        // width, height, whether the cache could be filled
+        SPSEP_PROBE3(fillCache__return, total_width, total_height, 0);
+        return;
+      }
 
-    for (int i = -1; i >= -30; i--) {
-      // true -> uses multithreading
-      reduceRgb(i, true);
+      if (allVisible) {
+        storeDiskCache();
+      }
     }
   }
 
   rgbCache.at(0)->clear = false;
   toggled.reset();
+  cacheMemory->set(cacheBytes());
   enableInteractions();
+  held.end();
   mtx.unlock();
+  SPSEP_PROBE3(fillCache__return, total_width, total_height, 1);
   triggerRedraw();
 }
 
+bool SliSource::loadDiskCache() {
+  if (diskCacheKey.empty()) {
+    return false;
+  }
+
+  std::map<int, SurfaceWrapper::Ptr> levels;
+  for (int zoom = 0; zoom >= -30; zoom--) {
+    const int width = total_width / pow(2, -zoom);
+    const int height = total_height / pow(2, -zoom);
+
+    DiskCache::Entry::Ptr entry =
+        DiskCache::open(diskCacheKey, fmt::format("level{}", -zoom));
+    if (!entry || entry->header.width != width ||
+        entry->header.height != height ||
+        static_cast<size_t>(entry->header.stride) !=
+            SurfaceWrapper::strideForWidth(width)) {
+      return false;
+    }
+    levels[zoom] = SurfaceWrapper::create(entry->data(), width, height,
+                                          entry->header.stride, entry);
+  }
+
+  rgbCache = levels;
+  return true;
+}
+
+void SliSource::storeDiskCache() {
+  if (diskCacheKey.empty() ||
+      DiskCache::open(diskCacheKey, fmt::format("level{}", 30))) {
+    return;
+  }
+
+  // The last level is stored last, so its presence means all levels are
+  for (int zoom = 0; zoom >= -30; zoom--) {
+    SurfaceWrapper::Ptr &surface = rgbCache.at(zoom);
+    surface->flush();
+    if (surface->getStride() > static_cast<size_t>(INT_MAX) ||
+        !DiskCache::store(diskCacheKey, fmt::format("level{}", -zoom),
+                          surface->getWidth(), surface->getHeight(),
+                          static_cast<int>(surface->getStride()),
+                          surface->getBitmap())) {
+      return;
+    }
+  }
+}
+
+size_t SliSource::cacheBytes() {
+  size_t bytes = 0;
+  for (const auto &level : rgbCache) {
+    bytes += level.second->getHeight() * level.second->getStride();
+  }
+  return bytes;
+}
+
+void SliSource::shedCache() {
+  // The surfaces are read on the UI thread without locking, so they can only
+  // be dropped there
+  WeakPtr weakThis = shared_from_this<SliSource>();
+  Scroom::GtkHelpers::async_on_ui_thread([weakThis] {
+    Ptr self = weakThis.lock();
+    if (!self) {
+      return;
+    }
+    // The cache is in use while it is being filled, so keep it then
+    if (self->mtx.try_lock()) {
+      self->rgbCache.clear();
+      self->cacheMemory->set(0);
+      self->mtx.unlock();
+    } else {
+      self->cacheMemory->shedFailed();
+    }
+  });
+}
+
 void SliSource::reduceSegments(SurfaceWrapper::Ptr targetSurface,
                                boost::dynamic_bitset<> toggledSegments,
                                int baseSegHeight, int zoom) {
+  // zoom, segments to reduce, height of a segment at zoom 0
+  SPSEP_PROBE3(reduceSegments__entry, zoom, toggledSegments.count(),
+               baseSegHeight);
   for (int i = 0; i < static_cast<int>(toggledSegments.size()); i++) {
     if (!toggledSegments[i])
       continue;
 
     const int sourceWidth = total_width / pow(2, -zoom - 1);
-    const int sourceOffset = (baseSegHeight / pow(2, -zoom - 1)) * i;
-    const int sourceStride = rgbCache.at(zoom + 1)->getStride();
+    const size_t sourceOffset = (baseSegHeight / pow(2, -zoom - 1)) * i;
+    const size_t sourceStride = rgbCache.at(zoom + 1)->getStride();
 
     int targetSegHeight;
     if (i == static_cast<int>(toggledSegments.size()) - 1) {
@@ -141,12 +656,12 @@ void SliSource::reduceSegments(SurfaceWrapper::Ptr targetSurface,
     }
 
     const int targetWidth = sourceWidth / 2;
-    const int targetOffset = (baseSegHeight / pow(2, -zoom)) * i;
-    auto targetStride = targetSurface->getStride();
+    const size_t targetOffset = (baseSegHeight / pow(2, -zoom)) * i;
+    const size_t targetStride = targetSurface->getStride();
     auto targetBitmap =
         targetSurface->getBitmap() + targetOffset * targetStride;
 
-    for (int y = 0; y < targetSegHeight; y++) {
+    for (size_t y = 0; y < static_cast<size_t>(targetSegHeight); y++) {
       auto sourceBitmap1 = rgbCache.at(zoom + 1)->getBitmap() +
                            2 * y * sourceStride + sourceOffset * sourceStride;
       auto sourceBitmap2 = sourceBitmap1 + sourceStride;
@@ -171,13 +686,18 @@ void SliSource::reduceSegments(SurfaceWrapper::Ptr targetSurface,
       }
     }
   }
+  SPSEP_PROBE3(reduceSegments__return, zoom, toggledSegments.count(),
+               baseSegHeight);
 }
 
 void SliSource::reduceRgb(int zoom, bool multithreading) {
+  Stats::ScopedTimer timer(stats->reduceRgb);
   // the total width of the reduced image
   const int totalTargetWidth = total_width / pow(2, -zoom);
   // the total height of the reduced image
   const int totalTargetHeight = total_height / pow(2, -zoom);
+  timer.addPixels(4 * static_cast<uint64_t>(totalTargetWidth) *
+                  totalTargetHeight);
 
   // create a new surface for this zoom level, unless it already exists
   SurfaceWrapper::Ptr targetSurface = SurfaceWrapper::create();
@@ -229,13 +749,14 @@ void SliSource::reduceRgb(int zoom, bool multithreading) {
 }
 
 void SliSource::convertCmykXoffset(uint8_t *surfacePointer,
-                                   uint32_t *targetPointer, int topLeftOffset,
-                                   int bottomRightOffset, int toggledWidth,
-                                   int toggledBound, int stride) {
+                                   uint32_t *targetPointer,
+                                   int64_t topLeftOffset,
+                                   int64_t bottomRightOffset, int toggledWidth,
+                                   int64_t toggledBound, int64_t stride) {
   double black;
   uint8_t C, M, Y, K, A, R, G, B;
 
-  for (int i = topLeftOffset; i < bottomRightOffset;) {
+  for (int64_t i = topLeftOffset; i < bottomRightOffset;) {
     C = surfacePointer[i + 0];
     M = surfacePointer[i + 1];
     Y = surfacePointer[i + 2];
@@ -258,32 +779,21 @@ void SliSource::convertCmykXoffset(uint8_t *surfacePointer,
 }
 
 void SliSource::convertCmyk(uint8_t *surfacePointer, uint32_t *targetPointer,
-                            int topLeftOffset, int bottomRightOffset) {
-  double black;
-  uint8_t C, M, Y, K, A, R, G, B;
-
-  for (int i = topLeftOffset; i < bottomRightOffset; i += 4) // SPP = 4
+                            int64_t topLeftOffset, int64_t bottomRightOffset) {
+  for (int64_t i = topLeftOffset; i < bottomRightOffset; i += 4) // SPP = 4
   {
-    C = surfacePointer[i + 0];
-    M = surfacePointer[i + 1];
-    Y = surfacePointer[i + 2];
-    K = surfacePointer[i + 3];
-
-    black = (1 - K / 255.0);
-    A = 255;
-    R = 255 * (1 - C / 255.0) * black;
-    G = 255 * (1 - M / 255.0) * black;
-    B = 255 * (1 - Y / 255.0) * black;
-
-    targetPointer[i / 4] = (A << 24) | (R << 16) | (G << 8) | B;
+    targetPointer[i / 4] = CustomColorHelpers::cmykToARGB(
+        surfacePointer[i + 0], surfacePointer[i + 1], surfacePointer[i + 2],
+        surfacePointer[i + 3]);
   }
 }
 
 void SliSource::drawCmyk(uint8_t *surfacePointer, uint8_t *bitmap,
-                         int bitmapStart, int bitmapOffset,
+                         int64_t bitmapStart, int64_t bitmapOffset,
                          SliLayer::Ptr layer) {
+  const CustomColorTable &colorTable = layer->colorTable;
 
-  for (int i = bitmapStart; i < bitmapStart + bitmapOffset;
+  for (int64_t i = bitmapStart; i < bitmapStart + bitmapOffset;
        i += layer->spp) {        // Iterate over all pixels
     int16_t C = *surfacePointer; // Initialize the CMYK holder values to the
                                  // current values for their color
@@ -292,8 +802,7 @@ void SliSource::drawCmyk(uint8_t *surfacePointer, uint8_t *bitmap,
     int16_t K = *(surfacePointer + 3);
     for (uint16_t j = 0; j < layer->spp;
          j++) { // Add values to the 32bit cmyk holders
-      auto &color = layer->channels.at(j);
-      CustomColorHelpers::calculateCMYK(color, C, M, Y, K, bitmap[i + j]);
+      colorTable.calculateCMYK(j, C, M, Y, K, bitmap[i + j]);
     }
     // Store the CMYK values back into the surface, clipped to uint_8
     *surfacePointer = CustomColorHelpers::toUint8(C);
@@ -306,13 +815,15 @@ void SliSource::drawCmyk(uint8_t *surfacePointer, uint8_t *bitmap,
 }
 
 void SliSource::drawCmykXoffset(uint8_t *surfacePointer, uint8_t *bitmap,
-                                int bitmapStart, int bitmapOffset,
+                                int64_t bitmapStart, int64_t bitmapOffset,
                                 Scroom::Utils::Rectangle<int> layerRect,
                                 Scroom::Utils::Rectangle<int> intersectRect,
-                                int layerBound, int stride,
+                                int layerBound, int64_t stride,
                                 SliLayer::Ptr layer) {
-  for (int i = bitmapStart; i < bitmapStart + bitmapOffset;) {
-    int k = i;
+  const CustomColorTable &colorTable = layer->colorTable;
+
+  for (int64_t i = bitmapStart; i < bitmapStart + bitmapOffset;) {
+    int64_t k = i;
     std::vector<uint8_t *> addresses = {};
     addresses.push_back(
         surfacePointer); // Store the address, so it can later be written to
@@ -341,8 +852,7 @@ void SliSource::drawCmykXoffset(uint8_t *surfacePointer, uint8_t *bitmap,
 
     for (uint16_t j = 0; j < layer->spp;
          j++) { // Add values to the 32bit cmyk holders
-      auto color = layer->channels.at(j);
-      CustomColorHelpers::calculateCMYK(color, C, M, Y, K, bitmap[i + j]);
+      colorTable.calculateCMYK(j, C, M, Y, K, bitmap[i + j]);
     }
     // Write the CMYK values back to the surface, clipped to uint_8
 
@@ -358,7 +868,7 @@ void SliSource::drawCmykXoffset(uint8_t *surfacePointer, uint8_t *bitmap,
 void SliSource::advanceIAndSurfacePointer(
     const Scroom::Utils::Rectangle<int> &layerRect,
     const Scroom::Utils::Rectangle<int> &intersectRect, int layerBound,
-    int stride, uint8_t *&surfacePointer, int &i) const {
+    int64_t stride, uint8_t *&surfacePointer, int64_t &i) const {
   i++;
   surfacePointer++;
   // we are past the image bounds; go to the next next line
@@ -369,6 +879,7 @@ void SliSource::advanceIAndSurfacePointer(
 }
 
 void SliSource::computeRgb() {
+  Stats::ScopedTimer timer(stats->computeRgb);
   SurfaceWrapper::Ptr surface = SurfaceWrapper::create();
 
   // Check if cache surface exists first
@@ -378,15 +889,19 @@ void SliSource::computeRgb() {
     surface =
         SurfaceWrapper::create(total_width, total_height, CAIRO_FORMAT_ARGB32);
   }
-  const int stride = surface->getStride();
-  cairo_surface_flush(surface->surface);
-  uint8_t *surfaceBegin = cairo_image_surface_get_data(surface->surface);
+  const int64_t stride = surface->getStride();
+  surface->flush();
+  uint8_t *surfaceBegin = surface->getBitmap();
   uint32_t *targetBegin = reinterpret_cast<uint32_t *>(surfaceBegin);
   uint8_t *currentSurfaceByte = surfaceBegin;
 
   // Rectangle (in bytes) of the toggled area
   Scroom::Utils::Rectangle<int> toggledRect =
       toBytesRectangle(spannedRectangle(toggled, layers));
+  timer.addPixels(getArea(toggledRect) / 4);
+  // width, height, bytes of the toggled area
+  SPSEP_PROBE3(computeRgb__entry, total_width, total_height,
+               getArea(toggledRect));
 
   for (size_t j = 0; j < layers.size(); j++) { // For every layer
     if (!visible[j])
@@ -397,7 +912,8 @@ void SliSource::computeRgb() {
     Scroom::Utils::Rectangle<int> layerRect =
         toBytesRectangle(layer->toRectangle(), layer->spp);
 
-    if (!layerRect.intersects(toggledRect))
+    // A layer whose file could not be read has no bitmap
+    if (bitmap == nullptr || !layerRect.intersects(toggledRect))
       continue;
 
     // Rectangle area (in bytes) of the intersection between the toggled and
@@ -405,11 +921,12 @@ void SliSource::computeRgb() {
     Scroom::Utils::Rectangle<int> intersectRect =
         toggledRect.intersection(layerRect);
     // index of the first pixel that needs to be drawn
-    int bitmapStart = pointToOffset(layerRect, intersectRect.getTopLeft());
+    int64_t bitmapStart = pointToOffset(layerRect, intersectRect.getTopLeft());
     // offset of the last pixel from bitmapStart
-    int bitmapOffset = intersectRect.getHeight() * layerRect.getWidth();
+    int64_t bitmapOffset =
+        static_cast<int64_t>(intersectRect.getHeight()) * layerRect.getWidth();
     // offset of the surface pointer from the top-left point of the surface
-    int surfacePointerOffset =
+    int64_t surfacePointerOffset =
         pointToOffset(intersectRect.getTopLeft(), stride);
     currentSurfaceByte = surfaceBegin + surfacePointerOffset;
 
@@ -424,11 +941,11 @@ void SliSource::computeRgb() {
     }
   }
 
-  int topLeftOffset = pointToOffset(toggledRect.getTopLeft(), stride);
-  int bottomRightOffset =
+  int64_t topLeftOffset = pointToOffset(toggledRect.getTopLeft(), stride);
+  int64_t bottomRightOffset =
       pointToOffset(toggledRect.getBottomRight(), stride) - stride;
   if (hasXoffsets) {
-    int toggledBound = toggledRect.getRight() % stride;
+    int64_t toggledBound = toggledRect.getRight() % stride;
     int toggledWidth = toggledRect.getWidth();
     convertCmykXoffset(surfaceBegin, targetBegin, topLeftOffset,
                        bottomRightOffset, toggledWidth, toggledBound, stride);
@@ -436,7 +953,9 @@ void SliSource::computeRgb() {
     convertCmyk(surfaceBegin, targetBegin, topLeftOffset, bottomRightOffset);
   }
 
-  cairo_surface_mark_dirty(surface->surface);
+  surface->markDirty();
+  SPSEP_PROBE3(computeRgb__return, total_width, total_height,
+               getArea(toggledRect));
 
   if (!rgbCache.count(0))
     rgbCache[0] = surface;
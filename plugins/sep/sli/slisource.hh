@@ -1,18 +1,27 @@
 #pragma once
 
+#include <scroom/pipettelayeroperations.hh>
 #include <scroom/scroominterface.hh>
 #include <scroom/threadpool.hh>
 
+#include <atomic>
+
 #include <boost/dynamic_bitset.hpp>
 
+#include "../memorybudget.hh"
 #include "../sepsource.hh"
+#include "../stats.hh"
 #include "sli-helpers.hh"
+#include "sliparser.hh"
 
 class SliSource : public virtual Scroom::Utils::Base {
 public:
   typedef boost::shared_ptr<SliSource> Ptr;
   typedef boost::weak_ptr<SliSource> WeakPtr;
 
+  /** Maximum number of threads reading the metadata of layers at once */
+  static const int MAX_PROBE_THREADS = 16;
+
   /** The SliLayers that are part of the presentation */
   std::vector<SliLayer::Ptr> layers;
 
@@ -25,13 +34,23 @@ public:
   /** Whether any of the layers has an xoffset */
   bool hasXoffsets;
 
-  /** Whether the bitmaps of all layers have been imported from the files yet */
-  bool bitmapsImported = false;
+  /**
+   * Whether the bitmaps of all layers have been imported from the files yet.
+   * They are only imported once they are needed, see importBitmaps().
+   */
+  std::atomic<bool> bitmapsImported{false};
 
   /** Bitmask representing the indexes of the currently visible layers
    * (little-endian) */
   boost::dynamic_bitset<> visible{0};
 
+  /**
+   * Must be acquired before changing `visible`, and before reading it
+   * outside of fillCache(). Unlike `mtx`, it is only held briefly, never
+   * while compositing, so the pipette does not wait for a redraw.
+   */
+  boost::mutex visibleMutex;
+
   /** Bitmask representing the indexes of the layers that need to be toggled
    * (little-endian) */
   boost::dynamic_bitset<> toggled{0};
@@ -58,6 +77,12 @@ public: // For testing
   /** Callback to trigger a redraw of the presentation */
   boost::function<void()> triggerRedraw;
 
+  /**
+   * The statistics of the presentation, which the sources of the SEP layers
+   * record into as well
+   */
+  Stats::Set::Ptr stats = Stats::Set::create();
+
   /**
    * For each layer that represens a SEP file, this map contains the
    * corresponding SepSource between reading the metadata of the layer and
@@ -65,6 +90,54 @@ public: // For testing
    */
   std::map<SliLayer::Ptr, SepSource::Ptr> sepSources;
 
+  /**
+   * Key of the layers in the disk cache (see DiskCache), or empty if caching
+   * is disabled. The disk cache holds the levels with all layers visible.
+   * Computed by the first fillCache().
+   */
+  std::string diskCacheKey;
+
+  /** Whether `diskCacheKey` has been computed */
+  bool diskCacheKeyComputed = false;
+
+  /** Must be acquired while importing the bitmaps, see importBitmaps() */
+  boost::mutex importMutex;
+
+  /** Whether fillCache() has been scheduled, but has not started yet */
+  std::atomic<bool> fillCacheQueued{false};
+
+  /**
+   * Whether the bitmaps of the layers could not be imported or the surfaces
+   * could not be allocated, for instance because there is not enough memory.
+   * Nothing is drawn in that case.
+   */
+  std::atomic<bool> cacheFailed{false};
+
+  /** The memory held by the bitmaps of the layers */
+  MemoryBudget::Account::Ptr layersMemory;
+
+  /** The memory held by rgbCache, which is dropped by shedCache() */
+  MemoryBudget::Account::Ptr cacheMemory;
+
+  /**
+   * The preview is reduced by the largest factor that keeps it at least this
+   * many pixels wide or high.
+   */
+  int previewSize = 2048;
+
+  /**
+   * All layers composited from the overviews embedded in their files, or
+   * nullptr if they don't all have one. It is drawn until the bitmaps have
+   * been imported and composited. Only accessed on the UI thread.
+   */
+  SurfaceWrapper::Ptr preview;
+
+  /** Every pixel of `preview` covers this many pixels in both directions */
+  uint32_t previewFactor = 0;
+
+  /** The memory held by `preview` */
+  MemoryBudget::Account::Ptr previewMemory;
+
 public: // For testing
   /** Constructor */
   SliSource(boost::function<void()> &triggerRedrawFunc);
@@ -118,7 +191,8 @@ public: // For testing
    * draw.
    */
   virtual void drawCmyk(uint8_t *surfacePointer, uint8_t *bitmap,
-                        int bitmapStart, int bitmapOffset, SliLayer::Ptr layer);
+                        int64_t bitmapStart, int64_t bitmapOffset,
+                        SliLayer::Ptr layer);
 
   /**
    * Draw the CMYK data onto the surface. It is similar to drawCmyk but it also
@@ -136,10 +210,11 @@ public: // For testing
    * @param stride is the stride of the entire SLI image.
    */
   virtual void drawCmykXoffset(uint8_t *surfacePointer, uint8_t *bitmap,
-                               int bitmapStart, int bitmapOffset,
+                               int64_t bitmapStart, int64_t bitmapOffset,
                                Scroom::Utils::Rectangle<int> layerRect,
                                Scroom::Utils::Rectangle<int> intersectRect,
-                               int layerBound, int stride, SliLayer::Ptr layer);
+                               int layerBound, int64_t stride,
+                               SliLayer::Ptr layer);
 
   /**
    * Converts the a CMYK surface to an RGB surface.
@@ -151,7 +226,7 @@ public: // For testing
    * byte of the surface.
    */
   virtual void convertCmyk(uint8_t *surfacePointer, uint32_t *targetPointer,
-                           int topLeftOffset, int bottomRightOffset);
+                           int64_t topLeftOffset, int64_t bottomRightOffset);
 
   /**
    * Converts the a CMYK surface to an RGB surface. It is similar to convertCmyk
@@ -169,15 +244,71 @@ public: // For testing
    * @param stride is the stride of the entire SLI image.
    */
   virtual void convertCmykXoffset(uint8_t *surfacePointer,
-                                  uint32_t *targetPointer, int topLeftOffset,
-                                  int bottomRightOffset, int toggledWidth,
-                                  int toggledBound, int stride);
+                                  uint32_t *targetPointer,
+                                  int64_t topLeftOffset,
+                                  int64_t bottomRightOffset, int toggledWidth,
+                                  int64_t toggledBound, int64_t stride);
 
   /**
    * For each SliLayer in layers, import the bitmap data from the file into the
-   * SliLayer. Computationally intensive, therefore done outside of UI thread.
+   * SliLayer, unless that has been done before. Computationally intensive,
+   * therefore done outside of UI thread. As long as the composite of all
+   * layers comes from the disk cache, the layers are not needed, so this is
+   * only done by the first fillCache() that has to composite the layers, or
+   * the first averageVisibleChannels().
+   * @return whether the bitmaps have been imported
    */
-  virtual void importBitmaps();
+  virtual bool importBitmaps();
+
+  /** Computes the key of the layers in the disk cache */
+  virtual std::string computeDiskCacheKey();
+
+  /** Returns the files of @param layer, one per channel for SEP files */
+  virtual std::vector<std::string> layerFiles(const SliLayer::Ptr &layer);
+
+  /**
+   * Composites all layers from the overviews embedded in their files, the
+   * way computeRgb() composites their bitmaps.
+   * @param factor is set to the reduction factor of the result
+   * @return the composite, or nullptr if the SLI file is small, or if not all
+   * files have overviews
+   */
+  virtual SurfaceWrapper::Ptr compositeOverviews(uint32_t &factor);
+
+  /**
+   * Stores the result of compositeOverviews() as `preview`, and redraws. Runs
+   * on a worker thread, next to importBitmaps().
+   */
+  virtual void computePreview();
+
+  /**
+   * Fills rgbCache with all levels from the disk cache.
+   * @return false if not all levels are in the disk cache
+   */
+  virtual bool loadDiskCache();
+
+  /** Stores all levels of rgbCache in the disk cache */
+  virtual void storeDiskCache();
+
+  /** Returns the size of all levels of rgbCache (in bytes) */
+  virtual size_t cacheBytes();
+
+  /**
+   * Drops all levels of rgbCache to stay within the memory budget. They are
+   * computed again when the presentation is viewed again.
+   */
+  virtual void shedCache();
+
+  /**
+   * Adds the samples of the layers in @param visibleLayers within the rows
+   * [top, bottom) of @param area to @param sums. @param slots maps every
+   * channel of every layer to its index in @param sums.
+   */
+  virtual void sumVisibleRows(Scroom::Utils::Rectangle<int> area, int top,
+                              int bottom,
+                              const boost::dynamic_bitset<> &visibleLayers,
+                              const std::vector<std::vector<size_t>> &slots,
+                              std::vector<uint64_t> &sums);
 
 public:
   /** Destructor */
@@ -210,6 +341,13 @@ public:
    */
   virtual SurfaceWrapper::Ptr getSurface(int zoom);
 
+  /**
+   * Returns the preview to draw while getSurface() returns nullptr, and sets
+   * @param factor to its reduction factor, or nullptr if there is none. It
+   * only stands in for the first composite, which shows all layers.
+   */
+  virtual SurfaceWrapper::Ptr getPreview(uint32_t &factor);
+
   /**
    * Create a new SliLayer and add it to the list of layers.
    * @param imagePath is the absolute path to the tif/sep file.
@@ -221,7 +359,27 @@ public:
                         int xOffset, int yOffset);
 
   /**
-   * Query the execution of importBitmaps() in a separate thread.
+   * Add a layer for each of @param files, in the same order. Reading the
+   * metadata mostly waits for the file system, so the files are read by up to
+   * MAX_PROBE_THREADS threads at the same time.
+   * @return false if one of the layers could not be created
+   */
+  virtual bool addLayers(const std::vector<SliFileLayer> &files);
+
+  /**
+   * Create a new SliLayer and read its metadata, without adding it. Safe to
+   * call from any thread.
+   * @param sep is set to the SepSource of the layer for SEP files.
+   * @return the layer, or nullptr if its metadata could not be read
+   */
+  static SliLayer::Ptr createLayer(const std::string &imagePath,
+                                   const std::string &filename, int xOffset,
+                                   int yOffset, SepSource::Ptr &sep);
+
+  /**
+   * Query the execution of the first fillCache() in a separate thread, and of
+   * computePreview() next to it. When the disk cache holds the composite,
+   * that draws from the disk cache without importing the bitmaps.
    */
   virtual void queryImportBitmaps();
 
@@ -231,9 +389,26 @@ public:
    */
   virtual void wipeCacheAndRedraw();
 
+  /**
+   * Computes the average of every channel of the visible layers within
+   * @param area, directly from the bitmaps of the layers. Channels with the
+   * same name in different layers are added up. The rows of the area are
+   * divided over threads of its own, as the jobs on CpuBound() may be
+   * waiting for the UI thread, which in turn may be waiting for the pipette.
+   * The first call imports the bitmaps, if the composite came from the disk
+   * cache.
+   * @return the averages in the order in which the channels first appear in
+   * the layers, or an empty result if the bitmaps could not be imported
+   */
+  virtual PipetteLayerOperations::PipetteColor
+  averageVisibleChannels(Scroom::Utils::Rectangle<int> area);
+
+  /** Returns a copy of `visible`, see `visibleMutex` */
+  boost::dynamic_bitset<> getVisible();
+
   void
   advanceIAndSurfacePointer(const Scroom::Utils::Rectangle<int> &layerRect,
                             const Scroom::Utils::Rectangle<int> &intersectRect,
-                            int layerBound, int stride,
-                            uint8_t *&surfacePointer, int &i) const;
+                            int layerBound, int64_t stride,
+                            uint8_t *&surfacePointer, int64_t &i) const;
 };
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include "stats.hh"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <fmt/format.h>
+
+namespace Stats {
+
+void Stage::record(uint64_t elapsed, uint64_t count) {
+  calls.fetch_add(1, std::memory_order_relaxed);
+  nanoseconds.fetch_add(elapsed, std::memory_order_relaxed);
+  pixels.fetch_add(count, std::memory_order_relaxed);
+
+  uint64_t max = maxNanoseconds.load(std::memory_order_relaxed);
+  while (elapsed > max && !maxNanoseconds.compare_exchange_weak(
+                              max, elapsed, std::memory_order_relaxed)) {
+  }
+
+  if (aggregate != nullptr) {
+    aggregate->record(elapsed, count);
+  }
+}
+
+void Stage::reset() {
+  calls = 0;
+  nanoseconds = 0;
+  maxNanoseconds = 0;
+  pixels = 0;
+}
+
+namespace {
+std::string counter(const Stage &stage, const std::string &name) {
+  const double ms = stage.nanoseconds / 1e6;
+  if (name == "calls") {
+    return std::to_string(stage.calls.load());
+  } else if (name == "ms") {
+    return fmt::format("{:.3f}", ms);
+  } else if (name == "max_ms") {
+    return fmt::format("{:.3f}", stage.maxNanoseconds / 1e6);
+  } else if (name == "pixels") {
+    return std::to_string(stage.pixels.load());
+  } else if (name == "mpix_per_s") {
+    return fmt::format("{:.1f}", ms > 0 ? stage.pixels / ms / 1e3 : 0.0);
+  }
+  return "";
+}
+
+/** Returns @param stage of @param set, or nullptr if there is no set */
+Stage *stageOf(Set *set, Stage Set::*stage) {
+  return set != nullptr ? &(set->*stage) : nullptr;
+}
+} // namespace
+
+Set::Set(Set *aggregate)
+    : fillTiles("fillTiles", stageOf(aggregate, &Set::fillTiles)),
+      readAhead("readAhead", stageOf(aggregate, &Set::readAhead)),
+      overviews("overviews", stageOf(aggregate, &Set::overviews)),
+      cache("cache", stageOf(aggregate, &Set::cache)),
+      reduce("reduce", stageOf(aggregate, &Set::reduce)),
+      varnishCache("varnishCache", stageOf(aggregate, &Set::varnishCache)),
+      varnishReduce("varnishReduce", stageOf(aggregate, &Set::varnishReduce)),
+      drawOverlay("drawOverlay", stageOf(aggregate, &Set::drawOverlay)),
+      importBitmaps("importBitmaps", stageOf(aggregate, &Set::importBitmaps)),
+      computeRgb("computeRgb", stageOf(aggregate, &Set::computeRgb)),
+      reduceRgb("reduceRgb", stageOf(aggregate, &Set::reduceRgb)),
+      all{&fillTiles,     &readAhead,    &overviews,     &cache,
+          &reduce,        &varnishCache, &varnishReduce, &drawOverlay,
+          &importBitmaps, &computeRgb,   &reduceRgb} {}
+
+Set::Ptr Set::create() { return Ptr(new Set(&total())); }
+
+Set &Set::total() {
+  static Set totals(nullptr);
+  return totals;
+}
+
+bool Set::getProperty(const std::string &name, std::string &value) const {
+  if (name == "stats") {
+    value = summary();
+    return true;
+  }
+
+  // stats.<stage>.<counter>
+  const std::string prefix = "stats.";
+  const size_t dot = name.rfind('.');
+  if (name.compare(0, prefix.size(), prefix) != 0 || dot < prefix.size()) {
+    return false;
+  }
+  const std::string stageName = name.substr(prefix.size(), dot - prefix.size());
+  for (const Stage *stage : stages()) {
+    if (stageName == stage->name) {
+      value = counter(*stage, name.substr(dot + 1));
+      return !value.empty();
+    }
+  }
+  return false;
+}
+
+std::string Set::summary() const {
+  std::string result;
+  for (const Stage *stage : stages()) {
+    if (stage->calls == 0) {
+      continue;
+    }
+    result += fmt::format(
+        "{}: {} calls, {} ms (max {} ms), {} pixels, {} Mpix/s\n", stage->name,
+        counter(*stage, "calls"), counter(*stage, "ms"),
+        counter(*stage, "max_ms"), counter(*stage, "pixels"),
+        counter(*stage, "mpix_per_s"));
+  }
+  return result;
+}
+
+void dumpIfEnabled() {
+  if (getenv("SCROOM_SEP_STATS") != nullptr) {
+    printf("SEP plugin statistics:\n%s", Set::total().summary().c_str());
+  }
+}
+
+void Set::reset() {
+  for (Stage *stage : stages()) {
+    stage->reset();
+  }
+}
+
+} // namespace Stats
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include "trace.hh"
+
+/**
+ * Always-on timers and counters of the stages that turn files into pixels,
+ * so it can be seen from outside where the time goes.
+ *
+ * Every stage counts its calls, the time spent in them and the number of
+ * pixels processed. Recording costs two reads of the monotonic clock and a
+ * few relaxed atomic additions per call, and nothing is formatted until the
+ * statistics are read.
+ *
+ * Every presentation has its own Set of stages, which its sources and layer
+ * operations record into. They are available as the properties
+ * `stats.<stage>.<counter>` of SepPresentation and SliPresentation, and
+ * `stats` gives all of them as text. If the environment variable
+ * SCROOM_SEP_STATS is set, the totals of all presentations are printed
+ * whenever a presentation is closed. The stages also show up in traces, see
+ * Trace.
+ */
+namespace Stats {
+
+/** The counters of a single stage */
+class Stage {
+public:
+  /** Name of the stage in the properties, e.g. "fillTiles" */
+  const char *const name;
+
+  /** The stage that every call is recorded in as well, or nullptr */
+  Stage *const aggregate;
+
+  std::atomic<uint64_t> calls{0};
+  std::atomic<uint64_t> nanoseconds{0};
+  std::atomic<uint64_t> maxNanoseconds{0};
+  std::atomic<uint64_t> pixels{0};
+
+  explicit Stage(const char *name_, Stage *aggregate_ = nullptr)
+      : name(name_), aggregate(aggregate_) {}
+
+  Stage(const Stage &) = delete;
+  Stage &operator=(const Stage &) = delete;
+
+  /** Records a call of @param elapsed ns, processing @param count pixels */
+  void record(uint64_t elapsed, uint64_t count);
+
+  /** Sets all counters to 0 */
+  void reset();
+};
+
+/**
+ * The stages of one presentation. Every set also adds its counters to
+ * total(), which is what dumpIfEnabled() prints.
+ */
+class Set {
+public:
+  typedef boost::shared_ptr<Set> Ptr;
+
+  /** SepSource::fillTiles(), decoding and interleaving the channels */
+  Stage fillTiles;
+  /** SepSource::readBand(), decoding bands ahead of fillTiles() */
+  Stage readAhead;
+  /**
+   * SepSource::readOverview() and SliSource::computePreview(), reading the
+   * overviews embedded in the files
+   */
+  Stage overviews;
+  /** OperationsCustomColors::cache(), converting tiles to RGB */
+  Stage cache;
+  /** OperationsCustomColors::reduce(), reducing tiles to lower zoom levels */
+  Stage reduce;
+  /** VarnishOperations::cache() */
+  Stage varnishCache;
+  /** VarnishOperations::reduce() */
+  Stage varnishReduce;
+  /** Varnish::drawOverlay() */
+  Stage drawOverlay;
+  /** SliSource::importBitmaps(), reading the bitmaps of all layers */
+  Stage importBitmaps;
+  /** SliSource::computeRgb(), compositing the layers */
+  Stage computeRgb;
+  /** SliSource::reduceRgb(), reducing the composited surface */
+  Stage reduceRgb;
+
+private:
+  /** All stages, in the order above */
+  std::vector<Stage *> all;
+
+  /** Creates a set that adds its counters to @param aggregate, if any */
+  explicit Set(Set *aggregate);
+
+public:
+  static Ptr create();
+
+  /** The counters of all sets together */
+  static Set &total();
+
+  Set(const Set &) = delete;
+  Set &operator=(const Set &) = delete;
+
+  /** All stages, in the order above */
+  const std::vector<Stage *> &stages() const { return all; }
+
+  /**
+   * Looks up the property @param name, which is either `stats` or
+   * `stats.<stage>.<counter>`. The counters are calls, ms, max_ms, pixels
+   * and mpix_per_s.
+   * @return false if it is not a statistics property
+   */
+  bool getProperty(const std::string &name, std::string &value) const;
+
+  /** Returns all statistics as text, one line per stage that was called */
+  std::string summary() const;
+
+  /** Sets the counters of all stages to 0 */
+  void reset();
+};
+
+/** Times the scope it lives in, and records it in a Stage */
+class ScopedTimer {
+private:
+  Stage &stage;
+  std::chrono::steady_clock::time_point start;
+  uint64_t count = 0;
+
+public:
+  explicit ScopedTimer(Stage &stage_)
+      : stage(stage_), start(std::chrono::steady_clock::now()) {}
+
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+  /** Adds @param n to the pixels processed in this scope */
+  void addPixels(uint64_t n) { count += n; }
+
+  ~ScopedTimer() {
+    const auto end = std::chrono::steady_clock::now();
+    const auto elapsed =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+    stage.record(static_cast<uint64_t>(elapsed.count()), count);
+
+    if (Trace::enabled()) {
+      Trace::record("stage", stage.name, nanoseconds(start), nanoseconds(end));
+    }
+  }
+
+private:
+  static uint64_t nanoseconds(std::chrono::steady_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               time.time_since_epoch())
+        .count();
+  }
+};
+
+/** Prints the summary of Set::total() if SCROOM_SEP_STATS is set */
+void dumpIfEnabled();
+
+} // namespace Stats
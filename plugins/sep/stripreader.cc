@@ -0,0 +1,272 @@
+#include "stripreader.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#ifdef SPSEP_IO_URING
+#include <liburing.h>
+#endif
+
+namespace StripReader {
+
+namespace {
+Backend initialBackend() {
+  const char *name = getenv("SCROOM_SEP_READER");
+  if (name != nullptr && strcmp(name, "scanline") == 0) {
+    return SCANLINE;
+  }
+  if (name != nullptr && strcmp(name, "pread") == 0) {
+    return PREAD;
+  }
+#ifdef SPSEP_IO_URING
+  return IO_URING;
+#else
+  return PREAD;
+#endif
+}
+
+std::atomic<Backend> backend{initialBackend()};
+
+/** Reads a single request, resuming after short reads */
+bool readWithPread(const Request &request) {
+  size_t done = 0;
+  while (done < request.length) {
+    const ssize_t n =
+        pread(request.fd, request.data + done, request.length - done,
+              static_cast<off_t>(request.offset + done));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    done += static_cast<size_t>(n);
+  }
+  return true;
+}
+
+bool readWithPread(const std::vector<Request> &requests) {
+  bool result = true;
+  for (const auto &request : requests) {
+    result &= readWithPread(request);
+  }
+  return result;
+}
+
+#ifdef SPSEP_IO_URING
+const unsigned QUEUE_DEPTH = 64;
+
+/**
+ * The io_uring of a thread. Every worker thread gets its own, so they never
+ * wait for each other's submissions.
+ */
+struct Ring {
+  struct io_uring ring;
+  bool ready;
+
+  Ring() { ready = io_uring_queue_init(QUEUE_DEPTH, &ring, 0) == 0; }
+
+  ~Ring() {
+    if (ready) {
+      io_uring_queue_exit(&ring);
+    }
+  }
+
+  /** Stops using the ring after an error, so pread is used from now on */
+  void close() {
+    io_uring_queue_exit(&ring);
+    ready = false;
+  }
+};
+
+Ring &threadRing() {
+  thread_local Ring ring;
+  return ring;
+}
+
+bool readWithIoUring(const std::vector<Request> &requests) {
+  Ring &ring = threadRing();
+  if (!ring.ready) {
+    return readWithPread(requests);
+  }
+
+  bool result = true;
+  bool failed = false;
+  std::vector<bool> completed(requests.size(), false);
+  size_t next = 0;
+  // Prepared, but not consumed by the kernel yet
+  size_t queued = 0;
+  // Consumed by the kernel, but not completed yet
+  size_t inFlight = 0;
+  while (next < requests.size() || queued > 0 || inFlight > 0) {
+    // Keep the queue filled with the requests that have not been prepared
+    while (!failed && next < requests.size() &&
+           queued + inFlight < QUEUE_DEPTH) {
+      io_uring_sqe *sqe = io_uring_get_sqe(&ring.ring);
+      if (sqe == nullptr) {
+        break;
+      }
+      // Longer reads complete partially, and are finished below
+      const Request &request = requests[next];
+      io_uring_prep_read(sqe, request.fd, request.data,
+                         static_cast<unsigned>(
+                             std::min<size_t>(request.length, 1u << 30)),
+                         request.offset);
+      sqe->user_data = next;
+      next++;
+      queued++;
+    }
+
+    io_uring_cqe *cqe = nullptr;
+    if (!failed) {
+      const int submitted = io_uring_submit_and_wait(&ring.ring, 1);
+      if (submitted >= 0) {
+        queued -= static_cast<size_t>(submitted);
+        inFlight += static_cast<size_t>(submitted);
+      } else if (submitted != -EINTR && submitted != -EAGAIN &&
+                 submitted != -EBUSY) {
+        failed = true;
+      }
+    } else {
+      const int waited = io_uring_wait_cqe(&ring.ring, &cqe);
+      if (waited < 0 && waited != -EINTR) {
+        // The reads in flight can't be waited for anymore
+        result = false;
+        break;
+      }
+    }
+
+    while (inFlight > 0 && io_uring_peek_cqe(&ring.ring, &cqe) == 0) {
+      const size_t index = cqe->user_data;
+      const int bytes = cqe->res;
+      io_uring_cqe_seen(&ring.ring, cqe);
+      inFlight--;
+      completed[index] = true;
+
+      // Errors and short reads are finished with pread
+      const Request &request = requests[index];
+      const size_t done = bytes > 0 ? static_cast<size_t>(bytes) : 0;
+      if (done < request.length) {
+        result &= readWithPread({request.fd, request.offset + done,
+                                 request.length - done, request.data + done});
+      }
+    }
+    if (failed && inFlight == 0) {
+      break;
+    }
+  }
+
+  // After an error, the ring is dropped, and the requests that have not
+  // completed are read with pread. Closing the ring discards the queued ones.
+  if (failed || inFlight > 0) {
+    ring.close();
+    for (size_t i = 0; i < requests.size(); i++) {
+      if (!completed[i]) {
+        result &= readWithPread(requests[i]);
+      }
+    }
+  }
+  return result;
+}
+#endif
+} // namespace
+
+Backend getBackend() { return backend; }
+
+void setBackend(Backend backend_) { backend = backend_; }
+
+std::string getName(Backend backend_) {
+  switch (backend_) {
+  case SCANLINE:
+    return "scanline";
+  case PREAD:
+    return "pread";
+  case IO_URING:
+    return "io_uring";
+  }
+  return "";
+}
+
+bool ioUringAvailable() {
+#ifdef SPSEP_IO_URING
+  return threadRing().ready;
+#else
+  return false;
+#endif
+}
+
+bool canReadDirectly(tiff *file) {
+  if (file == nullptr || TIFFIsTiled(file) || TIFFFileno(file) < 0) {
+    return false;
+  }
+  uint16_t compression = 0;
+  uint16_t spp = 0;
+  uint16_t bps = 0;
+  TIFFGetFieldDefaulted(file, TIFFTAG_COMPRESSION, &compression);
+  TIFFGetFieldDefaulted(file, TIFFTAG_SAMPLESPERPIXEL, &spp);
+  TIFFGetFieldDefaulted(file, TIFFTAG_BITSPERSAMPLE, &bps);
+  return compression == COMPRESSION_NONE && spp == 1 && bps == 8;
+}
+
+bool addRows(tiff *file, uint32_t row, uint32_t count, uint8_t *data,
+             std::vector<Request> &requests) {
+  uint32_t height = 0;
+  uint32_t rowsPerStrip = 0;
+  uint64_t *offsets = nullptr;
+  uint64_t *byteCounts = nullptr;
+  if (TIFFGetField(file, TIFFTAG_IMAGELENGTH, &height) != 1 ||
+      TIFFGetFieldDefaulted(file, TIFFTAG_ROWSPERSTRIP, &rowsPerStrip) != 1 ||
+      TIFFGetField(file, TIFFTAG_STRIPOFFSETS, &offsets) != 1 ||
+      TIFFGetField(file, TIFFTAG_STRIPBYTECOUNTS, &byteCounts) != 1 ||
+      rowsPerStrip == 0 || row > height || count > height - row) {
+    return false;
+  }
+
+  const uint64_t rowSize = static_cast<uint64_t>(TIFFScanlineSize64(file));
+  const uint32_t strips = TIFFNumberOfStrips(file);
+  const int fd = TIFFFileno(file);
+  const uint32_t end = row + count;
+  for (uint32_t y = row; y < end;) {
+    const uint32_t strip = y / rowsPerStrip;
+    const uint32_t first = strip * rowsPerStrip;
+    const uint32_t last = static_cast<uint32_t>(
+        std::min<uint64_t>(end, static_cast<uint64_t>(first) + rowsPerStrip));
+    const uint64_t start = (y - first) * rowSize;
+    const uint64_t length = (last - y) * rowSize;
+    if (strip >= strips || start + length > byteCounts[strip]) {
+      return false;
+    }
+
+    // Strips are usually stored one after another, so they are read at once
+    const uint64_t offset = offsets[strip] + start;
+    uint8_t *target = data + (y - row) * rowSize;
+    if (!requests.empty() && requests.back().fd == fd &&
+        requests.back().offset + requests.back().length == offset &&
+        requests.back().data + requests.back().length == target) {
+      requests.back().length += length;
+    } else {
+      requests.push_back({fd, offset, static_cast<size_t>(length), target});
+    }
+    y = last;
+  }
+  return true;
+}
+
+bool read(const std::vector<Request> &requests, Backend backend_) {
+#ifdef SPSEP_IO_URING
+  if (backend_ == IO_URING) {
+    return readWithIoUring(requests);
+  }
+#else
+  // Without io_uring, every backend reads with pread
+  (void)backend_;
+#endif
+  return readWithPread(requests);
+}
+
+} // namespace StripReader
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <tiffio.h>
+
+/**
+ * Reads the rows of uncompressed 8 bit TIFF files directly from their strips,
+ * bypassing the scanline interface of libtiff. The reads of all channels of a
+ * band are collected first, and then performed together:
+ * - with io_uring, they are submitted in one batch and complete in any order,
+ *   so the disk can serve all channel files at once. It is only available
+ *   when the plugin is configured with ENABLE_IO_URING, which needs liburing,
+ *   and falls back to pread if the kernel does not allow it.
+ * - with pread, they are performed one after another, without the seeks and
+ *   the copying of libtiff.
+ *
+ * The backend is set with SCROOM_SEP_READER, which is `scanline`, `pread` or
+ * `io_uring`. It defaults to io_uring if it has been compiled in, and to
+ * pread otherwise. With `scanline`, everything is read through libtiff.
+ */
+namespace StripReader {
+enum Backend { SCANLINE, PREAD, IO_URING };
+
+/** Reads @param length bytes at @param offset of @param fd into @param data */
+struct Request {
+  int fd;
+  uint64_t offset;
+  size_t length;
+  uint8_t *data;
+};
+
+/** The backend used for reading SEP files */
+Backend getBackend();
+void setBackend(Backend backend);
+
+/** Returns the name of @param backend, as in SCROOM_SEP_READER */
+std::string getName(Backend backend);
+
+/** Whether io_uring has been compiled in, and the kernel allows using it */
+bool ioUringAvailable();
+
+/**
+ * Whether the rows of @param file can be read directly: it has a single 8 bit
+ * sample per pixel, and is divided into uncompressed strips.
+ */
+bool canReadDirectly(tiff *file);
+
+/**
+ * Adds the requests for reading @param count rows of @param file, starting at
+ * @param row, to @param requests. The rows are read into @param data, which
+ * must hold `count * TIFFScanlineSize64(file)` bytes.
+ * @pre canReadDirectly(file)
+ * @return false if the rows are outside of the file
+ */
+bool addRows(tiff *file, uint32_t row, uint32_t count, uint8_t *data,
+             std::vector<Request> &requests);
+
+/**
+ * Performs all @param requests with @param backend, or with pread if it is
+ * not available.
+ * @return false if any of them could not be read completely
+ */
+bool read(const std::vector<Request> &requests,
+          Backend backend = getBackend());
+} // namespace StripReader
@@ -3,11 +3,27 @@
 //
 
 #include <boost/dll.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+#include <atomic>
+#include <fstream>
 
 #include "../colorconfig/CustomColorConfig.hh"
 #include "testglobals.hh"
 
+namespace {
+/** Copies colours.json to a temporary file that can be modified */
+std::string copyColoursFile() {
+  const boost::filesystem::path copy =
+      boost::filesystem::temp_directory_path() /
+      boost::filesystem::unique_path("spsep-colours-%%%%%%%%.json");
+  boost::filesystem::copy_file(TestFiles::getPathToFile("colours.json"),
+                               copy);
+  return copy.string();
+}
+} // namespace
+
 BOOST_AUTO_TEST_SUITE(ColorConfig_Tests)
 
 BOOST_AUTO_TEST_CASE(colorConfig_create) {
@@ -51,4 +67,90 @@ BOOST_AUTO_TEST_CASE(colorConfig_get_name) {
   BOOST_CHECK(colorConfig.getColorByNameOrAlias("b") != nullptr);
 }
 
+BOOST_AUTO_TEST_CASE(colorConfig_get_ignores_case) {
+  ColorConfig colorConfig;
+
+  colorConfig.loadFile(TestFiles::getPathToFile("colours_aliases.json"));
+  auto orange = colorConfig.getColorByNameOrAlias("ORANGE");
+  BOOST_REQUIRE(orange != nullptr);
+  BOOST_CHECK(colorConfig.getColorByNameOrAlias("orange") == orange);
+  BOOST_CHECK(colorConfig.getColorByNameOrAlias("O") == orange);
+  BOOST_CHECK(colorConfig.getColorByNameOrAlias("oR") == orange);
+  BOOST_CHECK(colorConfig.getColorByNameOrAlias("g") ==
+              colorConfig.getColorByNameOrAlias("Green"));
+  BOOST_CHECK(colorConfig.getColorByNameOrAlias("purple") == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(colorConfig_reload_clears_index) {
+  ColorConfig colorConfig;
+
+  colorConfig.loadFile(TestFiles::getPathToFile("colours_aliases.json"));
+  BOOST_CHECK(colorConfig.getColorByNameOrAlias("o") != nullptr);
+  colorConfig.loadFile(TestFiles::getPathToFile("colours.json"));
+  BOOST_CHECK(colorConfig.getColorByNameOrAlias("o") == nullptr);
+  BOOST_CHECK(colorConfig.getDefinedColors().size() == 5);
+}
+
+BOOST_AUTO_TEST_CASE(colorConfig_load_unchanged_file_once) {
+  ColorConfig colorConfig;
+  const std::string file = copyColoursFile();
+
+  colorConfig.loadFile(file);
+  auto snapshot = colorConfig.getSnapshot();
+  auto color = colorConfig.getColorByNameOrAlias("b");
+  colorConfig.loadFile(file);
+  BOOST_CHECK(colorConfig.getSnapshot() == snapshot);
+
+  // Touching the file without changing it does not reload it either
+  boost::filesystem::last_write_time(
+      file, boost::filesystem::last_write_time(file) + 10);
+  colorConfig.loadFile(file);
+  BOOST_CHECK(colorConfig.getSnapshot() == snapshot);
+
+  // Changing the contents does
+  {
+    std::ofstream stream(file, std::ios::app);
+    stream << "\n";
+  }
+  boost::filesystem::last_write_time(
+      file, boost::filesystem::last_write_time(file) + 20);
+  colorConfig.loadFile(file);
+  BOOST_CHECK(colorConfig.getSnapshot() != snapshot);
+  BOOST_CHECK(colorConfig.getDefinedColors().size() == 5);
+
+  // Colors of the previous load remain valid
+  BOOST_CHECK(color->name == "B");
+  BOOST_CHECK(colorConfig.getColorByNameOrAlias("b") != color);
+
+  boost::filesystem::remove(file);
+}
+
+BOOST_AUTO_TEST_CASE(colorConfig_concurrent_loads_and_lookups) {
+  ColorConfig colorConfig;
+  const std::string aliases = TestFiles::getPathToFile("colours_aliases.json");
+  const std::string colours = TestFiles::getPathToFile("colours.json");
+  colorConfig.loadFile(colours);
+
+  // Boost.Test assertions are not thread safe, so only check afterwards
+  std::atomic<bool> missed{false};
+  boost::thread_group threads;
+  for (int t = 0; t < 4; t++) {
+    threads.create_thread([&colorConfig, &aliases, &colours, t] {
+      for (int i = 0; i < 50; i++) {
+        colorConfig.loadFile((i + t) % 2 ? aliases : colours);
+      }
+    });
+    threads.create_thread([&colorConfig, &missed] {
+      for (int i = 0; i < 5000; i++) {
+        // C, M, Y and K are defined by both files
+        if (colorConfig.getColorByNameOrAlias("c") == nullptr) {
+          missed = true;
+        }
+      }
+    });
+  }
+  threads.join_all();
+  BOOST_CHECK(!missed);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <boost/test/unit_test.hpp>
 
 #include "../colorconfig/CustomColorHelpers.hh"
+#include "../colorconfig/CustomColorTable.hh"
 #include "testglobals.hh"
 
 BOOST_AUTO_TEST_SUITE(ColorHelpers_Tests)
@@ -51,4 +52,66 @@ BOOST_AUTO_TEST_CASE(colorHelpers_calculateCMYKall) {
   BOOST_CHECK(correct);
 }
 
+BOOST_AUTO_TEST_CASE(colorTable_calculateCMYK_matches_helpers) {
+  std::vector<CustomColor::Ptr> colors = {
+      CustomColor::Ptr(new CustomColor("C", 1, 0, 0, 0)),
+      CustomColor::Ptr(new CustomColor("orange", 0, 0.37f, 0.91f, 0)),
+      CustomColor::Ptr(new CustomColor("white", -0.5f, -0.5f, -0.5f, -0.3f)),
+      CustomColor::Ptr(new CustomColor("K", 0, 0, 0, 1))};
+  const CustomColorTable table(colors);
+  BOOST_REQUIRE_EQUAL(table.size(), colors.size());
+
+  // Negative multipliers make the rounding depend on the order of the
+  // additions, so the table has to do them the same way
+  for (int i = 0; i < 4096; i++) {
+    int16_t expected[4] = {0, 0, 0, 0};
+    int16_t actual[4] = {0, 0, 0, 0};
+    for (size_t j = 0; j < colors.size(); j++) {
+      const auto value =
+          static_cast<uint8_t>((i * (37 + 16 * j) + j * 91) % 256);
+      CustomColorHelpers::calculateCMYK(colors[j], expected[0], expected[1],
+                                        expected[2], expected[3], value);
+      table.calculateCMYK(j, actual[0], actual[1], actual[2], actual[3],
+                          value);
+    }
+    for (int c = 0; c < 4; c++) {
+      BOOST_CHECK_EQUAL(actual[c], expected[c]);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(colorTable_toARGB) {
+  std::vector<CustomColor::Ptr> colors = {
+      CustomColor::Ptr(new CustomColor("C", 1, 0, 0, 0)),
+      CustomColor::Ptr(new CustomColor("orange", 0, 0.37f, 0.91f, 0)),
+      CustomColor::Ptr(new CustomColor("K", 0, 0, 0, 1))};
+  const CustomColorTable table(colors);
+
+  const uint8_t none[3] = {0, 0, 0};
+  BOOST_CHECK_EQUAL(table.toARGB(none), 0xFFFFFFFFu);
+  const uint8_t cyan[3] = {255, 0, 0};
+  BOOST_CHECK_EQUAL(table.toARGB(cyan), 0xFF00FFFFu);
+  // M = 0.37 * 200 = 74 and Y = 0.91 * 200 = 182
+  const uint8_t orange[3] = {0, 200, 0};
+  BOOST_CHECK_EQUAL(table.toARGB(orange), 0xFFFFB549u);
+  // Black darkens all of R, G and B
+  const uint8_t grey[3] = {0, 0, 128};
+  BOOST_CHECK_EQUAL(table.toARGB(grey), 0xFF7F7F7Fu);
+  // Ink beyond 255 is capped
+  const uint8_t dark[3] = {255, 255, 255};
+  BOOST_CHECK_EQUAL(table.toARGB(dark), 0xFF000000u);
+}
+
+BOOST_AUTO_TEST_CASE(colorTable_missing_color) {
+  std::vector<CustomColor::Ptr> colors = {
+      nullptr, CustomColor::Ptr(new CustomColor("K", 0, 0, 0, 1))};
+  const CustomColorTable table(colors);
+  BOOST_REQUIRE_EQUAL(table.size(), 2);
+  BOOST_CHECK_EQUAL(table[0].c, 0);
+
+  // The channel without a color does not add ink
+  const uint8_t samples[2] = {255, 0};
+  BOOST_CHECK_EQUAL(table.toARGB(samples), 0xFFFFFFFFu);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
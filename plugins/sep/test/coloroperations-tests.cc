@@ -12,17 +12,17 @@ BOOST_AUTO_TEST_SUITE(ColorOperations_Tests)
 
 BOOST_AUTO_TEST_CASE(colorOperations_create) {
   PipetteCommonOperationsCustomColor::Ptr colorOperations =
-      OperationsCustomColors::create(4);
+      OperationsCustomColors::create(4, Stats::Set::create());
   BOOST_CHECK(colorOperations != nullptr);
 }
 
 BOOST_AUTO_TEST_CASE(colorOperations_setspp) {
-  OperationsCustomColors operations(8);
+  OperationsCustomColors operations(8, Stats::Set::create());
   BOOST_CHECK(operations.getBpp() == 64);
 }
 /*
 BOOST_AUTO_TEST_CASE(colorOperations_cache) {
-  OperationsCustomColors operations(1);
+  OperationsCustomColors operations(1, Stats::Set::create());
   Scroom::MemoryBlobs::RawPageData::ConstPtr data;
   data = {};
   boost::shared_ptr<ConstTile> ptr(new ConstTile(1, 1, 8, data));
@@ -31,7 +31,7 @@ BOOST_AUTO_TEST_CASE(colorOperations_cache) {
 }
 
 BOOST_AUTO_TEST_CASE(colorOperations_reduce) {
-  OperationsCustomColors operations(1);
+  OperationsCustomColors operations(1, Stats::Set::create());
   Scroom::MemoryBlobs::RawPageData::Ptr data;
   data = {};
   boost::shared_ptr<Tile> tile(new Tile(1, 1, 8, data));
@@ -0,0 +1,274 @@
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include "../colorconfig/CustomColorConfig.hh"
+#include "../diskcache.hh"
+#include "../sepsource.hh"
+#include "testglobals.hh"
+
+/** Test cases for diskcache.hh */
+
+namespace fs = boost::filesystem;
+
+namespace {
+/**
+ * Points SCROOM_SEP_CACHE_DIR to a new temporary directory for the duration
+ * of a test case, and removes the directory afterwards.
+ */
+struct CacheDirectory {
+  fs::path path;
+
+  CacheDirectory()
+      : path(fs::temp_directory_path() /
+             fs::unique_path("spsep-cache-%%%%%%%%")) {
+    fs::create_directories(path);
+    setenv("SCROOM_SEP_CACHE_DIR", path.c_str(), 1);
+  }
+
+  ~CacheDirectory() {
+    unsetenv("SCROOM_SEP_CACHE_DIR");
+    boost::system::error_code ec;
+    fs::remove_all(path, ec);
+  }
+};
+
+/** Copies a test file into @param directory, so it can be modified */
+std::string copyTestFile(const fs::path &directory, const std::string &name) {
+  const fs::path copy = directory / name;
+  fs::copy_file(TestFiles::getPathToFile(name), copy);
+  return copy.string();
+}
+
+/** Fills the single tile of all rows of the 600 x 400 sep_cmyk.sep */
+std::vector<uint8_t> fillAllRows(const SepSource::Ptr &source) {
+  const int width = 600;
+  const int height = 400;
+  const int bpp = 4;
+  boost::shared_ptr<uint8_t> data(new uint8_t[width * height * bpp],
+                                  [](uint8_t *p) { delete[] p; });
+  std::vector<Tile::Ptr> tiles = {
+      Tile::Ptr(new Tile(width, height, 8 * bpp, data))};
+
+  source->fillTiles(0, height, width, 0, tiles);
+  return std::vector<uint8_t>(data.get(), data.get() + width * height * bpp);
+}
+
+SepSource::Ptr openSep(const std::string &path) {
+  auto source = SepSource::create();
+  source->setData(SepSource::parseSep(path));
+  source->setName(path);
+  source->openFiles();
+  return source;
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(DiskCache_Tests)
+
+BOOST_AUTO_TEST_CASE(diskcache_disabled) {
+  unsetenv("SCROOM_SEP_CACHE_DIR");
+  BOOST_CHECK(DiskCache::getDirectory().empty());
+  BOOST_CHECK(
+      DiskCache::computeKey({TestFiles::getPathToFile("C.tif")}).empty());
+  BOOST_CHECK(!DiskCache::create("", "level0", 1, 1, 4));
+}
+
+BOOST_AUTO_TEST_CASE(diskcache_missing_file) {
+  CacheDirectory directory;
+  BOOST_CHECK(DiskCache::computeKey({"does/not/exist.tif"}).empty());
+}
+
+BOOST_AUTO_TEST_CASE(diskcache_store_and_open) {
+  CacheDirectory directory;
+  const std::string key =
+      DiskCache::computeKey({TestFiles::getPathToFile("C.tif")});
+  BOOST_REQUIRE(!key.empty());
+  BOOST_CHECK(!DiskCache::open(key, "entry"));
+
+  std::vector<uint8_t> data(3 * 8);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<uint8_t>(i);
+  }
+  BOOST_REQUIRE(DiskCache::store(key, "entry", 2, 3, 8, data.data()));
+
+  DiskCache::Entry::Ptr entry = DiskCache::open(key, "entry");
+  BOOST_REQUIRE(entry);
+  BOOST_CHECK_EQUAL(entry->header.width, 2);
+  BOOST_CHECK_EQUAL(entry->header.height, 3);
+  BOOST_CHECK_EQUAL(entry->header.stride, 8);
+  BOOST_CHECK_EQUAL_COLLECTIONS(entry->data(), entry->data() + data.size(),
+                                data.begin(), data.end());
+}
+
+BOOST_AUTO_TEST_CASE(diskcache_uncommitted_writer) {
+  CacheDirectory directory;
+  const std::string key =
+      DiskCache::computeKey({TestFiles::getPathToFile("C.tif")});
+
+  fs::path temporary;
+  {
+    DiskCache::Writer::Ptr writer = DiskCache::create(key, "entry", 1, 1, 4);
+    BOOST_REQUIRE(writer);
+    temporary = writer->temporary;
+    BOOST_CHECK(fs::exists(temporary));
+    // An entry that is being written can not be opened yet
+    BOOST_CHECK(!DiskCache::open(key, "entry"));
+  }
+  BOOST_CHECK(!fs::exists(temporary));
+  BOOST_CHECK(!DiskCache::open(key, "entry"));
+}
+
+BOOST_AUTO_TEST_CASE(diskcache_commit_temporary) {
+  CacheDirectory directory;
+  const std::string key =
+      DiskCache::computeKey({TestFiles::getPathToFile("C.tif")});
+
+  const fs::path temporary = DiskCache::createTemporary(key, "file.tif");
+  BOOST_REQUIRE(!temporary.empty());
+  std::ofstream(temporary.string()) << "data";
+  BOOST_CHECK(!fs::exists(DiskCache::getPath(key, "file.tif")));
+
+  BOOST_CHECK(DiskCache::commitTemporary(temporary, key, "file.tif"));
+  BOOST_CHECK(fs::exists(DiskCache::getPath(key, "file.tif")));
+  BOOST_CHECK(!fs::exists(temporary));
+}
+
+BOOST_AUTO_TEST_CASE(diskcache_key_changes) {
+  CacheDirectory directory;
+  const std::string file = copyTestFile(directory.path, "C.tif");
+
+  const std::string key = DiskCache::computeKey({file});
+  BOOST_CHECK_EQUAL(key, DiskCache::computeKey({file}));
+  BOOST_CHECK_NE(key, DiskCache::computeKey({file}, "salt"));
+
+  // A different modification time
+  fs::last_write_time(file, fs::last_write_time(file) - 60);
+  const std::string touched = DiskCache::computeKey({file});
+  BOOST_CHECK_NE(key, touched);
+
+  // A different size
+  {
+    std::ofstream stream(file, std::ios::app | std::ios::binary);
+    stream.put('\0');
+  }
+  fs::last_write_time(file, fs::last_write_time(file) - 60);
+  BOOST_CHECK_NE(touched, DiskCache::computeKey({file}));
+}
+
+BOOST_AUTO_TEST_CASE(diskcache_trim_least_recently_used) {
+  CacheDirectory directory;
+  setenv("SCROOM_SEP_CACHE_SIZE", "1", 1);
+  const std::string file = TestFiles::getPathToFile("C.tif");
+  const std::string old = DiskCache::computeKey({file}, "old");
+  const std::string older = DiskCache::computeKey({file}, "older");
+  const std::string latest = DiskCache::computeKey({file}, "latest");
+
+  // Two entries of 400 kB fit in a megabyte, three don't
+  std::vector<uint8_t> data(400 * 1024);
+  BOOST_REQUIRE(DiskCache::store(old, "entry", 1024, 400, 1024, data.data()));
+  BOOST_REQUIRE(
+      DiskCache::store(older, "entry", 1024, 400, 1024, data.data()));
+  fs::last_write_time(directory.path / old, std::time(nullptr) - 100);
+  fs::last_write_time(directory.path / older, std::time(nullptr) - 50);
+  // Opening an entry uses it
+  BOOST_CHECK(DiskCache::open(old, "entry"));
+
+  BOOST_REQUIRE(
+      DiskCache::store(latest, "entry", 1024, 400, 1024, data.data()));
+  BOOST_CHECK(DiskCache::open(old, "entry"));
+  BOOST_CHECK(!fs::exists(directory.path / older));
+  BOOST_CHECK(DiskCache::open(latest, "entry"));
+
+  // The entry that was just committed is kept, even if it does not fit
+  std::vector<uint8_t> large(2 * 1024 * 1024);
+  BOOST_REQUIRE(
+      DiskCache::store(older, "entry", 1024, 2048, 1024, large.data()));
+  BOOST_CHECK(DiskCache::open(older, "entry"));
+  BOOST_CHECK(!fs::exists(directory.path / old));
+  BOOST_CHECK(!fs::exists(directory.path / latest));
+
+  unsetenv("SCROOM_SEP_CACHE_SIZE");
+  BOOST_CHECK_EQUAL(DiskCache::getMaxSize(), static_cast<uintmax_t>(8) << 30);
+}
+
+BOOST_AUTO_TEST_CASE(diskcache_sep_pyramid) {
+  ColorConfig::getInstance().loadFile();
+  const std::string path = TestFiles::getPathToFile("sep_cmyk.sep");
+
+  std::vector<uint8_t> expected;
+  {
+    // Without a cache directory
+    unsetenv("SCROOM_SEP_CACHE_DIR");
+    auto source = openSep(path);
+    expected = fillAllRows(source);
+    source->done();
+  }
+
+  CacheDirectory directory;
+  {
+    auto source = openSep(path);
+    source->findOverviews();
+    BOOST_CHECK_EQUAL(source->getOverviewFactor(2), 0);
+
+    Notification cached;
+    source->pyramidCached = [&cached] { cached.notify(); };
+    BOOST_CHECK(fillAllRows(source) == expected);
+    BOOST_REQUIRE(cached.wait());
+    source->done();
+  }
+  {
+    // The next open draws zoomed-out views from the reduced images: 300x200
+    // and 150x100, which fits in a single tile
+    auto source = openSep(path);
+    source->findOverviews();
+    BOOST_CHECK_EQUAL(source->getOverviewFactor(2), 2);
+    BOOST_CHECK_EQUAL(source->getOverviewFactor(1000), 4);
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    auto reduced = source->readOverview(2, width, height);
+    BOOST_CHECK_EQUAL(width, 300);
+    BOOST_CHECK_EQUAL(height, 200);
+    BOOST_REQUIRE_EQUAL(reduced.size(), 300 * 200 * 4);
+
+    // Every pixel averages 2x2 pixels
+    const size_t x = 65;
+    const size_t y = 50;
+    for (size_t c = 0; c < 4; c++) {
+      const int sum = expected[((2 * y) * 600 + 2 * x) * 4 + c] +
+                      expected[((2 * y) * 600 + 2 * x + 1) * 4 + c] +
+                      expected[((2 * y + 1) * 600 + 2 * x) * 4 + c] +
+                      expected[((2 * y + 1) * 600 + 2 * x + 1) * 4 + c];
+      BOOST_CHECK_EQUAL(reduced[(y * 300 + x) * 4 + c], (sum + 2) / 4);
+    }
+    source->done();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(diskcache_sep_pyramid_out_of_order) {
+  ColorConfig::getInstance().loadFile();
+  CacheDirectory directory;
+  const std::string path = TestFiles::getPathToFile("sep_cmyk.sep");
+
+  auto source = openSep(path);
+  const int width = 600;
+  const int bpp = 4;
+  boost::shared_ptr<uint8_t> data(new uint8_t[width * 100 * bpp],
+                                  [](uint8_t *p) { delete[] p; });
+  std::vector<Tile::Ptr> tiles = {
+      Tile::Ptr(new Tile(width, 100, 8 * bpp, data))};
+
+  source->fillTiles(0, 100, width, 0, tiles);
+  BOOST_CHECK(source->pyramidWriter);
+
+  // Skipping lines gives up on the reduced images
+  source->fillTiles(200, 100, width, 0, tiles);
+  BOOST_CHECK(!source->pyramidWriter);
+  BOOST_CHECK(fs::is_empty(directory.path / source->computeDiskCacheKey()));
+  source->done();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,189 @@
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <fstream>
+
+#include "../colorconfig/CustomColorConfig.hh"
+#include "../export/exporter.hh"
+#include "../export/exportsource.hh"
+#include "../export/pyramidtiffwriter.hh"
+#include "testglobals.hh"
+
+/** Test cases for the export directory */
+
+namespace {
+/** Reads the pixel at (x, y) of the current directory of a tiled RGB TIFF */
+std::vector<uint8_t> readPixel(TIFF *tif, int x, int y) {
+  uint32_t tileWidth, tileLength;
+  TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tileWidth);
+  TIFFGetField(tif, TIFFTAG_TILELENGTH, &tileLength);
+
+  std::vector<uint8_t> tile(TIFFTileSize(tif));
+  TIFFReadTile(tif, tile.data(), x, y, 0, 0);
+  const size_t offset = ((y % tileLength) * tileWidth + x % tileWidth) * 3;
+  return {tile[offset], tile[offset + 1], tile[offset + 2]};
+}
+
+std::string temporaryFile() {
+  return (boost::filesystem::temp_directory_path() /
+          boost::filesystem::unique_path("spsep-export-%%%%%%%%.tif"))
+      .string();
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(Export_Tests)
+
+BOOST_AUTO_TEST_CASE(export_source_sep) {
+  ColorConfig::getInstance().loadFile();
+
+  auto source = ExportSource::open(TestFiles::getPathToFile("sep_cmyk.sep"));
+  BOOST_REQUIRE(source);
+  BOOST_CHECK_EQUAL(source->getWidth(), 600);
+  BOOST_CHECK_EQUAL(source->getHeight(), 400);
+}
+
+BOOST_AUTO_TEST_CASE(export_source_sli) {
+  ColorConfig::getInstance().loadFile();
+
+  auto source = ExportSource::open(TestFiles::getPathToFile("sli_pipette.sli"));
+  BOOST_REQUIRE(source);
+  BOOST_CHECK_EQUAL(source->getWidth(), 2);
+  BOOST_CHECK_EQUAL(source->getHeight(), 2);
+
+  // The top-left pixel is pure cyan
+  std::vector<uint8_t> row(3 * 2);
+  BOOST_REQUIRE(source->readRgbRow(0, row.data()));
+  BOOST_CHECK_EQUAL(row[0], 0);
+  BOOST_CHECK_EQUAL(row[1], 255);
+  BOOST_CHECK_EQUAL(row[2], 255);
+}
+
+BOOST_AUTO_TEST_CASE(export_source_unsupported) {
+  BOOST_CHECK(!ExportSource::open(TestFiles::getPathToFile("C.tif")));
+}
+
+BOOST_AUTO_TEST_CASE(export_pyramid_tiff) {
+  ColorConfig::getInstance().loadFile();
+
+  const std::string output = temporaryFile();
+  BOOST_REQUIRE(exportPyramidTiff(TestFiles::getPathToFile("sep_cmyk.sep"),
+                                  output, 64, 3));
+
+  auto source = ExportSource::open(TestFiles::getPathToFile("sep_cmyk.sep"));
+  std::vector<uint8_t> rows(3 * 600 * 2);
+  BOOST_REQUIRE(source->readRgbRows(100, 2, rows.data()));
+
+  TIFF *tif = TIFFOpen(output.c_str(), "r");
+  BOOST_REQUIRE(tif);
+  BOOST_CHECK(TIFFIsTiled(tif));
+
+  // 600x400, 300x200, 150x100, 75x50 and 38x25
+  BOOST_CHECK_EQUAL(TIFFNumberOfDirectories(tif), 5);
+
+  // The full resolution level matches the source
+  auto pixel = readPixel(tif, 130, 100);
+  for (int c = 0; c < 3; c++) {
+    BOOST_CHECK_EQUAL(pixel[c], rows[130 * 3 + c]);
+  }
+
+  // The first reduced level averages 2x2 pixels
+  BOOST_REQUIRE(TIFFSetDirectory(tif, 1));
+  uint32_t width;
+  TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
+  BOOST_CHECK_EQUAL(width, 300);
+  pixel = readPixel(tif, 65, 50);
+  for (int c = 0; c < 3; c++) {
+    const int sum = rows[130 * 3 + c] + rows[131 * 3 + c] +
+                    rows[(600 + 130) * 3 + c] + rows[(600 + 131) * 3 + c];
+    BOOST_CHECK_EQUAL(pixel[c], (sum + 2) / 4);
+  }
+
+  TIFFClose(tif);
+  boost::filesystem::remove(output);
+}
+
+BOOST_AUTO_TEST_CASE(export_pyramid_tiff_read_error) {
+  ColorConfig::getInstance().loadFile();
+
+  // A tiled channel file can't be read a scanline at a time
+  const boost::filesystem::path directory =
+      boost::filesystem::temp_directory_path() /
+      boost::filesystem::unique_path("spsep-export-%%%%%%%%");
+  boost::filesystem::create_directories(directory);
+  TIFF *tif = TIFFOpen((directory / "C.tif").string().c_str(), "w");
+  BOOST_REQUIRE(tif);
+  TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, 64);
+  TIFFSetField(tif, TIFFTAG_IMAGELENGTH, 32);
+  TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
+  TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
+  TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISWHITE);
+  TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField(tif, TIFFTAG_TILEWIDTH, 16);
+  TIFFSetField(tif, TIFFTAG_TILELENGTH, 16);
+  std::vector<uint8_t> tile(16 * 16, 100);
+  for (int y = 0; y < 32; y += 16) {
+    for (int x = 0; x < 64; x += 16) {
+      TIFFWriteTile(tif, tile.data(), x, y, 0, 0);
+    }
+  }
+  TIFFClose(tif);
+  const std::string input = (directory / "tiled.sep").string();
+  std::ofstream(input) << "64\n32\nC : C.tif\n";
+
+  auto source = ExportSource::open(input);
+  BOOST_REQUIRE(source);
+  std::vector<uint8_t> row(3 * 64);
+  BOOST_CHECK(!source->readRgbRow(0, row.data()));
+
+  // The export fails, rather than writing blank tiles
+  const std::string output = temporaryFile();
+  BOOST_CHECK(!exportPyramidTiff(input, output, 16, 2));
+
+  boost::filesystem::remove_all(directory);
+  boost::filesystem::remove(output);
+}
+
+BOOST_AUTO_TEST_CASE(export_pyramid_tiff_invalid_tile_size) {
+  BOOST_CHECK(!PyramidTiffWriter::create(temporaryFile(), 100, 100, 10));
+}
+
+BOOST_AUTO_TEST_CASE(export_pyramid_tiff_reduced_only) {
+  // Four samples per pixel, with only the reduced images in the file
+  const std::string output = temporaryFile();
+  auto writer = PyramidTiffWriter::create(output, 40, 34, 16, 4,
+                                          PHOTOMETRIC_MINISBLACK, false);
+  BOOST_REQUIRE(writer);
+  std::vector<uint8_t> rows(40 * 34 * 4);
+  for (size_t i = 0; i < rows.size(); i++) {
+    rows[i] = static_cast<uint8_t>(i % 251);
+  }
+  BOOST_REQUIRE(writer->writeRows(rows.data(), 34));
+  BOOST_REQUIRE(writer->finish());
+
+  TIFF *tif = TIFFOpen(output.c_str(), "r");
+  BOOST_REQUIRE(tif);
+  // 20x17 and 10x9
+  BOOST_CHECK_EQUAL(TIFFNumberOfDirectories(tif), 2);
+  uint32_t width;
+  uint16_t spp;
+  TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
+  TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &spp);
+  BOOST_CHECK_EQUAL(width, 20);
+  BOOST_CHECK_EQUAL(spp, 4);
+
+  std::vector<uint8_t> tile(TIFFTileSize(tif));
+  TIFFReadTile(tif, tile.data(), 0, 0, 0, 0);
+  for (int c = 0; c < 4; c++) {
+    const int sum = rows[c] + rows[4 + c] + rows[40 * 4 + c] +
+                    rows[40 * 4 + 4 + c];
+    BOOST_CHECK_EQUAL(tile[c], (sum + 2) / 4);
+  }
+  TIFFClose(tif);
+  boost::filesystem::remove(output);
+
+  // An image that fits in a tile has no reduced images
+  BOOST_CHECK(!PyramidTiffWriter::create(temporaryFile(), 16, 16, 16, 4,
+                                         PHOTOMETRIC_MINISBLACK, false));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,127 @@
+#include <boost/test/unit_test.hpp>
+
+#include <iterator>
+#include <sstream>
+
+#include "../inkcoverage.hh"
+#include "testglobals.hh"
+
+/** Test cases for inkcoverage.hh */
+
+namespace {
+/** Computes the histograms and maximum total area coverage line by line */
+void computeDirectly(const SepFile &file,
+                     std::vector<InkCoverage::Histogram> &histograms,
+                     int &maxTotal) {
+  auto source = SepSource::create();
+  source->setData(file);
+  source->openFiles();
+
+  const size_t spp = source->nr_channels;
+  histograms.assign(spp, InkCoverage::Histogram{});
+  maxTotal = 0;
+
+  std::vector<byte> row(file.width * spp);
+  for (size_t y = 0; y < file.height; y++) {
+    source->readCombinedScanline(row, y);
+    for (size_t x = 0; x < file.width; x++) {
+      int total = 0;
+      for (size_t c = 0; c < spp; c++) {
+        histograms[c][row[x * spp + c]]++;
+        total += row[x * spp + c];
+      }
+      maxTotal = std::max(maxTotal, total);
+    }
+  }
+  source->done();
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(InkCoverage_Tests)
+
+BOOST_AUTO_TEST_CASE(inkcoverage_process_bands) {
+  SepFile file = SepSource::parseSep(TestFiles::getPathToFile("sep_cmyk.sep"));
+  auto coverage = InkCoverage::create(file);
+  BOOST_REQUIRE(coverage->getBandCount() >= 1);
+  BOOST_CHECK(!coverage->isDone());
+  BOOST_CHECK_EQUAL(coverage->getStatus(),
+                    "0 of " + std::to_string(coverage->getBandCount()) +
+                        " bands");
+
+  for (int band = 0; band < coverage->getBandCount(); band++) {
+    coverage->processBand(band);
+  }
+  BOOST_CHECK(coverage->isDone());
+  BOOST_CHECK_EQUAL(coverage->getStatus(), "done");
+
+  std::vector<InkCoverage::Histogram> expected;
+  int expectedMax;
+  computeDirectly(file, expected, expectedMax);
+
+  BOOST_REQUIRE(expected.size() == coverage->channels.size());
+  for (size_t c = 0; c < expected.size(); c++) {
+    auto histogram = coverage->getHistogram(coverage->channels[c]);
+    uint64_t count = 0;
+    for (size_t value = 0; value < 256; value++) {
+      BOOST_CHECK_EQUAL(histogram[value], expected[c][value]);
+      count += histogram[value];
+    }
+    BOOST_CHECK_EQUAL(count, file.width * file.height);
+  }
+  BOOST_CHECK_EQUAL(coverage->maxTotalCoverage, expectedMax);
+
+  auto properties = coverage->getProperties();
+  for (size_t c = 0; c < coverage->channels.size(); c++) {
+    const std::string &channel = coverage->channels[c];
+    BOOST_CHECK(properties.count("Ink coverage " + channel));
+
+    // The histogram, as 256 numbers separated by spaces
+    std::istringstream histogram(
+        properties["Ink coverage histogram " + channel]);
+    std::vector<uint64_t> values{std::istream_iterator<uint64_t>(histogram),
+                                 std::istream_iterator<uint64_t>()};
+    BOOST_REQUIRE_EQUAL(values.size(), 256);
+    for (size_t value = 0; value < 256; value++) {
+      BOOST_CHECK_EQUAL(values[value], expected[c][value]);
+    }
+  }
+  BOOST_CHECK(properties.count("Total area coverage mean"));
+  BOOST_CHECK(properties.count("Total area coverage max"));
+}
+
+BOOST_AUTO_TEST_CASE(inkcoverage_bands_align_to_strips) {
+  SepFile file = SepSource::parseSep(TestFiles::getPathToFile("sep_cmyk.sep"));
+  auto coverage = InkCoverage::create(file);
+  const int stripHeight = coverage->getStripHeight();
+  BOOST_REQUIRE(stripHeight >= 1);
+  BOOST_CHECK_EQUAL(coverage->bandHeight % stripHeight, 0);
+  BOOST_CHECK(coverage->getBandCount() * coverage->bandHeight >=
+              static_cast<int>(file.height));
+}
+
+BOOST_AUTO_TEST_CASE(inkcoverage_is_property) {
+  BOOST_CHECK(InkCoverage::isProperty("Ink coverage Cyan"));
+  BOOST_CHECK(InkCoverage::isProperty("Total area coverage max"));
+  BOOST_CHECK(InkCoverage::isProperty("Ink coverage histogram Cyan"));
+  BOOST_CHECK(InkCoverage::isProperty(InkCoverage::STATUS_PROPERTY));
+  BOOST_CHECK(!InkCoverage::isProperty("Pipette"));
+}
+
+BOOST_AUTO_TEST_CASE(inkcoverage_background) {
+  SepFile file = SepSource::parseSep(TestFiles::getPathToFile("sep_cmyk.sep"));
+  auto coverage = InkCoverage::create(file);
+  Notification done;
+  coverage->done = [&done] { done.notify(); };
+
+  coverage->start();
+  BOOST_REQUIRE(done.wait());
+  BOOST_REQUIRE(coverage->isDone());
+
+  uint64_t count = 0;
+  for (auto value : coverage->getHistogram(coverage->channels[0])) {
+    count += value;
+  }
+  BOOST_CHECK_EQUAL(count, file.width * file.height);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
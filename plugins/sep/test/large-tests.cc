@@ -0,0 +1,258 @@
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <cstring>
+
+#include "../colorconfig/CustomColorConfig.hh"
+#include "../generator/datasetgenerator.hh"
+#include "../sepsource.hh"
+#include "../sli/slilayer.hh"
+#include "../sli/sliparser.hh"
+#include "../sli/slipresentation.hh"
+#include "testglobals.hh"
+
+/**
+ * Scale tests on generated datasets. They take a while and need several GB of
+ * memory and disk space, so they are disabled by default. Run them with
+ * `spsep_tests --run_test=Large_Tests`, or configure with ENABLE_LARGE_TESTS
+ * and run `ctest -L large`.
+ */
+
+namespace fs = boost::filesystem;
+
+namespace {
+/**
+ * Generates a dataset in a new temporary directory, and loads its colors.
+ * The directory is removed and the test colors are restored afterwards.
+ */
+struct Dataset {
+  fs::path directory;
+
+  Dataset(const DatasetOptions &options)
+      : directory(fs::temp_directory_path() /
+                  fs::unique_path("spsep-large-%%%%%%%%")) {
+    BOOST_REQUIRE(
+        DatasetGenerator::generate(directory.string(), "large", options));
+    ColorConfig::getInstance().loadFile(
+        (directory / "colours.json").string());
+  }
+
+  ~Dataset() {
+    ColorConfig::getInstance().loadFile(
+        TestFiles::getPathToFile("colours.json"));
+    boost::system::error_code ec;
+    fs::remove_all(directory, ec);
+  }
+
+  std::string path(const std::string &extension) const {
+    return (directory / ("large" + extension)).string();
+  }
+};
+
+/**
+ * Reads the band of @param lineCount rows at @param startLine of @param
+ * source, and checks the samples on the last row against the generator.
+ */
+void checkBand(const SepSource::Ptr &source, int startLine, int lineCount) {
+  const size_t width = source->sep_file.width;
+  const size_t bpp = source->channels.size();
+  boost::shared_ptr<uint8_t> data(new uint8_t[width * lineCount * bpp],
+                                  [](uint8_t *p) { delete[] p; });
+  std::vector<Tile::Ptr> tiles = {Tile::Ptr(
+      new Tile(static_cast<int>(width), lineCount, 8 * bpp, data))};
+  source->fillTiles(startLine, lineCount, static_cast<int>(width), 0, tiles);
+
+  // The channels are sorted by name, so find the channel number of each
+  std::vector<int> channelNumbers;
+  for (const auto &name : source->channels) {
+    int c = 0;
+    while (DatasetGenerator::channelColor(c).name != name) {
+      c++;
+    }
+    channelNumbers.push_back(c);
+  }
+
+  const size_t y = startLine + lineCount - 1;
+  const uint8_t *row = data.get() + (lineCount - 1) * width * bpp;
+  for (size_t x = 0; x < width; x += 997) {
+    for (size_t i = 0; i < bpp; i++) {
+      BOOST_REQUIRE_EQUAL(row[x * bpp + i],
+                          DatasetGenerator::sample(x, y, channelNumbers[i]));
+    }
+  }
+}
+
+SepSource::Ptr openSep(const std::string &path) {
+  SepSource::Ptr source = SepSource::create();
+  source->setData(SepSource::parseSep(path));
+  source->setName(path);
+  source->openFiles();
+  return source;
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(Large_Tests, *utf::disabled())
+
+BOOST_AUTO_TEST_CASE(large_sep_gigapixel) {
+  DatasetOptions options;
+  options.width = 32768;
+  options.height = 32768;
+  options.channels = 1;
+  options.rowsPerStrip = 16;
+  Dataset dataset(options);
+
+  SepSource::Ptr source = openSep(dataset.path(".sep"));
+  BOOST_REQUIRE_EQUAL(source->channels.size(), 1);
+  checkBand(source, 0, 64);
+  checkBand(source, 32768 - 64, 64);
+}
+
+BOOST_AUTO_TEST_CASE(large_sep_16_channels_with_varnish) {
+  DatasetOptions options;
+  options.width = 4096;
+  options.height = 4096;
+  options.channels = 16;
+  options.compression = COMPRESSION_ADOBE_DEFLATE;
+  options.varnish = true;
+  Dataset dataset(options);
+
+  SepFile sep = SepSource::parseSep(dataset.path(".sep"));
+  BOOST_CHECK_EQUAL(sep.files.size(), 16);
+  BOOST_CHECK(!sep.varnish_file.empty());
+
+  SepSource::Ptr source = openSep(dataset.path(".sep"));
+  checkBand(source, 4096 - 256, 256);
+}
+
+BOOST_AUTO_TEST_CASE(large_sep_wider_than_cairo) {
+  // Cairo surfaces can not be wider than 32767 pixels
+  DatasetOptions options;
+  options.width = 40000;
+  options.height = 64;
+  options.compression = COMPRESSION_NONE;
+  Dataset dataset(options);
+
+  SepSource::Ptr source = openSep(dataset.path(".sep"));
+  checkBand(source, 0, 64);
+}
+
+BOOST_AUTO_TEST_CASE(large_tiled_tiff) {
+  DatasetOptions options;
+  options.width = 5000;
+  options.height = 3000;
+  options.tiled = true;
+  const std::string path =
+      (fs::temp_directory_path() / fs::unique_path("spsep-tiled-%%%%.tif"))
+          .string();
+  BOOST_REQUIRE(DatasetGenerator::writeTiff(path, options.width,
+                                            options.height, 4, 0, options));
+
+  TIFF *tif = TIFFOpen(path.c_str(), "r");
+  BOOST_REQUIRE(tif != nullptr);
+  BOOST_CHECK(TIFFIsTiled(tif));
+  std::vector<uint8_t> tile(TIFFTileSize(tif));
+  // The bottom right tile is padded
+  BOOST_REQUIRE(TIFFReadTile(tif, tile.data(), 4864, 2816, 0, 0) > 0);
+  BOOST_CHECK_EQUAL(tile[3], DatasetGenerator::sample(4864, 2816, 3));
+  BOOST_CHECK_EQUAL(tile[(255 * 256 + 255) * 4], 0);
+  TIFFClose(tif);
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(large_sli_thousands_of_layers) {
+  DatasetOptions options;
+  options.width = 64;
+  options.height = 64;
+  options.layers = 5000;
+  options.mixedLayers = true;
+  options.xOffset = 64;
+  options.yOffset = 64;
+  options.layersPerRow = 100;
+  Dataset dataset(options);
+
+  SliFile sli = SliParser::parseFile(dataset.path(".sli"));
+  BOOST_CHECK(sli.errors.empty());
+  BOOST_REQUIRE_EQUAL(sli.layers.size(), 5000);
+  BOOST_CHECK_EQUAL(sli.layers[4999].xoffset, 99 * 64);
+  BOOST_CHECK_EQUAL(sli.layers[4999].yoffset, 49 * 64);
+
+  SliPresentation::Ptr presentation = SliPresentation::create(nullptr);
+  SliSource::Ptr source = presentation->source;
+  BOOST_REQUIRE(source->addLayers(sli.layers));
+  BOOST_REQUIRE_EQUAL(source->layers.size(), 5000);
+  source->computeHeightWidth();
+  BOOST_CHECK_EQUAL(source->total_width, 100 * 64);
+  BOOST_CHECK_EQUAL(source->total_height, 50 * 64);
+}
+
+BOOST_AUTO_TEST_CASE(large_sli_layer_over_4_gib) {
+  // 36000 * 30000 * 4 bytes do not fit in 32 bit offsets
+  DatasetOptions options;
+  options.width = 36000;
+  options.height = 30000;
+  const std::string path =
+      (fs::temp_directory_path() / fs::unique_path("spsep-cmyk-%%%%.tif"))
+          .string();
+  BOOST_REQUIRE(DatasetGenerator::writeTiff(path, options.width,
+                                            options.height, 4, 0, options));
+
+  SliLayer::Ptr layer = SliLayer::create(path, "cmyk.tif", 0, 0);
+  BOOST_REQUIRE(layer->fillMetaFromTiff(8, 4));
+  layer->fillBitmapFromTiff();
+  fs::remove(path);
+
+  const size_t stride = options.width * 4;
+  for (size_t y : {size_t(0), size_t(20000), options.height - 1}) {
+    for (size_t x : {size_t(0), options.width - 1}) {
+      for (int c = 0; c < 4; c++) {
+        BOOST_REQUIRE_EQUAL(layer->bitmap[y * stride + x * 4 + c],
+                            DatasetGenerator::sample(x, y, c));
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(large_sli_surface_over_2_gib) {
+  // Two small layers at opposite corners of a 30000 x 20064 canvas, so the
+  // bottom surface takes 2.4 GB
+  DatasetOptions options;
+  options.width = 64;
+  options.height = 64;
+  const std::string path =
+      (fs::temp_directory_path() / fs::unique_path("spsep-cmyk-%%%%.tif"))
+          .string();
+  BOOST_REQUIRE(DatasetGenerator::writeTiff(path, options.width,
+                                            options.height, 4, 0, options));
+
+  SliPresentation::Ptr presentation = SliPresentation::create(nullptr);
+  SliSource::Ptr source = presentation->source;
+  for (int i = 0; i < 2; i++) {
+    SliLayer::Ptr layer =
+        SliLayer::create(path, "cmyk.tif", i * 29936, i * 20000);
+    BOOST_REQUIRE(layer->fillMetaFromTiff(8, 4));
+    layer->fillBitmapFromTiff();
+    source->layers.push_back(layer);
+  }
+  fs::remove(path);
+
+  source->visible = boost::dynamic_bitset<>{2}.set();
+  source->toggled = boost::dynamic_bitset<>{2}.set();
+  source->computeHeightWidth();
+  source->checkXoffsets();
+  BOOST_REQUIRE_EQUAL(source->total_width, 30000);
+  BOOST_REQUIRE_EQUAL(source->total_height, 20064);
+  source->computeRgb();
+
+  // Both layers are drawn identically
+  SurfaceWrapper::Ptr surface = source->rgbCache.at(0);
+  const size_t stride = surface->getStride();
+  const uint8_t *first = surface->getBitmap();
+  const uint8_t *last = first + size_t(20000) * stride + size_t(29936) * 4;
+  for (size_t y = 0; y < 64; y++) {
+    BOOST_REQUIRE_EQUAL(memcmp(first + y * stride, last + y * stride, 64 * 4),
+                        0);
+  }
+  BOOST_CHECK(first[stride - 1] == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
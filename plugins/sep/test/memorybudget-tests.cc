@@ -0,0 +1,154 @@
+#include <boost/make_shared.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include "../memorybudget.hh"
+#include "../seppresentation.hh"
+#include "testglobals.hh"
+
+/** Test cases for memorybudget.hh */
+
+namespace {
+/** Restores the budget after the test */
+struct Budget {
+  MemoryBudget &budget = MemoryBudget::getInstance();
+  const size_t original = budget.getBudget();
+
+  ~Budget() { budget.setBudget(original); }
+};
+
+/** Creates an account that sheds all of its memory, and counts how often */
+MemoryBudget::Account::Ptr createShedding(int &shed) {
+  auto weak = boost::make_shared<MemoryBudget::Account::WeakPtr>();
+  MemoryBudget::Account::Ptr account =
+      MemoryBudget::getInstance().createAccount("test", [weak, &shed] {
+        shed++;
+        weak->lock()->set(0);
+      });
+  *weak = account;
+  return account;
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(MemoryBudget_Tests)
+
+BOOST_AUTO_TEST_CASE(memorybudget_total) {
+  Budget budget;
+  const size_t before = budget.budget.getTotal();
+  {
+    auto a = budget.budget.createAccount("a");
+    auto b = budget.budget.createAccount("b");
+    a->set(1000);
+    b->set(500);
+    BOOST_CHECK_EQUAL(budget.budget.getTotal(), before + 1500);
+    a->set(200);
+    BOOST_CHECK_EQUAL(budget.budget.getTotal(), before + 700);
+  }
+  // Destroyed accounts no longer count
+  BOOST_CHECK_EQUAL(budget.budget.getTotal(), before);
+}
+
+BOOST_AUTO_TEST_CASE(memorybudget_sheds_least_recently_used) {
+  Budget budget;
+  budget.budget.setBudget(budget.budget.getTotal() + 100);
+
+  int shedOld = 0;
+  int shedMiddle = 0;
+  int shedNew = 0;
+  auto old = createShedding(shedOld);
+  auto middle = createShedding(shedMiddle);
+  auto unsheddable = budget.budget.createAccount("layers");
+  auto recent = createShedding(shedNew);
+  unsheddable->set(30);
+  old->set(30);
+  middle->set(30);
+
+  middle->touch();
+  old->touch();
+  recent->touch();
+
+  // Exceeds the budget by 50, which the least recently used cache can't
+  // release by itself
+  recent->set(60);
+  BOOST_CHECK_EQUAL(shedMiddle, 1);
+  BOOST_CHECK_EQUAL(shedOld, 1);
+  BOOST_CHECK_EQUAL(shedNew, 0);
+  BOOST_CHECK_EQUAL(unsheddable->getBytes(), 30);
+  BOOST_CHECK_EQUAL(recent->getBytes(), 60);
+}
+
+BOOST_AUTO_TEST_CASE(memorybudget_keeps_the_viewed_cache) {
+  Budget budget;
+  budget.budget.setBudget(budget.budget.getTotal() + 100);
+
+  int shed = 0;
+  auto viewed = createShedding(shed);
+  viewed->touch();
+  viewed->set(1000);
+  BOOST_CHECK_EQUAL(shed, 0);
+  BOOST_CHECK_EQUAL(viewed->getBytes(), 1000);
+}
+
+BOOST_AUTO_TEST_CASE(memorybudget_pending_shed) {
+  Budget budget;
+  budget.budget.setBudget(budget.budget.getTotal() + 100);
+
+  // Sheds asynchronously, so its memory is still counted for a while
+  int shed = 0;
+  int shedViewed = 0;
+  auto slow = budget.budget.createAccount("slow", [&shed] { shed++; });
+  auto other = budget.budget.createAccount("other");
+  auto viewed = createShedding(shedViewed);
+  viewed->set(10);
+  slow->set(80);
+  other->set(80);
+  BOOST_CHECK_EQUAL(shed, 1);
+
+  // Not asked again until it reports its new size
+  other->set(90);
+  BOOST_CHECK_EQUAL(shed, 1);
+  BOOST_CHECK_EQUAL(shedViewed, 0);
+  slow->set(0);
+  slow->set(80);
+  BOOST_CHECK_EQUAL(shed, 2);
+}
+
+BOOST_AUTO_TEST_CASE(memorybudget_failed_shed) {
+  Budget budget;
+  budget.budget.setBudget(budget.budget.getTotal() + 100);
+
+  // Can't release its memory while it is in use
+  int shed = 0;
+  MemoryBudget::Account::Ptr busy;
+  busy = budget.budget.createAccount("busy", [&shed, &busy] {
+    shed++;
+    busy->shedFailed();
+  });
+  auto other = budget.budget.createAccount("other");
+  int shedViewed = 0;
+  auto viewed = createShedding(shedViewed);
+  viewed->set(10);
+  busy->set(80);
+  other->set(80);
+  BOOST_CHECK_EQUAL(shed, 1);
+  BOOST_CHECK_EQUAL(busy->getBytes(), 80);
+
+  // Its memory still counts, so it is asked again
+  other->set(90);
+  BOOST_CHECK_EQUAL(shed, 2);
+  BOOST_CHECK_EQUAL(shedViewed, 0);
+}
+
+BOOST_AUTO_TEST_CASE(memorybudget_properties) {
+  Budget budget;
+  budget.budget.setBudget(1 << 30);
+  SepPresentation::Ptr presentation = SepPresentation::create();
+
+  std::string value;
+  BOOST_REQUIRE(presentation->getProperty("memory.budget", value));
+  BOOST_CHECK_EQUAL(value, std::to_string(1 << 30));
+  BOOST_CHECK(presentation->isPropertyDefined("memory.total"));
+  BOOST_REQUIRE(presentation->getProperty("memory", value));
+  BOOST_CHECK(value.find("of 1024.0 MiB") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
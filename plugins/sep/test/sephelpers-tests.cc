@@ -10,6 +10,10 @@ BOOST_AUTO_TEST_CASE(sephelpers_sum_empty_pipette_colours) {
   BOOST_CHECK(res.size() == 1);
   BOOST_CHECK(res[0].first == "C");
   BOOST_CHECK(std::abs(res[0].second - 1.0) < 1e-4);
+
+  // The number of pixels of a 70000 x 70000 selection does not fit in an int
+  res = dividePipetteColors({{"C", 2 * 4900000000.0}}, 4900000000);
+  BOOST_CHECK(std::abs(res[0].second - 2.0) < 1e-4);
 }
 
 BOOST_AUTO_TEST_CASE(sephelpers_sum_pipette_colours) {
@@ -24,6 +28,10 @@ BOOST_AUTO_TEST_CASE(sephelpers_divide_pipette_colours) {
   BOOST_CHECK(res.size() == 1);
   BOOST_CHECK(res[0].first == "C");
   BOOST_CHECK(std::abs(res[0].second - 1.0) < 1e-4);
+
+  // The number of pixels of a 70000 x 70000 selection does not fit in an int
+  res = dividePipetteColors({{"C", 2 * 4900000000.0}}, 4900000000);
+  BOOST_CHECK(std::abs(res[0].second - 2.0) < 1e-4);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,7 @@
 #include <boost/test/unit_test.hpp>
 #include <cmath>
 
+#include "../sep-helpers.hh"
 #include "../seppresentation.hh"
 #include "testglobals.hh"
 
@@ -40,6 +41,36 @@ BOOST_AUTO_TEST_CASE(seppresentation_load_true) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(seppresentation_coverage_on_demand) {
+  SepPresentation::Ptr presentation = SepPresentation::create();
+  std::string value;
+  presentation->getProperty("Total area coverage max", value);
+  BOOST_CHECK(presentation->coverage == nullptr);
+
+  BOOST_CHECK_EQUAL(
+      presentation->load(TestFiles::getPathToFile("sep_cmyk.sep")), true);
+  BOOST_CHECK(presentation->coverage == nullptr);
+  presentation->getProperty("Some other property", value);
+  BOOST_CHECK(presentation->coverage == nullptr);
+
+  // The properties are not known until the statistics are done
+  BOOST_CHECK(!presentation->getProperty("Total area coverage max", value));
+  BOOST_CHECK(presentation->coverage != nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(seppresentation_coverage_status) {
+  SepPresentation::Ptr presentation = SepPresentation::create();
+  BOOST_CHECK_EQUAL(
+      presentation->load(TestFiles::getPathToFile("sep_cmyk.sep")), true);
+
+  // Asking how far the statistics are starts computing them
+  std::string value;
+  BOOST_CHECK(presentation->getProperty(InkCoverage::STATUS_PROPERTY, value));
+  BOOST_CHECK(presentation->coverage != nullptr);
+  BOOST_CHECK(value == "done" || value.find(" bands") != std::string::npos);
+  BOOST_CHECK(presentation->isPropertyDefined(InkCoverage::STATUS_PROPERTY));
+}
+
 BOOST_AUTO_TEST_CASE(seppresentation_getTitle) {
   SepPresentation::Ptr presentation = SepPresentation::create();
   BOOST_CHECK_EQUAL(
@@ -94,4 +125,38 @@ BOOST_AUTO_TEST_CASE(seppresentation_pipette) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(seppresentation_pipette_tile_sums) {
+  SepPresentation::Ptr presentation = SepPresentation::create();
+  BOOST_CHECK_EQUAL(
+      presentation->load(TestFiles::getPathToFile("sep_cmyk.sep")), true);
+  Scroom::Utils::Rectangle<double> area{13, 7, 500, 300};
+
+  // The tables are only built once the pipette is used
+  BOOST_CHECK(!presentation->sep_source->buildTileSums);
+  BOOST_REQUIRE(presentation->sep_source->getTileSums(0, 0) == nullptr);
+
+  // The sums of the pixels themselves, from the single tile of the image
+  ConstTile::Ptr tile =
+      presentation->tbi->getBottomLayer()->getTile(0, 0)->getConstTileSync();
+  auto direct = dividePipetteColors(
+      presentation->layer_operations->sumPixelValues(area.to<int>(), tile),
+      500 * 300);
+
+  auto exact = presentation->getPixelAverages(area);
+  BOOST_CHECK(presentation->sep_source->buildTileSums);
+  BOOST_REQUIRE(presentation->sep_source->getTileSums(0, 0) != nullptr);
+
+  presentation->exactPipette = false;
+  auto approximate = presentation->getPixelAverages(area);
+
+  BOOST_REQUIRE_EQUAL(direct.size(), exact.size());
+  BOOST_REQUIRE_EQUAL(direct.size(), approximate.size());
+  for (size_t i = 0; i < direct.size(); i++) {
+    BOOST_CHECK_EQUAL(direct[i].first, exact[i].first);
+    BOOST_CHECK_CLOSE(direct[i].second, exact[i].second, 1e-9);
+    BOOST_CHECK_EQUAL(direct[i].first, approximate[i].first);
+    BOOST_CHECK(approximate[i].second >= 0 && approximate[i].second <= 255);
+  }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include <boost/dll.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 #include "../sepsource.hh"
 #include "../sli/slilayer.hh"
@@ -8,6 +9,39 @@
 
 /** Test cases for sepsource.hh */
 
+namespace {
+/** Opens the 600 x 400 sep_cmyk.sep */
+SepSource::Ptr openCmyk() {
+  auto source = SepSource::create();
+  source->setData(
+      SepSource::parseSep(TestFiles::getPathToFile("sep_cmyk.sep")));
+  source->openFiles();
+  return source;
+}
+
+/** Fills the single tile of @param lineCount rows at @param startLine */
+std::vector<uint8_t> fillBand(const SepSource::Ptr &source, int startLine,
+                              int lineCount) {
+  const int width = 600;
+  const int bpp = 4;
+  boost::shared_ptr<uint8_t> data(new uint8_t[width * lineCount * bpp],
+                                  [](uint8_t *p) { delete[] p; });
+  std::vector<Tile::Ptr> tiles = {
+      Tile::Ptr(new Tile(width, lineCount, 8 * bpp, data))};
+
+  source->fillTiles(startLine, lineCount, width, 0, tiles);
+  return std::vector<uint8_t>(data.get(), data.get() + width * lineCount * bpp);
+}
+
+/** Waits until the read-ahead job of @param source has finished */
+void waitForReadAhead(const SepSource::Ptr &source) {
+  boost::mutex::scoped_lock lock(source->readAheadMutex);
+  while (source->readAheadRunning) {
+    source->readAheadChanged.wait(lock);
+  }
+}
+} // namespace
+
 BOOST_AUTO_TEST_SUITE(SepSource_Tests)
 
 BOOST_AUTO_TEST_CASE(sepsource_create) {
@@ -185,7 +219,7 @@ BOOST_AUTO_TEST_CASE(sepsource_open_files_twice) {
   std::map<std::string, tiff *> files;
   for (const std::string colour : {"C", "M", "Y", "K"}) {
     files[colour] =
-        source->channel_files[boost::algorithm::to_upper_copy(colour)];
+        source->channel_files[boost::algorithm::to_upper_copy(colour)].get();
   }
 
   // Tested call
@@ -194,7 +228,7 @@ BOOST_AUTO_TEST_CASE(sepsource_open_files_twice) {
   // Check that all the CMYK files have not been opened again
   for (const std::string colour : {"C", "M", "Y", "K"}) {
     BOOST_CHECK(
-        source->channel_files[boost::algorithm::to_upper_copy(colour)] ==
+        source->channel_files[boost::algorithm::to_upper_copy(colour)].get() ==
         files[colour]);
   }
 }
@@ -207,6 +241,8 @@ BOOST_AUTO_TEST_CASE(sepsource_open_files_extra) {
   // Set white manually to avoid white choice popup dialog which
   // crashes when executed during tests.
   source->sep_file.files["W"] = TestFiles::getPathToFile("C.tif");
+  Notification varnishLoaded;
+  source->varnishLoaded = [&varnishLoaded] { varnishLoaded.notify(); };
 
   // Tested call
   source->openFiles();
@@ -218,8 +254,10 @@ BOOST_AUTO_TEST_CASE(sepsource_open_files_extra) {
         nullptr);
   }
 
-  // Check that varnish has also been opened
-  BOOST_CHECK(source->varnish != nullptr);
+  // Check that varnish has also been opened. It is loaded in the
+  // background, so wait for it.
+  BOOST_CHECK(varnishLoaded.wait());
+  BOOST_CHECK(source->getVarnish() != nullptr);
 }
 
 BOOST_AUTO_TEST_CASE(sepsource_check_files) {
@@ -290,6 +328,16 @@ BOOST_AUTO_TEST_CASE(sepsource_fill_sli_empty) {
   BOOST_CHECK(sli->height == 42);
 }
 
+BOOST_AUTO_TEST_CASE(sepsource_fill_sli_no_varnish) {
+  SliLayer::Ptr sli =
+      SliLayer::create(TestFiles::getPathToFile("sep_cmykv.sep"), "name", 0, 0);
+  SepSource::Ptr sepSource = SepSource::create();
+  sepSource->fillSliLayerMeta(sli);
+  BOOST_CHECK(sepSource->sep_file.varnish_file.empty());
+  BOOST_CHECK(sepSource->getVarnish() == nullptr);
+  BOOST_CHECK(sli->spp == 4);
+}
+
 BOOST_AUTO_TEST_CASE(sepsource_fill_sli_1) {
   SliLayer::Ptr sli =
       SliLayer::create(TestFiles::getPathToFile("sep_cmyk.sep"), "name", 0, 0);
@@ -334,4 +382,71 @@ BOOST_AUTO_TEST_CASE(sepsource_fill_no_tiles) {
   BOOST_CHECK(true);
 }
 
+BOOST_AUTO_TEST_CASE(sepsource_read_ahead_sequential) {
+  auto source = openCmyk();
+  // Room for two bands of 100 lines
+  source->readAheadBytes = 2 * 100 * 600 * 4;
+  fillBand(source, 0, 100);
+  BOOST_CHECK(!source->sequential);
+  waitForReadAhead(source);
+  BOOST_CHECK(source->readAheadBands.empty());
+
+  // The second adjacent band starts the read-ahead of the next two
+  fillBand(source, 100, 100);
+  BOOST_CHECK(source->sequential);
+  waitForReadAhead(source);
+  BOOST_CHECK_EQUAL(source->readAheadBands.size(), 2);
+  BOOST_CHECK(source->readAheadBands.count(200) == 1);
+  BOOST_CHECK(source->readAheadBands.count(300) == 1);
+  BOOST_CHECK_EQUAL(source->readAheadMemory->getBytes(), 2 * 100 * 600 * 4);
+
+  // Taking a band leaves the ones after it
+  fillBand(source, 200, 100);
+  waitForReadAhead(source);
+  BOOST_CHECK(source->readAheadBands.count(200) == 0);
+  BOOST_CHECK(source->readAheadBands.count(300) == 1);
+
+  // Jumping back drops all of them
+  fillBand(source, 0, 100);
+  BOOST_CHECK(!source->sequential);
+  BOOST_CHECK(source->readAheadBands.empty());
+
+  source->done();
+  BOOST_CHECK_EQUAL(source->readAheadMemory->getBytes(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(sepsource_read_ahead_limit) {
+  auto source = openCmyk();
+  boost::mutex::scoped_lock lock(source->readAheadMutex);
+  source->bandLines = 100;
+  BOOST_CHECK_EQUAL(source->readAheadLimit(), 400 / 100 + 1);
+
+  source->readAheadBytes = 3 * 100 * 600 * 4;
+  BOOST_CHECK_EQUAL(source->readAheadLimit(), 3);
+
+  // At least one band is decoded ahead, even if it does not fit
+  source->readAheadBytes = 1;
+  BOOST_CHECK_EQUAL(source->readAheadLimit(), 1);
+
+  source->readAheadBytes = 0;
+  BOOST_CHECK_EQUAL(source->readAheadLimit(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(sepsource_read_ahead_same_data) {
+  auto source = openCmyk();
+  auto reference = openCmyk();
+  reference->readAheadBytes = 0;
+
+  for (int line = 0; line < 400; line += 80) {
+    BOOST_CHECK(fillBand(source, line, 80) == fillBand(reference, line, 80));
+  }
+  waitForReadAhead(source);
+  BOOST_CHECK(reference->readAheadBands.empty());
+
+  // The files can be used again after the job has been stopped by done()
+  source->done();
+  waitForReadAhead(source);
+  BOOST_CHECK(fillBand(source, 0, 80) == fillBand(reference, 0, 80));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
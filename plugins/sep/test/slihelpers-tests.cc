@@ -4,6 +4,7 @@
 
 #include <iostream>
 
+#include "../sep-helpers.hh"
 #include "../sli/sli-helpers.hh"
 #include "../sli/slilayer.hh"
 #include <scroom/scroominterface.hh>
@@ -128,6 +129,35 @@ BOOST_AUTO_TEST_CASE(slihelpers_point_to_offset) {
   BOOST_CHECK(pointToOffset(rect, p2) == 6);
 }
 
+BOOST_AUTO_TEST_CASE(slihelpers_point_to_offset_64_bit) {
+  // Offsets of surfaces larger than 2 GiB
+  Scroom::Utils::Point<int> p{0, 70000};
+  BOOST_CHECK_EQUAL(pointToOffset(p, 160000), 11200000000);
+  BOOST_CHECK_EQUAL(getArea({0, 0, 70000, 70000}), 4900000000);
+}
+
+BOOST_AUTO_TEST_CASE(slihelpers_checked_size) {
+  BOOST_CHECK_EQUAL(checkedSize(70000, 160000), 11200000000u);
+  BOOST_CHECK_THROW(checkedSize(SIZE_MAX / 2, 3), std::length_error);
+}
+
+BOOST_AUTO_TEST_CASE(slihelpers_wider_than_cairo) {
+  auto surfaceWrapper = SurfaceWrapper::create(40000, 2, CAIRO_FORMAT_ARGB32);
+  BOOST_CHECK(surfaceWrapper->surface == nullptr);
+  BOOST_CHECK_EQUAL(surfaceWrapper->getStride(), 160000);
+
+  // Areas of the surface can still be drawn
+  cairo_surface_t *sub = surfaceWrapper->createSubSurface({39990, 0, 100, 2});
+  BOOST_REQUIRE(sub != nullptr);
+  BOOST_CHECK_EQUAL(cairo_image_surface_get_width(sub), 10);
+  BOOST_CHECK_EQUAL(cairo_image_surface_get_height(sub), 2);
+  BOOST_CHECK(cairo_image_surface_get_data(sub) ==
+              surfaceWrapper->getBitmap() + 39990 * 4);
+  cairo_surface_destroy(sub);
+
+  BOOST_CHECK(surfaceWrapper->createSubSurface({40000, 0, 10, 2}) == nullptr);
+}
+
 BOOST_AUTO_TEST_CASE(slihelpers_spanned_rectangle) {
   unsigned int n_layers = 2;
   boost::dynamic_bitset<> bitmap{n_layers};
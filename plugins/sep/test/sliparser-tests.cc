@@ -0,0 +1,130 @@
+#include <chrono>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+#include <fmt/format.h>
+
+#include "../sli/sliparser.hh"
+#include "testglobals.hh"
+
+/** Test cases for sliparser.hh */
+
+namespace {
+/** Generates an SLI file with @param layerCount layers */
+std::string generateSli(size_t layerCount) {
+  const std::vector<std::string> files = {"sep_cmyk.sep", "tiff_cmyk.tif",
+                                          "tinycmyk.tif"};
+  std::string contents = "Xresolution: 100\nYresolution: 200\n";
+  for (size_t i = 0; i < layerCount; i++) {
+    contents += fmt::format("{} : {} {}\n", files[i % files.size()], i % 977,
+                            i / 977);
+  }
+  return contents;
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(SliParser_Tests)
+
+BOOST_AUTO_TEST_CASE(sliparser_tokenize) {
+  auto tokens = SliParser::tokenize("  a.tif\t:  1 -2\r");
+  BOOST_REQUIRE_EQUAL(tokens.size(), 4);
+  BOOST_CHECK(tokens[0] == "a.tif");
+  BOOST_CHECK(tokens[1] == ":");
+  BOOST_CHECK(tokens[2] == "1");
+  BOOST_CHECK(tokens[3] == "-2");
+
+  BOOST_CHECK(SliParser::tokenize("").empty());
+  BOOST_CHECK(SliParser::tokenize(" \t\r").empty());
+}
+
+BOOST_AUTO_TEST_CASE(sliparser_parse_file) {
+  SliFile sli =
+      SliParser::parseFile(TestFiles::getPathToFile("sli_xoffset.sli"));
+  BOOST_CHECK(sli.errors.empty());
+  BOOST_CHECK_EQUAL(sli.Xresolution, 100);
+  BOOST_CHECK_EQUAL(sli.Yresolution, 100);
+  BOOST_CHECK(sli.varnishPath.empty());
+  BOOST_REQUIRE_EQUAL(sli.layers.size(), 4);
+  BOOST_CHECK_EQUAL(sli.layers[1].name, "sep_cmyk.sep");
+  BOOST_CHECK_EQUAL(sli.layers[1].filepath,
+                    TestFiles::getPathToFile("sep_cmyk.sep"));
+  BOOST_CHECK_EQUAL(sli.layers[1].xoffset, 100);
+  BOOST_CHECK_EQUAL(sli.layers[1].yoffset, 200);
+}
+
+BOOST_AUTO_TEST_CASE(sliparser_parse_varnish) {
+  SliFile sli =
+      SliParser::parseFile(TestFiles::getPathToFile("sli_varnish.sli"));
+  BOOST_CHECK(sli.errors.empty());
+  BOOST_CHECK(!sli.varnishPath.empty());
+}
+
+BOOST_AUTO_TEST_CASE(sliparser_parse_missing_file) {
+  SliFile sli = SliParser::parseFile(TestFiles::getPathToFile("missing.sli"));
+  BOOST_CHECK_EQUAL(sli.errors.size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(sliparser_offsets_optional) {
+  SliFile sli = SliParser::parse(
+      "tinycmyk.tif\ntinycmyk.tif 5\ntinycmyk.tif: \n", TestFiles::getPath());
+  // "tinycmyk.tif:" is a file name, which does not exist
+  BOOST_CHECK_EQUAL(sli.errors.size(), 1);
+  BOOST_REQUIRE_EQUAL(sli.layers.size(), 2);
+  BOOST_CHECK_EQUAL(sli.layers[0].xoffset, 0);
+  BOOST_CHECK_EQUAL(sli.layers[1].xoffset, 5);
+  BOOST_CHECK_EQUAL(sli.layers[1].yoffset, 0);
+}
+
+BOOST_AUTO_TEST_CASE(sliparser_all_errors) {
+  SliFile sli = SliParser::parse("Xresolution: abc\n"
+                                 "\n"
+                                 "missing.tif : 0 0\n"
+                                 "tinycmyk.tif : x 0\n"
+                                 "tinycmyk.tif : 0 1.5\n"
+                                 "varnish_file: missing.tif\n"
+                                 "tinycmyk.tif : 3 4",
+                                 TestFiles::getPath());
+  BOOST_REQUIRE_EQUAL(sli.errors.size(), 5);
+  BOOST_CHECK(sli.errors[0].find("Line 1:") == 0);
+  BOOST_CHECK(sli.errors[1].find("Line 3:") == 0);
+  BOOST_CHECK(sli.errors[2].find("Line 4:") == 0);
+  BOOST_CHECK(sli.errors[3].find("Line 5:") == 0);
+  BOOST_CHECK(sli.errors[4].find("Line 6:") == 0);
+
+  // The valid line without a trailing newline is still parsed
+  BOOST_REQUIRE_EQUAL(sli.layers.size(), 1);
+  BOOST_CHECK_EQUAL(sli.layers[0].xoffset, 3);
+  BOOST_CHECK_EQUAL(sli.layers[0].yoffset, 4);
+}
+
+BOOST_AUTO_TEST_CASE(sliparser_stats_once) {
+  SliParser parser(TestFiles::getPath());
+  parser.parseLine("tinycmyk.tif : 0 0", 1);
+  parser.parseLine("tinycmyk.tif : 1 1", 2);
+  parser.parseLine("missing.tif : 1 1", 3);
+  parser.parseLine("missing.tif : 1 1", 4);
+  BOOST_CHECK_EQUAL(parser.exists.size(), 2);
+  BOOST_CHECK_EQUAL(parser.result.layers.size(), 2);
+  BOOST_CHECK_EQUAL(parser.result.errors.size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(sliparser_10k_layers) {
+  const size_t layerCount = 10000;
+  const std::string contents = generateSli(layerCount);
+
+  const auto start = std::chrono::steady_clock::now();
+  SliFile sli = SliParser::parse(contents, TestFiles::getPath());
+  const auto elapsed = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start);
+  BOOST_TEST_MESSAGE(fmt::format("Parsed {} layers in {:.1f} ms", layerCount,
+                                 elapsed.count()));
+
+  BOOST_CHECK(sli.errors.empty());
+  BOOST_CHECK_EQUAL(sli.Xresolution, 100);
+  BOOST_CHECK_EQUAL(sli.Yresolution, 200);
+  BOOST_REQUIRE_EQUAL(sli.layers.size(), layerCount);
+  BOOST_CHECK_EQUAL(sli.layers[9999].xoffset, 9999 % 977);
+  BOOST_CHECK_EQUAL(sli.layers[9999].yoffset, 9999 / 977);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
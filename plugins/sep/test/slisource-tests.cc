@@ -1,7 +1,12 @@
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
 #include <boost/dll.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/test/unit_test.hpp>
 
+#include "../colorconfig/CustomColorConfig.hh"
 #include "../sli/slipresentation.hh"
 #include <scroom/scroominterface.hh>
 
@@ -162,4 +167,164 @@ BOOST_AUTO_TEST_CASE(slisource_computergb_xoffset) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(slisource_average_visible_channels) {
+  SliPresentation::Ptr presentation = createPresentation1();
+  presentation->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+  dummyRedraw1(presentation);
+  auto source = presentation->source;
+  Scroom::Utils::Rectangle<int> canvas{0, 0, source->total_width,
+                                       source->total_height};
+
+  // Sum the samples of all layers one by one
+  std::map<std::string, double> expected;
+  for (auto &layer : source->layers) {
+    for (int i = 0; i < layer->width * layer->height; i++) {
+      for (unsigned int j = 0; j < layer->spp; j++) {
+        expected[layer->channels[j]->name] +=
+            layer->bitmap[i * layer->spp + j];
+      }
+    }
+  }
+
+  auto result = source->averageVisibleChannels(canvas);
+  BOOST_REQUIRE(result.size() == expected.size());
+  for (auto &channel : result) {
+    BOOST_CHECK_CLOSE(channel.second,
+                      expected[channel.first] / getArea(canvas), 1e-9);
+  }
+
+  // The pipette does not wait while the layers are being drawn
+  {
+    boost::mutex::scoped_lock lock(source->mtx);
+    BOOST_CHECK_EQUAL(source->averageVisibleChannels(canvas).size(),
+                      expected.size());
+  }
+
+  // Hidden layers do not contribute
+  source->visible.reset();
+  result = source->averageVisibleChannels(canvas);
+  BOOST_REQUIRE(result.size() == expected.size());
+  for (auto &channel : result) {
+    BOOST_CHECK(channel.second == 0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(slisource_import_bitmaps_failure) {
+  ColorConfig::getInstance().loadFile();
+  SliPresentation::Ptr presentation = createPresentation1();
+  auto source = presentation->source;
+
+  auto layer = SliLayer::create(TestFiles::getPathToFile("sep_cmyk.sep"),
+                                "sep_cmyk.sep", 0, 0);
+  auto sep = SepSource::create();
+  sep->fillSliLayerMeta(layer);
+  source->layers.push_back(layer);
+  source->sepSources[layer] = sep;
+
+  // Far too large to allocate
+  layer->width = INT_MAX;
+  layer->height = INT_MAX;
+  source->importBitmaps();
+  BOOST_CHECK(source->cacheFailed);
+  BOOST_CHECK(!source->bitmapsImported);
+  BOOST_CHECK(layer->bitmap == nullptr);
+  BOOST_CHECK(source->getSurface(0) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(slisource_average_visible_channels_no_layers) {
+  SliPresentation::Ptr presentation = createPresentation1();
+  BOOST_CHECK(presentation->source->averageVisibleChannels({0, 0, 10, 10})
+                  .empty());
+}
+
+BOOST_AUTO_TEST_CASE(slisource_reopen_from_disk_cache) {
+  ColorConfig::getInstance().loadFile();
+  const boost::filesystem::path directory =
+      boost::filesystem::temp_directory_path() /
+      boost::filesystem::unique_path("spsep-cache-%%%%%%%%");
+  boost::filesystem::create_directories(directory);
+  setenv("SCROOM_SEP_CACHE_DIR", directory.c_str(), 1);
+
+  std::vector<uint8_t> expected;
+  {
+    SliPresentation::Ptr presentation = createPresentation1();
+    presentation->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+    dummyRedraw1(presentation);
+    BOOST_CHECK(presentation->source->bitmapsImported);
+    auto level = presentation->source->rgbCache.at(0);
+    expected.assign(level->getBitmap(),
+                    level->getBitmap() +
+                        level->getHeight() * level->getStride());
+  }
+
+  // Reopening draws all levels from the disk cache, without the layers
+  SliPresentation::Ptr presentation = createPresentation1();
+  presentation->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+  dummyRedraw1(presentation);
+  auto source = presentation->source;
+  BOOST_CHECK(!source->bitmapsImported);
+  for (auto &layer : source->layers) {
+    BOOST_CHECK(layer->bitmap == nullptr);
+  }
+  BOOST_CHECK(std::equal(expected.begin(), expected.end(),
+                         source->rgbCache.at(0)->getBitmap()));
+
+  // The pipette imports them
+  BOOST_CHECK(!source
+                   ->averageVisibleChannels(
+                       {0, 0, source->total_width, source->total_height})
+                   .empty());
+  BOOST_CHECK(source->bitmapsImported);
+
+  unsetenv("SCROOM_SEP_CACHE_DIR");
+  boost::system::error_code ec;
+  boost::filesystem::remove_all(directory, ec);
+}
+
+BOOST_AUTO_TEST_CASE(slisource_add_layers_in_order) {
+  SliPresentation::Ptr presentation = createPresentation1();
+  ColorConfig::getInstance().loadFile();
+
+  // More layers than threads, alternating between TIFF and SEP files
+  std::vector<SliFileLayer> files;
+  for (int i = 0; i < 3 * SliSource::MAX_PROBE_THREADS; i++) {
+    SliFileLayer file;
+    file.name = i % 2 ? "sep_cmyk.sep" : "tinycmyk.tif";
+    file.filepath = TestFiles::getPathToFile(file.name);
+    file.xoffset = i;
+    file.yoffset = 2 * i;
+    files.push_back(file);
+  }
+
+  auto source = presentation->source;
+  BOOST_REQUIRE(source->addLayers(files));
+  BOOST_REQUIRE(source->layers.size() == files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    BOOST_CHECK(source->layers[i]->name == files[i].name);
+    BOOST_CHECK(source->layers[i]->xoffset == files[i].xoffset);
+    BOOST_CHECK(source->layers[i]->yoffset == files[i].yoffset);
+    BOOST_CHECK(source->sepSources.count(source->layers[i]) == i % 2);
+  }
+  BOOST_CHECK(source->layers[1]->width == 600);
+  BOOST_CHECK(source->layers[1]->spp == 4);
+}
+
+BOOST_AUTO_TEST_CASE(slisource_add_layers_failure) {
+  SliPresentation::Ptr presentation = createPresentation1();
+
+  // The second layer has 1 sample per pixel instead of 4
+  std::vector<SliFileLayer> files(3);
+  files[0].name = "tinycmyk.tif";
+  files[1].name = "C.tif";
+  files[2].name = "tinycmyk.tif";
+  for (auto &file : files) {
+    file.filepath = TestFiles::getPathToFile(file.name);
+  }
+
+  auto source = presentation->source;
+  BOOST_CHECK(!source->addLayers(files));
+  // The layers in front of the failing one have been added
+  BOOST_CHECK(source->layers.size() == 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
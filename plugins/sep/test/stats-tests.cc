@@ -0,0 +1,109 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../seppresentation.hh"
+#include "../sli/slipresentation.hh"
+#include "../stats.hh"
+#include "testglobals.hh"
+
+/** Test cases for stats.hh */
+
+BOOST_AUTO_TEST_SUITE(Stats_Tests)
+
+BOOST_AUTO_TEST_CASE(stats_record) {
+  Stats::Stage stage("test");
+  stage.record(2000000, 10);
+  stage.record(5000000, 20);
+  stage.record(1000000, 30);
+
+  BOOST_CHECK_EQUAL(stage.calls.load(), 3);
+  BOOST_CHECK_EQUAL(stage.nanoseconds.load(), 8000000);
+  BOOST_CHECK_EQUAL(stage.maxNanoseconds.load(), 5000000);
+  BOOST_CHECK_EQUAL(stage.pixels.load(), 60);
+
+  stage.reset();
+  BOOST_CHECK_EQUAL(stage.calls.load(), 0);
+  BOOST_CHECK_EQUAL(stage.maxNanoseconds.load(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(stats_scoped_timer) {
+  Stats::Stage stage("test");
+  {
+    Stats::ScopedTimer timer(stage);
+    timer.addPixels(100);
+    timer.addPixels(28);
+  }
+  BOOST_CHECK_EQUAL(stage.calls.load(), 1);
+  BOOST_CHECK_EQUAL(stage.pixels.load(), 128);
+  BOOST_CHECK(stage.nanoseconds.load() > 0);
+}
+
+BOOST_AUTO_TEST_CASE(stats_properties) {
+  Stats::Set::Ptr stats = Stats::Set::create();
+  stats->computeRgb.record(4000000, 2000000);
+
+  std::string value;
+  BOOST_REQUIRE(stats->getProperty("stats.computeRgb.calls", value));
+  BOOST_CHECK_EQUAL(value, "1");
+  BOOST_REQUIRE(stats->getProperty("stats.computeRgb.ms", value));
+  BOOST_CHECK_EQUAL(value, "4.000");
+  BOOST_REQUIRE(stats->getProperty("stats.computeRgb.mpix_per_s", value));
+  BOOST_CHECK_EQUAL(value, "500.0");
+  BOOST_REQUIRE(stats->getProperty("stats.fillTiles.pixels", value));
+  BOOST_CHECK_EQUAL(value, "0");
+
+  // Only the stages that were called are in the summary
+  BOOST_REQUIRE(stats->getProperty("stats", value));
+  BOOST_CHECK(value.find("computeRgb: 1 calls") != std::string::npos);
+  BOOST_CHECK(value.find("fillTiles") == std::string::npos);
+
+  BOOST_CHECK(!stats->getProperty("stats.computeRgb.unknown", value));
+  BOOST_CHECK(!stats->getProperty("stats.unknown.calls", value));
+  BOOST_CHECK(!stats->getProperty("stats.", value));
+  BOOST_CHECK(!stats->getProperty("Pipette", value));
+}
+
+BOOST_AUTO_TEST_CASE(stats_sets) {
+  Stats::Set::Ptr first = Stats::Set::create();
+  Stats::Set::Ptr second = Stats::Set::create();
+  const uint64_t totalCalls = Stats::Set::total().reduce.calls;
+
+  { Stats::ScopedTimer timer(first->reduce); }
+  first->reduce.record(1000, 10);
+
+  // The sets don't share their counters, but all of them count in the total,
+  // which jobs of other tests may still be adding to
+  BOOST_CHECK_EQUAL(first->reduce.calls.load(), 2);
+  BOOST_CHECK_EQUAL(second->reduce.calls.load(), 0);
+  BOOST_CHECK(Stats::Set::total().reduce.calls >= totalCalls + 2);
+
+  // Resetting a set leaves the total alone
+  first->reset();
+  BOOST_CHECK_EQUAL(first->reduce.calls.load(), 0);
+  BOOST_CHECK(Stats::Set::total().reduce.calls >= totalCalls + 2);
+}
+
+BOOST_AUTO_TEST_CASE(stats_presentation_properties) {
+  SepPresentation::Ptr sep = SepPresentation::create();
+  SliPresentation::Ptr sli = SliPresentation::create(nullptr);
+
+  std::string value;
+  BOOST_CHECK(sep->isPropertyDefined("stats.fillTiles.calls"));
+  BOOST_CHECK(sep->getProperty("stats.fillTiles.calls", value));
+  BOOST_CHECK_EQUAL(value, "0");
+  BOOST_CHECK(sli->isPropertyDefined("stats.reduceRgb.max_ms"));
+  BOOST_CHECK(sli->getProperty("stats", value));
+  BOOST_CHECK(!sli->isPropertyDefined("stats.nothing.calls"));
+
+  // Every presentation only shows its own counters
+  sep->sep_source->stats->fillTiles.record(1000, 10);
+  BOOST_CHECK(sep->getProperty("stats.fillTiles.calls", value));
+  BOOST_CHECK_EQUAL(value, "1");
+  SepPresentation::Ptr other = SepPresentation::create();
+  BOOST_CHECK(other->getProperty("stats.fillTiles.calls", value));
+  BOOST_CHECK_EQUAL(value, "0");
+
+  // The pipette property is still there
+  BOOST_CHECK(sep->isPropertyDefined(PIPETTE_PROPERTY_NAME));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
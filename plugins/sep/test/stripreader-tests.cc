@@ -0,0 +1,167 @@
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include "../generator/datasetgenerator.hh"
+#include "../sepsource.hh"
+#include "../sli/slilayer.hh"
+#include "../stripreader.hh"
+#include "testglobals.hh"
+
+/** Test cases for stripreader.hh */
+
+namespace fs = boost::filesystem;
+
+namespace {
+const size_t WIDTH = 300;
+const size_t HEIGHT = 200;
+
+/**
+ * A new temporary directory for the duration of a test case, which restores
+ * the backend afterwards.
+ */
+struct Directory {
+  fs::path path;
+  const StripReader::Backend backend = StripReader::getBackend();
+
+  Directory()
+      : path(fs::temp_directory_path() /
+             fs::unique_path("spsep-strips-%%%%%%%%")) {
+    fs::create_directories(path);
+  }
+
+  ~Directory() {
+    StripReader::setBackend(backend);
+    boost::system::error_code ec;
+    fs::remove_all(path, ec);
+  }
+
+  /** Writes a single channel TIFF file with @param options */
+  std::string writeTiff(const DatasetOptions &options) const {
+    const std::string file = (path / "channel.tif").string();
+    BOOST_REQUIRE(
+        DatasetGenerator::writeTiff(file, WIDTH, HEIGHT, 1, 0, options));
+    return file;
+  }
+};
+
+DatasetOptions uncompressed() {
+  DatasetOptions options;
+  options.width = WIDTH;
+  options.height = HEIGHT;
+  options.compression = COMPRESSION_NONE;
+  options.rowsPerStrip = 64;
+  return options;
+}
+
+/** Checks @param count rows starting at @param row against the generator */
+void checkRows(const std::vector<uint8_t> &data, size_t row, size_t count) {
+  for (size_t y = 0; y < count; y++) {
+    for (size_t x = 0; x < WIDTH; x += 7) {
+      BOOST_REQUIRE_EQUAL(data[y * WIDTH + x],
+                          DatasetGenerator::sample(x, row + y, 0));
+    }
+  }
+}
+
+/** Fills a single tile with all rows of the SEP file at @param path */
+std::vector<uint8_t> fillAllRows(const std::string &path) {
+  SepSource::Ptr source = SepSource::create();
+  source->setData(SepSource::parseSep(path));
+  source->openFiles();
+
+  const size_t bpp = source->channels.size();
+  boost::shared_ptr<uint8_t> data(new uint8_t[WIDTH * HEIGHT * bpp],
+                                  [](uint8_t *p) { delete[] p; });
+  std::vector<Tile::Ptr> tiles = {
+      Tile::Ptr(new Tile(WIDTH, HEIGHT, 8 * bpp, data))};
+  source->fillTiles(0, HEIGHT, WIDTH, 0, tiles);
+  return std::vector<uint8_t>(data.get(), data.get() + WIDTH * HEIGHT * bpp);
+}
+
+/** Reads the bitmap of the SEP file at @param path as an SLI layer */
+std::vector<uint8_t> readLayer(const std::string &path) {
+  SliLayer::Ptr sli = SliLayer::create(path, "name", 0, 0);
+  SepSource::Ptr source = SepSource::create();
+  source->fillSliLayerMeta(sli);
+  source->fillSliLayerBitmap(sli);
+  const size_t size = static_cast<size_t>(sli->width) * sli->height * sli->spp;
+  return std::vector<uint8_t>(&sli->bitmap[0], &sli->bitmap[0] + size);
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(StripReader_Tests)
+
+BOOST_AUTO_TEST_CASE(stripreader_can_read_directly) {
+  Directory directory;
+  tiff *file = TIFFOpen(directory.writeTiff(uncompressed()).c_str(), "r");
+  BOOST_CHECK(StripReader::canReadDirectly(file));
+  TIFFClose(file);
+
+  DatasetOptions tiled = uncompressed();
+  tiled.tiled = true;
+  file = TIFFOpen(directory.writeTiff(tiled).c_str(), "r");
+  BOOST_CHECK(!StripReader::canReadDirectly(file));
+  TIFFClose(file);
+
+  file = TIFFOpen(TestFiles::getPathToFile("C.tif").c_str(), "r");
+  BOOST_CHECK(!StripReader::canReadDirectly(file));
+  TIFFClose(file);
+
+  BOOST_CHECK(!StripReader::canReadDirectly(nullptr));
+}
+
+BOOST_AUTO_TEST_CASE(stripreader_add_rows) {
+  Directory directory;
+  tiff *file = TIFFOpen(directory.writeTiff(uncompressed()).c_str(), "r");
+  BOOST_REQUIRE(file != nullptr);
+
+  // Rows 50 to 150 are in three strips, which are stored one after another
+  std::vector<uint8_t> data(100 * WIDTH);
+  std::vector<StripReader::Request> requests;
+  BOOST_REQUIRE(StripReader::addRows(file, 50, 100, data.data(), requests));
+  BOOST_REQUIRE_EQUAL(requests.size(), 1);
+  BOOST_CHECK_EQUAL(requests[0].length, 100 * WIDTH);
+
+  for (auto backend : {StripReader::PREAD, StripReader::IO_URING}) {
+    std::fill(data.begin(), data.end(), 0);
+    BOOST_CHECK(StripReader::read(requests, backend));
+    checkRows(data, 50, 100);
+  }
+
+  BOOST_CHECK(!StripReader::addRows(file, 150, 51, data.data(), requests));
+  TIFFClose(file);
+}
+
+BOOST_AUTO_TEST_CASE(stripreader_read_error) {
+  std::vector<uint8_t> data(16);
+  for (auto backend : {StripReader::PREAD, StripReader::IO_URING}) {
+    BOOST_CHECK(!StripReader::read({{-1, 0, data.size(), data.data()}},
+                                   backend));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(stripreader_names) {
+  BOOST_CHECK_EQUAL(StripReader::getName(StripReader::SCANLINE), "scanline");
+  BOOST_CHECK_EQUAL(StripReader::getName(StripReader::PREAD), "pread");
+  BOOST_CHECK_EQUAL(StripReader::getName(StripReader::IO_URING), "io_uring");
+}
+
+BOOST_AUTO_TEST_CASE(stripreader_sep_source) {
+  Directory directory;
+  BOOST_REQUIRE(DatasetGenerator::generate(directory.path.string(), "strips",
+                                           uncompressed()));
+  const std::string path = (directory.path / "strips.sep").string();
+
+  StripReader::setBackend(StripReader::SCANLINE);
+  const std::vector<uint8_t> tiles = fillAllRows(path);
+  const std::vector<uint8_t> layer = readLayer(path);
+  BOOST_CHECK(tiles == layer);
+
+  for (auto backend : {StripReader::PREAD, StripReader::IO_URING}) {
+    StripReader::setBackend(backend);
+    BOOST_CHECK(fillAllRows(path) == tiles);
+    BOOST_CHECK(readLayer(path) == layer);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,8 @@
 
 #include <boost/dll.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
 
 namespace utf = boost::unit_test;
 /**
@@ -51,3 +53,31 @@ public:
     return (dir / filename).string();
   }
 };
+
+/**
+ * Lets a test case wait for a callback that is called from a worker thread,
+ * such as SepSource::varnishLoaded, instead of polling for its effect.
+ */
+struct Notification {
+  boost::mutex mutex;
+  boost::condition_variable changed;
+  bool notified = false;
+
+  /** Marks the notification as done, and wakes up wait() */
+  void notify() {
+    boost::mutex::scoped_lock lock(mutex);
+    notified = true;
+    changed.notify_all();
+  }
+
+  /**
+   * Waits until notify() has been called, for at most @param seconds, so a
+   * callback that is never called fails the test case instead of hanging it.
+   * @return whether notify() has been called
+   */
+  bool wait(int seconds = 10) {
+    boost::mutex::scoped_lock lock(mutex);
+    return changed.timed_wait(lock, boost::posix_time::seconds(seconds),
+                              [this] { return notified; });
+  }
+};
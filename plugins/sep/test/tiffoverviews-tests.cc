@@ -0,0 +1,310 @@
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include "../colorconfig/CustomColorConfig.hh"
+#include "../export/pyramidtiffwriter.hh"
+#include "../generator/datasetgenerator.hh"
+#include "../seppresentation.hh"
+#include "../sepsource.hh"
+#include "../sli/sliparser.hh"
+#include "../sli/slipresentation.hh"
+#include "../tiffoverviews.hh"
+#include "testglobals.hh"
+
+/** Test cases for tiffoverviews.hh */
+
+namespace fs = boost::filesystem;
+
+namespace {
+const size_t WIDTH = 300;
+const size_t HEIGHT = 200;
+
+/** A new temporary directory for the duration of a test case */
+struct Directory {
+  fs::path path;
+
+  Directory()
+      : path(fs::temp_directory_path() /
+             fs::unique_path("spsep-overviews-%%%%%%%%")) {
+    fs::create_directories(path);
+  }
+
+  ~Directory() {
+    boost::system::error_code ec;
+    fs::remove_all(path, ec);
+  }
+
+  std::string file(const std::string &name) const {
+    return (path / name).string();
+  }
+};
+
+/** Options for files with overviews reduced by 2 and 4 */
+DatasetOptions withOverviews() {
+  DatasetOptions options;
+  options.width = WIDTH;
+  options.height = HEIGHT;
+  options.overviews = 2;
+  return options;
+}
+
+/**
+ * Writes a single channel TIFF file to @param path, with overviews reduced
+ * by 2 and 4 in SubIFDs.
+ */
+void writeSubIfds(const std::string &path) {
+  TIFF *tif = TIFFOpen(path.c_str(), "w");
+  BOOST_REQUIRE(tif != nullptr);
+  uint64_t offsets[2] = {0, 0};
+  for (uint32_t factor : {1u, 2u, 4u}) {
+    const uint32_t width = (WIDTH + factor - 1) / factor;
+    const uint32_t height = (HEIGHT + factor - 1) / factor;
+    if (factor == 1) {
+      // The next two directories are written as its SubIFDs
+      TIFFSetField(tif, TIFFTAG_SUBIFD, 2, offsets);
+    } else {
+      TIFFSetField(tif, TIFFTAG_SUBFILETYPE, FILETYPE_REDUCEDIMAGE);
+    }
+    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, width);
+    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, height);
+    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
+    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, 16);
+
+    std::vector<uint8_t> row(width);
+    for (uint32_t y = 0; y < height; y++) {
+      for (uint32_t x = 0; x < width; x++) {
+        row[x] = DatasetGenerator::sample(x * factor, y * factor, 0);
+      }
+      BOOST_REQUIRE(TIFFWriteScanline(tif, row.data(), y) >= 0);
+    }
+    BOOST_REQUIRE(TIFFWriteDirectory(tif));
+  }
+  TIFFClose(tif);
+}
+
+/** Checks that @param path has overviews reduced by 2 and 4 */
+void checkOverviews(const std::string &path) {
+  const std::vector<TiffOverviews::Overview> overviews =
+      TiffOverviews::find(path);
+  BOOST_REQUIRE_EQUAL(overviews.size(), 2);
+  BOOST_CHECK_EQUAL(overviews[0].factor, 2);
+  BOOST_CHECK_EQUAL(overviews[0].width, 150);
+  BOOST_CHECK_EQUAL(overviews[0].height, 100);
+  BOOST_CHECK_EQUAL(overviews[1].factor, 4);
+  BOOST_CHECK_EQUAL(overviews[1].width, 75);
+  BOOST_CHECK_EQUAL(overviews[1].height, 50);
+
+  const TiffOverviews::Overview &overview = overviews[1];
+  std::vector<uint8_t> data(overview.width * overview.height);
+  BOOST_REQUIRE(TiffOverviews::read(path, overview, data.data()));
+  for (uint32_t y = 0; y < overview.height; y++) {
+    for (uint32_t x = 0; x < overview.width; x += 7) {
+      BOOST_REQUIRE_EQUAL(data[y * overview.width + x],
+                          DatasetGenerator::sample(4 * x, 4 * y, 0));
+    }
+  }
+}
+
+/** The index of @param channel in the generated dataset */
+int channelIndex(const std::string &channel) {
+  return static_cast<int>(std::string("cmyk").find(channel));
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(TiffOverviews_Tests)
+
+BOOST_AUTO_TEST_CASE(tiffoverviews_pages) {
+  Directory directory;
+  const std::string path = directory.file("pages.tif");
+  BOOST_REQUIRE(
+      DatasetGenerator::writeTiff(path, WIDTH, HEIGHT, 1, 0, withOverviews()));
+  checkOverviews(path);
+  BOOST_CHECK_EQUAL(TiffOverviews::find(path)[0].page, 1);
+}
+
+BOOST_AUTO_TEST_CASE(tiffoverviews_tiled_pages) {
+  Directory directory;
+  const std::string path = directory.file("tiled.tif");
+  DatasetOptions options = withOverviews();
+  options.tiled = true;
+  options.tileSize = 64;
+  BOOST_REQUIRE(
+      DatasetGenerator::writeTiff(path, WIDTH, HEIGHT, 1, 0, options));
+  checkOverviews(path);
+}
+
+BOOST_AUTO_TEST_CASE(tiffoverviews_sub_ifds) {
+  Directory directory;
+  const std::string path = directory.file("subifds.tif");
+  writeSubIfds(path);
+  checkOverviews(path);
+  BOOST_CHECK(TiffOverviews::find(path)[0].subIfd != 0);
+}
+
+BOOST_AUTO_TEST_CASE(tiffoverviews_none) {
+  BOOST_CHECK(TiffOverviews::find(TestFiles::getPathToFile("C.tif")).empty());
+  BOOST_CHECK(TiffOverviews::find("").empty());
+  BOOST_CHECK(TiffOverviews::find("/nonexistent.tif").empty());
+}
+
+BOOST_AUTO_TEST_CASE(tiffoverviews_reductions) {
+  Directory directory;
+  const std::string path = directory.file("reductions.tif");
+  auto writer = PyramidTiffWriter::create(path, WIDTH, HEIGHT, 64, 3,
+                                          PHOTOMETRIC_MINISBLACK, false);
+  BOOST_REQUIRE(writer);
+  std::vector<uint8_t> rows(WIDTH * HEIGHT * 3, 42);
+  BOOST_REQUIRE(writer->writeRows(rows.data(), HEIGHT));
+  BOOST_REQUIRE(writer->finish());
+
+  // 150x100, 75x50 and 38x25, starting at the first page
+  auto overviews = TiffOverviews::findReductions(path, WIDTH, HEIGHT, 3);
+  BOOST_REQUIRE_EQUAL(overviews.size(), 3);
+  BOOST_CHECK_EQUAL(overviews[0].factor, 2);
+  BOOST_CHECK_EQUAL(overviews[0].page, 0);
+  BOOST_CHECK_EQUAL(overviews[2].factor, 8);
+
+  std::vector<uint8_t> samples(38 * 25 * 3);
+  BOOST_REQUIRE(TiffOverviews::read(path, overviews[2], samples.data()));
+  BOOST_CHECK(samples[0] == 42 && samples.back() == 42);
+
+  // The samples per pixel have to match
+  BOOST_CHECK(TiffOverviews::findReductions(path, WIDTH, HEIGHT, 4).empty());
+  BOOST_CHECK(TiffOverviews::findReductions("", WIDTH, HEIGHT, 3).empty());
+}
+
+BOOST_AUTO_TEST_CASE(tiffoverviews_select) {
+  const std::vector<TiffOverviews::Overview> a = {{150, 100, 1, 2, 1, 0},
+                                                  {75, 50, 1, 4, 2, 0},
+                                                  {38, 25, 1, 8, 3, 0}};
+  const std::vector<TiffOverviews::Overview> b = {{150, 100, 1, 2, 1, 0},
+                                                  {38, 25, 1, 8, 2, 0}};
+  BOOST_CHECK(TiffOverviews::select(a, 1) == nullptr);
+  BOOST_CHECK_EQUAL(TiffOverviews::select(a, 7)->factor, 4);
+  BOOST_CHECK_EQUAL(TiffOverviews::select(a, 100)->factor, 8);
+
+  BOOST_CHECK_EQUAL(TiffOverviews::commonFactor({a, b}, 7), 2);
+  BOOST_CHECK_EQUAL(TiffOverviews::commonFactor({a, b}, 8), 8);
+  BOOST_CHECK_EQUAL(TiffOverviews::commonFactor({a, {}}, 8), 0);
+  BOOST_CHECK_EQUAL(TiffOverviews::commonFactor({}, 8), 0);
+}
+
+BOOST_AUTO_TEST_CASE(tiffoverviews_sep_source) {
+  Directory directory;
+  BOOST_REQUIRE(DatasetGenerator::generate(directory.path.string(), "ov",
+                                           withOverviews()));
+  SepSource::Ptr source = SepSource::create();
+  source->setData(SepSource::parseSep(directory.file("ov.sep")));
+  source->findOverviews();
+  BOOST_CHECK_EQUAL(source->getOverviewFactor(1), 0);
+  BOOST_CHECK_EQUAL(source->getOverviewFactor(3), 2);
+
+  uint32_t width = 0;
+  uint32_t height = 0;
+  const std::vector<byte> data = source->readOverview(4, width, height);
+  BOOST_REQUIRE_EQUAL(width, 75);
+  BOOST_REQUIRE_EQUAL(height, 50);
+  BOOST_REQUIRE_EQUAL(data.size(), 75 * 50 * 4);
+  for (uint32_t y = 0; y < height; y += 3) {
+    for (uint32_t x = 0; x < width; x += 5) {
+      for (size_t i = 0; i < source->channels.size(); i++) {
+        const int channel = channelIndex(source->channels[i]);
+        BOOST_REQUIRE_EQUAL(data[(y * width + x) * 4 + i],
+                            DatasetGenerator::sample(4 * x, 4 * y, channel));
+      }
+    }
+  }
+  BOOST_CHECK(source->readOverview(8, width, height).empty());
+}
+
+BOOST_AUTO_TEST_CASE(tiffoverviews_sep_presentation) {
+  Directory directory;
+  BOOST_REQUIRE(DatasetGenerator::generate(directory.path.string(), "ov",
+                                           withOverviews()));
+  SepPresentation::Ptr presentation = SepPresentation::create();
+  BOOST_REQUIRE(presentation->load(directory.file("ov.sep")));
+  // The tiles are not loaded until a view needs the full resolution
+  BOOST_CHECK(!presentation->fullResolution);
+
+  cairo_surface_t *surface =
+      cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 100, 100);
+  cairo_t *cr = cairo_create(surface);
+  Scroom::Utils::Rectangle<double> rect(0.0, 0.0, 400.0, 400.0);
+  BOOST_CHECK(presentation->drawOverview(cr, rect, -2));
+  BOOST_CHECK(presentation->overviewSurfaces.count(4));
+  BOOST_CHECK(!presentation->drawOverview(cr, rect, 0));
+  cairo_destroy(cr);
+  cairo_surface_destroy(surface);
+
+  // The pipette loads it from a worker thread, possibly while redrawing
+  boost::thread pipette([presentation] { presentation->loadFullResolution(); });
+  presentation->loadFullResolution();
+  pipette.join();
+  BOOST_CHECK(presentation->fullResolution);
+
+  // Without overviews, the full resolution is loaded right away
+  SepPresentation::Ptr plain = SepPresentation::create();
+  BOOST_REQUIRE(plain->load(TestFiles::getPathToFile("sep_cmyk.sep")));
+  BOOST_CHECK(plain->fullResolution);
+}
+
+BOOST_AUTO_TEST_CASE(tiffoverviews_sli_preview) {
+  Directory directory;
+  DatasetOptions options = withOverviews();
+  options.layers = 2;
+  options.mixedLayers = true;
+  options.xOffset = 100;
+  options.yOffset = 100;
+  BOOST_REQUIRE(
+      DatasetGenerator::generate(directory.path.string(), "ov", options));
+  ColorConfig::getInstance().loadFile();
+
+  SliFile sli = SliParser::parseFile(directory.file("ov.sli"));
+  SliPresentation::Ptr presentation = SliPresentation::create(nullptr);
+  SliSource::Ptr source = presentation->source;
+  BOOST_REQUIRE(source->addLayers(sli.layers));
+  source->toggled.resize(source->layers.size(), true);
+  source->computeHeightWidth();
+  BOOST_REQUIRE_EQUAL(source->total_width, 400);
+
+  // Too small for a preview by default
+  uint32_t factor = 0;
+  BOOST_CHECK(source->compositeOverviews(factor) == nullptr);
+
+  source->previewSize = 100;
+  SurfaceWrapper::Ptr preview = source->compositeOverviews(factor);
+  BOOST_REQUIRE(preview);
+  BOOST_CHECK_EQUAL(factor, 4);
+  BOOST_CHECK_EQUAL(preview->getWidth(), 100);
+  BOOST_CHECK_EQUAL(preview->getHeight(), 75);
+
+  auto pixel = [&preview](int x, int y) {
+    return reinterpret_cast<uint32_t *>(preview->getBitmap() +
+                                        y * preview->getStride())[x];
+  };
+  // Outside of both layers
+  BOOST_CHECK_EQUAL(pixel(90, 10), 0xFFFFFFFF);
+
+  // Only covered by the CMYK layer, at (25, 25) in the preview
+  const CustomColorTable &colors = source->layers[1]->colorTable;
+  int16_t C = 0;
+  int16_t M = 0;
+  int16_t Y = 0;
+  int16_t K = 0;
+  for (int s = 0; s < 4; s++) {
+    colors.calculateCMYK(s, C, M, Y, K,
+                         DatasetGenerator::sample(4 * 55, 4 * 35, s));
+  }
+  BOOST_CHECK_EQUAL(pixel(80, 60),
+                    CustomColorHelpers::cmykToARGB(
+                        CustomColorHelpers::toUint8(C),
+                        CustomColorHelpers::toUint8(M),
+                        CustomColorHelpers::toUint8(Y),
+                        CustomColorHelpers::toUint8(K)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
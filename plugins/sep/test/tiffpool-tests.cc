@@ -0,0 +1,111 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../sepsource.hh"
+#include "../tiffpool.hh"
+#include "testglobals.hh"
+
+/** Test cases for tiffpool.hh */
+
+namespace {
+/**
+ * Uses a pool with a small capacity for the duration of a test case, and
+ * restores the capacity afterwards.
+ */
+struct SmallPool {
+  size_t capacity;
+
+  SmallPool(size_t small) : capacity(TiffPool::getInstance().capacity) {
+    TiffPool::getInstance().setCapacity(0);
+    TiffPool::getInstance().setCapacity(small);
+  }
+
+  ~SmallPool() { TiffPool::getInstance().setCapacity(capacity); }
+};
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(TiffPool_Tests)
+
+BOOST_AUTO_TEST_CASE(tiffpool_missing_file) {
+  SmallPool pool(4);
+  BOOST_CHECK(!TiffPool::getInstance().acquire(""));
+  BOOST_CHECK(!TiffPool::getInstance().acquire(
+      TestFiles::getPathToFile("does_not_exist.tif")));
+  BOOST_CHECK_EQUAL(TiffPool::getInstance().getOpenCount(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(tiffpool_reuses_idle_handles) {
+  SmallPool pool(4);
+  const std::string path = TestFiles::getPathToFile("C.tif");
+
+  tiff *first;
+  {
+    TiffPool::Handle handle = TiffPool::getInstance().acquire(path);
+    BOOST_REQUIRE(handle);
+    first = handle.get();
+
+    // A leased handle is not handed out twice
+    TiffPool::Handle other = TiffPool::getInstance().acquire(path);
+    BOOST_REQUIRE(other);
+    BOOST_CHECK(other.get() != first);
+    BOOST_CHECK_EQUAL(TiffPool::getInstance().getOpenCount(), 2);
+  }
+  // Released handles stay open
+  BOOST_CHECK_EQUAL(TiffPool::getInstance().getOpenCount(), 2);
+  BOOST_CHECK_EQUAL(TiffPool::getInstance().idle.size(), 2);
+
+  TiffPool::Handle again = TiffPool::getInstance().acquire(path);
+  BOOST_CHECK(again);
+  BOOST_CHECK_EQUAL(TiffPool::getInstance().getOpenCount(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(tiffpool_closes_least_recently_used) {
+  SmallPool pool(2);
+  TiffPool &tiffs = TiffPool::getInstance();
+
+  tiffs.acquire(TestFiles::getPathToFile("C.tif"));
+  tiffs.acquire(TestFiles::getPathToFile("M.tif"));
+  BOOST_CHECK_EQUAL(tiffs.getOpenCount(), 2);
+
+  // Opening a third file closes the oldest idle one
+  TiffPool::Handle yellow = tiffs.acquire(TestFiles::getPathToFile("Y.tif"));
+  BOOST_REQUIRE(yellow);
+  BOOST_CHECK_EQUAL(tiffs.getOpenCount(), 2);
+  BOOST_REQUIRE_EQUAL(tiffs.idle.size(), 1);
+  BOOST_CHECK_EQUAL(tiffs.idle.front().first,
+                    TestFiles::getPathToFile("M.tif"));
+
+  // Leased files are never closed, even beyond the capacity
+  TiffPool::Handle black = tiffs.acquire(TestFiles::getPathToFile("K.tif"));
+  TiffPool::Handle cyan = tiffs.acquire(TestFiles::getPathToFile("C.tif"));
+  BOOST_CHECK(black);
+  BOOST_CHECK(cyan);
+  BOOST_CHECK_EQUAL(tiffs.getOpenCount(), 3);
+  BOOST_CHECK(tiffs.idle.empty());
+}
+
+BOOST_AUTO_TEST_CASE(tiffpool_sepsource_reacquires) {
+  SmallPool pool(2);
+  auto source = SepSource::create();
+  source->setData(
+      SepSource::parseSep(TestFiles::getPathToFile("sep_cmyk.sep")));
+  source->openFiles();
+  BOOST_CHECK_EQUAL(TiffPool::getInstance().getOpenCount(), 4);
+
+  std::vector<byte> expected(4 * 600);
+  source->readCombinedScanline(expected, 10);
+
+  source->done();
+  for (const auto &file : source->channel_files) {
+    BOOST_CHECK(!file.second);
+  }
+  // Only the capacity of the pool remains open
+  BOOST_CHECK_EQUAL(TiffPool::getInstance().getOpenCount(), 2);
+
+  source->acquireFiles();
+  std::vector<byte> line(4 * 600);
+  source->readCombinedScanline(line, 10);
+  BOOST_CHECK(line == expected);
+  source->done();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
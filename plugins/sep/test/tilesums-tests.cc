@@ -0,0 +1,101 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../tilesums.hh"
+#include "testglobals.hh"
+
+/** Test cases for tilesums.hh */
+
+namespace {
+/** Builds a tile of 100 x 70 pixels with 2 samples per pixel */
+std::vector<byte> createTileData(int stride) {
+  std::vector<byte> data(stride * 70);
+  for (int y = 0; y < 70; y++) {
+    for (int x = 0; x < 100; x++) {
+      data[y * stride + 2 * x] = static_cast<byte>(x + y);
+      data[y * stride + 2 * x + 1] = 7;
+    }
+  }
+  return data;
+}
+
+/** Sums the samples of `channel` in `area` one by one */
+double sumDirectly(const std::vector<byte> &data, int stride,
+                   Scroom::Utils::Rectangle<int> area, int channel) {
+  double sum = 0;
+  for (int y = area.getTop(); y < area.getBottom(); y++) {
+    for (int x = area.getLeft(); x < area.getRight(); x++) {
+      sum += data[y * stride + 2 * x + channel];
+    }
+  }
+  return sum;
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(TileSums_Tests)
+
+BOOST_AUTO_TEST_CASE(tilesums_dimensions) {
+  // Stride includes some padding that must not be summed
+  const int stride = 2 * 128;
+  auto data = createTileData(stride);
+  TileSums::Ptr sums = TileSums::create(data.data(), stride, 100, 70, 2);
+
+  BOOST_CHECK_EQUAL(sums->columns, 4);
+  BOOST_CHECK_EQUAL(sums->rows, 3);
+  BOOST_CHECK_EQUAL(sums->table.size(), 5 * 4 * 2);
+}
+
+BOOST_AUTO_TEST_CASE(tilesums_align_inward) {
+  const int stride = 2 * 100;
+  auto data = createTileData(stride);
+  TileSums::Ptr sums = TileSums::create(data.data(), stride, 100, 70, 2);
+
+  auto inner = sums->alignInward({5, 33, 95, 37});
+  BOOST_CHECK_EQUAL(inner.getLeft(), 32);
+  BOOST_CHECK_EQUAL(inner.getTop(), 64);
+  // The last column of cells ends at the edge of the tile
+  BOOST_CHECK_EQUAL(inner.getRight(), 100);
+  BOOST_CHECK_EQUAL(inner.getBottom(), 70);
+
+  // No complete cell fits
+  inner = sums->alignInward({5, 5, 40, 40});
+  BOOST_CHECK_EQUAL(inner.getWidth(), 0);
+  BOOST_CHECK_EQUAL(inner.getHeight(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(tilesums_sum_aligned) {
+  const int stride = 2 * 128;
+  auto data = createTileData(stride);
+  TileSums::Ptr sums = TileSums::create(data.data(), stride, 100, 70, 2);
+
+  for (Scroom::Utils::Rectangle<int> area :
+       {Scroom::Utils::Rectangle<int>{0, 0, 100, 70},
+        Scroom::Utils::Rectangle<int>{32, 0, 32, 32},
+        Scroom::Utils::Rectangle<int>{64, 32, 36, 38}}) {
+    auto result = sums->sum(area);
+    BOOST_REQUIRE_EQUAL(result.size(), 2);
+    BOOST_CHECK_EQUAL(result[0], sumDirectly(data, stride, area, 0));
+    BOOST_CHECK_EQUAL(result[1], sumDirectly(data, stride, area, 1));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(tilesums_approximate_sum) {
+  const int stride = 2 * 100;
+  auto data = createTileData(stride);
+  TileSums::Ptr sums = TileSums::create(data.data(), stride, 100, 70, 2);
+
+  // Exact for aligned areas
+  Scroom::Utils::Rectangle<int> aligned{32, 32, 68, 38};
+  BOOST_CHECK_CLOSE(sums->approximateSum(aligned)[0],
+                    sumDirectly(data, stride, aligned, 0), 1e-9);
+
+  // The second channel is constant, so any area is estimated exactly
+  Scroom::Utils::Rectangle<int> unaligned{5, 9, 77, 50};
+  BOOST_CHECK_CLOSE(sums->approximateSum(unaligned)[1],
+                    sumDirectly(data, stride, unaligned, 1), 1e-9);
+
+  // The first channel is a gradient, so the estimate is close
+  BOOST_CHECK_CLOSE(sums->approximateSum(unaligned)[0],
+                    sumDirectly(data, stride, unaligned, 0), 5);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
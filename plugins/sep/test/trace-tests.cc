@@ -0,0 +1,144 @@
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include <fstream>
+#include <sstream>
+
+#include "../stats.hh"
+#include "../trace.hh"
+#include "testglobals.hh"
+
+/** Test cases for trace.hh */
+
+namespace fs = boost::filesystem;
+
+namespace {
+/** Writes the trace to a temporary file, and returns its contents */
+std::string writeTrace() {
+  const fs::path path =
+      fs::temp_directory_path() / fs::unique_path("spsep-trace-%%%%.json");
+  BOOST_REQUIRE(Trace::write(path.string()));
+  std::ifstream file(path.string());
+  std::stringstream contents;
+  contents << file.rdbuf();
+  fs::remove(path);
+  return contents.str();
+}
+
+size_t countOccurrences(const std::string &text, const std::string &part) {
+  size_t count = 0;
+  for (size_t i = text.find(part); i != std::string::npos;
+       i = text.find(part, i + 1)) {
+    count++;
+  }
+  return count;
+}
+
+/** Enables tracing for the duration of a test, starting without events */
+struct Tracing {
+  Tracing() {
+    Trace::clear();
+    Trace::setEnabled(true);
+  }
+
+  ~Tracing() {
+    Trace::setEnabled(false);
+    Trace::clear();
+  }
+};
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(Trace_Tests)
+
+BOOST_AUTO_TEST_CASE(trace_disabled) {
+  Trace::clear();
+  Trace::setEnabled(false);
+  { Trace::Span span("test", "trace_disabled"); }
+  BOOST_CHECK(writeTrace().find("trace_disabled") == std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(trace_spans_of_threads) {
+  Tracing tracing;
+  { Trace::Span span("test", "main thread"); }
+  boost::thread other([] {
+    Trace::Span span("test", "other thread");
+    span.end();
+    // Ending twice records it once
+    span.end();
+  });
+  other.join();
+
+  const std::string trace = writeTrace();
+  BOOST_CHECK_EQUAL(trace.find("{\"displayTimeUnit\": \"ms\", "), 0);
+  BOOST_CHECK_EQUAL(countOccurrences(trace, "\"name\": \"main thread\""), 1);
+  BOOST_CHECK_EQUAL(countOccurrences(trace, "\"name\": \"other thread\""), 1);
+  BOOST_CHECK_EQUAL(countOccurrences(trace, "\"ph\": \"X\""), 2);
+
+  // The threads have their own ids
+  const size_t tid1 = trace.find("\"tid\": ");
+  const size_t tid2 = trace.find("\"tid\": ", tid1 + 1);
+  BOOST_REQUIRE(tid2 != std::string::npos);
+  BOOST_CHECK(trace.substr(tid1, trace.find('}', tid1) - tid1) !=
+              trace.substr(tid2, trace.find('}', tid2) - tid2));
+}
+
+BOOST_AUTO_TEST_CASE(trace_stages) {
+  Tracing tracing;
+  Stats::Stage stage("traced stage");
+  { Stats::ScopedTimer timer(stage); }
+  BOOST_CHECK_EQUAL(
+      countOccurrences(writeTrace(), "\"name\": \"traced stage\", \"cat\": "
+                                     "\"stage\""),
+      1);
+}
+
+BOOST_AUTO_TEST_CASE(trace_set_stages) {
+  Tracing tracing;
+  Stats::Set::Ptr stats = Stats::Set::create();
+  { Stats::ScopedTimer timer(stats->computeRgb); }
+  // Adding the call to the total does not trace it again
+  BOOST_CHECK_EQUAL(
+      countOccurrences(writeTrace(), "\"name\": \"computeRgb\", \"cat\": "
+                                     "\"stage\""),
+      1);
+}
+
+BOOST_AUTO_TEST_CASE(trace_ring_buffer) {
+  Tracing tracing;
+  boost::thread recorder([] {
+    for (size_t i = 0; i < Trace::BUFFER_SIZE + 100; i++) {
+      Trace::record("test", "old", i, i + 1);
+    }
+    Trace::record("test", "last", 0, 1);
+  });
+  recorder.join();
+
+  // Only the most recent events are kept
+  const std::string trace = writeTrace();
+  const size_t old = countOccurrences(trace, "\"name\": \"old\"");
+  BOOST_CHECK(old > 0);
+  BOOST_CHECK(old < Trace::BUFFER_SIZE);
+  BOOST_CHECK_EQUAL(countOccurrences(trace, "\"name\": \"last\""), 1);
+}
+
+BOOST_AUTO_TEST_CASE(trace_write_while_recording) {
+  Tracing tracing;
+  std::atomic<bool> stop{false};
+  boost::thread recorder([&stop] {
+    for (uint64_t i = 0; !stop; i++) {
+      Trace::record("test", "busy", 1000 * i, 1000 * i + 1000);
+    }
+  });
+
+  // Events that are being overwritten are skipped instead of written torn
+  for (int i = 0; i < 20; i++) {
+    const std::string trace = writeTrace();
+    BOOST_CHECK_EQUAL(countOccurrences(trace, "\"name\": \"busy\""),
+                      countOccurrences(trace, "\"dur\": 1.000"));
+  }
+  stop = true;
+  recorder.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
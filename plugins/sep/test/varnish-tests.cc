@@ -3,7 +3,9 @@
 #include <boost/test/unit_test.hpp>
 
 #include "../varnish/varnish.hh"
+#include "../varnish/varnishoperations.hh"
 #include "testglobals.hh"
+#include <scroom/bitmap-helpers.hh>
 #include <scroom/scroominterface.hh>
 #include <scroom/viewinterface.hh>
 
@@ -65,7 +67,8 @@ BOOST_AUTO_TEST_CASE(varnish_load_valid_tiff) {
       TestFiles::getPathToFile("v_valid.tif"), "SomeCoolTitle", 0, 0);
   test_varnishLayer->fillMetaFromTiff(8, 1);
   test_varnishLayer->fillBitmapFromTiff();
-  Varnish::Ptr test_varnish = Varnish::create(test_varnishLayer);
+  Varnish::Ptr test_varnish =
+      Varnish::create(test_varnishLayer, Stats::Set::create());
   // Properties set correctly?
   BOOST_REQUIRE(test_varnish->layer->name == "SomeCoolTitle");
   BOOST_REQUIRE(test_varnish->layer->filepath ==
@@ -77,8 +80,15 @@ BOOST_AUTO_TEST_CASE(varnish_load_valid_tiff) {
   BOOST_REQUIRE(test_varnish->layer->xAspect == 1);
   BOOST_REQUIRE(test_varnish->layer->yAspect == 1);
   BOOST_REQUIRE(test_varnish->inverted == false);
-  // Valid cairo surface?
-  BOOST_REQUIRE(test_varnish->surface);
+  // Valid tiled bitmap?
+  BOOST_REQUIRE(test_varnish->tbi);
+  // The tiles are only loaded once the overlay is drawn
+  BOOST_REQUIRE(!test_varnish->fullResolution);
+  test_varnish->loadFullResolution();
+  BOOST_REQUIRE(test_varnish->fullResolution);
+  // Loading again does not hand the file to the bitmap a second time
+  test_varnish->loadFullResolution();
+  BOOST_REQUIRE(test_varnish->fullResolution);
 }
 
 BOOST_AUTO_TEST_CASE(varnish_load_valid_tiff_centimeter) {
@@ -87,7 +97,8 @@ BOOST_AUTO_TEST_CASE(varnish_load_valid_tiff_centimeter) {
                        "SomeCoolTitle", 0, 0);
   test_varnishLayer->fillMetaFromTiff(8, 1);
   test_varnishLayer->fillBitmapFromTiff();
-  Varnish::Ptr test_varnish = Varnish::create(test_varnishLayer);
+  Varnish::Ptr test_varnish =
+      Varnish::create(test_varnishLayer, Stats::Set::create());
   // Properties set correctly?
   BOOST_REQUIRE(test_varnish->layer->name == "SomeCoolTitle");
   BOOST_REQUIRE(test_varnish->layer->filepath ==
@@ -99,8 +110,8 @@ BOOST_AUTO_TEST_CASE(varnish_load_valid_tiff_centimeter) {
   BOOST_REQUIRE(test_varnish->layer->xAspect == 1);
   BOOST_REQUIRE(test_varnish->layer->yAspect == 1);
   BOOST_REQUIRE(test_varnish->inverted == false);
-  // Valid cairo surface?
-  BOOST_REQUIRE(test_varnish->surface);
+  // Valid tiled bitmap?
+  BOOST_REQUIRE(test_varnish->tbi);
 }
 
 BOOST_AUTO_TEST_CASE(varnish_load_valid_tiff_no_spp_tag) {
@@ -111,7 +122,8 @@ BOOST_AUTO_TEST_CASE(varnish_load_valid_tiff_no_spp_tag) {
                        "SomeCoolTitle", 0, 0);
   test_varnishLayer->fillMetaFromTiff(8, 1);
   test_varnishLayer->fillBitmapFromTiff();
-  Varnish::Ptr test_varnish = Varnish::create(test_varnishLayer);
+  Varnish::Ptr test_varnish =
+      Varnish::create(test_varnishLayer, Stats::Set::create());
   // Properties set correctly?
   BOOST_REQUIRE(test_varnish->layer->name == "SomeCoolTitle");
   BOOST_REQUIRE(test_varnish->layer->filepath ==
@@ -123,8 +135,126 @@ BOOST_AUTO_TEST_CASE(varnish_load_valid_tiff_no_spp_tag) {
   BOOST_REQUIRE(test_varnish->layer->xAspect == 1);
   BOOST_REQUIRE(test_varnish->layer->yAspect == 1);
   BOOST_REQUIRE(test_varnish->inverted == false);
-  // Valid cairo surface?
-  BOOST_REQUIRE(test_varnish->surface);
+  // Valid tiled bitmap?
+  BOOST_REQUIRE(test_varnish->tbi);
+}
+
+BOOST_AUTO_TEST_CASE(varnish_switch_mode) {
+  SliLayer::Ptr test_varnishLayer = SliLayer::create(
+      TestFiles::getPathToFile("v_valid.tif"), "SomeCoolTitle", 0, 0);
+  test_varnishLayer->fillMetaFromTiff(8, 1);
+  Varnish::Ptr test_varnish =
+      Varnish::create(test_varnishLayer, Stats::Set::create());
+  test_varnish->triggerRedraw = dummyFunction;
+
+  ViewInterface::Ptr view = DummyViewInterface::create();
+  Scroom::GtkHelpers::sync_on_ui_thread([&] {
+    test_varnish->setView(view);
+    gtk_toggle_button_set_active(
+        GTK_TOGGLE_BUTTON(test_varnish->radio_inverted), true);
+  });
+  BOOST_REQUIRE(test_varnish->inverted == true);
+
+  Scroom::GtkHelpers::sync_on_ui_thread([&] {
+    gtk_toggle_button_set_active(
+        GTK_TOGGLE_BUTTON(test_varnish->radio_enabled), true);
+  });
+  BOOST_REQUIRE(test_varnish->inverted == false);
+}
+
+BOOST_AUTO_TEST_CASE(varnish_operations_cache) {
+  VarnishOperations::Ptr operations =
+      VarnishOperations::create(Stats::Set::create());
+  BOOST_REQUIRE(operations->getBpp() == 8);
+
+  // A tile whose width is not a multiple of 4, so cairo pads the rows
+  const int width = 3;
+  const int height = 2;
+  boost::shared_ptr<uint8_t> data(new uint8_t[width * height]{1, 2, 3, 4, 5, 6},
+                                  [](uint8_t *p) { delete[] p; });
+  ConstTile::Ptr tile(new ConstTile(width, height, 8, data));
+
+  auto surface = boost::static_pointer_cast<Scroom::Bitmap::BitmapSurface>(
+                     operations->cache(tile))
+                     ->get();
+  BOOST_REQUIRE(cairo_image_surface_get_format(surface) == CAIRO_FORMAT_A8);
+  BOOST_REQUIRE(cairo_image_surface_get_width(surface) == width);
+  BOOST_REQUIRE(cairo_image_surface_get_height(surface) == height);
+
+  int stride = cairo_image_surface_get_stride(surface);
+  uint8_t *cached = cairo_image_surface_get_data(surface);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      BOOST_REQUIRE(cached[y * stride + x] == data.get()[y * width + x]);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(varnish_operations_reduce) {
+  VarnishOperations::Ptr operations =
+      VarnishOperations::create(Stats::Set::create());
+
+  // An 8x16 source tile: the top half is 0 and the bottom half is 128
+  boost::shared_ptr<uint8_t> sourceData(new uint8_t[8 * 16],
+                                        [](uint8_t *p) { delete[] p; });
+  memset(sourceData.get(), 0, 8 * 8);
+  memset(sourceData.get() + 8 * 8, 128, 8 * 8);
+  ConstTile::Ptr source(new ConstTile(8, 16, 8, sourceData));
+
+  boost::shared_ptr<uint8_t> targetData(new uint8_t[8 * 8],
+                                        [](uint8_t *p) { delete[] p; });
+  memset(targetData.get(), 255, 8 * 8);
+  Tile::Ptr target(new Tile(8, 8, 8, targetData));
+
+  operations->reduce(target, source, 0, 0);
+
+  BOOST_REQUIRE(targetData.get()[0] == 0);
+  BOOST_REQUIRE(targetData.get()[8] == 128);
+  // The rest of the target is untouched
+  BOOST_REQUIRE(targetData.get()[1] == 255);
+}
+
+BOOST_AUTO_TEST_CASE(varnish_operations_draw_reduced) {
+  VarnishOperations::Ptr operations =
+      VarnishOperations::create(Stats::Set::create());
+  operations->red = 1;
+  operations->green = 0;
+  operations->blue = 0;
+  operations->alpha = 1;
+  operations->inverted = true;
+
+  // A 64x64 tile with the varnish set on its left half
+  boost::shared_ptr<uint8_t> sourceData(new uint8_t[64 * 64],
+                                        [](uint8_t *p) { delete[] p; });
+  for (int y = 0; y < 64; y++) {
+    memset(sourceData.get() + y * 64, 255, 32);
+    memset(sourceData.get() + y * 64 + 32, 0, 32);
+  }
+  ConstTile::Ptr source(new ConstTile(64, 64, 8, sourceData));
+
+  // Zoomed out by a factor 8, the view draws the reduced tile one to one
+  boost::shared_ptr<uint8_t> reducedData(new uint8_t[8 * 8],
+                                         [](uint8_t *p) { delete[] p; });
+  Tile::Ptr reduced(new Tile(8, 8, 8, reducedData));
+  operations->reduce(reduced, source, 0, 0);
+  ConstTile::Ptr reducedTile(new ConstTile(8, 8, 8, reducedData));
+
+  cairo_surface_t *view = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 8, 8);
+  cairo_t *cr = cairo_create(view);
+  operations->draw(cr, reducedTile, {0, 0, 8, 8}, {0, 0, 8, 8}, -3,
+                   operations->cache(reducedTile));
+  cairo_destroy(cr);
+  cairo_surface_flush(view);
+
+  const int stride = cairo_image_surface_get_stride(view);
+  const uint8_t *pixels = cairo_image_surface_get_data(view);
+  for (int y = 0; y < 8; y++) {
+    const auto *row = reinterpret_cast<const uint32_t *>(pixels + y * stride);
+    for (int x = 0; x < 8; x++) {
+      BOOST_CHECK_EQUAL(row[x], x < 4 ? 0xFFFF0000u : 0u);
+    }
+  }
+  cairo_surface_destroy(view);
 }
 
 BOOST_AUTO_TEST_CASE(varnish_load_invalid_tiff) {
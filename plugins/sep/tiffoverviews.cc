@@ -0,0 +1,267 @@
+#include "tiffoverviews.hh"
+
+#include <algorithm>
+#include <cstring>
+
+namespace TiffOverviews {
+
+namespace {
+/** The properties of the full image an overview must match */
+struct Image {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint16_t spp = 1;
+  uint16_t photometric = 0;
+};
+
+Image describe(TIFF *file) {
+  Image image;
+  TIFFGetField(file, TIFFTAG_IMAGEWIDTH, &image.width);
+  TIFFGetField(file, TIFFTAG_IMAGELENGTH, &image.height);
+  TIFFGetFieldDefaulted(file, TIFFTAG_SAMPLESPERPIXEL, &image.spp);
+  TIFFGetField(file, TIFFTAG_PHOTOMETRIC, &image.photometric);
+  return image;
+}
+
+/** Whether @param size is @param full reduced by @param factor */
+bool reducedSize(uint32_t size, uint32_t full, uint32_t factor) {
+  // Writers round either way
+  const uint64_t expected = (static_cast<uint64_t>(full) + factor - 1) / factor;
+  return size + 1 >= expected && size <= expected + 1;
+}
+
+/**
+ * Adds the current directory of @param file to @param overviews if it can
+ * stand in for @param image.
+ */
+void addIfUsable(TIFF *file, const Image &image, uint16_t page,
+                 uint64_t subIfd, std::vector<Overview> &overviews) {
+  const Image reduced = describe(file);
+  uint16_t bps = 0;
+  uint16_t planar = PLANARCONFIG_CONTIG;
+  TIFFGetFieldDefaulted(file, TIFFTAG_BITSPERSAMPLE, &bps);
+  TIFFGetFieldDefaulted(file, TIFFTAG_PLANARCONFIG, &planar);
+  if (bps != 8 || planar != PLANARCONFIG_CONTIG || reduced.width == 0 ||
+      reduced.height == 0 || reduced.spp != image.spp ||
+      reduced.photometric != image.photometric) {
+    return;
+  }
+
+  const uint32_t factor = (image.width + reduced.width / 2) / reduced.width;
+  if (factor < 2 || !reducedSize(reduced.width, image.width, factor) ||
+      !reducedSize(reduced.height, image.height, factor)) {
+    return;
+  }
+  overviews.push_back(
+      {reduced.width, reduced.height, reduced.spp, factor, page, subIfd});
+}
+
+/** Sorts @param overviews by factor, and keeps the first one of every factor */
+void keepOnePerFactor(std::vector<Overview> &overviews) {
+  std::stable_sort(
+      overviews.begin(), overviews.end(),
+      [](const Overview &a, const Overview &b) { return a.factor < b.factor; });
+  overviews.erase(std::unique(overviews.begin(), overviews.end(),
+                              [](const Overview &a, const Overview &b) {
+                                return a.factor == b.factor;
+                              }),
+                  overviews.end());
+}
+
+bool readScanlines(TIFF *file, const Overview &overview, uint8_t *out) {
+  const size_t rowLength = static_cast<size_t>(overview.width) * overview.spp;
+  if (static_cast<size_t>(TIFFScanlineSize64(file)) != rowLength) {
+    return false;
+  }
+  for (uint32_t y = 0; y < overview.height; y++) {
+    if (TIFFReadScanline(file, out + y * rowLength, y) < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool readTiles(TIFF *file, const Overview &overview, uint8_t *out) {
+  uint32_t tileWidth = 0;
+  uint32_t tileHeight = 0;
+  TIFFGetField(file, TIFFTAG_TILEWIDTH, &tileWidth);
+  TIFFGetField(file, TIFFTAG_TILELENGTH, &tileHeight);
+  const size_t tileRowLength = static_cast<size_t>(tileWidth) * overview.spp;
+  if (tileWidth == 0 || tileHeight == 0 ||
+      static_cast<size_t>(TIFFTileSize64(file)) != tileRowLength * tileHeight) {
+    return false;
+  }
+
+  const size_t rowLength = static_cast<size_t>(overview.width) * overview.spp;
+  std::vector<uint8_t> tile(tileRowLength * tileHeight);
+  for (uint32_t top = 0; top < overview.height; top += tileHeight) {
+    const uint32_t rows = std::min(tileHeight, overview.height - top);
+    for (uint32_t left = 0; left < overview.width; left += tileWidth) {
+      if (TIFFReadTile(file, tile.data(), left, top, 0, 0) < 0) {
+        return false;
+      }
+      // Tiles on the edges are padded
+      const size_t copied =
+          std::min(tileWidth, overview.width - left) * overview.spp;
+      for (uint32_t y = 0; y < rows; y++) {
+        memcpy(out + (top + y) * rowLength + left * overview.spp,
+               tile.data() + y * tileRowLength, copied);
+      }
+    }
+  }
+  return true;
+}
+} // namespace
+
+std::vector<Overview> find(const std::string &path) {
+  std::vector<Overview> overviews;
+  TIFF *file = path.empty() ? nullptr : TIFFOpen(path.c_str(), "r");
+  if (file == nullptr) {
+    return overviews;
+  }
+  const Image image = describe(file);
+
+  // The offsets are freed once another directory is read, so copy them first
+  uint16_t count = 0;
+  uint64_t *offsets = nullptr;
+  std::vector<uint64_t> subIfds;
+  if (TIFFGetField(file, TIFFTAG_SUBIFD, &count, &offsets) == 1 &&
+      offsets != nullptr) {
+    subIfds.assign(offsets, offsets + count);
+  }
+  for (uint64_t subIfd : subIfds) {
+    if (TIFFSetSubDirectory(file, subIfd)) {
+      addIfUsable(file, image, 0, subIfd, overviews);
+    }
+  }
+
+  for (uint16_t page = 1; page < MAX_PAGES && TIFFSetDirectory(file, page);
+       page++) {
+    uint32_t type = 0;
+    if (TIFFGetField(file, TIFFTAG_SUBFILETYPE, &type) == 1 &&
+        (type & FILETYPE_REDUCEDIMAGE)) {
+      addIfUsable(file, image, page, 0, overviews);
+    }
+  }
+  TIFFClose(file);
+
+  keepOnePerFactor(overviews);
+  return overviews;
+}
+
+std::vector<Overview> findReductions(const std::string &path, uint32_t width,
+                                     uint32_t height, uint16_t spp) {
+  std::vector<Overview> overviews;
+  TIFF *file = path.empty() ? nullptr : TIFFOpen(path.c_str(), "r");
+  if (file == nullptr) {
+    return overviews;
+  }
+
+  Image image;
+  image.width = width;
+  image.height = height;
+  image.spp = spp;
+  for (uint16_t page = 0; page < MAX_PAGES && TIFFSetDirectory(file, page);
+       page++) {
+    // The file is not the image, so any interpretation of the samples goes
+    image.photometric = describe(file).photometric;
+    addIfUsable(file, image, page, 0, overviews);
+  }
+  TIFFClose(file);
+
+  keepOnePerFactor(overviews);
+  return overviews;
+}
+
+const Overview *select(const std::vector<Overview> &overviews,
+                       uint32_t factor) {
+  const Overview *result = nullptr;
+  for (const Overview &overview : overviews) {
+    if (overview.factor <= factor) {
+      result = &overview;
+    }
+  }
+  return result;
+}
+
+uint32_t commonFactor(const std::vector<std::vector<Overview>> &overviews,
+                      uint32_t factor) {
+  if (overviews.empty()) {
+    return 0;
+  }
+  for (auto candidate = overviews[0].rbegin(); candidate != overviews[0].rend();
+       ++candidate) {
+    if (candidate->factor > factor) {
+      continue;
+    }
+    bool everywhere = true;
+    for (const auto &other : overviews) {
+      const Overview *match = select(other, candidate->factor);
+      everywhere &= match != nullptr && match->factor == candidate->factor;
+    }
+    if (everywhere) {
+      return candidate->factor;
+    }
+  }
+  return 0;
+}
+
+bool read(const std::string &path, const Overview &overview, uint8_t *out) {
+  TIFF *file = TIFFOpen(path.c_str(), "r");
+  if (file == nullptr) {
+    return false;
+  }
+  bool ok = overview.subIfd != 0 ? TIFFSetSubDirectory(file, overview.subIfd)
+                                 : TIFFSetDirectory(file, overview.page);
+  if (ok) {
+    ok = TIFFIsTiled(file) ? readTiles(file, overview, out)
+                           : readScanlines(file, overview, out);
+  }
+  TIFFClose(file);
+  return ok;
+}
+
+std::vector<uint8_t>
+readInterleaved(const std::vector<std::string> &paths,
+                const std::vector<std::vector<Overview>> &overviews,
+                uint32_t factor, uint32_t &width, uint32_t &height) {
+  if (paths.empty() || paths.size() != overviews.size()) {
+    return {};
+  }
+
+  std::vector<const Overview *> selected;
+  size_t spp = 0;
+  for (const auto &candidates : overviews) {
+    const Overview *overview = select(candidates, factor);
+    if (overview == nullptr || overview->factor != factor ||
+        (!selected.empty() && (overview->width != selected[0]->width ||
+                               overview->height != selected[0]->height))) {
+      return {};
+    }
+    selected.push_back(overview);
+    spp += overview->spp;
+  }
+  width = selected[0]->width;
+  height = selected[0]->height;
+
+  const size_t pixels = static_cast<size_t>(width) * height;
+  std::vector<uint8_t> result(pixels * spp);
+  std::vector<uint8_t> samples;
+  size_t first = 0;
+  for (size_t i = 0; i < paths.size(); i++) {
+    const size_t fileSpp = selected[i]->spp;
+    samples.resize(pixels * fileSpp);
+    if (!read(paths[i], *selected[i], samples.data())) {
+      return {};
+    }
+    for (size_t p = 0; p < pixels; p++) {
+      for (size_t s = 0; s < fileSpp; s++) {
+        result[p * spp + first + s] = samples[p * fileSpp + s];
+      }
+    }
+    first += fileSpp;
+  }
+  return result;
+}
+
+} // namespace TiffOverviews
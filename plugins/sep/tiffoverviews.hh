@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <tiffio.h>
+
+/**
+ * Finds and reads the reduced-resolution images (overviews) that TIFF files
+ * may carry next to the full image, so zoomed-out views can be drawn without
+ * decoding the full image. Both ways of storing them are supported:
+ * - as pages after the image, marked with FILETYPE_REDUCEDIMAGE in their
+ *   NewSubfileType tag, as written by gdaladdo and by many RIPs
+ * - as SubIFDs of the image, as written by `vips tiffsave --subifd`
+ *
+ * Only overviews that can stand in for the image are used: they have the
+ * same photometric interpretation and samples per pixel, 8 bits per sample,
+ * and a whole reduction factor of at least 2.
+ *
+ * Every function opens the file itself, so they can be called from any
+ * thread without disturbing the handles that are reading the full image.
+ */
+namespace TiffOverviews {
+
+struct Overview {
+  uint32_t width;
+  uint32_t height;
+  uint16_t spp;
+
+  /** Every pixel of the overview covers factor x factor pixels of the image */
+  uint32_t factor;
+
+  /** The page of the overview, if it is not a SubIFD */
+  uint16_t page;
+
+  /** The offset of the SubIFD of the overview, or 0 if it is a page */
+  uint64_t subIfd;
+};
+
+/** Pages after this many are not searched for overviews */
+const uint16_t MAX_PAGES = 32;
+
+/**
+ * Finds the overviews of the TIFF file at @param path.
+ * @return the overviews sorted by factor, one per factor, or an empty vector
+ * if there are none or the file can't be opened
+ */
+std::vector<Overview> find(const std::string &path);
+
+/**
+ * Finds the overviews in the TIFF file at @param path that only holds
+ * reduced images of another image, of @param width by @param height pixels
+ * with @param spp samples per pixel. Every page of the file that fits is
+ * used, as written by PyramidTiffWriter without the full resolution image.
+ * @return the overviews sorted by factor, one per factor, or an empty vector
+ * if there are none or the file can't be opened
+ */
+std::vector<Overview> findReductions(const std::string &path, uint32_t width,
+                                     uint32_t height, uint16_t spp);
+
+/**
+ * Returns the overview with the largest factor up to @param factor, or
+ * nullptr if all of @param overviews are smaller than that.
+ */
+const Overview *select(const std::vector<Overview> &overviews,
+                       uint32_t factor);
+
+/**
+ * Returns the largest factor up to @param factor that every file in
+ * @param overviews has an overview of, or 0 if there is none.
+ */
+uint32_t commonFactor(const std::vector<std::vector<Overview>> &overviews,
+                      uint32_t factor);
+
+/**
+ * Reads @param overview of the TIFF file at @param path into @param out,
+ * which must hold `width * height * spp` bytes.
+ * @return false if it could not be read
+ */
+bool read(const std::string &path, const Overview &overview, uint8_t *out);
+
+/**
+ * Reads the overviews with reduction @param factor of all @param paths, and
+ * interleaves their samples per pixel, in the order of the paths, the way
+ * the channels of a SEP file are combined. @param overviews holds the
+ * overviews of every path, as returned by find().
+ * @return the samples, or an empty vector if one of the files has no such
+ * overview, they differ in size, or they can't be read
+ */
+std::vector<uint8_t>
+readInterleaved(const std::vector<std::string> &paths,
+                const std::vector<std::vector<Overview>> &overviews,
+                uint32_t factor, uint32_t &width, uint32_t &height);
+
+} // namespace TiffOverviews
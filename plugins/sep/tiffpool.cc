@@ -0,0 +1,89 @@
+#include "tiffpool.hh"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+
+namespace {
+/**
+ * Leave most of the descriptors to the rest of the process, and don't keep
+ * more files open than reasonable.
+ */
+size_t defaultCapacity() {
+  const size_t maximum = 256;
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0 ||
+      limit.rlim_cur == RLIM_INFINITY) {
+    return maximum;
+  }
+  return std::max<size_t>(16, std::min<size_t>(maximum, limit.rlim_cur / 4));
+}
+} // namespace
+
+TiffPool::TiffPool() : capacity(defaultCapacity()) {}
+
+TiffPool::~TiffPool() {
+  for (auto &entry : idle) {
+    TIFFClose(entry.second);
+  }
+}
+
+TiffPool::Handle TiffPool::acquire(const std::string &path) {
+  if (path.empty()) {
+    return nullptr;
+  }
+
+  tiff *file = nullptr;
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    auto found = std::find_if(
+        idle.begin(), idle.end(),
+        [&path](const auto &entry) { return entry.first == path; });
+    if (found != idle.end()) {
+      file = found->second;
+      idle.erase(found);
+    } else {
+      closeIdle(1);
+    }
+    // Count the file before opening it, so other threads make room for it
+    leased++;
+  }
+
+  if (file == nullptr) {
+    file = TIFFOpen(path.c_str(), "r");
+    if (file == nullptr) {
+      boost::mutex::scoped_lock lock(mutex);
+      leased--;
+      return nullptr;
+    }
+  }
+
+  return Handle(file, [this, path](tiff *released) {
+    release(path, released);
+  });
+}
+
+void TiffPool::release(const std::string &path, tiff *file) {
+  boost::mutex::scoped_lock lock(mutex);
+  leased--;
+  idle.emplace_front(path, file);
+  closeIdle(0);
+}
+
+void TiffPool::closeIdle(size_t extra) {
+  while (!idle.empty() && leased + idle.size() + extra > capacity) {
+    TIFFClose(idle.back().second);
+    idle.pop_back();
+  }
+}
+
+void TiffPool::setCapacity(size_t capacity_) {
+  boost::mutex::scoped_lock lock(mutex);
+  capacity = capacity_;
+  closeIdle(0);
+}
+
+size_t TiffPool::getOpenCount() {
+  boost::mutex::scoped_lock lock(mutex);
+  return leased + idle.size();
+}
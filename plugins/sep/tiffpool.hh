@@ -0,0 +1,67 @@
+#pragma once
+
+#include <list>
+#include <string>
+#include <utility>
+
+#include <tiffio.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+/**
+ * Pool of opened TIFF files, so many open SEP files and SLI layers do not
+ * run out of file descriptors.
+ *
+ * A handle is leased exclusively to its holder. Once the holder releases it,
+ * the file stays open as an idle handle, so the next lease of the same file
+ * does not need to open it again. When more than `capacity` files are open,
+ * the least recently used idle handles are closed.
+ */
+class TiffPool {
+public:
+  /** A leased file. The file returns to the pool when the last copy is gone. */
+  typedef boost::shared_ptr<tiff> Handle;
+
+public: // For testing
+  /** Maximum number of open files, unless all of them are leased */
+  size_t capacity;
+
+  /** Number of files that are currently leased */
+  size_t leased = 0;
+
+  /** Open files that are not leased, the most recently released first */
+  std::list<std::pair<std::string, tiff *>> idle;
+
+  /** Must be acquired before accessing the members above */
+  boost::mutex mutex;
+
+  TiffPool();
+
+  /** Closes the idle handles */
+  ~TiffPool();
+
+  /** Returns @param file of @param path to the idle handles */
+  void release(const std::string &path, tiff *file);
+
+  /** Closes idle handles until there is room for @param extra more files */
+  void closeIdle(size_t extra);
+
+public:
+  static TiffPool &getInstance() {
+    static TiffPool INSTANCE;
+    return INSTANCE;
+  }
+
+  /**
+   * Leases the file at @param path, opening it if there is no idle handle.
+   * @return the handle, or nullptr if the file could not be opened
+   */
+  Handle acquire(const std::string &path);
+
+  /** Sets the maximum number of open files, closing idle ones if needed */
+  void setCapacity(size_t capacity);
+
+  /** Returns the number of files that are currently open */
+  size_t getOpenCount();
+};
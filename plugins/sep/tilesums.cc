@@ -0,0 +1,158 @@
+#include "tilesums.hh"
+
+#include <algorithm>
+#include <cmath>
+
+TileSums::TileSums(const byte *data, int stride, int width_, int height_,
+                   int spp_)
+    : width(width_), height(height_), spp(spp_),
+      columns((width_ + CELL_SIZE - 1) / CELL_SIZE),
+      rows((height_ + CELL_SIZE - 1) / CELL_SIZE),
+      table(static_cast<size_t>(rows + 1) * (columns + 1) * spp_, 0) {
+  const size_t rowLength = static_cast<size_t>(columns + 1) * spp;
+
+  // Sum the samples of every cell into the table, shifted by one row and
+  // one column, so the prefix sums below can be computed in place.
+  for (int y = 0; y < height; y++) {
+    const byte *cur = data + static_cast<size_t>(y) * stride;
+    uint32_t *cells = table.data() + (y / CELL_SIZE + 1) * rowLength + spp;
+
+    for (int x = 0; x < width; x++) {
+      uint32_t *cell = cells + (x / CELL_SIZE) * spp;
+      for (int i = 0; i < spp; i++) {
+        cell[i] += cur[i];
+      }
+      cur += spp;
+    }
+  }
+
+  // Turn the cell sums into prefix sums, first along the rows, then along
+  // the columns
+  for (int row = 1; row <= rows; row++) {
+    uint32_t *cur = table.data() + row * rowLength;
+    for (size_t i = spp; i < rowLength; i++) {
+      cur[i] += cur[i - spp];
+    }
+  }
+  for (int row = 2; row <= rows; row++) {
+    uint32_t *cur = table.data() + row * rowLength;
+    const uint32_t *above = cur - rowLength;
+    for (size_t i = 0; i < rowLength; i++) {
+      cur[i] += above[i];
+    }
+  }
+}
+
+TileSums::Ptr TileSums::create(const byte *data, int stride, int width,
+                               int height, int spp) {
+  return Ptr(new TileSums(data, stride, width, height, spp));
+}
+
+uint32_t TileSums::corner(int column, int row, int channel) const {
+  return table[(static_cast<size_t>(row) * (columns + 1) + column) * spp +
+               channel];
+}
+
+/**
+ * Converts a position (in pixels) into a position in cells. The last cell
+ * may be smaller than CELL_SIZE, so it is scaled separately.
+ */
+static double toCells(double position, int size, int count) {
+  const int lastStart = (count - 1) * TileSums::CELL_SIZE;
+  if (position <= lastStart) {
+    return position / TileSums::CELL_SIZE;
+  }
+  return count - 1 + (position - lastStart) / (size - lastStart);
+}
+
+double TileSums::interpolate(double x, double y, int channel) const {
+  if (columns == 0 || rows == 0) {
+    return 0;
+  }
+
+  const double cx = toCells(std::min<double>(std::max(x, 0.0), width),
+                            width, columns);
+  const double cy = toCells(std::min<double>(std::max(y, 0.0), height),
+                            height, rows);
+  const int column = std::min(static_cast<int>(cx), columns - 1);
+  const int row = std::min(static_cast<int>(cy), rows - 1);
+  const double tx = cx - column;
+  const double ty = cy - row;
+
+  const double top = (1 - tx) * corner(column, row, channel) +
+                     tx * corner(column + 1, row, channel);
+  const double bottom = (1 - tx) * corner(column, row + 1, channel) +
+                        tx * corner(column + 1, row + 1, channel);
+  return (1 - ty) * top + ty * bottom;
+}
+
+/** Returns the first cell boundary at or after `position` */
+static int ceilToCell(int position, int size) {
+  return std::min(
+      (position + TileSums::CELL_SIZE - 1) / TileSums::CELL_SIZE *
+          TileSums::CELL_SIZE,
+      size);
+}
+
+/** Returns the last cell boundary at or before `position` */
+static int floorToCell(int position, int size) {
+  if (position >= size) {
+    return size;
+  }
+  return position / TileSums::CELL_SIZE * TileSums::CELL_SIZE;
+}
+
+Scroom::Utils::Rectangle<int>
+TileSums::alignInward(Scroom::Utils::Rectangle<int> area) const {
+  const int left = ceilToCell(area.getLeft(), width);
+  const int top = ceilToCell(area.getTop(), height);
+  const int right = floorToCell(area.getRight(), width);
+  const int bottom = floorToCell(area.getBottom(), height);
+
+  if (left >= right || top >= bottom) {
+    return {area.getLeft(), area.getTop(), 0, 0};
+  }
+  return {left, top, right - left, bottom - top};
+}
+
+std::vector<double> TileSums::sum(Scroom::Utils::Rectangle<int> area) const {
+  std::vector<double> sums(spp, 0);
+  if (area.getWidth() <= 0 || area.getHeight() <= 0) {
+    return sums;
+  }
+
+  // Cell boundaries coincide with pixel boundaries, except for the end of
+  // the last cell, which is the end of the tile
+  const auto toCell = [](int position, int size, int count) {
+    return position >= size ? count : position / CELL_SIZE;
+  };
+  const int left = toCell(area.getLeft(), width, columns);
+  const int top = toCell(area.getTop(), height, rows);
+  const int right = toCell(area.getRight(), width, columns);
+  const int bottom = toCell(area.getBottom(), height, rows);
+
+  for (int i = 0; i < spp; i++) {
+    // Do the arithmetic in 64 bits, as the intermediate result might not fit
+    const int64_t total = static_cast<int64_t>(corner(right, bottom, i)) -
+                          corner(left, bottom, i) - corner(right, top, i) +
+                          corner(left, top, i);
+    sums[i] = static_cast<double>(total);
+  }
+  return sums;
+}
+
+std::vector<double>
+TileSums::approximateSum(Scroom::Utils::Rectangle<int> area) const {
+  std::vector<double> sums(spp, 0);
+  if (area.getWidth() <= 0 || area.getHeight() <= 0) {
+    return sums;
+  }
+
+  for (int i = 0; i < spp; i++) {
+    sums[i] = interpolate(area.getRight(), area.getBottom(), i) -
+              interpolate(area.getLeft(), area.getBottom(), i) -
+              interpolate(area.getRight(), area.getTop(), i) +
+              interpolate(area.getLeft(), area.getTop(), i);
+  }
+  return sums;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <scroom/rectangle.hh>
+#include <scroom/tiledbitmapinterface.hh>
+
+/**
+ * Summed-area table of the samples of a single tile, for all channels at
+ * once. To keep its size manageable, the table only stores the sums at the
+ * corners of cells of CELL_SIZE x CELL_SIZE pixels.
+ *
+ * With it, the sum over any cell-aligned rectangle of the tile takes four
+ * lookups per channel, regardless of the size of the rectangle.
+ */
+class TileSums {
+public:
+  using Ptr = boost::shared_ptr<TileSums>;
+
+  /** Width and height of a cell (in pixels) */
+  static const int CELL_SIZE = 32;
+
+public: // For testing
+  /** Size of the summed area (in pixels) */
+  int width;
+  int height;
+
+  /** Number of samples per pixel */
+  int spp;
+
+  /** Number of cells horizontally and vertically */
+  int columns;
+  int rows;
+
+  /**
+   * The sums of all samples above and to the left of each cell corner,
+   * (rows + 1) * (columns + 1) * spp values.
+   *
+   * Even for a complete tile of 4096 x 4096 pixels, the sums fit in 32 bits.
+   */
+  std::vector<uint32_t> table;
+
+  /** Constructor */
+  TileSums(const byte *data, int stride, int width, int height, int spp);
+
+  /** Returns the sum of `channel` above and to the left of a cell corner */
+  uint32_t corner(int column, int row, int channel) const;
+
+  /**
+   * Interpolates the summed-area table at the given position (in pixels),
+   * assuming the samples are evenly distributed within each cell.
+   */
+  double interpolate(double x, double y, int channel) const;
+
+public:
+  /**
+   * Computes the table for a tile.
+   *
+   * @param data - the samples of the tile, 8 bits each
+   * @param stride - the length of a row of the tile (in bytes)
+   * @param width - the number of pixels per row to include
+   * @param height - the number of rows to include
+   * @param spp - the number of samples per pixel
+   */
+  static Ptr create(const byte *data, int stride, int width, int height,
+                    int spp);
+
+  /**
+   * Returns the largest cell-aligned rectangle that fits within `area`. The
+   * result is empty if no complete cell fits.
+   */
+  Scroom::Utils::Rectangle<int>
+  alignInward(Scroom::Utils::Rectangle<int> area) const;
+
+  /**
+   * Sums the samples of every channel in `area`, which must be cell-aligned
+   * (see alignInward()).
+   */
+  std::vector<double> sum(Scroom::Utils::Rectangle<int> area) const;
+
+  /**
+   * Estimates the sums of the samples of every channel in `area`, which may
+   * be any rectangle within the tile. The result is exact for cell-aligned
+   * rectangles.
+   */
+  std::vector<double>
+  approximateSum(Scroom::Utils::Rectangle<int> area) const;
+};
@@ -0,0 +1,143 @@
+#include "trace.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <fmt/format.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace Trace {
+
+std::atomic<bool> active{getenv("SCROOM_SEP_TRACE") != nullptr};
+
+namespace {
+/**
+ * A single event in a ring buffer. write() reads it while its thread may be
+ * overwriting it, so it is guarded like a seqlock: `sequence` is 0 while the
+ * event is being written, and the index of the event plus 1 once it is
+ * complete. The fields are atomics, so reading a torn event is not undefined
+ * behaviour, and the sequence tells whether it was torn.
+ */
+struct Event {
+  std::atomic<uint64_t> sequence{0};
+  std::atomic<const char *> category{nullptr};
+  std::atomic<const char *> name{nullptr};
+  std::atomic<uint64_t> start{0};
+  std::atomic<uint64_t> end{0};
+};
+
+/**
+ * The events of a single thread. Only that thread writes to it, so it needs
+ * no lock. `written` counts all events ever recorded, the last BUFFER_SIZE
+ * of which are kept.
+ */
+struct Buffer {
+  long tid;
+  std::vector<Event> events;
+  std::atomic<uint64_t> written{0};
+
+  explicit Buffer(long tid_) : tid(tid_), events(BUFFER_SIZE) {}
+};
+
+/** All buffers, which outlive their threads so their events are kept */
+boost::mutex registryMutex;
+std::vector<boost::shared_ptr<Buffer>> registry;
+
+Buffer &threadBuffer() {
+  thread_local boost::shared_ptr<Buffer> buffer;
+  if (!buffer) {
+    buffer.reset(new Buffer(syscall(SYS_gettid)));
+    boost::mutex::scoped_lock lock(registryMutex);
+    registry.push_back(buffer);
+  }
+  return *buffer;
+}
+} // namespace
+
+void setEnabled(bool enable) { active = enable; }
+
+uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void record(const char *category, const char *name, uint64_t start,
+            uint64_t end) {
+  Buffer &buffer = threadBuffer();
+  const uint64_t index = buffer.written.load(std::memory_order_relaxed);
+  Event &event = buffer.events[index % BUFFER_SIZE];
+  event.sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  event.category.store(category, std::memory_order_relaxed);
+  event.name.store(name, std::memory_order_relaxed);
+  event.start.store(start, std::memory_order_relaxed);
+  event.end.store(end, std::memory_order_relaxed);
+  event.sequence.store(index + 1, std::memory_order_release);
+  buffer.written.store(index + 1, std::memory_order_release);
+}
+
+bool write(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    printf("Error: Failed to write the trace to %s\n", path.c_str());
+    return false;
+  }
+
+  const int pid = getpid();
+  fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  bool first = true;
+  boost::mutex::scoped_lock lock(registryMutex);
+  for (const auto &buffer : registry) {
+    const uint64_t written = buffer->written.load(std::memory_order_acquire);
+    const uint64_t begin = written > BUFFER_SIZE ? written - BUFFER_SIZE : 0;
+    for (uint64_t i = begin; i < written; i++) {
+      const Event &event = buffer->events[i % BUFFER_SIZE];
+      const uint64_t sequence = event.sequence.load(std::memory_order_acquire);
+      const char *name = event.name.load(std::memory_order_relaxed);
+      const char *category = event.category.load(std::memory_order_relaxed);
+      const uint64_t start = event.start.load(std::memory_order_relaxed);
+      const uint64_t end = event.end.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      // Skip the events that are being overwritten by newer ones
+      if (sequence != i + 1 ||
+          event.sequence.load(std::memory_order_relaxed) != sequence) {
+        continue;
+      }
+
+      // Complete events, with the times in microseconds
+      fmt::print(file,
+                 "{}{{\"name\": \"{}\", \"cat\": \"{}\", \"ph\": \"X\", "
+                 "\"ts\": {:.3f}, \"dur\": {:.3f}, \"pid\": {}, \"tid\": {}}}",
+                 first ? "" : ",\n", name, category, start / 1e3,
+                 (end - start) / 1e3, pid, buffer->tid);
+      first = false;
+    }
+  }
+  fprintf(file, "\n]}\n");
+  return fclose(file) == 0;
+}
+
+void writeIfEnabled() {
+  const char *path = getenv("SCROOM_SEP_TRACE");
+  if (enabled() && path != nullptr && *path != '\0') {
+    write(path);
+  }
+}
+
+void clear() {
+  boost::mutex::scoped_lock lock(registryMutex);
+  for (const auto &buffer : registry) {
+    buffer->written = 0;
+    for (Event &event : buffer->events) {
+      event.sequence = 0;
+    }
+  }
+}
+
+} // namespace Trace
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Opt-in tracing of the jobs, UI thread calls and critical sections of the
+ * plugin, to see how they interleave over time when the UI stalls.
+ *
+ * Tracing is enabled by pointing the environment variable SCROOM_SEP_TRACE
+ * to a file. Whenever a presentation is closed, the events recorded so far
+ * are written to it in the trace event format, which chrome://tracing and
+ * https://ui.perfetto.dev open.
+ *
+ * Every thread records into its own ring buffer of the last BUFFER_SIZE
+ * events, without locks, so tracing hardly changes the timings. When
+ * tracing is disabled, recording an event is a single relaxed load.
+ *
+ * A thread allocates its buffer (2.5 MiB) when it records its first event,
+ * and the buffer is only freed when the process exits, so the events of
+ * threads that have finished can still be written. Scroom's thread pool
+ * keeps its threads, so this is a few buffers per worker, but a program that
+ * keeps starting new threads while tracing keeps growing.
+ */
+namespace Trace {
+
+/** Number of events kept per thread */
+const size_t BUFFER_SIZE = 65536;
+
+/** Whether events are recorded, see enabled() */
+extern std::atomic<bool> active;
+
+/** Whether events are recorded */
+inline bool enabled() { return active.load(std::memory_order_relaxed); }
+
+/** Enables or disables recording, regardless of SCROOM_SEP_TRACE */
+void setEnabled(bool enable);
+
+/** The current time of the monotonic clock (in ns) */
+uint64_t now();
+
+/**
+ * Records that @param name ran from @param start to @param end (in ns, see
+ * now()) on the current thread. The strings are not copied, so they must be
+ * literals.
+ */
+void record(const char *category, const char *name, uint64_t start,
+            uint64_t end);
+
+/**
+ * Writes the events of all threads to @param path.
+ * @return false if the file could not be written
+ */
+bool write(const std::string &path);
+
+/** Writes the events to SCROOM_SEP_TRACE, if it is set */
+void writeIfEnabled();
+
+/** Discards the events of all threads, while none of them is recording */
+void clear();
+
+/**
+ * Records the time from its construction until end() or its destruction,
+ * whichever comes first.
+ */
+class Span {
+private:
+  const char *category;
+  const char *name;
+  uint64_t start;
+  bool running;
+
+public:
+  Span(const char *category_, const char *name_)
+      : category(category_), name(name_), start(0), running(enabled()) {
+    if (running) {
+      start = now();
+    }
+  }
+
+  Span(const Span &) = delete;
+  Span &operator=(const Span &) = delete;
+
+  /** Ends the span early, for instance right before releasing a lock */
+  void end() {
+    if (running) {
+      record(category, name, start, now());
+      running = false;
+    }
+  }
+
+  ~Span() { end(); }
+};
+
+} // namespace Trace
@@ -3,24 +3,44 @@
 #include <scroom/cairo-helpers.hh>
 #include <scroom/viewinterface.hh>
 
-Varnish::Varnish(const SliLayer::Ptr &sliLayer) {
+#include "varnishsource.hh"
+#include "../stats.hh"
+
+Varnish::Varnish(const SliLayer::Ptr &sliLayer, const Stats::Set::Ptr &stats_)
+    : stats(stats_) {
   this->layer = sliLayer;
   inverted = false;
-  // Precalculate the surface and save it.
-  int stride = cairo_format_stride_for_width(CAIRO_FORMAT_A8, sliLayer->width);
-  surface = cairo_image_surface_create_for_data(
-      sliLayer->bitmap.get(), CAIRO_FORMAT_A8, sliLayer->width,
-      sliLayer->height, stride);
-  // Map is read inverted by cairo, so we invert it here once
-  invertSurface();
+
+  // The varnish is loaded tile by tile through Scroom, just like any other
+  // bitmap, so it shares the tile cache and does not need to fit in memory.
+  // The tiles are only loaded once the overlay is drawn, see
+  // loadFullResolution().
+  operations = VarnishOperations::create(stats);
+  tbi = createTiledBitmap(sliLayer->width, sliLayer->height, {operations});
 }
 
-Varnish::Ptr Varnish::create(const SliLayer::Ptr &layer) {
-  Varnish::Ptr result = Ptr(new Varnish(layer));
+Varnish::Ptr Varnish::create(const SliLayer::Ptr &layer,
+                             const Stats::Set::Ptr &stats) {
+  Varnish::Ptr result = Ptr(new Varnish(layer, stats));
   return result;
 }
 
-Varnish::~Varnish() { cairo_surface_destroy(surface); }
+Varnish::~Varnish() {}
+
+void Varnish::loadFullResolution() {
+  if (!fullResolution) {
+    fullResolution = true;
+    tbi->setSource(VarnishSource::create(layer->filepath, layer->width));
+  }
+}
+
+void Varnish::open(const ViewInterface::WeakPtr &viewWeakPtr) {
+  tbi->open(viewWeakPtr);
+}
+
+void Varnish::close(const ViewInterface::WeakPtr &viewWeakPtr) {
+  tbi->close(viewWeakPtr);
+}
 
 void Varnish::setView(const ViewInterface::WeakPtr &viewWeakPtr) {
   registerUI(viewWeakPtr);
@@ -61,21 +81,8 @@ void color_changed(GObject *, GParamSpec *, gpointer varnishP) {
 void Varnish::fixVarnishState() {
   require(Scroom::GtkHelpers::on_ui_thread());
 
-  if (inverted) {
-    // If we're currently inverted and moving to normal,
-    // We need to invert back
-    if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(radio_enabled))) {
-      invertSurface();
-      inverted = false;
-    }
-  } else {
-    // If we're currently normal and moving to normal,
-    // We need to invert back
-    if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(radio_inverted))) {
-      invertSurface();
-      inverted = true;
-    }
-  }
+  // The tiles themselves are never touched, drawOverlay() picks the polarity
+  inverted = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(radio_inverted));
 }
 
 void Varnish::registerUI(const ViewInterface::WeakPtr &viewWeakPtr) {
@@ -129,35 +136,28 @@ void Varnish::registerUI(const ViewInterface::WeakPtr &viewWeakPtr) {
       [&] { view->addSideWidget("Varnish", box); });
 }
 
-void Varnish::invertSurface() {
-  cairo_surface_flush(surface);
-  int width = cairo_image_surface_get_width(surface);
-  int height = cairo_image_surface_get_height(surface);
-  unsigned char *data = cairo_image_surface_get_data(surface);
-  for (int i = 0; i < width * height; i++) {
-    // Invert each suface pixel.
-    data[i] ^= 255;
-  }
-  cairo_surface_mark_dirty(surface);
-}
-
-void Varnish::drawOverlay(ViewInterface::Ptr const &, cairo_t *cr,
+void Varnish::drawOverlay(ViewInterface::Ptr const &vi, cairo_t *cr,
                           Scroom::Utils::Rectangle<double> presentationArea,
                           int zoom) {
   require(Scroom::GtkHelpers::on_ui_thread());
+  Stats::ScopedTimer timer(stats->drawOverlay);
 
   if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(radio_disabled))) {
     // if the varnish overlay is disabled, return without drawing anything.
     return;
   }
+  loadFullResolution();
+
   double pixelSize = pixelSizeFromZoom(zoom);
   cairo_save(cr);
   // Disable blurring/anti-aliasing
   cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
-  cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
-  cairo_translate(cr, -presentationArea.getLeft() * pixelSize,
-                  -presentationArea.getTop() * pixelSize);
-  cairo_scale(cr, pixelSize, pixelSize);
+
+  // Nothing is drawn outside of the varnish, not even in normal mode
+  cairo_rectangle(cr, -presentationArea.getLeft() * pixelSize,
+                  -presentationArea.getTop() * pixelSize,
+                  layer->width * pixelSize, layer->height * pixelSize);
+  cairo_clip(cr);
 
   // Read the overlay color and alpha
   GdkRGBA color;
@@ -165,13 +165,16 @@ void Varnish::drawOverlay(ViewInterface::Ptr const &, cairo_t *cr,
 
   if (!gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(check_show_background))) {
     // Clear the background
-    cairo_rectangle(cr, 0, 0, layer->width, layer->height);
     cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
-    cairo_fill(cr);
+    cairo_paint(cr);
   }
 
-  cairo_set_source_rgba(cr, color.red, color.green, color.blue, color.alpha);
-  cairo_mask_surface(cr, surface, 0, 0);
+  operations->red = color.red;
+  operations->green = color.green;
+  operations->blue = color.blue;
+  operations->alpha = color.alpha;
+  operations->inverted = inverted;
+  tbi->redraw(vi, cr, presentationArea, zoom);
 
   cairo_restore(cr);
 }
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "../sli/slilayer.hh"
+#include "varnishoperations.hh"
 #include <gtk/gtk.h>
+#include <scroom/tiledbitmapinterface.hh>
 
 class Varnish {
 public:
@@ -13,25 +15,61 @@ public:
   ViewInterface::WeakPtr viewWeak;
 
 public: // For testing
-  Varnish(const SliLayer::Ptr &sliLayer);
+  Varnish(const SliLayer::Ptr &sliLayer, const Stats::Set::Ptr &stats_);
   GtkWidget *box;
   GtkWidget *radio_enabled;
   GtkWidget *radio_disabled;
   GtkWidget *radio_inverted;
   GtkWidget *check_show_background;
   GtkWidget *colorpicker;
-  void invertSurface();
   void registerUI(const ViewInterface::WeakPtr &viewWeakPtr);
   SliLayer::Ptr layer;
-  cairo_surface_t *surface;
+
+  /** Layer operations that draw the varnish tiles as a mask */
+  VarnishOperations::Ptr operations;
+
+  /** The statistics drawOverlay() and the operations record into */
+  Stats::Set::Ptr stats;
+
+  /**
+   * Tiled bitmap holding the varnish data. Its reduced levels, which
+   * VarnishOperations::reduce() computes once per tile, are the masks of the
+   * zoomed-out views, so drawing never scales the full resolution mask down.
+   */
+  TiledBitmapInterface::Ptr tbi;
+
+  /**
+   * Whether the overlay is drawn where the varnish data is set (inverted), or
+   * where it is not set (normal). Both polarities are drawn from the same
+   * tiles, so switching only flips this flag.
+   */
   bool inverted;
 
+  /**
+   * Whether the varnish file has been handed to tbi, which then loads all
+   * tiles. That only happens once the overlay is drawn, so a varnish that
+   * stays disabled is never decoded. Only accessed on the UI thread.
+   */
+  bool fullResolution = false;
+
 public:
-  static Ptr create(const SliLayer::Ptr &layer);
+  static Ptr create(const SliLayer::Ptr &layer, const Stats::Set::Ptr &stats);
   void setView(const ViewInterface::WeakPtr &viewWeakPtr);
   void resetView(const ViewInterface::WeakPtr &viewWeakPtr);
   void fixVarnishState();
 
+  /**
+   * Hands the varnish file to tbi, so the tiles are loaded. Does nothing if
+   * that has been done already.
+   */
+  void loadFullResolution();
+
+  /** Make the varnish tiles available to the given view */
+  void open(const ViewInterface::WeakPtr &viewWeakPtr);
+
+  /** Release the varnish tiles of the given view */
+  void close(const ViewInterface::WeakPtr &viewWeakPtr);
+
   ~Varnish();
   void drawOverlay(ViewInterface::Ptr const &vi, cairo_t *cr,
                    Scroom::Utils::Rectangle<double> presentationArea, int zoom);
@@ -0,0 +1,127 @@
+#include "varnishoperations.hh"
+#include "../stats.hh"
+
+#include <cstring>
+#include <scroom/bitmap-helpers.hh>
+#include <scroom/unused.hh>
+#include <utility>
+
+VarnishOperations::VarnishOperations(Stats::Set::Ptr stats_)
+    : stats(std::move(stats_)) {}
+
+VarnishOperations::Ptr VarnishOperations::create(const Stats::Set::Ptr &stats) {
+  return Ptr(new VarnishOperations(stats));
+}
+
+int VarnishOperations::getBpp() { return 8; }
+
+Scroom::Utils::Stuff VarnishOperations::cache(const ConstTile::Ptr &tile) {
+  Stats::ScopedTimer timer(stats->varnishCache);
+  timer.addPixels(static_cast<uint64_t>(tile->width) * tile->height);
+  // Cairo may pad the rows of an A8 surface, so copy the tile row by row
+  const int stride =
+      cairo_format_stride_for_width(CAIRO_FORMAT_A8, tile->width);
+  boost::shared_ptr<uint8_t> data(
+      static_cast<uint8_t *>(malloc(stride * tile->height)), free);
+
+  const uint8_t *cur = tile->data.get();
+  for (int y = 0; y < tile->height; y++) {
+    memcpy(data.get() + y * stride, cur + y * tile->width, tile->width);
+  }
+
+  return Scroom::Bitmap::BitmapSurface::create(tile->width, tile->height,
+                                               CAIRO_FORMAT_A8, stride, data);
+}
+
+void VarnishOperations::reduce(Tile::Ptr target, const ConstTile::Ptr source,
+                               int top_left_x, int top_left_y) {
+  Stats::ScopedTimer timer(stats->varnishReduce);
+  timer.addPixels(static_cast<uint64_t>(source->width) * source->height);
+  // Reducing by a factor 8
+  const int sourceStride = source->width; // stride in bytes
+  const byte *sourceBase = source->data.get();
+
+  const int targetStride = target->width; // stride in bytes
+  byte *targetBase =
+      target->data.get() +
+      (target->height * top_left_y + top_left_x) * targetStride / 8;
+
+  for (int y = 0; y < source->height / 8; y++) {
+    byte *targetPtr = targetBase;
+
+    for (int x = 0; x < source->width / 8; x++) {
+      // Store the average of the 8*8 pixels with (x, y) as top-left corner
+      const byte *base = sourceBase + 8 * x;
+      size_t sum = 0;
+
+      for (int row = 0; row < 8; row++) {
+        for (int column = 0; column < 8; column++) {
+          sum += base[row * sourceStride + column];
+        }
+      }
+
+      *targetPtr = static_cast<byte>(sum / 64);
+      targetPtr++;
+    }
+
+    targetBase += targetStride;
+    sourceBase += sourceStride * 8;
+  }
+}
+
+void VarnishOperations::draw(cairo_t *cr, const ConstTile::Ptr &,
+                             Scroom::Utils::Rectangle<double> tileArea,
+                             Scroom::Utils::Rectangle<double> viewArea, int,
+                             Scroom::Utils::Stuff cache) {
+  if (!cache) {
+    return;
+  }
+
+  Scroom::Bitmap::BitmapSurface::Ptr source =
+      boost::static_pointer_cast<Scroom::Bitmap::BitmapSurface>(cache);
+  cairo_surface_t *mask = source->get();
+
+  cairo_save(cr);
+  cairo_rectangle(cr, viewArea.getLeft(), viewArea.getTop(),
+                  viewArea.getWidth(), viewArea.getHeight());
+  cairo_clip(cr);
+
+  // Map the requested part of the tile onto the requested part of the view
+  cairo_translate(cr, viewArea.getLeft(), viewArea.getTop());
+  cairo_scale(cr, viewArea.getWidth() / tileArea.getWidth(),
+              viewArea.getHeight() / tileArea.getHeight());
+  cairo_translate(cr, -tileArea.getLeft(), -tileArea.getTop());
+
+  cairo_pattern_t *pattern = cairo_pattern_create_for_surface(mask);
+  cairo_pattern_set_filter(pattern, CAIRO_FILTER_NEAREST);
+
+  if (inverted) {
+    // Draw the overlay where the varnish is set
+    cairo_set_source_rgba(cr, red, green, blue, alpha);
+    cairo_mask(cr, pattern);
+  } else {
+    // Draw the overlay where the varnish is not set: fill the tile with the
+    // overlay color in a group and cut the mask out of it. The group only
+    // spans the clipped area.
+    cairo_push_group(cr);
+    cairo_rectangle(cr, 0, 0, cairo_image_surface_get_width(mask),
+                    cairo_image_surface_get_height(mask));
+    cairo_set_source_rgba(cr, red, green, blue, alpha);
+    cairo_fill(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_DEST_OUT);
+    cairo_set_source_rgba(cr, 0, 0, 0, 1);
+    cairo_mask(cr, pattern);
+    cairo_pop_group_to_source(cr);
+    cairo_paint(cr);
+  }
+
+  cairo_pattern_destroy(pattern);
+  cairo_restore(cr);
+}
+
+void VarnishOperations::drawState(cairo_t *cr, TileState s,
+                                  Scroom::Utils::Rectangle<double> viewArea) {
+  UNUSED(cr);
+  UNUSED(s);
+  UNUSED(viewArea);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <boost/shared_ptr.hpp>
+#include <scroom/layeroperations.hh>
+
+#include "../stats.hh"
+
+/**
+ * Layer operations for the varnish overlay. Tiles contain the varnish data as
+ * 8 bits per pixel, which is cached as an A8 cairo surface and used as a mask
+ * for the overlay color when drawing.
+ *
+ * Zoomed-out views are drawn from the tiles of the reduced levels of the
+ * tiled bitmap, each of which reduce() averages from 8x8 pixels of the level
+ * above it. So every zoom level has a mask of about its own resolution,
+ * which draw() maps onto the view with a nearest filter.
+ */
+class VarnishOperations : public CommonOperations {
+public:
+  using Ptr = boost::shared_ptr<VarnishOperations>;
+
+  /** Color of the overlay, set by the Varnish before every redraw */
+  double red = 0;
+  double green = 0;
+  double blue = 0;
+  double alpha = 1;
+
+  /**
+   * Whether the overlay is drawn where the varnish data is set (inverted), or
+   * where it is not set (normal).
+   */
+  bool inverted = false;
+
+  /** The statistics cache() and reduce() record into */
+  Stats::Set::Ptr stats;
+
+private:
+  explicit VarnishOperations(Stats::Set::Ptr stats_);
+
+public:
+  static Ptr create(const Stats::Set::Ptr &stats);
+
+  int getBpp() override;
+  Scroom::Utils::Stuff cache(const ConstTile::Ptr &tile) override;
+  void reduce(Tile::Ptr target, const ConstTile::Ptr source, int x,
+              int y) override;
+  void draw(cairo_t *cr, const ConstTile::Ptr &tile,
+            Scroom::Utils::Rectangle<double> tileArea,
+            Scroom::Utils::Rectangle<double> viewArea, int zoom,
+            Scroom::Utils::Stuff cache) override;
+
+  /**
+   * Tiles that are not loaded yet are not drawn at all, so the image below
+   * the overlay remains visible.
+   */
+  void drawState(cairo_t *cr, TileState s,
+                 Scroom::Utils::Rectangle<double> viewArea) override;
+};
@@ -0,0 +1,67 @@
+#include "varnishsource.hh"
+
+#include <cstring>
+
+#include "../sepsource.hh"
+
+VarnishSource::VarnishSource(const std::string &filepath_, int width_)
+    : filepath(filepath_), width(width_) {}
+
+VarnishSource::~VarnishSource() { SepSource::closeIfNeeded(file); }
+
+VarnishSource::Ptr VarnishSource::create(const std::string &filepath,
+                                         int width) {
+  return Ptr(new VarnishSource(filepath, width));
+}
+
+void VarnishSource::fillTiles(int startLine, int lineCount, int tileWidth,
+                              int firstTile, std::vector<Tile::Ptr> &tiles) {
+  if (tiles.empty()) {
+    return;
+  }
+
+  if (file == nullptr) {
+    file = TIFFOpen(filepath.c_str(), "r");
+  }
+
+  const size_t tile_count = tiles.size();
+  const size_t tile_stride = static_cast<size_t>(tileWidth);
+  const size_t first_tile = static_cast<size_t>(firstTile);
+
+  // Varnish has one byte per pixel, so a row is `width` bytes long. The
+  // scanlines in the file might be padded, though.
+  size_t row_size = static_cast<size_t>(width);
+  if (file != nullptr) {
+    row_size = std::max(row_size, static_cast<size_t>(TIFFScanlineSize(file)));
+  }
+  auto row = std::vector<byte>(row_size, 0);
+
+  auto tile_data = std::vector<byte *>(tile_count);
+  for (size_t tile = 0; tile < tile_count; tile++) {
+    tile_data[tile] = tiles[tile]->data.get();
+  }
+
+  // The number of bytes that are in the full tiles of the image
+  const size_t accounted_width = (first_tile + tile_count - 1) * tile_stride;
+  // The number of remaining bytes
+  const size_t remaining_width = width - accounted_width;
+
+  for (int i = 0; i < lineCount; i++) {
+    SepSource::TIFFReadScanline_(file, row.data(), startLine + i);
+
+    for (size_t tile = 0; tile < tile_count - 1; tile++) {
+      memcpy(tile_data[tile], row.data() + (first_tile + tile) * tile_stride,
+             tile_stride);
+      tile_data[tile] += tile_stride;
+    }
+
+    // The last tile might not be completely filled
+    memcpy(tile_data[tile_count - 1], row.data() + accounted_width,
+           remaining_width);
+    tile_data[tile_count - 1] += tile_stride;
+  }
+}
+
+void VarnishSource::done() { SepSource::closeIfNeeded(file); }
+
+std::string VarnishSource::getName() { return filepath; }
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <tiffio.h>
+
+#include <scroom/tiledbitmapinterface.hh>
+
+/**
+ * Provides the data of a varnish TIFF file to a tiled bitmap. The file is only
+ * opened when Scroom starts loading the tiles, and closed again when loading
+ * is done.
+ */
+class VarnishSource : public SourcePresentation {
+public:
+  typedef boost::shared_ptr<VarnishSource> Ptr;
+
+public: // For testing
+  /** Path to the varnish TIFF file */
+  std::string filepath;
+
+  /** Width of the varnish (in pixels) */
+  int width;
+
+  /** The opened varnish file, or nullptr if it is not opened */
+  tiff *file = nullptr;
+
+  /** Constructor */
+  VarnishSource(const std::string &filepath, int width);
+
+public:
+  /** Destructor */
+  ~VarnishSource() override;
+
+  static Ptr create(const std::string &filepath, int width);
+
+  ////////////////////////////////////////////////////////////////////////
+  // SourcePresentation
+  ////////////////////////////////////////////////////////////////////////
+  void fillTiles(int startLine, int lineCount, int tileWidth, int firstTile,
+                 std::vector<Tile::Ptr> &tiles) override;
+
+  /** Closes the varnish file */
+  void done() override;
+
+  /** Returns the path of the varnish file */
+  std::string getName() override;
+};